@@ -0,0 +1,496 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "AsyncDataBase.h"
+#include <errmsg.h>
+#include <algorithm>
+#include <poll.h>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "QueryProfiler.h"
+#include "server/Log.h"
+
+namespace yucode {
+
+//
+// AsyncResult
+//
+
+AsyncResult::AsyncResult ()
+	: m_result(NULL), m_row(NULL), m_lengths(NULL), m_failed(false),
+	  m_affected_rows(0), m_insert_id(0)
+{
+}
+
+AsyncResult::~AsyncResult ()
+{
+	if (m_result)
+		mysql_free_result(m_result);
+}
+
+AsyncResult::iterator AsyncResult::begin ()
+{
+	return iterator(*this, !fetch());
+}
+
+AsyncResult::iterator AsyncResult::end ()
+{
+	return iterator(*this, true);
+}
+
+bool AsyncResult::fetch ()
+{
+	if (!m_result || !(m_row = mysql_fetch_row(m_result)))
+		return false;
+	m_lengths = mysql_fetch_lengths(m_result);
+	return true;
+}
+
+//
+// AsyncDataBase
+//
+
+/// A connection of the AsyncDataBase, along the call it is in.
+struct AsyncDataBase::Connection
+{
+	enum Step {
+		Connecting,
+		Idle,
+		Querying,
+		Storing,
+		/// Sending QUIT, out of m_connections but kept in m_closing.
+		Closing,
+		Closed
+	};
+	
+	explicit Connection (boost::asio::io_service & io_service)
+		: mysql(NULL), socket(io_service), timer(io_service), step(Connecting),
+		  generation(0), waiting(0), connected(NULL), query_error(0), stored(NULL), started(0) {}
+	
+	MYSQL * mysql;
+	/// The socket of mysql, watched for readiness but owned by it.
+	boost::asio::posix::stream_descriptor socket;
+	boost::asio::deadline_timer timer;
+	Step step;
+	/// Bumped on every resume, so the waits left behind are ignored.
+	unsigned int generation;
+	/// Status the current step waits on.
+	int waiting;
+	
+	/// Outputs of the non blocking calls.
+	MYSQL * connected;
+	int query_error;
+	MYSQL_RES * stored;
+	
+	Pending pending;
+	uint64_t started;
+};
+
+namespace {
+
+void fulfil(const boost::shared_ptr<boost::promise<AsyncResultPtr> > & promise, const AsyncResultPtr & result)
+{
+	promise->set_value(result);
+}
+
+}
+
+AsyncDataBase::AsyncDataBase ()
+	: m_io_service(NULL), m_max(0), m_stopping(false), m_connecting(0), m_idle(0), m_busy(0), m_queued(0),
+	  m_queries(0), m_failures(0)
+{
+}
+
+/// Connections are closed by stop(), as the io_service they wait on may be
+/// gone by now.
+AsyncDataBase::~AsyncDataBase ()
+{
+}
+
+void AsyncDataBase::start (boost::asio::io_service & io_service, std::size_t maxConnections)
+{
+	m_io_service = &io_service;
+	m_max = std::max<std::size_t>(maxConnections, 1);
+	m_strand.reset(new boost::asio::io_service::strand(io_service));
+}
+
+void AsyncDataBase::stop ()
+{
+	// The io_service no longer runs, so closes are completed here
+	m_stopping = true;
+	m_queue.clear();
+	m_queued = 0;
+	for (std::vector<ConnectionPtr>::iterator it = m_connections.begin(); it != m_connections.end(); ++it)
+		close(*it);
+	m_connections.clear();
+	std::vector<ConnectionPtr> closing;
+	closing.swap(m_closing);
+	for (std::vector<ConnectionPtr>::iterator it = closing.begin(); it != closing.end(); ++it)
+		drain(*it, (*it)->waiting);
+	m_strand.reset();
+	m_stopping = false;
+}
+
+void AsyncDataBase::query (const std::string & sql, const Handler & handler)
+{
+	if (!started())
+		throw "AsyncDataBase::query() - Not started";
+	
+	Pending pending;
+	pending.sql = sql;
+	pending.handler = handler;
+	pending.queued = server::Metrics::now();
+	++m_queued;
+	m_strand->post(boost::bind(&AsyncDataBase::enqueue, this, pending));
+}
+
+boost::unique_future<AsyncResultPtr> AsyncDataBase::query (const std::string & sql)
+{
+	boost::shared_ptr<boost::promise<AsyncResultPtr> > promise(new boost::promise<AsyncResultPtr>());
+	boost::unique_future<AsyncResultPtr> future = promise->get_future();
+	query(sql, boost::bind(&fulfil, promise, _1));
+	return boost::move(future);
+}
+
+AsyncDataBaseStats AsyncDataBase::stats () const
+{
+	AsyncDataBaseStats stats;
+	stats.connecting = m_connecting;
+	stats.idle = m_idle;
+	stats.busy = m_busy;
+	stats.queued = m_queued;
+	// Queries are counted before their failure, so failures never exceed
+	// them when read first
+	stats.failures = m_failures;
+	stats.queries = m_queries;
+	return stats;
+}
+
+void AsyncDataBase::enqueue (const Pending & pending)
+{
+	m_queue.push_back(pending);
+	dispatch();
+}
+
+void AsyncDataBase::dispatch ()
+{
+	m_connections.erase(std::remove_if(m_connections.begin(), m_connections.end(),
+			boost::bind(&Connection::step, _1) >= Connection::Closing), m_connections.end());
+	
+	// Idle connections take the oldest queries
+	std::size_t connecting = 0;
+	std::vector<ConnectionPtr> idle;
+	for (std::vector<ConnectionPtr>::iterator it = m_connections.begin(); it != m_connections.end(); ++it) {
+		if ((*it)->step == Connection::Idle)
+			idle.push_back(*it);
+		else if ((*it)->step == Connection::Connecting)
+			++connecting;
+	}
+	for (std::vector<ConnectionPtr>::iterator it = idle.begin(); it != idle.end() && !m_queue.empty(); ++it) {
+		(*it)->pending = m_queue.front();
+		m_queue.pop_front();
+		--m_queued;
+		run(*it);
+	}
+	
+	// More are opened while queries outnumber the ones being opened
+	while (m_queue.size() > connecting && m_connections.size() < m_max) {
+		ConnectionPtr connection(new Connection(*m_io_service));
+		m_connections.push_back(connection);
+		++m_connecting;
+		++connecting;
+		connect(connection);
+	}
+}
+
+void AsyncDataBase::connect (const ConnectionPtr & connection)
+{
+	DataBase & dataBase = DataBase::singleton();
+	try {
+		connection->mysql = dataBase.createConnection();
+	} catch (const char * error) {
+		LOG_ERROR("[AsyncDataBase] " << error);
+		close(connection);
+		return;
+	}
+	mysql_options(connection->mysql, MYSQL_OPT_NONBLOCK, 0);
+	proceed(connection, mysql_real_connect_start(&connection->connected, connection->mysql,
+			"localhost", dataBase.dbuser, dataBase.passw, dataBase.database, 0, NULL, 0));
+}
+
+void AsyncDataBase::run (const ConnectionPtr & connection)
+{
+	connection->step = Connection::Querying;
+	connection->started = server::Metrics::now();
+	--m_idle;
+	++m_busy;
+	const std::string & sql = connection->pending.sql;
+	proceed(connection, mysql_real_query_start(&connection->query_error, connection->mysql,
+			sql.data(), sql.size()));
+}
+
+void AsyncDataBase::proceed (const ConnectionPtr & connection, int status)
+{
+	if (status) {
+		wait(connection, status);
+		return;
+	}
+	
+	switch (connection->step) {
+	case Connection::Connecting:
+		if (!connection->connected) {
+			LOG_ERROR("[AsyncDataBase] mysql error: " << mysql_error(connection->mysql));
+			close(connection);
+			return;
+		}
+		connection->step = Connection::Idle;
+		--m_connecting;
+		++m_idle;
+		m_strand->post(boost::bind(&AsyncDataBase::dispatch, this));
+		return;
+		
+	case Connection::Querying:
+		if (connection->query_error)
+			finish(connection, mysql_error(connection->mysql));
+		else if (!mysql_field_count(connection->mysql))
+			finish(connection, NULL);
+		else {
+			connection->step = Connection::Storing;
+			proceed(connection, mysql_store_result_start(&connection->stored, connection->mysql));
+		}
+		return;
+		
+	case Connection::Storing:
+		finish(connection, connection->stored? NULL : mysql_error(connection->mysql));
+		return;
+		
+	case Connection::Closing:
+		closed(connection);
+		return;
+		
+	default:
+		return;
+	}
+}
+
+void AsyncDataBase::wait (const ConnectionPtr & connection, int status)
+{
+	boost::system::error_code error;
+	if (!connection->socket.is_open())
+		connection->socket.assign(mysql_get_socket(connection->mysql), error);
+	if (error) {
+		LOG_ERROR("[AsyncDataBase] socket not watchable: " << error.message());
+		if (connection->step == Connection::Connecting)
+			close(connection);
+		else if (connection->step == Connection::Closing)
+			drain(connection, status);
+		else
+			finish(connection, "socket not watchable");
+		return;
+	}
+	
+	connection->waiting = status;
+	unsigned int generation = connection->generation;
+	if (status & (MYSQL_WAIT_READ | MYSQL_WAIT_EXCEPT))
+		connection->socket.async_read_some(boost::asio::null_buffers(), m_strand->wrap(
+				boost::bind(&AsyncDataBase::ready, this, connection, generation, 
+					MYSQL_WAIT_READ, boost::asio::placeholders::error)));
+	if (status & MYSQL_WAIT_WRITE)
+		connection->socket.async_write_some(boost::asio::null_buffers(), m_strand->wrap(
+				boost::bind(&AsyncDataBase::ready, this, connection, generation, 
+					MYSQL_WAIT_WRITE, boost::asio::placeholders::error)));
+	if (status & MYSQL_WAIT_TIMEOUT) {
+		connection->timer.expires_from_now(boost::posix_time::milliseconds(
+				mysql_get_timeout_value_ms(connection->mysql)));
+		connection->timer.async_wait(m_strand->wrap(
+				boost::bind(&AsyncDataBase::ready, this, connection, generation, 
+					MYSQL_WAIT_TIMEOUT, boost::asio::placeholders::error)));
+	}
+}
+
+void AsyncDataBase::ready (const ConnectionPtr & connection, unsigned int generation, int event, const boost::system::error_code & error)
+{
+	// Only the first of the waits of a step resumes it
+	if (connection->step == Connection::Closed || generation != connection->generation
+		|| error == boost::asio::error::operation_aborted)
+		return;
+	++connection->generation;
+	boost::system::error_code ignored;
+	connection->socket.cancel(ignored);
+	connection->timer.cancel(ignored);
+	
+	// Socket errors surface through the call being resumed
+	int status = 0;
+	switch (connection->step) {
+	case Connection::Connecting:
+		status = mysql_real_connect_cont(&connection->connected, connection->mysql, event);
+		break;
+	case Connection::Querying:
+		status = mysql_real_query_cont(&connection->query_error, connection->mysql, event);
+		break;
+	case Connection::Storing:
+		status = mysql_store_result_cont(&connection->stored, connection->mysql, event);
+		break;
+	case Connection::Closing:
+		status = mysql_close_cont(connection->mysql, event);
+		break;
+	default:
+		return;
+	}
+	proceed(connection, status);
+}
+
+void AsyncDataBase::finish (const ConnectionPtr & connection, const char * error)
+{
+	Pending pending;
+	std::swap(pending, connection->pending);
+	
+	AsyncResultPtr result(new AsyncResult());
+	if (error) {
+		LOG_ERROR("AsyncDataBase SQL error message: " << error);
+		LOG_ERROR("AsyncDataBase SQL error query: " << pending.sql);
+		result->m_failed = true;
+		result->m_error = error;
+	} else {
+		result->m_result = connection->stored;
+		result->m_affected_rows = mysql_affected_rows(connection->mysql);
+		result->m_insert_id = mysql_insert_id(connection->mysql);
+	}
+	connection->stored = NULL;
+	
+	uint64_t finished = server::Metrics::now();
+	QueryProfiler::singleton().record(pending.sql.c_str(), finished - connection->started,
+			result->getRowCount(), false);
+	m_query_time.record(finished - pending.queued);
+	++m_queries;
+	if (error)
+		++m_failures;
+	
+	// Lost connections are replaced by new ones on demand
+	unsigned int errorNumber = error? mysql_errno(connection->mysql) : 0;
+	if (errorNumber == CR_SERVER_GONE_ERROR || errorNumber == CR_SERVER_LOST || (error && !errorNumber)) {
+		close(connection);
+	} else {
+		connection->step = Connection::Idle;
+		--m_busy;
+		++m_idle;
+	}
+	m_strand->post(boost::bind(&AsyncDataBase::dispatch, this));
+	
+	try {
+		pending.handler(result);
+	} catch (...) {
+		LOG_ERROR("AsyncDataBase: completion handler failed for query: " << pending.sql);
+	}
+}
+
+void AsyncDataBase::close (const ConnectionPtr & connection)
+{
+	if (connection->step >= Connection::Closing)
+		return;
+	bool connecting = connection->step == Connection::Connecting;
+	if (connecting)
+		--m_connecting;
+	else if (connection->step == Connection::Idle)
+		--m_idle;
+	else
+		--m_busy;
+	connection->step = Connection::Closing;
+	++connection->generation;
+	
+	boost::system::error_code ignored;
+	connection->timer.cancel(ignored);
+	if (connection->socket.is_open())
+		connection->socket.cancel(ignored);
+	if (connection->stored)
+		mysql_free_result(connection->stored);
+	connection->stored = NULL;
+	
+	// QUIT goes through the non blocking calls too, the connection is
+	// kept in m_closing until they are done
+	if (connection->mysql) {
+		m_closing.push_back(connection);
+		int status = mysql_close_start(connection->mysql);
+		if (m_stopping)
+			drain(connection, status);
+		else
+			proceed(connection, status);
+	} else {
+		closed(connection);
+	}
+	
+	// Queries are failed rather than left waiting when no connection is
+	// left to run them
+	if (connecting) {
+		bool alive = false;
+		for (std::vector<ConnectionPtr>::iterator it = m_connections.begin(); it != m_connections.end(); ++it)
+			if ((*it)->step < Connection::Closing)
+				alive = true;
+		while (!alive && !m_queue.empty()) {
+			Pending pending = m_queue.front();
+			m_queue.pop_front();
+			--m_queued;
+			AsyncResultPtr result(new AsyncResult());
+			result->m_failed = true;
+			result->m_error = "AsyncDataBase: failed to connect";
+			++m_queries;
+			++m_failures;
+			m_strand->post(boost::bind(pending.handler, result));
+		}
+	}
+}
+
+void AsyncDataBase::drain (const ConnectionPtr & connection, int status)
+{
+	++connection->generation;
+	int fd = mysql_get_socket(connection->mysql);
+	while (status) {
+		pollfd ready = { fd, 0, 0 };
+		if (status & MYSQL_WAIT_READ)
+			ready.events |= POLLIN;
+		if (status & MYSQL_WAIT_WRITE)
+			ready.events |= POLLOUT;
+		if (status & MYSQL_WAIT_EXCEPT)
+			ready.events |= POLLPRI;
+		int timeout = (status & MYSQL_WAIT_TIMEOUT)? mysql_get_timeout_value_ms(connection->mysql) : -1;
+		int polled = poll(&ready, 1, timeout);
+		int event = 0;
+		if (polled == 0)
+			event = MYSQL_WAIT_TIMEOUT;
+		else if (polled > 0) {
+			if (ready.revents & (POLLIN | POLLERR | POLLHUP))
+				event |= MYSQL_WAIT_READ;
+			if (ready.revents & POLLOUT)
+				event |= MYSQL_WAIT_WRITE;
+			if (ready.revents & POLLPRI)
+				event |= MYSQL_WAIT_EXCEPT;
+		}
+		status = mysql_close_cont(connection->mysql, event);
+	}
+	closed(connection);
+}
+
+void AsyncDataBase::closed (const ConnectionPtr & connection)
+{
+	connection->step = Connection::Closed;
+	++connection->generation;
+	boost::system::error_code ignored;
+	connection->timer.cancel(ignored);
+	if (connection->socket.is_open()) {
+		connection->socket.cancel(ignored);
+		connection->socket.release();
+	}
+	connection->mysql = NULL;
+	m_closing.erase(std::remove(m_closing.begin(), m_closing.end(), connection), m_closing.end());
+}
+
+}
@@ -0,0 +1,224 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef _AsyncDataBase_h_
+#define _AsyncDataBase_h_
+
+#include <mysql.h>
+#include <stdint.h>
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/future.hpp>
+#include "DataBase.h"
+#include "server/Metrics.h"
+
+namespace yucode {
+
+	/// Outcome of a query run by the AsyncDataBase, its rows stored client
+	/// side so they are read without blocking.
+	class AsyncResult
+	{
+	public:
+		AsyncResult ();
+		~AsyncResult ();
+		
+		/// Whether the query failed, getError() telling why.
+		inline bool failed() const { return m_failed; }
+		inline const std::string & getError() const { return m_error; }
+		
+		inline unsigned long long getAffectedRows() const { return m_affected_rows; }
+		inline unsigned long long getLastInsertedId() const { return m_insert_id; }
+		inline unsigned long long getRowCount() const { return m_result? mysql_num_rows(m_result) : 0; }
+		
+		/// Rows, read as with a TableTraverser. A single pass is allowed.
+		class iterator
+		{
+		public:
+			iterator (AsyncResult & container, bool end)
+				: m_container(container), m_end(end) {}
+			iterator (const iterator & it) : m_container(it.m_container), m_end(it.m_end) {}
+			inline iterator & operator++ () {
+				m_end = !m_container.fetch();
+				return *this;
+			}
+			inline bool operator== (const iterator& rhs) { return rhs.m_end == m_end; }
+			inline bool operator!= (const iterator& rhs){ return rhs.m_end != m_end; }
+			
+			inline bool isNull(int row) const { return m_container.m_row[row] == 0; }
+			
+			inline unsigned int rowLength(int row) const 
+				{ return m_container.m_lengths[row]; }
+				
+			inline const char * rowAsString(int row) const
+				{ return m_container.m_row[row]; }
+			
+			inline int rowAsInt(int row) const
+				{ return rowAs<int>(row); }
+			
+			inline unsigned int rowAsUnsignedInt(int row) const
+				{ return rowAs<unsigned int>(row); }
+			
+			inline long long rowAsLongLong(int row) const
+				{ return rowAs<long long>(row); }
+			
+			inline unsigned long long rowAsUnsignedLongLong(int row) const
+				{ return rowAs<unsigned long long>(row); }
+			
+			inline double rowAsDouble(int row) const
+				{ return rowAs<double>(row); }
+			
+			template <typename T>
+			inline T rowAs(int row) const
+				{ return DataBase::rowToScalar<T>(m_container.m_row[row], m_container.m_lengths[row]); }
+			
+		private:
+			AsyncResult & m_container;
+			bool m_end;
+		};
+		
+		iterator begin();
+		iterator end();
+		
+	private:
+		friend class AsyncDataBase;
+		
+		bool fetch();
+		
+		MYSQL_RES * m_result;
+		MYSQL_ROW m_row;
+		unsigned long * m_lengths;
+		bool m_failed;
+		std::string m_error;
+		unsigned long long m_affected_rows;
+		unsigned long long m_insert_id;
+	};
+	
+	typedef boost::shared_ptr<AsyncResult> AsyncResultPtr;
+	
+	/// Counters of the AsyncDataBase.
+	struct AsyncDataBaseStats
+	{
+		/// Connections being opened.
+		std::size_t connecting;
+		/// Connections open and waiting for a query.
+		std::size_t idle;
+		/// Connections running a query.
+		std::size_t busy;
+		/// Queries waiting for a connection.
+		std::size_t queued;
+		/// Queries answered, failures included.
+		unsigned long long queries;
+		unsigned long long failures;
+	};
+	
+	/// Data base client which never blocks: queries go through the non
+	/// blocking MariaDB calls (mysql_real_query_start and _cont), resumed
+	/// by an io_service when their socket gets ready. Each of its own
+	/// connections runs a query at a time, queries beyond them queue, so
+	/// a few threads keep as many queries in flight as connections allowed.
+	/// Completion handlers run on the io_service, serialized, and must not
+	/// block either. Statements needing the blocking connection of the
+	/// thread (temporary tables, transactions) stay with DataBase.
+	/// Only built against MariaDB Connector/C, when configure defines
+	/// YUCODE_MYSQL_NONBLOCK.
+	class AsyncDataBase
+	{
+	public:
+		typedef boost::function<void (const AsyncResultPtr &)> Handler;
+		
+		inline static AsyncDataBase& singleton (){
+			static AsyncDataBase instance;
+			return instance;
+		}
+		
+		/// Run on io_service with up to maxConnections, opened on demand
+		/// with the DataBase access. Call once, before any query.
+		void start(boost::asio::io_service & io_service, std::size_t maxConnections);
+		
+		/// Close the connections, once io_service is done running.
+		void stop();
+		
+		inline bool started() const { return m_strand.get() != NULL; }
+		
+		/// Queue a query, handler gets its result. Callable from any thread.
+		void query(const std::string & sql, const Handler & handler);
+		
+		/// Queue a query, its result delivered through the future.
+		boost::unique_future<AsyncResultPtr> query(const std::string & sql);
+		
+		AsyncDataBaseStats stats() const;
+		
+		/// Time from queueing to completion of queries.
+		inline const server::LatencyHistogram & queryTime() const {
+			return m_query_time;
+		}
+		
+	private:
+		AsyncDataBase ();
+		~AsyncDataBase ();
+		
+		struct Pending {
+			std::string sql;
+			Handler handler;
+			uint64_t queued;
+		};
+		
+		struct Connection;
+		typedef boost::shared_ptr<Connection> ConnectionPtr;
+		
+		/// The rest runs on m_strand.
+		void enqueue(const Pending & pending);
+		void dispatch();
+		void connect(const ConnectionPtr & connection);
+		void run(const ConnectionPtr & connection);
+		/// Continue the current step given the status its last call
+		/// returned, waiting for the socket if it is not done.
+		void proceed(const ConnectionPtr & connection, int status);
+		void wait(const ConnectionPtr & connection, int status);
+		void ready(const ConnectionPtr & connection, unsigned int generation, int event, const boost::system::error_code & error);
+		void finish(const ConnectionPtr & connection, const char * error);
+		/// Take the connection out of service and start sending QUIT.
+		void close(const ConnectionPtr & connection);
+		/// Complete a close blocking on the socket, for stop() and sockets
+		/// asio can not watch.
+		void drain(const ConnectionPtr & connection, int status);
+		void closed(const ConnectionPtr & connection);
+		
+		boost::asio::io_service * m_io_service;
+		boost::scoped_ptr<boost::asio::io_service::strand> m_strand;
+		std::size_t m_max;
+		std::vector<ConnectionPtr> m_connections;
+		std::vector<ConnectionPtr> m_closing;
+		std::deque<Pending> m_queue;
+		bool m_stopping;
+		
+		/// Connections per step, updated on every change of step.
+		boost::atomic<std::size_t> m_connecting;
+		boost::atomic<std::size_t> m_idle;
+		boost::atomic<std::size_t> m_busy;
+		boost::atomic<std::size_t> m_queued;
+		boost::atomic<unsigned long long> m_queries;
+		boost::atomic<unsigned long long> m_failures;
+		server::LatencyHistogram m_query_time;
+	};
+
+}
+
+#endif
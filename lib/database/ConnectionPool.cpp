@@ -0,0 +1,208 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "ConnectionPool.h"
+#include <algorithm>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "server/Log.h"
+
+namespace yucode {
+
+namespace {
+
+/// Idle connections are pinged before reuse after this time.
+const uint64_t ping_after_nanoseconds = 30 * 1000000000ULL;
+
+/// Idle connections beyond the minimum are closed after this time.
+const uint64_t close_after_nanoseconds = 300 * 1000000000ULL;
+
+/// Bounds of the delay before connecting again after a failure.
+const unsigned int min_backoff_milliseconds = 100;
+const unsigned int max_backoff_milliseconds = 10000;
+
+}
+
+/// @class ConnectionPool
+/// The pool itself never holds its mutex while talking to the server:
+/// connecting, pinging and closing are done after taking a slot or an idle
+/// connection out of the shared state.
+
+ConnectionPool::ConnectionPool(const Connector & connector, const Disconnector & disconnector)
+	: m_connector(connector), m_disconnector(disconnector), m_open(0), m_min(0), m_max(16), m_waiting(0),
+	  m_wait_nanoseconds(2000 * 1000000ULL), m_retry_at(0), m_backoff_milliseconds(0),
+	  m_checkouts(0), m_waits(0), m_timeouts(0), m_connects(0), m_connect_failures(0),
+	  m_ping_failures(0)
+{
+}
+
+ConnectionPool::~ConnectionPool()
+{
+	// Run at exit, when the disconnector may use objects already destroyed
+	for (std::deque<Idle>::iterator it = m_idle.begin(); it != m_idle.end(); ++it)
+		mysql_close(it->connection);
+}
+
+void ConnectionPool::setLimits(std::size_t min, std::size_t max)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_max = std::max<std::size_t>(max, 1);
+	m_min = std::min(min, m_max);
+}
+
+void ConnectionPool::fill()
+{
+	for (;;) {
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			if (m_open >= m_min)
+				return;
+			++m_open;
+		}
+		release(connect());
+	}
+}
+
+MYSQL * ConnectionPool::acquire()
+{
+	uint64_t started = server::Metrics::now();
+	MYSQL * connection = NULL;
+	bool stale = false;
+	{
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		++m_checkouts;
+		bool waited = false;
+		for (;;) {
+			uint64_t now = server::Metrics::now();
+			if (!m_idle.empty()) {
+				connection = m_idle.back().connection;
+				stale = now - m_idle.back().since > ping_after_nanoseconds;
+				m_idle.pop_back();
+				break;
+			}
+			if (m_open < m_max && now >= m_retry_at) {
+				// Take the slot, the connection is opened below
+				++m_open;
+				break;
+			}
+			
+			if (!waited) {
+				waited = true;
+				++m_waits;
+			}
+			uint64_t deadline = started + m_wait_nanoseconds;
+			if (now >= deadline) {
+				++m_timeouts;
+				lock.unlock();
+				m_wait_time.record(now - started);
+				LOG_ERROR("ConnectionPool::acquire: no connection available after " << (now - started) / 1000000 << "ms");
+				throw "ConnectionPool::acquire() - Timed out waiting for a connection";
+			}
+			// Wake up at the deadline, or once connecting may be retried
+			uint64_t wake = deadline;
+			if (m_open < m_max && m_retry_at < wake)
+				wake = m_retry_at;
+			++m_waiting;
+			m_returned.timed_wait(lock, boost::posix_time::microseconds((wake - now) / 1000 + 1));
+			--m_waiting;
+		}
+	}
+	
+	if (connection && stale && mysql_ping(connection)) {
+		LOG_WARN("ConnectionPool::acquire: idle connection lost: " << mysql_error(connection));
+		m_disconnector(connection);
+		connection = NULL;
+		boost::mutex::scoped_lock lock(m_mutex);
+		++m_ping_failures;
+	}
+	if (!connection)
+		connection = connect();
+	
+	m_wait_time.record(server::Metrics::now() - started);
+	return connection;
+}
+
+void ConnectionPool::release(MYSQL * connection)
+{
+	std::vector<MYSQL *> expired;
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		uint64_t now = server::Metrics::now();
+		Idle idle = { connection, now };
+		m_idle.push_back(idle);
+		// The least recently returned are at the front
+		while (m_open > m_min && now - m_idle.front().since > close_after_nanoseconds) {
+			expired.push_back(m_idle.front().connection);
+			m_idle.pop_front();
+			--m_open;
+		}
+	}
+	m_returned.notify_one();
+	
+	for (std::vector<MYSQL *>::iterator it = expired.begin(); it != expired.end(); ++it)
+		m_disconnector(*it);
+}
+
+void ConnectionPool::discard(MYSQL * connection)
+{
+	m_disconnector(connection);
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		--m_open;
+	}
+	m_returned.notify_one();
+}
+
+ConnectionPoolStats ConnectionPool::stats()
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	ConnectionPoolStats stats;
+	stats.idle = m_idle.size();
+	stats.in_use = m_open - m_idle.size();
+	stats.waiting = m_waiting;
+	stats.checkouts = m_checkouts;
+	stats.waits = m_waits;
+	stats.timeouts = m_timeouts;
+	stats.connects = m_connects;
+	stats.connect_failures = m_connect_failures;
+	stats.ping_failures = m_ping_failures;
+	return stats;
+}
+
+MYSQL * ConnectionPool::connect()
+{
+	MYSQL * connection = NULL;
+	try {
+		connection = m_connector();
+	} catch (...) {
+		unsigned int backoff;
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			--m_open;
+			++m_connect_failures;
+			m_backoff_milliseconds = m_backoff_milliseconds?
+				std::min(2 * m_backoff_milliseconds, max_backoff_milliseconds) : min_backoff_milliseconds;
+			m_retry_at = server::Metrics::now() + m_backoff_milliseconds * 1000000ULL;
+			backoff = m_backoff_milliseconds;
+		}
+		m_returned.notify_one();
+		LOG_ERROR("ConnectionPool::connect: failed, next attempt in " << backoff << "ms");
+		throw;
+	}
+	
+	boost::mutex::scoped_lock lock(m_mutex);
+	++m_connects;
+	m_backoff_milliseconds = 0;
+	return connection;
+}
+
+}
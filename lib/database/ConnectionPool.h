@@ -0,0 +1,124 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef _ConnectionPool_h_
+#define _ConnectionPool_h_
+
+#include <mysql.h>
+#include <stdint.h>
+
+#include <cstddef>
+#include <deque>
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include "server/Metrics.h"
+
+namespace yucode {
+
+	/// Counters of a ConnectionPool.
+	struct ConnectionPoolStats
+	{
+		std::size_t idle;
+		std::size_t in_use;
+		/// Threads waiting for a connection.
+		std::size_t waiting;
+		unsigned long long checkouts;
+		/// Checkouts which had to wait for a connection to be returned,
+		/// timed out ones included.
+		unsigned long long waits;
+		/// Checkouts given up after the wait timeout.
+		unsigned long long timeouts;
+		unsigned long long connects;
+		unsigned long long connect_failures;
+		/// Idle connections found dead when checked out.
+		unsigned long long ping_failures;
+	};
+	
+	/// Bounded pool of MySQL connections. Connections are opened on demand up
+	/// to the maximum, threads checking out beyond it wait for one to be
+	/// returned. Idle ones are pinged before reuse, and closed after a while
+	/// as long as the minimum stays open. Failing to connect backs off
+	/// exponentially, in the meantime only returned connections are served.
+	class ConnectionPool
+	{
+	public:
+		/// Opens a new connection, throws on failure.
+		typedef boost::function<MYSQL * ()> Connector;
+		/// Closes a connection.
+		typedef boost::function<void (MYSQL *)> Disconnector;
+		
+		ConnectionPool(const Connector & connector, const Disconnector & disconnector);
+		~ConnectionPool();
+		
+		/// Connections kept open and most opened at once. Set before use.
+		void setLimits(std::size_t min, std::size_t max);
+		
+		/// Time a checkout waits for a connection before throwing.
+		inline void setWaitTimeout(unsigned int milliseconds) {
+			m_wait_nanoseconds = milliseconds * 1000000ULL;
+		}
+		
+		/// Open connections up to the minimum.
+		void fill();
+		
+		/// Check a connection out, waiting for one if all are in use.
+		MYSQL * acquire();
+		
+		/// Return a connection checked out, with no result pending.
+		void release(MYSQL * connection);
+		
+		/// Close a broken connection checked out, instead of returning it.
+		void discard(MYSQL * connection);
+		
+		ConnectionPoolStats stats();
+		
+		/// Time spent by checkouts, waiting included.
+		inline const server::LatencyHistogram & waitTime() const {
+			return m_wait_time;
+		}
+		
+	private:
+		struct Idle {
+			MYSQL * connection;
+			uint64_t since;
+		};
+		
+		/// Open a connection for a slot already counted in m_open.
+		MYSQL * connect();
+		
+		Connector m_connector;
+		Disconnector m_disconnector;
+		boost::mutex m_mutex;
+		boost::condition_variable m_returned;
+		/// Idle connections, the most recently returned at the back.
+		std::deque<Idle> m_idle;
+		std::size_t m_open;
+		std::size_t m_min;
+		std::size_t m_max;
+		std::size_t m_waiting;
+		uint64_t m_wait_nanoseconds;
+		/// No connection is opened before this time after a failure.
+		uint64_t m_retry_at;
+		unsigned int m_backoff_milliseconds;
+		unsigned long long m_checkouts;
+		unsigned long long m_waits;
+		unsigned long long m_timeouts;
+		unsigned long long m_connects;
+		unsigned long long m_connect_failures;
+		unsigned long long m_ping_failures;
+		server::LatencyHistogram m_wait_time;
+	};
+
+}
+
+#endif
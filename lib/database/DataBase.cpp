@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <cstring>
 #include <errmsg.h>
+#include <boost/bind.hpp>
 #include "misc/Utilities.h"
 
 using namespace std;
@@ -31,6 +32,9 @@ extern __thread long long yucode::server::LogSeqNumber;
 /// Since DataBase::DataBase() is private, it can't instantiated by client
 /// objects. A single instance is allowed, and can be acceded through
 /// DataBase::singleton().
+/// Connections come from a bounded ConnectionPool. A thread checks one out
+/// the first time it needs it, and keeps it until its outermost
+/// ConnectionScope ends.
 
 
 /// Singleton object
@@ -38,78 +42,134 @@ DataBase  DataBase::m_data_base;
 
 __thread MYSQL * m_connection = 0;
 
-/// Nothing is done in current implementation. A single connection is
-/// hold during the whole program execution
+__thread unsigned int ConnectionScopeDepth = 0;
+
+__thread bool TransactionOpen = false;
+
+DataBase::DataBase ()
+	: m_pool(boost::bind(&DataBase::connect, this), boost::bind(&DataBase::disconnect, this, _1)),
+	  m_engine("InnoDB"), passw(NULL), dbuser(NULL), database(NULL)
+{
+}
+
+/// Nothing is done, the connection may still be used by the thread.
+/// It goes back to the pool with returnConnection().
 void DataBase::releaseConnection (MYSQL * connection)
 {
-	// Doing nothing, reuse connection (release at destroy)
 }
 
-/// MySQL connection is opened.
+void DataBase::returnConnection ()
+{
+	if (!m_connection)
+		return;
+	// A pending EXPLAIN runs while the connection is still ours
+	QueryProfiler::singleton().explainPending(m_connection);
+	m_pool.release(m_connection);
+	m_connection = NULL;
+}
+
+void DataBase::reconnect ()
+{
+	discardConnection();
+	openConnection();
+}
+
+void DataBase::discardConnection ()
+{
+	if (m_connection)
+		m_pool.discard(m_connection);
+	m_connection = NULL;
+}
+
+/// Connection is checked out from the pool.
 void DataBase::openConnectionRaw ()
 {
-	createConnection();
+	m_connection = m_pool.acquire();
+}
+
+/// MySQL connection is opened.
+MYSQL * DataBase::connect ()
+{
+	MYSQL * connection = createConnection();
 
-	if (mysql_real_connect(m_connection, "localhost", dbuser,
+	if (mysql_real_connect(connection, "localhost", dbuser,
 				passw, database, 0, NULL, 0) == NULL)
 	{
-		const char * msg = mysql_error(m_connection);
+		const char * msg = mysql_error(connection);
 		LOG_ERROR("[DataBase] mysql error: " << string(msg ? msg : "null"));
 
-		mysql_close(m_connection);
-		m_connection = NULL;
+		mysql_close(connection);
 		
 		// Try to create data base
-		createConnection();
-		if (mysql_real_connect(m_connection, "localhost", dbuser,
+		connection = createConnection();
+		if (mysql_real_connect(connection, "localhost", dbuser,
 				passw, NULL, 0, NULL, 0) == NULL) {
-			const char * msg = mysql_error(m_connection);
+			const char * msg = mysql_error(connection);
 			LOG_ERROR("[DataBase] mysql error (failed to connect to any database): "
 				<< string(msg ? msg : "null"));
+			mysql_close(connection);
 			
 			throw "DataBase::openConnection() - Failed mysql_real_connect()";
 		}
-		createDataBaseIfNotExists(database);
-		mysql_close(m_connection);
-		m_connection = NULL;
+		char buffer[1024];
+		snprintf(buffer, sizeof(buffer), "CREATE DATABASE IF NOT EXISTS %s "
+				"CHARACTER SET utf8 COLLATE utf8_unicode_ci", database);
+		if (mysql_query(connection, buffer))
+			LOG_ERROR("[DataBase] mysql error (creating database): " << mysql_error(connection));
+		mysql_close(connection);
 		
 		// Last attempt
-		createConnection();
-		if (mysql_real_connect(m_connection, "localhost", dbuser,
+		connection = createConnection();
+		if (mysql_real_connect(connection, "localhost", dbuser,
 				passw, database, 0, NULL, 0) == NULL)
 		{
-			const char * msg = mysql_error(m_connection);
+			const char * msg = mysql_error(connection);
 			LOG_ERROR("[DataBase] mysql error (Second attempt): "
 				<< string(msg ? msg : "null"));
+			mysql_close(connection);
 			
 			throw "DataBase::openConnection() - Failed mysql_real_connect()";
 		}
 	}
 
 	LOG("[DataBase] Connected: " << dbuser << "@" << database);
+	return connection;
 }
 
-void DataBase::createConnection ()
+void DataBase::disconnect (MYSQL * connection)
 {
-	m_connection = mysql_init(NULL);
-	if (!m_connection)
+	PreparedStatements::singleton().forget(connection);
+	mysql_close(connection);
+}
+
+MYSQL * DataBase::createConnection ()
+{
+	MYSQL * connection = mysql_init(NULL);
+	if (!connection)
 		throw "DataBase::openConnection() - Failed mysql_init()";
 
-	mysql_options(m_connection, MYSQL_SET_CHARSET_NAME, "utf8");
-	mysql_options(m_connection, MYSQL_INIT_COMMAND, "SET NAMES utf8");
-	mysql_set_character_set(m_connection, "utf8_unicode_ci");
+	mysql_options(connection, MYSQL_SET_CHARSET_NAME, "utf8");
+	mysql_options(connection, MYSQL_INIT_COMMAND, "SET NAMES utf8");
+	mysql_set_character_set(connection, "utf8_unicode_ci");
+	return connection;
 }
 
-void DataBase::reportError(const char * query) {
+MYSQL * DataBase::reportError(MYSQL * connection, const char * query) {
 	// Recover in case of lost connection
-	unsigned int err = mysql_errno(m_connection);
-	if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST) {
-		m_connection = NULL;
-		openConnection();
-		if (!mysql_query(m_connection, query))
-			return;
+	unsigned int err = mysql_errno(connection);
+	if (connection == m_connection && (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)) {
+		if (TransactionOpen) {
+			LOG_ERROR("DataBase SQL error message: connection lost in transaction");
+			LOG_ERROR("DataBase SQL error query: " << query);
+			reconnect();
+			throw "DataBase query failed";
+		}
+		reconnect();
+		connection = m_connection;
+		if (!mysql_query(connection, query))
+			return connection;
 	}
-	LOG_ERROR("DataBase SQL error message: " << mysql_error(m_connection));
+	LOG_ERROR("DataBase SQL error message: " << mysql_error(connection));
 	LOG_ERROR("DataBase SQL error query: " << query);
 	throw "DataBase query failed";
 }
@@ -135,6 +195,8 @@ bool DataBase::existsResultsForQuery(const char * query) {
 		throw "TableTraverser::existsResultsForQuery() - Failed: mysql_use_result() ";
 	}
 	MYSQL_ROW row = mysql_fetch_row(result);
+	if (row)
+		accountRow(result, mysql_fetch_lengths(result));
 	bool exists = row? true : false;
 	mysql_free_result(result);
 	
@@ -224,7 +286,7 @@ bool DataBase::createTable(const char * table_name, const char * fields)
 	}
 
 	snprintf(buffer, sizeof(buffer), "CREATE TABLE %s (%s) "
-	                "ENGINE = MYISAM CHARACTER  SET utf8 COLLATE utf8_unicode_ci AUTO_INCREMENT=0", table_name, fields);
+	                "ENGINE = %s CHARACTER  SET utf8 COLLATE utf8_unicode_ci AUTO_INCREMENT=0", table_name, fields, m_engine.c_str());
 	if (mysql_query(m_connection, buffer))
 	{
 		cerr << "[ERROR] DataBase::createTable() at mysql_query(): " << mysql_error(m_connection) << endl
@@ -241,7 +303,7 @@ bool DataBase::createTableIfNotExists(const char * table_name, const char * fiel
 	if (!m_connection) openConnection();
 
 	snprintf(buffer, sizeof(buffer), "CREATE TABLE IF NOT EXISTS %s (%s) "
-	                "ENGINE = MYISAM CHARACTER SET utf8 COLLATE utf8_unicode_ci AUTO_INCREMENT=0", table_name, fields);
+	                "ENGINE = %s CHARACTER SET utf8 COLLATE utf8_unicode_ci AUTO_INCREMENT=0", table_name, fields, m_engine.c_str());
 	if (mysql_query(m_connection, buffer))
 	{
 		cerr << "[ERROR] DataBase::createTableIfNotExists() at mysql_query(): " << mysql_error(m_connection) << endl
@@ -251,6 +313,52 @@ bool DataBase::createTableIfNotExists(const char * table_name, const char * fiel
 	return true;
 }
 
+bool DataBase::alterTable(const char * table_name, const char * alterations)
+{
+	char buffer[10240];
+	
+	if (!m_connection) openConnection();
+
+	snprintf(buffer, sizeof(buffer), "ALTER TABLE %s %s", table_name, alterations);
+	if (mysql_query(m_connection, buffer))
+	{
+		cerr << "[ERROR] DataBase::alterTable() at mysql_query(): " << mysql_error(m_connection) << endl
+		     << "Query was:" << buffer << endl;
+		return false;
+	}
+	return true;
+}
+
+std::string DataBase::getTableEngine(const char * table_name)
+{
+	char buffer[10240];
+	
+	if (!m_connection) openConnection();
+
+	snprintf(buffer, sizeof(buffer), "SELECT ENGINE "
+		"FROM INFORMATION_SCHEMA.TABLES "
+		"WHERE TABLE_SCHEMA=DATABASE() "
+		"AND TABLE_NAME='%s'", table_name);
+	if (mysql_query(m_connection, buffer))
+	{
+		cerr << "[ERROR] DataBase::getTableEngine() at mysql_query(): " << mysql_error(m_connection) << endl
+		     << "Query was:" << buffer << endl;
+		return std::string();
+	}
+	
+	MYSQL_RES * result = storeResult();
+	if (!result) {
+		cerr << "[ERROR] DataBase::getTableEngine() at store result: " << mysql_error(m_connection) << endl
+		     << "Query was:" << buffer << endl;
+		return std::string();
+	}
+	
+	MYSQL_ROW row = mysql_fetch_row(result);
+	std::string engine = row && row[0]? row[0] : "";
+	mysql_free_result(result);
+	return engine;
+}
+
 bool DataBase::createDataBaseIfNotExists(const char * database_name)
 {
 	char buffer[10240];
@@ -347,8 +455,8 @@ bool DataBase::createTemporaryTable(const char * table_name, const char * from)
 		return false;
 	}
 
-	snprintf(buffer, sizeof(buffer), "CREATE TEMPORARY TABLE %s_%lld ENGINE = MYISAM CHARACTER  SET utf8 COLLATE utf8_unicode_ci AUTO_INCREMENT=0 AS (%s) ",
-		table_name, yucode::server::LogSeqNumber, from);
+	snprintf(buffer, sizeof(buffer), "CREATE TEMPORARY TABLE %s_%lld ENGINE = %s CHARACTER  SET utf8 COLLATE utf8_unicode_ci AUTO_INCREMENT=0 AS (%s) ",
+		table_name, yucode::server::LogSeqNumber, m_engine.c_str(), from);
 	if (mysql_query(m_connection, buffer))
 	{
 		cerr << "[ERROR] DataBase::createTemporaryTable() at mysql_query(): " << mysql_error(m_connection) << endl
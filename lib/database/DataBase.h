@@ -16,20 +16,90 @@
 #include <mysql.h>
 
 #include <iostream>
+#include <limits>
+#include <sstream>
 #include <string.h>
 #include <string>
+#include <type_traits>
 #include <vector>
 #include <stdlib.h>
+#include "ConnectionPool.h"
+#include "PreparedStatements.h"
+#include "QueryProfiler.h"
+#include "server/Metrics.h"
+#include "server/Trace.h"
 
 //#define DEBUG_QUERIES
 #ifdef DEBUG_QUERIES
 #include "server/Log.h"
 #endif
 
+/// Connection checked out by the calling thread, NULL if none.
 extern __thread MYSQL * m_connection;
 
+/// ConnectionScope objects alive in the calling thread.
+extern __thread unsigned int ConnectionScopeDepth;
+
+/// Whether the calling thread has a Transaction open on its connection.
+extern __thread bool TransactionOpen;
+
 namespace yucode {
-		
+	
+	/// Decodes the text of a column value as T, 0 if it is not one. Types
+	/// without a faster specialization go through a stream.
+	template <typename T, typename Enable = void>
+	struct ScalarDecoder
+	{
+		static inline T decode(const char * ptr, int len) {
+			T t;
+			std::istringstream stringStream(std::string(ptr, len));
+			if ((stringStream >> t).fail())
+				return T(0);
+			return t;
+		}
+	};
+	
+	/// Integers are parsed in place, as a stream would: leading blanks and
+	/// sign skipped, stopping at the first non digit, 0 on overflow.
+	/// Negatives wrap around for unsigned types.
+	template <typename T>
+	struct ScalarDecoder<T, typename std::enable_if<std::is_integral<T>::value && (sizeof(T) > 1)>::type>
+	{
+		static inline T decode(const char * ptr, int len) {
+			typedef typename std::make_unsigned<T>::type U;
+			const char * end = ptr + len;
+			while (ptr != end && isspace(static_cast<unsigned char>(*ptr)))
+				++ptr;
+			bool negative = false;
+			if (ptr != end && (*ptr == '-' || *ptr == '+'))
+				negative = *ptr++ == '-';
+			if (ptr == end || *ptr < '0' || *ptr > '9')
+				return T(0);
+			
+			U limit = std::is_signed<T>::value?
+				U(std::numeric_limits<T>::max()) + (negative? 1 : 0) : std::numeric_limits<U>::max();
+			U value = 0;
+			for (; ptr != end && *ptr >= '0' && *ptr <= '9'; ++ptr) {
+				U digit = *ptr - '0';
+				if (value > (limit - digit) / 10)
+					return T(0);
+				value = value * 10 + digit;
+			}
+			return negative? T(U(0) - value) : T(value);
+		}
+	};
+	
+	/// Reals are parsed in place, column values being NUL terminated.
+	template <typename T>
+	struct ScalarDecoder<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+	{
+		static inline T decode(const char * ptr, int len) {
+			char * end;
+			double value = strtod(ptr, &end);
+			return end == ptr? T(0) : T(value);
+		}
+	};
+	
 	/// General propose DataBase execption class
 	/// @author David Yuste 
 	class DataBaseException : public std::exception
@@ -50,9 +120,7 @@ namespace yucode {
 	class DataBase
 	{
 	public:
-		DataBase () {
-			setAccess(NULL, NULL, NULL);
-		}
+		DataBase ();
 		
 		inline static DataBase& singleton (){
 			return m_data_base;
@@ -62,6 +130,16 @@ namespace yucode {
 			return database;
 		}
 
+		/// Storage engine of the tables created from now on, InnoDB by
+		/// default. Set before bootstrapping.
+		void setEngine(const char * engine) {
+			m_engine = engine;
+		}
+		
+		const std::string & getEngine() const {
+			return m_engine;
+		}
+
 		void setAccess(const char * d, const char * u, const char * p) { 
 			if (database) free(database);
 			database = d? strdup(d) : NULL; 
@@ -71,13 +149,28 @@ namespace yucode {
 			passw = p? strdup(p) : null;
 		}
 
-		/// MySQL connction is returned. If it doesn't exist, it is opened.
+		/// MySQL connction of the calling thread is returned. If it has
+		/// none, one is checked out from the pool.
 		inline MYSQL * getConnection () {
 			if (!m_connection)
 				openConnection();
 			return m_connection;
 		}
 		void releaseConnection (MYSQL * connection);
+		
+		/// Return the connection of the calling thread to the pool.
+		void returnConnection ();
+		
+		/// Replace the lost connection of the calling thread by a new one.
+		void reconnect ();
+		
+		/// Close the lost connection of the calling thread instead of
+		/// returning it to the pool. Its next statement checks out another.
+		void discardConnection ();
+		
+		inline ConnectionPool & pool() {
+			return m_pool;
+		}
 
 	public:
 		bool existsResultsForQuery(const char * query);
@@ -87,20 +180,71 @@ namespace yucode {
 		
 		inline void executeQuery(const char * query){
 			if (!m_connection) openConnection();
+			executeQuery(m_connection, query);
+		}
+		
+		/// Run query on connection, either the one of the calling thread
+		/// or one checked out from pool() by the caller.
+		inline void executeQuery(MYSQL * connection, const char * query){
 #ifdef DEBUG_QUERIES
 			LOG(std::string("executeQuery: ") << query);
 #endif
-			if (mysql_query(m_connection, query))
-				reportError(query);
+			QueryProfiler & profiler = QueryProfiler::singleton();
+			profiler.explainPending(connection);
+			server::TraceSpan trace(server::TraceQueryBegin, server::TraceStatement(query));
+			uint64_t started = server::Metrics::now();
+			if (mysql_query(connection, query))
+				connection = reportError(connection, query);
+			uint64_t elapsed = server::Metrics::now() - started;
+			// Statements without a result set count their affected rows
+			profiler.record(query, elapsed, mysql_field_count(connection)? 0 : mysql_affected_rows(connection));
+			if (server::RequestSample * sample = server::CurrentRequestSample) {
+				++sample->queries;
+				sample->db_nanoseconds += elapsed;
+			}
 		}
 		
 		inline void executeQuery(const std::string& query){
 			executeQuery(query.c_str());
 		}
 		
-		void reportError(const char * query);
+		inline void reportError(const char * query) {
+			reportError(m_connection, query);
+		}
+		
+		/// Log the error of query and throw, but when the connection of the
+		/// calling thread was lost: then query is run again on a new one,
+		/// which is returned.
+		MYSQL * reportError(MYSQL * connection, const char * query);
 		inline MYSQL_RES * storeResult() {
-			return mysql_store_result(m_connection);
+			server::RequestSample * sample = server::CurrentRequestSample;
+			uint64_t started = sample? server::Metrics::now() : 0;
+			MYSQL_RES * result = mysql_store_result(m_connection);
+			if (sample)
+				sample->db_nanoseconds += server::Metrics::now() - started;
+			if (result)
+				QueryProfiler::singleton().addRows(mysql_num_rows(result));
+			// The connection is idle once the result is stored
+			QueryProfiler::singleton().explainPending(m_connection);
+			return result;
+		}
+		
+		/// Account a row fetched from result to the Request being handled.
+		inline static void accountRow(MYSQL_RES * result, const unsigned long * lengths) {
+			server::RequestSample * sample = server::CurrentRequestSample;
+			if (!sample || !lengths)
+				return;
+			++sample->db_rows;
+			for (unsigned int i = 0, fields = mysql_num_fields(result); i < fields; ++i)
+				sample->db_bytes += lengths[i];
+		}
+		
+		/// Account a row of bytes fetched to the Request being handled.
+		inline static void accountRow(uint64_t bytes) {
+			if (server::RequestSample * sample = server::CurrentRequestSample) {
+				++sample->db_rows;
+				sample->db_bytes += bytes;
+			}
 		}
 		
 		void executeDelete(const char * table, const char * where);
@@ -147,6 +291,15 @@ namespace yucode {
 		inline bool createDataBaseIfNotExists(const std::string & database_name) {
 			return createDataBaseIfNotExists(database_name.c_str());
 		}
+		bool alterTable(const char * table_name, const char * alterations);
+		inline bool alterTable(const std::string & table_name, const std::string & alterations) {
+			return alterTable(table_name.c_str(), alterations.c_str());
+		}
+		/// Storage engine of a table, empty if it does not exist.
+		std::string getTableEngine(const char * table_name);
+		inline std::string getTableEngine(const std::string & table_name) {
+			return getTableEngine(table_name.c_str());
+		}
 		bool existsTable(const char * table_name);
 		bool truncateTable(const char * table_name);
 		bool dropTable(const char * table_name);
@@ -164,11 +317,7 @@ namespace yucode {
 		inline static T rowToScalar(const char * ptr, int len)
 		{
 			if (!ptr) return T(0);
-			T t;
-			std::istringstream stringStream(std::string(ptr, len));
-			if ((stringStream >> t).fail())
-				return T(0);
-			return t;
+			return ScalarDecoder<T>::decode(ptr, len);
 		}
 		
 		inline void openConnection () {
@@ -178,14 +327,77 @@ namespace yucode {
 		}
 	protected:
 		void openConnectionRaw ();
-		void createConnection ();
+		
+		/// Open a new connection, creating the data base if missing.
+		MYSQL * connect ();
+		MYSQL * createConnection ();
+		
+		/// Close a connection, with the statements prepared on it.
+		void disconnect (MYSQL * connection);
 
 	private:
+		/// Opens its own connections with the same access.
+		friend class AsyncDataBase;
+		
 		static DataBase  m_data_base;
+		ConnectionPool m_pool;
+		std::string m_engine;
 		char * passw;
 		char * dbuser;
 		char * database;
 	};
+	
+	/// Scope along which the calling thread keeps the connection it checks
+	/// out, so its statements share temporary tables and results. When the
+	/// outermost one ends, the connection goes back to the pool. Threads
+	/// out of any keep their connection until they return it.
+	class ConnectionScope
+	{
+	public:
+		ConnectionScope () {
+			++ConnectionScopeDepth;
+		}
+		
+		~ConnectionScope () {
+			if (!--ConnectionScopeDepth && m_connection)
+				DataBase::singleton().returnConnection();
+		}
+	};
+	
+	/// Transaction on the connection of the calling thread, which stays
+	/// checked out until it ends. Rolled back unless commit() is called.
+	/// Lost connections are not recovered meanwhile, as the statements
+	/// already run would be silently dropped.
+	class Transaction
+	{
+	public:
+		Transaction () : m_done(false) {
+			if (TransactionOpen)
+				throw "DataBase nested transaction";
+			DataBase::singleton().executeQuery("START TRANSACTION");
+			TransactionOpen = true;
+		}
+		
+		~Transaction () {
+			if (m_done)
+				return;
+			TransactionOpen = false;
+			if (m_connection)
+				mysql_query(m_connection, "ROLLBACK");
+		}
+		
+		/// A failed COMMIT throws with the transaction still open, so that
+		/// the destructor rolls it back before the connection is returned.
+		void commit () {
+			DataBase::singleton().executeQuery("COMMIT");
+			TransactionOpen = false;
+			m_done = true;
+		}
+	
+	private:
+		ConnectionScope m_scope;
+		bool m_done;
+	};
 
 }
 
@@ -0,0 +1,185 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "PreparedStatements.h"
+#include <string.h>
+#include "server/Log.h"
+
+namespace yucode {
+
+namespace {
+
+/// Initial size of text column buffers, values longer are fetched again.
+const std::size_t initial_text_size = 64;
+
+StatementColumn::Kind columnKind(enum_field_types type) {
+	switch (type) {
+	case MYSQL_TYPE_TINY:
+	case MYSQL_TYPE_SHORT:
+	case MYSQL_TYPE_INT24:
+	case MYSQL_TYPE_LONG:
+	case MYSQL_TYPE_LONGLONG:
+	case MYSQL_TYPE_YEAR:
+		return StatementColumn::Integer;
+	case MYSQL_TYPE_FLOAT:
+	case MYSQL_TYPE_DOUBLE:
+		return StatementColumn::Real;
+	default:
+		return StatementColumn::Text;
+	}
+}
+
+}
+
+void PreparedStatement::bindResults()
+{
+	for (std::size_t i = 0; i < columns.size(); ++i) {
+		StatementColumn & column = columns[i];
+		MYSQL_BIND & bind = results[i];
+		memset(&bind, 0, sizeof(bind));
+		bind.length = &column.length;
+		bind.is_null = &column.is_null;
+		bind.error = &column.error;
+		switch (column.kind) {
+		case StatementColumn::Integer:
+			bind.buffer_type = MYSQL_TYPE_LONGLONG;
+			bind.buffer = &column.integer;
+			bind.is_unsigned = column.is_unsigned;
+			break;
+		case StatementColumn::Real:
+			bind.buffer_type = MYSQL_TYPE_DOUBLE;
+			bind.buffer = &column.real;
+			break;
+		case StatementColumn::Text:
+			// Room for the NUL terminator is kept out of buffer_length
+			bind.buffer_type = MYSQL_TYPE_STRING;
+			bind.buffer = &column.text[0];
+			bind.buffer_length = column.text.size() - 1;
+			break;
+		}
+	}
+	if (!results.empty())
+		mysql_stmt_bind_result(stmt, &results[0]);
+}
+
+StatementId PreparedStatements::declare(const std::string & sql)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_sql.push_back(sql);
+	return m_sql.size() - 1;
+}
+
+const std::string & PreparedStatements::sql(StatementId id)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_sql[id];
+}
+
+PreparedStatement * PreparedStatements::acquire(MYSQL * connection, StatementId id, unsigned int & error)
+{
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		std::vector<PreparedStatement *> & prepared = m_prepared[connection];
+		if (prepared.size() > id && prepared[id] && !prepared[id]->busy) {
+			prepared[id]->busy = true;
+			return prepared[id];
+		}
+	}
+	
+	PreparedStatement * statement = prepare(connection, id, error);
+	if (!statement)
+		return NULL;
+	statement->busy = true;
+	
+	boost::mutex::scoped_lock lock(m_mutex);
+	std::vector<PreparedStatement *> & prepared = m_prepared[connection];
+	if (prepared.size() <= id)
+		prepared.resize(id + 1, NULL);
+	if (prepared[id])
+		// Nested use of a statement, the cached one stays
+		statement->owned = true;
+	else
+		prepared[id] = statement;
+	return statement;
+}
+
+void PreparedStatements::release(PreparedStatement * statement)
+{
+	if (statement->owned)
+		delete statement;
+	else
+		statement->busy = false;
+}
+
+void PreparedStatements::forget(MYSQL * connection)
+{
+	std::vector<PreparedStatement *> prepared;
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		std::unordered_map<MYSQL *, std::vector<PreparedStatement *> >::iterator it = m_prepared.find(connection);
+		if (it == m_prepared.end())
+			return;
+		prepared.swap(it->second);
+		m_prepared.erase(it);
+	}
+	for (std::vector<PreparedStatement *>::iterator it = prepared.begin(); it != prepared.end(); ++it) {
+		if (!*it)
+			continue;
+		// Those in use are deleted by their user
+		if ((*it)->busy)
+			(*it)->owned = true;
+		else
+			delete *it;
+	}
+}
+
+PreparedStatement * PreparedStatements::prepare(MYSQL * connection, StatementId id, unsigned int & error)
+{
+	const std::string & query = sql(id);
+	MYSQL_STMT * stmt = mysql_stmt_init(connection);
+	if (!stmt) {
+		error = mysql_errno(connection);
+		LOG_ERROR("PreparedStatements::prepare: mysql_stmt_init failed: " << mysql_error(connection));
+		return NULL;
+	}
+	if (mysql_stmt_prepare(stmt, query.c_str(), query.size())) {
+		error = mysql_stmt_errno(stmt);
+		LOG_ERROR("PreparedStatements::prepare: " << mysql_stmt_error(stmt) << ", statement: " << query);
+		mysql_stmt_close(stmt);
+		return NULL;
+	}
+	
+	PreparedStatement * statement = new PreparedStatement(stmt, query);
+	if (MYSQL_RES * metadata = mysql_stmt_result_metadata(stmt)) {
+		unsigned int count = mysql_num_fields(metadata);
+		MYSQL_FIELD * fields = mysql_fetch_fields(metadata);
+		statement->columns.resize(count);
+		statement->results.resize(count);
+		for (unsigned int i = 0; i < count; ++i) {
+			StatementColumn & column = statement->columns[i];
+			column.kind = columnKind(fields[i].type);
+			column.is_unsigned = (fields[i].flags & UNSIGNED_FLAG) != 0;
+			column.integer = 0;
+			column.real = 0;
+			if (column.kind == StatementColumn::Text)
+				column.text.resize(initial_text_size + 1);
+			column.length = 0;
+			column.is_null = 0;
+			column.error = 0;
+		}
+		mysql_free_result(metadata);
+		statement->bindResults();
+	}
+	return statement;
+}
+
+}
@@ -0,0 +1,119 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef _PreparedStatements_h_
+#define _PreparedStatements_h_
+
+#include <mysql.h>
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+
+namespace yucode {
+
+	/// Statement declared to PreparedStatements.
+	typedef unsigned int StatementId;
+	
+	/// Flags MYSQL_BIND points at: my_bool, which MySQL 8 replaced by bool
+	/// and no longer defines. MariaDB keeps it.
+#if MYSQL_VERSION_ID >= 80000 && !defined(MARIADB_BASE_VERSION) && !defined(MARIADB_PACKAGE_VERSION_ID)
+	typedef bool StatementFlag;
+#else
+	typedef my_bool StatementFlag;
+#endif
+	
+	/// Buffer a result column is fetched into, in binary form.
+	struct StatementColumn
+	{
+		enum Kind { Integer, Real, Text };
+		
+		Kind kind;
+		bool is_unsigned;
+		long long integer;
+		double real;
+		/// Text value, NUL terminated. Integers and reals are formatted here
+		/// when asked as text.
+		std::vector<char> text;
+		unsigned long length;
+		StatementFlag is_null;
+		StatementFlag error;
+	};
+	
+	/// Statement prepared on a connection, with its result bound to columns.
+	struct PreparedStatement
+	{
+		PreparedStatement(MYSQL_STMT * _stmt, const std::string & _sql)
+			: stmt(_stmt), sql(_sql), busy(false), owned(false) {}
+		~PreparedStatement() {
+			mysql_stmt_close(stmt);
+		}
+		
+		/// Bind results to columns again, after a text buffer moved.
+		void bindResults();
+		
+		MYSQL_STMT * stmt;
+		const std::string & sql;
+		std::vector<StatementColumn> columns;
+		std::vector<MYSQL_BIND> results;
+		/// Whether a StatementTraverser is using it.
+		bool busy;
+		/// Whether it is out of the cache, deleted once released.
+		bool owned;
+	};
+	
+	/// Statements declared once by the code running them, and prepared
+	/// lazily on each connection the first time they are run there. Handles
+	/// are kept until their connection is closed, so MySQL parses each
+	/// statement once per connection.
+	class PreparedStatements
+	{
+	public:
+		inline static PreparedStatements & singleton() {
+			static PreparedStatements instance;
+			return instance;
+		}
+		
+		/// Declare sql, with '?' for its parameters. The id is meant to be
+		/// kept, e.g. in a function static.
+		StatementId declare(const std::string & sql);
+		
+		const std::string & sql(StatementId id);
+		
+		/// Statement id prepared on connection, marked busy. A busy one is
+		/// prepared again out of the cache. NULL with the MySQL error
+		/// number in error if it can not be prepared.
+		PreparedStatement * acquire(MYSQL * connection, StatementId id, unsigned int & error);
+		
+		/// Give back a statement acquired.
+		void release(PreparedStatement * statement);
+		
+		/// Close the statements prepared on connection, before closing it.
+		void forget(MYSQL * connection);
+		
+	private:
+		PreparedStatements() {}
+		
+		PreparedStatement * prepare(MYSQL * connection, StatementId id, unsigned int & error);
+		
+		boost::mutex m_mutex;
+		/// SQL of each StatementId, references stay valid as it grows.
+		std::deque<std::string> m_sql;
+		/// Statements prepared per connection, by StatementId.
+		std::unordered_map<MYSQL *, std::vector<PreparedStatement *> > m_prepared;
+	};
+
+}
+
+#endif
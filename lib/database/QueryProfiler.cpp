@@ -0,0 +1,224 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "QueryProfiler.h"
+
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <boost/thread/tss.hpp>
+#include "server/Log.h"
+#include "server/Trace.h"
+
+using namespace std;
+
+namespace yucode {
+
+__thread bool QueryExplainPending = false;
+
+namespace {
+
+/// Profiling state of a thread.
+struct ProfilerThread
+{
+	ProfilerThread() : last(0), pending_fingerprint(0), pending_nanoseconds(0) {
+		normalized.reserve(256);
+	}
+	
+	std::string normalized;
+	/// Fingerprint of the last statement recorded.
+	uint64_t last;
+	/// Slow SELECT to explain.
+	std::string pending;
+	uint64_t pending_fingerprint;
+	uint64_t pending_nanoseconds;
+};
+
+__thread ProfilerThread * CurrentProfilerThread = NULL;
+
+ProfilerThread & currentProfilerThread() {
+	if (!CurrentProfilerThread) {
+		// Deletes the state of each thread when it exits
+		static boost::thread_specific_ptr<ProfilerThread> * threads = new boost::thread_specific_ptr<ProfilerThread>();
+		threads->reset(new ProfilerThread());
+		CurrentProfilerThread = threads->get();
+	}
+	return *CurrentProfilerThread;
+}
+
+bool isSelect(const char * query) {
+	while (isspace(static_cast<unsigned char>(*query)) || *query == '(')
+		++query;
+	return strncasecmp(query, "SELECT", 6) == 0;
+}
+
+struct QueryStatsOrder {
+	QueryStatsOrder(const string & _order) : order(_order) {}
+	
+	unsigned long long key(const QueryStats & stats) const {
+		if (order == "count") return stats.count;
+		if (order == "max") return stats.max_nanoseconds;
+		if (order == "rows") return stats.rows;
+		return stats.total_nanoseconds;
+	}
+	
+	bool operator()(const QueryStats & a, const QueryStats & b) const {
+		return key(a) > key(b);
+	}
+	
+	string order;
+};
+
+} // namespace
+
+void QueryProfiler::setSlowThreshold(unsigned int milliseconds)
+{
+	m_slow_nanoseconds.store(milliseconds * 1000000ULL, boost::memory_order_relaxed);
+}
+
+void QueryProfiler::record(const char * query, uint64_t nanoseconds, unsigned long long rows, bool explainable)
+{
+	ProfilerThread & thread = currentProfilerThread();
+	uint64_t fingerprint = server::TraceFingerprint(query, thread.normalized);
+	thread.last = fingerprint;
+	
+	uint64_t slow = m_slow_nanoseconds.load(boost::memory_order_relaxed);
+	bool explain = false;
+	{
+		Shard & shard = shardOf(fingerprint);
+		boost::mutex::scoped_lock lock(shard.mutex);
+		QueryStats & stats = shard.stats[fingerprint];
+		if (!stats.count)
+			stats.statement = thread.normalized;
+		++stats.count;
+		stats.total_nanoseconds += nanoseconds;
+		stats.max_nanoseconds = std::max<unsigned long long>(stats.max_nanoseconds, nanoseconds);
+		stats.rows += rows;
+		if (slow && nanoseconds > slow && !stats.explained && !QueryExplainPending && explainable && isSelect(query)) {
+			stats.explained = true;
+			explain = true;
+		}
+	}
+	
+	if (explain) {
+		thread.pending = query;
+		thread.pending_fingerprint = fingerprint;
+		thread.pending_nanoseconds = nanoseconds;
+		QueryExplainPending = true;
+	}
+}
+
+void QueryProfiler::addRows(unsigned long long rows)
+{
+	ProfilerThread & thread = currentProfilerThread();
+	if (!thread.last || !rows)
+		return;
+	Shard & shard = shardOf(thread.last);
+	boost::mutex::scoped_lock lock(shard.mutex);
+	std::unordered_map<uint64_t, QueryStats>::iterator it = shard.stats.find(thread.last);
+	if (it != shard.stats.end())
+		it->second.rows += rows;
+}
+
+void QueryProfiler::explain(MYSQL * connection)
+{
+	ProfilerThread & thread = currentProfilerThread();
+	QueryExplainPending = false;
+	std::string query = "EXPLAIN " + thread.pending;
+	thread.pending.clear();
+	
+	if (mysql_query(connection, query.c_str())) {
+		LOG_WARN("QueryProfiler::explain: EXPLAIN failed: " << mysql_error(connection));
+		return;
+	}
+	MYSQL_RES * result = mysql_store_result(connection);
+	if (!result)
+		return;
+	
+	// One row per table read, kept as its non NULL columns
+	ostringstream plan;
+	bool full_scan = false;
+	MYSQL_FIELD * fields = mysql_fetch_fields(result);
+	unsigned int columns = mysql_num_fields(result);
+	bool first = true;
+	while (MYSQL_ROW row = mysql_fetch_row(result)) {
+		plan << (first? "" : "; ");
+		first = false;
+		for (unsigned int i = 0; i < columns; ++i) {
+			if (!row[i])
+				continue;
+			plan << fields[i].name << "=" << row[i] << " ";
+			if (strcasecmp(fields[i].name, "type") == 0 && strcmp(row[i], "ALL") == 0)
+				full_scan = true;
+		}
+	}
+	mysql_free_result(result);
+	
+	std::string statement;
+	{
+		Shard & shard = shardOf(thread.pending_fingerprint);
+		boost::mutex::scoped_lock lock(shard.mutex);
+		std::unordered_map<uint64_t, QueryStats>::iterator it = shard.stats.find(thread.pending_fingerprint);
+		if (it == shard.stats.end())
+			return;
+		it->second.plan = plan.str();
+		it->second.full_scan = full_scan;
+		statement = it->second.statement;
+	}
+	LOG_WARN("QueryProfiler: slow query, " << thread.pending_nanoseconds / 1000000 << "ms"
+			<< (full_scan? ", full table scan" : "") << ": " << statement << " EXPLAIN: " << plan.str());
+}
+
+std::vector<QueryStats> QueryProfiler::snapshot(const std::string & order, std::size_t limit)
+{
+	std::vector<QueryStats> all;
+	for (std::size_t i = 0; i < shards; ++i) {
+		boost::mutex::scoped_lock lock(m_shards[i].mutex);
+		for (std::unordered_map<uint64_t, QueryStats>::const_iterator it = m_shards[i].stats.begin(); it != m_shards[i].stats.end(); ++it)
+			all.push_back(it->second);
+	}
+	std::sort(all.begin(), all.end(), QueryStatsOrder(order));
+	if (limit && all.size() > limit)
+		all.resize(limit);
+	return all;
+}
+
+void QueryProfiler::write(std::ostream & os, const std::string & order, std::size_t limit)
+{
+	std::vector<QueryStats> all = snapshot(order, limit);
+	os << setw(10) << "count" << setw(12) << "total ms" << setw(10) << "avg ms" << setw(10) << "max ms"
+		<< setw(12) << "rows" << setw(10) << "rows/exec" << "  statement\n";
+	os << fixed << setprecision(2);
+	for (std::vector<QueryStats>::const_iterator it = all.begin(); it != all.end(); ++it) {
+		os << setw(10) << it->count
+			<< setw(12) << it->total_nanoseconds / 1e6
+			<< setw(10) << it->total_nanoseconds / 1e6 / it->count
+			<< setw(10) << it->max_nanoseconds / 1e6
+			<< setw(12) << it->rows
+			<< setw(10) << static_cast<double>(it->rows) / it->count
+			<< "  " << it->statement << "\n";
+		if (!it->plan.empty())
+			os << setw(66) << (it->full_scan? "FULL SCAN" : "plan") << "  " << it->plan << "\n";
+	}
+}
+
+void QueryProfiler::reset()
+{
+	for (std::size_t i = 0; i < shards; ++i) {
+		boost::mutex::scoped_lock lock(m_shards[i].mutex);
+		m_shards[i].stats.clear();
+	}
+}
+
+}
@@ -0,0 +1,114 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef _QueryProfiler_h_
+#define _QueryProfiler_h_
+
+#include <mysql.h>
+#include <stdint.h>
+
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace yucode {
+
+	/// Totals of the executions of the statements sharing a fingerprint.
+	struct QueryStats
+	{
+		QueryStats() : count(0), total_nanoseconds(0), max_nanoseconds(0), rows(0),
+			explained(false), full_scan(false) {}
+		
+		/// Statement with its literals replaced by '?'.
+		std::string statement;
+		unsigned long long count;
+		unsigned long long total_nanoseconds;
+		unsigned long long max_nanoseconds;
+		/// Rows returned or affected.
+		unsigned long long rows;
+		/// Whether a slow execution was scheduled for an EXPLAIN.
+		bool explained;
+		/// Plan captured, one "column=value" list per table.
+		std::string plan;
+		/// Whether the plan reads a whole table.
+		bool full_scan;
+	};
+	
+	// Whether the calling thread ran a slow SELECT not yet explained.
+	extern __thread bool QueryExplainPending;
+	
+	/// Inventory of the statements run by DataBase, by fingerprint. The first
+	/// slow execution of a SELECT gets its EXPLAIN captured and logged, once
+	/// its connection is idle again.
+	class QueryProfiler
+	{
+	public:
+		inline static QueryProfiler & singleton() {
+			static QueryProfiler instance;
+			return instance;
+		}
+		
+		/// Executions slower than milliseconds get their plan captured, 0 never.
+		void setSlowThreshold(unsigned int milliseconds);
+		
+		/// Account an execution of query that took nanoseconds and returned
+		/// or affected rows. Rows stored afterwards are added by addRows.
+		/// Slow ones are explained unless explainable is false.
+		void record(const char * query, uint64_t nanoseconds, unsigned long long rows, bool explainable = true);
+		
+		/// Add rows to the last statement recorded by the calling thread.
+		void addRows(unsigned long long rows);
+		
+		/// Run the EXPLAIN left pending by the calling thread, if any.
+		/// connection must have no result pending.
+		inline void explainPending(MYSQL * connection) {
+			if (QueryExplainPending)
+				explain(connection);
+		}
+		
+		/// Statistics of every fingerprint, by order: "total" time, "count",
+		/// "max" time or "rows", descending. At most limit of them, 0 all.
+		std::vector<QueryStats> snapshot(const std::string & order = "total", std::size_t limit = 0);
+		
+		/// Write snapshot(order, limit) as a text table.
+		void write(std::ostream & os, const std::string & order = "total", std::size_t limit = 0);
+		
+		/// Forget every statistic and plan.
+		void reset();
+		
+	private:
+		QueryProfiler() : m_slow_nanoseconds(0) {}
+		
+		void explain(MYSQL * connection);
+		
+		/// Statistics are split in shards, each locked alone.
+		static const std::size_t shards = 16;
+		
+		struct Shard {
+			boost::mutex mutex;
+			std::unordered_map<uint64_t, QueryStats> stats;
+		};
+		
+		inline Shard & shardOf(uint64_t fingerprint) {
+			return m_shards[fingerprint % shards];
+		}
+		
+		Shard m_shards[shards];
+		boost::atomic<uint64_t> m_slow_nanoseconds;
+	};
+	
+}
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef _RowTraverser_h_
+#define _RowTraverser_h_
+
+#include <boost/optional.hpp>
+#include "TableTraverser.h"
+
+namespace yucode {
+	
+	/// Decodes a column value into a T, NULL being 0 or empty.
+	template <typename T>
+	struct ColumnDecoder
+	{
+		static inline void decode(T & to, const char * value, unsigned long length) {
+			to = DataBase::rowToScalar<T>(value, length);
+		}
+	};
+	
+	template <>
+	struct ColumnDecoder<std::string>
+	{
+		static inline void decode(std::string & to, const char * value, unsigned long length) {
+			if (value)
+				to.assign(value, length);
+			else
+				to.clear();
+		}
+	};
+	
+	/// NULL is decoded as none.
+	template <typename T>
+	struct ColumnDecoder<boost::optional<T> >
+	{
+		static inline void decode(boost::optional<T> & to, const char * value, unsigned long length) {
+			if (!value) {
+				to = boost::none;
+				return;
+			}
+			T decoded;
+			ColumnDecoder<T>::decode(decoded, value, length);
+			to = decoded;
+		}
+	};
+	
+	/// Column of a result set decoded into Member of Row.
+	template <typename Row, typename T, T Row::* Member>
+	struct Column
+	{
+		static inline void decode(Row & row, const char * value, unsigned long length) {
+			ColumnDecoder<T>::decode(row.*Member, value, length);
+		}
+	};
+	
+	/// Decodes columns Index and following of a MYSQL_ROW into a Row.
+	template <typename Row, unsigned int Index, typename... Columns>
+	struct RowDecoder
+	{
+		static inline void decode(Row & row, MYSQL_ROW values, const unsigned long * lengths) {}
+	};
+	
+	template <typename Row, unsigned int Index, typename First, typename... Rest>
+	struct RowDecoder<Row, Index, First, Rest...>
+	{
+		static inline void decode(Row & row, MYSQL_ROW values, const unsigned long * lengths) {
+			First::decode(row, values[Index], lengths[Index]);
+			RowDecoder<Row, Index + 1, Rest...>::decode(row, values, lengths);
+		}
+	};
+	
+	/// TableTraverser decoding each row into a Row struct, its columns
+	/// being declared once, in SELECT order, as the type parameters. Values
+	/// are parsed straight from the MYSQL_ROW, without temporary strings.
+	///
+	///	struct CellRow { unsigned int position; boost::optional<unsigned long long> playerId; };
+	///	RowTraverser<CellRow,
+	///		Column<CellRow, unsigned int, &CellRow::position>,
+	///		Column<CellRow, boost::optional<unsigned long long>, &CellRow::playerId> >
+	///		cellTraverser("SELECT position,player_id FROM ...");
+	///	vector<CellRow> cells;
+	///	cellTraverser.fetchAll(cells);
+	template <typename Row, typename... Columns>
+	class RowTraverser : public TableTraverser {
+	public:
+		RowTraverser (const std::string& sql_query)
+			: TableTraverser(sql_query) {}
+		
+		/// Decode the current row into row.
+		inline void decode(Row & row) const {
+			RowDecoder<Row, 0, Columns...>::decode(row, m_row, m_lengths);
+		}
+		
+		/// Append the rows not traversed yet to rows, returning how many.
+		std::size_t fetchAll(std::vector<Row> & rows) {
+			std::size_t count = 0;
+			if (m_row_start != 1 || !m_row) {
+				initializeDataSource();
+				advanceDataSource();
+				if (m_result)
+					rows.reserve(rows.size() + mysql_num_rows(m_result));
+			}
+			for (; !eofDataSource(); advanceDataSource(), ++count) {
+				rows.push_back(Row());
+				decode(rows.back());
+			}
+			return count;
+		}
+		
+		/// Rows as a vector.
+		inline std::vector<Row> fetchAll() {
+			std::vector<Row> rows;
+			fetchAll(rows);
+			return rows;
+		}
+	};
+	
+}
+
+#endif
@@ -0,0 +1,216 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "StatementTraverser.h"
+#include <stdio.h>
+#include <errmsg.h>
+#include "server/Log.h"
+
+using namespace std;
+
+namespace yucode {
+
+StatementTraverser::~StatementTraverser ()
+{
+	if (!m_statement)
+		return;
+	if (m_executed)
+		mysql_stmt_free_result(m_statement->stmt);
+	PreparedStatements::singleton().release(m_statement);
+}
+
+StatementTraverser & StatementTraverser::bindInteger(long long value, bool is_unsigned)
+{
+	m_parameters.push_back(Parameter());
+	Parameter & parameter = m_parameters.back();
+	parameter.type = MYSQL_TYPE_LONGLONG;
+	parameter.is_unsigned = is_unsigned;
+	parameter.integer = value;
+	parameter.is_null = 0;
+	return *this;
+}
+
+StatementTraverser & StatementTraverser::bind(double value)
+{
+	m_parameters.push_back(Parameter());
+	Parameter & parameter = m_parameters.back();
+	parameter.type = MYSQL_TYPE_DOUBLE;
+	parameter.is_unsigned = false;
+	parameter.real = value;
+	parameter.is_null = 0;
+	return *this;
+}
+
+StatementTraverser & StatementTraverser::bind(const std::string & value)
+{
+	m_parameters.push_back(Parameter());
+	Parameter & parameter = m_parameters.back();
+	parameter.type = MYSQL_TYPE_STRING;
+	parameter.is_unsigned = false;
+	parameter.text = value;
+	parameter.length = value.size();
+	parameter.is_null = 0;
+	return *this;
+}
+
+StatementTraverser & StatementTraverser::bindNull()
+{
+	m_parameters.push_back(Parameter());
+	Parameter & parameter = m_parameters.back();
+	parameter.type = MYSQL_TYPE_NULL;
+	parameter.is_unsigned = false;
+	parameter.is_null = 1;
+	return *this;
+}
+
+unsigned long long StatementTraverser::execute()
+{
+	if (!m_executed)
+		run();
+	return m_affected_rows;
+}
+
+void StatementTraverser::run()
+{
+	PreparedStatements & statements = PreparedStatements::singleton();
+	const std::string & sql = statements.sql(m_id);
+	
+	std::vector<MYSQL_BIND> binds(m_parameters.size());
+	for (std::size_t i = 0; i < m_parameters.size(); ++i) {
+		Parameter & parameter = m_parameters[i];
+		MYSQL_BIND & bind = binds[i];
+		memset(&bind, 0, sizeof(bind));
+		bind.buffer_type = parameter.type;
+		bind.is_null = &parameter.is_null;
+		bind.is_unsigned = parameter.is_unsigned;
+		if (parameter.type == MYSQL_TYPE_LONGLONG) {
+			bind.buffer = &parameter.integer;
+		} else if (parameter.type == MYSQL_TYPE_DOUBLE) {
+			bind.buffer = &parameter.real;
+		} else if (parameter.type == MYSQL_TYPE_STRING) {
+			bind.buffer = const_cast<char *>(parameter.text.data());
+			bind.buffer_length = parameter.length;
+			bind.length = &parameter.length;
+		}
+	}
+	
+	QueryProfiler & profiler = QueryProfiler::singleton();
+	server::TraceSpan trace(server::TraceQueryBegin, server::TraceStatement(sql.c_str()));
+	uint64_t started = 0;
+	for (int attempt = 0; ; ++attempt) {
+		MYSQL * connection = DataBase::singleton().getConnection();
+		profiler.explainPending(connection);
+		started = server::Metrics::now();
+		
+		unsigned int error = 0;
+		m_statement = statements.acquire(connection, m_id, error);
+		if (m_statement) {
+			MYSQL_STMT * stmt = m_statement->stmt;
+			if ((!binds.empty() && mysql_stmt_bind_param(stmt, &binds[0]))
+				|| mysql_stmt_execute(stmt)
+				|| (!m_statement->columns.empty() && mysql_stmt_store_result(stmt))) {
+				error = mysql_stmt_errno(stmt);
+				LOG_ERROR("StatementTraverser SQL error message: " << mysql_stmt_error(stmt));
+				statements.release(m_statement);
+				m_statement = NULL;
+			}
+		}
+		if (m_statement)
+			break;
+		
+		// Recover in case of lost connection, retrying unless a transaction
+		// was open on it
+		if (!attempt && (error == CR_SERVER_GONE_ERROR || error == CR_SERVER_LOST)) {
+			DataBase::singleton().reconnect();
+			if (!TransactionOpen)
+				continue;
+		}
+		LOG_ERROR("StatementTraverser SQL error query: " << sql);
+		throw "StatementTraverser query failed";
+	}
+	m_executed = true;
+	
+	MYSQL_STMT * stmt = m_statement->stmt;
+	uint64_t elapsed = server::Metrics::now() - started;
+	unsigned long long rows;
+	if (m_statement->columns.empty()) {
+		m_affected_rows = rows = mysql_stmt_affected_rows(stmt);
+		m_insert_id = mysql_stmt_insert_id(stmt);
+	} else {
+		rows = mysql_stmt_num_rows(stmt);
+	}
+	// Parameters are not in the statement text, so it can not be explained
+	profiler.record(sql.c_str(), elapsed, rows, false);
+	if (server::RequestSample * sample = server::CurrentRequestSample) {
+		++sample->queries;
+		sample->db_nanoseconds += elapsed;
+	}
+}
+
+bool StatementTraverser::fetch()
+{
+	if (!m_statement || m_statement->columns.empty())
+		return m_row = false;
+	
+	MYSQL_STMT * stmt = m_statement->stmt;
+	std::vector<StatementColumn> & columns = m_statement->columns;
+	int status = mysql_stmt_fetch(stmt);
+	if (status == MYSQL_NO_DATA)
+		return m_row = false;
+	if (status == 1) {
+		LOG_ERROR("StatementTraverser::fetch: " << mysql_stmt_error(stmt));
+		throw "StatementTraverser::fetch() - Failed: mysql_stmt_fetch()";
+	}
+	if (status == MYSQL_DATA_TRUNCATED) {
+		// Grow the text buffers too short and fetch their columns again
+		for (std::size_t i = 0; i < columns.size(); ++i) {
+			if (columns[i].kind != StatementColumn::Text || !columns[i].error)
+				continue;
+			columns[i].text.resize(columns[i].length + 1);
+			m_statement->bindResults();
+			mysql_stmt_fetch_column(stmt, &m_statement->results[i], i, 0);
+		}
+	}
+	
+	uint64_t bytes = 0;
+	for (std::size_t i = 0; i < columns.size(); ++i) {
+		StatementColumn & column = columns[i];
+		if (column.kind == StatementColumn::Text) {
+			column.text[column.is_null? 0 : column.length] = 0;
+			bytes += column.length;
+		} else {
+			bytes += column.kind == StatementColumn::Integer? sizeof(column.integer) : sizeof(column.real);
+		}
+	}
+	DataBase::accountRow(bytes);
+	return m_row = true;
+}
+
+const char * StatementTraverser::columnAsString(int row)
+{
+	StatementColumn & column = m_statement->columns[row];
+	if (column.is_null)
+		return "";
+	if (column.kind == StatementColumn::Text)
+		return &column.text[0];
+	
+	column.text.resize(32);
+	if (column.kind == StatementColumn::Real)
+		snprintf(&column.text[0], column.text.size(), "%.17g", column.real);
+	else if (column.is_unsigned)
+		snprintf(&column.text[0], column.text.size(), "%llu", static_cast<unsigned long long>(column.integer));
+	else
+		snprintf(&column.text[0], column.text.size(), "%lld", column.integer);
+	return &column.text[0];
+}
+
+}
@@ -0,0 +1,167 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef _StatementTraverser_h_
+#define _StatementTraverser_h_
+
+#include "DataBase.h"
+#include "PreparedStatements.h"
+
+namespace yucode {
+	
+	/// TableTraverser counterpart for prepared statements: parameters are
+	/// sent and results fetched in binary form, integers never go through
+	/// text. Bind the parameters in order, then iterate the rows, or run
+	/// execute() for statements without result.
+	///
+	///	static const StatementId selectGame = PreparedStatements::singleton().declare(
+	///		"SELECT width,height FROM game WHERE id=?");
+	///	StatementTraverser gameTraverser(selectGame);
+	///	gameTraverser.bind(gameId);
+	///	for (StatementTraverser::iterator it = gameTraverser.begin(); it != gameTraverser.end(); ++it)
+	///		width = it.rowAsUnsignedInt(0);
+	class StatementTraverser {
+	public:
+		explicit StatementTraverser (StatementId id)
+			: m_id(id), m_statement(0), m_executed(false), m_row(false),
+			  m_affected_rows(0), m_insert_id(0) {}
+		
+		virtual ~StatementTraverser ();
+		
+		inline StatementTraverser & bind(int value) { return bindInteger(value, false); }
+		inline StatementTraverser & bind(unsigned int value) { return bindInteger(value, true); }
+		inline StatementTraverser & bind(long value) { return bindInteger(value, false); }
+		inline StatementTraverser & bind(unsigned long value) { return bindInteger(value, true); }
+		inline StatementTraverser & bind(long long value) { return bindInteger(value, false); }
+		inline StatementTraverser & bind(unsigned long long value) { return bindInteger(value, true); }
+		StatementTraverser & bind(double value);
+		StatementTraverser & bind(const std::string & value);
+		StatementTraverser & bindNull();
+		
+		/// Run the statement, returning the rows it affected.
+		unsigned long long execute();
+		
+		inline unsigned long long getAffectedRows() const { return m_affected_rows; }
+		inline unsigned long long getLastInsertedId() const { return m_insert_id; }
+		
+		// STL-iterator class, single instance allowed
+		class iterator : public std::iterator<std::input_iterator_tag, const std::string> {
+		public:
+			iterator (StatementTraverser & container, bool end = false)
+				: m_container(container), m_end(end) {}
+			iterator (const iterator & it) : m_container(it.m_container), m_end(it.m_end) {}
+			inline iterator & operator++ () {
+				m_end = !m_container.fetch();
+				return *this;
+			}
+			inline bool operator== (const iterator& rhs) { return rhs.m_end == m_end; }
+			inline bool operator!= (const iterator& rhs){ return rhs.m_end != m_end; }
+			
+			inline bool isNull(int row) const { return column(row).is_null; }
+			
+			inline unsigned int rowLength(int row) const
+				{ return column(row).kind == StatementColumn::Text? column(row).length : strlen(rowAsString(row)); }
+			
+			inline const char * rowAsString(int row) const
+				{ return m_container.columnAsString(row); }
+			
+			inline int rowAsInt(int row) const
+				{ return rowAs<int>(row); }
+			
+			inline unsigned int rowAsUnsignedInt(int row) const
+				{ return rowAs<unsigned int>(row); }
+			
+			inline long rowAsLong(int row) const
+				{ return rowAs<long>(row); }
+			
+			inline unsigned long rowAsUnsignedLong(int row) const
+				{ return rowAs<unsigned long>(row); }
+			
+			inline long long rowAsLongLong(int row) const
+				{ return rowAs<long long>(row); }
+			
+			inline unsigned long long rowAsUnsignedLongLong(int row) const
+				{ return rowAs<unsigned long long>(row); }
+			
+			inline double rowAsDouble(int row) const
+				{ return rowAs<double>(row); }
+			
+		private:
+			inline const StatementColumn & column(int row) const {
+				return m_container.m_statement->columns[row];
+			}
+			
+			template <typename T>
+			inline T rowAs(int row) const {
+				const StatementColumn & value = column(row);
+				if (value.is_null)
+					return T(0);
+				switch (value.kind) {
+				case StatementColumn::Integer:
+					return value.is_unsigned? T(static_cast<unsigned long long>(value.integer)) : T(value.integer);
+				case StatementColumn::Real:
+					return T(value.real);
+				default:
+					return DataBase::rowToScalar<T>(&value.text[0], value.length);
+				}
+			}
+			
+			StatementTraverser & m_container;
+			bool m_end;
+		};
+		
+		/// Statement is run the first time, and the first row fetched.
+		inline iterator begin () {
+			if (!m_executed) {
+				run();
+				m_row = fetch();
+			}
+			return iterator(*this, !m_row);
+		}
+		
+		inline iterator end () {
+			return iterator(*this, true);
+		}
+		
+	private:
+		struct Parameter {
+			enum_field_types type;
+			bool is_unsigned;
+			long long integer;
+			double real;
+			std::string text;
+			unsigned long length;
+			StatementFlag is_null;
+		};
+		
+		StatementTraverser & bindInteger(long long value, bool is_unsigned);
+		
+		/// Execute the statement, storing its result if any.
+		void run();
+		
+		/// Fetch the next row, false past the last one.
+		bool fetch();
+		
+		const char * columnAsString(int row);
+		
+		StatementId m_id;
+		std::vector<Parameter> m_parameters;
+		PreparedStatement * m_statement;
+		bool m_executed;
+		bool m_row;
+		unsigned long long m_affected_rows;
+		unsigned long long m_insert_id;
+	};
+	
+}
+
+#endif
@@ -24,17 +24,34 @@ namespace yucode {
 
 TableTraverser::~TableTraverser ()
 {
-	// Unfetch remaining entries, if any
-	if (m_connection && m_result)
-		while (m_row) m_row = mysql_fetch_row(m_result);
-
-	if (m_result)
-		mysql_free_result(m_result);
-
-	if (m_connection)
+	freeResult();
+	
+	if (m_connection && !m_streaming)
 		DataBase::singleton().releaseConnection (m_connection);
 }
 
+bool TableTraverser::freeResult ()
+{
+	if (!m_result)
+		return true;
+	
+	// Unfetch remaining entries, a streamed result must be read to its end
+	// before the connection runs anything else
+	while (m_row) m_row = mysql_fetch_row(m_result);
+	mysql_free_result(m_result);
+	m_result = 0;
+	if (!m_streaming)
+		return true;
+	
+	bool failed = mysql_errno(m_connection) != 0;
+	if (failed) {
+		LOG_ERROR("TableTraverser: streaming failed: " << mysql_error(m_connection));
+		DataBase::singleton().discardConnection();
+	}
+	m_connection = 0;
+	return !failed;
+}
+
 unsigned long long TableTraverser::getAvailableRows() 
 {
 	if (m_row_start != 1 || !m_row || !m_result) {
@@ -53,17 +70,37 @@ unsigned long long TableTraverser::getAvailableRows()
 // ones (MYSQL_RES) if any
 void TableTraverser::initializeDataSourceTrunk ()
 {
-	if (!m_connection)
-		m_connection = DataBase::singleton().getConnection ();
+	freeResult();
 	
-	if (m_result) {
-		while (m_row) m_row = mysql_fetch_row(m_result);
-		mysql_free_result (m_result);
-		m_result = 0;
+	if (m_streaming) {
+#ifdef _DEBUG_
+		cout << "[TableTraverser] Launch query: '" << m_sql_query << "'" << endl;
+#endif
+		// A lost connection is replaced while running the query
+		DataBase::singleton().executeQuery(m_sql_query.c_str());
+		m_connection = DataBase::singleton().getConnection();
+		m_result = mysql_use_result(m_connection);
+		if (m_result == NULL)
+		{
+			const char * msg = mysql_error(m_connection);
+			LOG_ERROR("mysql error " << (msg ? msg : "null"));
+			throw "TableTraverser::initializeDataSource() - Failed: mysql_use_result() ";
+		}
+		return;
 	}
 	
+	if (!m_connection)
+		m_connection = DataBase::singleton().getConnection ();
+	
 	stringstream ss;
-	ss << m_sql_query << " LIMIT " << m_row_start << ", " << m_chunk_size;
+	ss << m_sql_query;
+	if (m_key.empty()) {
+		ss << " LIMIT " << m_row_start << ", " << m_chunk_size;
+	} else {
+		if (m_row_start > 0)
+			ss << " AND " << m_key << ">" << m_last_key;
+		ss << " ORDER BY " << m_key << " ASC LIMIT " << m_chunk_size;
+	}
 	string query = ss.str();
 #ifdef _DEBUG_
 	cout << "[TableTraverser] Launch query: '" << query << "'" << endl;
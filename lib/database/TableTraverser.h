@@ -23,12 +23,34 @@ namespace yucode {
 			: m_sql_query(sql_query), 
 			  m_connection(0), m_result(0), 
 			  m_lengths(0), m_row(0), m_row_start(0),
-			  m_chunk_size(2000), m_limit(0), m_total_rows(0) {}
+			  m_chunk_size(2000), m_limit(0), m_total_rows(0),
+			  m_streaming(false), m_key_column(0), m_last_key(0) {}
 		
 		virtual ~TableTraverser ();
 
 		void setLimit(unsigned long long limit) { m_limit = limit; }
 		void setChunkSize(unsigned long long chunkSize) { m_chunk_size = chunkSize; }
+		
+		/// Read the rows as the server sends them, with mysql_use_result,
+		/// instead of querying chunk after chunk. The query runs once and
+		/// memory stays bounded: the server blocks while the traverser falls
+		/// behind. It runs on the connection of the calling thread, which
+		/// can not run other statements until every row is read or the
+		/// traverser is destroyed. Set before traversing.
+		void setStreaming() { m_streaming = true; }
+		
+		/// Read the rows in chunks ordered by key, each resuming after the
+		/// last key seen instead of skipping an offset. key must be an
+		/// unsigned integer unique per row, selected at column keyColumn.
+		/// The query must end with its WHERE clause, without ORDER BY nor
+		/// LIMIT. Set before traversing.
+		void setKeyset(const std::string & key, unsigned int keyColumn) {
+			m_key = key;
+			m_key_column = keyColumn;
+		}
+		
+		/// Rows of the chunk being read. Unknown while streaming: 0 until
+		/// every row is read.
 		unsigned long long getAvailableRows();
 		
 		// STL-iterator class, single instance allowed
@@ -63,11 +85,11 @@ namespace yucode {
 				{ return DataBase::rowToScalar<unsigned int>(m_container.m_row[row],
 				m_container.m_lengths[row]); }
 				
-			inline long long rowAsLong(int row) const
+			inline long rowAsLong(int row) const
 				{ return DataBase::rowToScalar<long>(m_container.m_row[row],
 				m_container.m_lengths[row]); }	
 			
-			inline long long rowAsUnsignedLong(int row) const
+			inline unsigned long rowAsUnsignedLong(int row) const
 				{ return DataBase::rowToScalar<unsigned long>(m_container.m_row[row],
 				m_container.m_lengths[row]); }	
 			
@@ -75,7 +97,7 @@ namespace yucode {
 				{ return DataBase::rowToScalar<long long>(m_container.m_row[row],
 				m_container.m_lengths[row]); }	
 			
-			inline long long rowAsUnsignedLongLong(int row) const
+			inline unsigned long long rowAsUnsignedLongLong(int row) const
 				{ return DataBase::rowToScalar<unsigned long long>(m_container.m_row[row],
 				m_container.m_lengths[row]); }	
 				
@@ -83,7 +105,7 @@ namespace yucode {
 				{ return DataBase::rowToScalar<float>(m_container.m_row[row],
 				m_container.m_lengths[row]); }
 		
-			inline float rowAsDouble(int row) const
+			inline double rowAsDouble(int row) const
 				{ return DataBase::rowToScalar<double>(m_container.m_row[row],
 				m_container.m_lengths[row]); }
 				
@@ -113,11 +135,7 @@ namespace yucode {
 	protected:
 		// Initialise data source (eg., connect DB and launch an SQL query)
 		void initializeDataSource (){
-			if (m_result) {
-				while (m_row) m_row = mysql_fetch_row(m_result);
-				mysql_free_result (m_result);
-				m_result = 0;
-			}
+			freeResult();
 			m_row = 0;
 			m_row_start = 0;
 			m_total_rows = 0;
@@ -127,13 +145,20 @@ namespace yucode {
 		// If previous register is not set, it starts by the first.
 		// Previous register, if any, must be released.
 		inline void advanceDataSource () {
-			if (m_row_start % m_chunk_size == 0)
+			if (m_streaming? m_row_start == 0 : m_row_start % m_chunk_size == 0)
 				initializeDataSourceTrunk ();
 			m_row_start++;
 			m_total_rows++;
 
 			m_row =	mysql_fetch_row(m_result);
 			m_lengths = mysql_fetch_lengths(m_result);
+			if (!m_row && m_streaming && !freeResult())
+				throw "TableTraverser::advanceDataSource() - Failed: connection lost while streaming";
+			if (m_row) {
+				DataBase::accountRow(m_result, m_lengths);
+				if (!m_key.empty())
+					m_last_key = DataBase::rowToScalar<unsigned long long>(m_row[m_key_column], m_lengths[m_key_column]);
+			}
 		}
 
 		// Returns whether the last element has been read
@@ -143,6 +168,10 @@ namespace yucode {
 		// Gets the next trunk of entries and free the previous
 		// ones (MYSQL_RES) if any
 		void initializeDataSourceTrunk();
+		
+		/// Read the rows left and free the result, if any. A streaming
+		/// connection which failed meanwhile is discarded, false returned.
+		bool freeResult();
 
 	protected:
 		std::string m_sql_query;
@@ -154,6 +183,10 @@ namespace yucode {
 		unsigned long long m_chunk_size;
 		unsigned long long m_limit;
 		unsigned long long m_total_rows;
+		bool m_streaming;
+		std::string m_key;
+		unsigned int m_key_column;
+		unsigned long long m_last_key;
 	};
 	
 }
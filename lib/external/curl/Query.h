@@ -33,19 +33,40 @@ namespace curl {
 		
 		void setUrl(const std::string & baseUrl) { baseUrl_ = baseUrl; }
 		
+		/// Base url followed by the attributes, their names and values
+		/// percent encoded.
 		std::string getUrl() const {
 			std::string url = baseUrl_;
 			std::map<std::string, std::string>::const_iterator attrIt = attributes_.begin();
 			if (attrIt != attributes_.end()) {
 				url += "?";
-				url += attrIt->first + "=" + attrIt->second;
+				url += escape(attrIt->first) + "=" + escape(attrIt->second);
 		
 				for (++attrIt; attrIt != attributes_.end(); ++attrIt)
-					url += "&" + attrIt->first + "=" + attrIt->second;
+					url += "&" + escape(attrIt->first) + "=" + escape(attrIt->second);
 			}
 			
 			return url;
 		}
+		
+		/// Percent encode every byte but the unreserved ones (RFC 3986 2.3).
+		static std::string escape(const std::string & value) {
+			static const char hex[] = "0123456789ABCDEF";
+			std::string escaped;
+			escaped.reserve(value.size());
+			for (std::string::const_iterator it = value.begin(); it != value.end(); ++it) {
+				unsigned char c = *it;
+				if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+						|| c == '-' || c == '.' || c == '_' || c == '~') {
+					escaped += c;
+				} else {
+					escaped += '%';
+					escaped += hex[c >> 4];
+					escaped += hex[c & 15];
+				}
+			}
+			return escaped;
+		}
 
 	private:
 		std::string baseUrl_;
@@ -12,10 +12,12 @@
  */
 #include "NotificationController.h"
 
+#include <algorithm>
 #include "NotificationResources.h"
 #include "external/ios/apn/apn.h"
 #include "database/TableTraverser.h"
 #include "misc/Utilities.h"
+#include "server/WebSocketHub.h"
 
 //#define NOTIFCATIONS_ENABLED
 
@@ -77,21 +79,45 @@ void NotificationController::pushUserNotification(unsigned long long userId, Not
 	
 	if (tokens.size() > 0)
 		pushIosNotification(tokens, payload);
+	
+	if (!server::WebSocketHub::singleton().empty())
+		server::WebSocketHub::singleton().publish(userId, payload.toString());
+}
+
+void NotificationController::pushWebSocketNotification(std::vector<unsigned long long> & userIds, NotificationData & payload) {
+	// Only users with a WebSocket open in this process can be reached
+	server::WebSocketHub & hub = server::WebSocketHub::singleton();
+	if (hub.empty())
+		return;
+	
+	// Users with several tokens come once per token
+	std::sort(userIds.begin(), userIds.end());
+	userIds.erase(std::unique(userIds.begin(), userIds.end()), userIds.end());
+	std::string message = payload.toString();
+	for (std::vector<unsigned long long>::const_iterator it = userIds.begin(); it != userIds.end(); ++it)
+		hub.publish(*it, message);
 }
 
 void NotificationController::pushGroupNotification(unsigned int groupTypeId, unsigned long long groupId, NotificationData & payload) {
+	// The users of the group, for their WebSockets, and their iOS tokens
+	// come in a single query
 	std::vector<std::string> tokens;
-	TableTraverser iosTokens(
-		MKSTRING("SELECT u.token FROM " << TableUserTokens << " u "
-			 "INNER JOIN " << TableGroupUsers << " g "
-				"ON u.id=g.user_id "
-			 "WHERE g.group_type_id=" << groupTypeId << " AND g.group_id=" << groupId << " "
-				"AND u.token_type=" << NotificationIosToken));
-	for (TableTraverser::iterator it = iosTokens.begin(); it != iosTokens.end(); ++it)
-		tokens.push_back(it.rowAsString(0));
+	std::vector<unsigned long long> userIds;
+	TableTraverser users(
+		MKSTRING("SELECT g.user_id,u.token FROM " << TableGroupUsers << " g "
+			 "LEFT JOIN " << TableUserTokens << " u "
+				"ON u.id=g.user_id AND u.token_type=" << NotificationIosToken << " "
+			 "WHERE g.group_type_id=" << groupTypeId << " AND g.group_id=" << groupId));
+	for (TableTraverser::iterator it = users.begin(); it != users.end(); ++it) {
+		userIds.push_back(it.rowAsUnsignedLongLong(0));
+		if (!it.isNull(1))
+			tokens.push_back(it.rowAsString(1));
+	}
 	
 	if (tokens.size() > 0)
 		pushIosNotification(tokens, payload);
+	
+	pushWebSocketNotification(userIds, payload);
 }
 
 void NotificationController::pushIosNotification(const vector<string> & tokens, NotificationData & payload) {
@@ -102,6 +102,9 @@ public:
 	
 protected:
 	void pushIosNotification(const std::vector<std::string> & tokens, NotificationData & payload);
+	/// Send payload to the WebSockets open in this process of userIds, which
+	/// get sorted and deduplicated.
+	void pushWebSocketNotification(std::vector<unsigned long long> & userIds, NotificationData & payload);
 };
 
 } // namespace notificatons
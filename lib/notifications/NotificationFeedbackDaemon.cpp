@@ -45,10 +45,16 @@ void NotificationFeedbackDaemon::purgeDeadTokens() {
 	vector<string> deadTokens = fetchIosDeadTokens();
 	if (deadTokens.size() > 0) {
 		LOG("NotificationFeedbackDaemon::purgeDeadTokens : deleting " << deadTokens.size() << " tokens");
-		DataBase::singleton().executeQuery( 
-			MKSTRING("DELETE FROM " << NotificationController::TableUserTokens << " "
-				"WHERE token_type=" << NotificationTokenType::NotificationIosToken << 
-				" AND token IN (" << misc::Utilities::implode(deadTokens, ",", "'") << ")"));
+		// Bounded statements, however long the feedback list is
+		const size_t batchSize = 500;
+		for (size_t first = 0; first < deadTokens.size(); first += batchSize) {
+			vector<string> batch(deadTokens.begin() + first,
+				deadTokens.begin() + min(first + batchSize, deadTokens.size()));
+			DataBase::singleton().executeQuery( 
+				MKSTRING("DELETE FROM " << NotificationController::TableUserTokens << " "
+					"WHERE token_type=" << NotificationTokenType::NotificationIosToken << 
+					" AND token IN (" << misc::Utilities::implode(batch, ",", "'") << ")"));
+		}
 	}
 }
 
@@ -0,0 +1,167 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "AdmissionControl.h"
+
+#include <stdlib.h>
+#include <boost/lexical_cast.hpp>
+#include "Log.h"
+
+namespace yucode {
+namespace server {
+
+AdmissionControl::AdmissionControl(std::size_t max_in_flight,
+		unsigned int default_budget_ms, unsigned int retry_after_seconds)
+	: max_in_flight_(max_in_flight),
+		default_budget_ms_(default_budget_ms),
+		retry_after_seconds_(retry_after_seconds),
+		in_flight_(0),
+		admitted_(0),
+		rejected_in_flight_(0),
+		rejected_queue_time_(0),
+		warned_queue_time_(0),
+		last_warning_second_(0)
+{
+}
+
+void AdmissionControl::setMaxInFlight(std::size_t max_in_flight)
+{
+	max_in_flight_ = max_in_flight;
+}
+
+void AdmissionControl::setRetryAfter(unsigned int retry_after_seconds)
+{
+	retry_after_seconds_ = retry_after_seconds;
+}
+
+void AdmissionControl::setQueueBudget(const std::string & method_class, unsigned int budget_ms)
+{
+	if (method_class == "default") {
+		default_budget_ms_ = budget_ms;
+		return;
+	}
+	for (std::size_t i = 0; i < budgets_.size(); ++i) {
+		if (budgets_[i].first == method_class) {
+			budgets_[i].second = budget_ms;
+			return;
+		}
+	}
+	budgets_.push_back(std::make_pair(method_class, budget_ms));
+}
+
+bool AdmissionControl::setQueueBudgets(const std::string & budgets)
+{
+	std::size_t pos = 0;
+	while (pos < budgets.size()) {
+		std::size_t comma = budgets.find(',', pos);
+		std::string budget = budgets.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+		pos = comma == std::string::npos ? budgets.size() : comma + 1;
+		if (budget.empty())
+			continue;
+
+		std::size_t equal = budget.find('=');
+		char * endptr = 0;
+		unsigned long budget_ms = equal == std::string::npos ? 0 : strtoul(budget.c_str() + equal + 1, &endptr, 10);
+		if (equal == std::string::npos || equal == 0 || endptr == budget.c_str() + equal + 1 || *endptr != '\0') {
+			LOG_ERROR("AdmissionControl::setQueueBudgets: wrong budget " << budget);
+			return false;
+		}
+		setQueueBudget(budget.substr(0, equal), budget_ms);
+	}
+	return true;
+}
+
+bool AdmissionControl::admit()
+{
+	std::size_t in_flight = ++in_flight_;
+	if (max_in_flight_ && in_flight > max_in_flight_) {
+		--in_flight_;
+		++rejected_in_flight_;
+		LOG_VERBOSE("AdmissionControl::admit: " << in_flight - 1 << " requests in flight, rejected");
+		return false;
+	}
+	++admitted_;
+	return true;
+}
+
+bool AdmissionControl::withinBudget(const Request & req, const TimeStamp & queued_at)
+{
+	unsigned int budget_ms = budgetFor(req);
+	if (!budget_ms)
+		return true;
+
+	TimeStamp current = now();
+	TimeStamp waited = TimespecDiff(queued_at, current);
+	unsigned long long waited_ms = waited.tv_sec * 1000ULL + waited.tv_nsec / 1000000;
+	if (waited_ms <= budget_ms)
+		return true;
+
+	// Overloaded, rejections come by the thousand: warn once a second at
+	// most, /metrics counts every one
+	unsigned long long rejected = ++rejected_queue_time_;
+	long last = last_warning_second_.load(boost::memory_order_relaxed);
+	if (current.tv_sec != last && last_warning_second_.compare_exchange_strong(last, current.tv_sec)) {
+		unsigned long long warned = warned_queue_time_.exchange(rejected);
+		LOG_WARN("AdmissionControl::withinBudget: queued " << waited_ms << "ms, over the "
+				<< budget_ms << "ms budget, rejected (" << rejected - warned << " since the last warning)");
+	}
+	return false;
+}
+
+void AdmissionControl::release()
+{
+	--in_flight_;
+}
+
+Reply AdmissionControl::overloaded() const
+{
+	Reply rep = Reply::stock_Reply(Reply::service_unavailable);
+	rep.headers.push_back(Header());
+	rep.headers.back().name = "Retry-After";
+	rep.headers.back().value = boost::lexical_cast<std::string>(retry_after_seconds_);
+	return rep;
+}
+
+AdmissionStats AdmissionControl::stats() const
+{
+	AdmissionStats stats;
+	stats.admitted = admitted_.load();
+	stats.rejected_in_flight = rejected_in_flight_.load();
+	stats.rejected_queue_time = rejected_queue_time_.load();
+	stats.in_flight = in_flight_.load();
+	return stats;
+}
+
+TimeStamp AdmissionControl::now()
+{
+	TimeStamp now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now;
+}
+
+unsigned int AdmissionControl::budgetFor(const Request & req) const
+{
+	if (budgets_.empty())
+		return default_budget_ms_;
+
+	boost::string_ref method_class("static");
+	boost::string_ref method;
+	if (req.loadArgumentView(method, "method"))
+		method_class = method.substr(0, method.find('.'));
+	for (std::size_t i = 0; i < budgets_.size(); ++i)
+		if (method_class == budgets_[i].first)
+			return budgets_[i].second;
+	return default_budget_ms_;
+}
+
+} // namespace server
+} // namespace yucode
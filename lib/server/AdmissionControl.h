@@ -0,0 +1,105 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef YUCODE_SERVER_ADMISSION_CONTROL_H
+#define YUCODE_SERVER_ADMISSION_CONTROL_H
+
+#include <string>
+#include <vector>
+#include <time.h>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/utility/string_ref.hpp>
+#include "Reply.h"
+#include "Request.h"
+
+namespace yucode {
+namespace server {
+
+/// Totals of the admission decisions since start up.
+struct AdmissionStats
+{
+	unsigned long long admitted;
+	unsigned long long rejected_in_flight;
+	unsigned long long rejected_queue_time;
+	unsigned long long in_flight;
+};
+
+/// Sheds load before it reaches the workers. A Request is refused when too
+/// many are already queued or running, and dropped when it waited in the
+/// queue longer than the budget of its method class. Both get a cheap 503, so
+/// the admitted Requests keep bounded latencies during an overload.
+///
+/// The method class is the part of the "method" argument before the first
+/// dot ("game" for "game.move"); Requests without method are of class
+/// "static".
+class AdmissionControl
+	: private boost::noncopyable
+{
+public:
+	/// max_in_flight 0 means unlimited, so does a budget of 0 ms.
+	explicit AdmissionControl(std::size_t max_in_flight = 0,
+			unsigned int default_budget_ms = 0, unsigned int retry_after_seconds = 1);
+
+	/// Limit of Requests queued or running. Call before serving.
+	void setMaxInFlight(std::size_t max_in_flight);
+
+	/// Seconds sent in Retry-After. Call before serving.
+	void setRetryAfter(unsigned int retry_after_seconds);
+
+	/// Set the queueing time budget of a method class. Call before serving.
+	void setQueueBudget(const std::string & method_class, unsigned int budget_ms);
+
+	/// Parse "class=ms,class=ms" budgets, "default" naming the default one.
+	bool setQueueBudgets(const std::string & budgets);
+
+	/// Take an in flight slot for a Request about to be queued. When false
+	/// the Request must be answered with overloaded() right away.
+	bool admit();
+
+	/// Whether a Request queued at queued_at may still run. Call when it
+	/// leaves the queue; when false answer it with overloaded().
+	bool withinBudget(const Request & req, const TimeStamp & queued_at);
+
+	/// Give back the slot taken by admit once the Request is handled.
+	void release();
+
+	/// 503 Reply asking the client to retry later.
+	Reply overloaded() const;
+
+	AdmissionStats stats() const;
+
+	/// Current CLOCK_MONOTONIC time, as queued_at.
+	static TimeStamp now();
+
+private:
+	unsigned int budgetFor(const Request & req) const;
+
+	std::size_t max_in_flight_;
+	unsigned int default_budget_ms_;
+	unsigned int retry_after_seconds_;
+	std::vector<std::pair<std::string, unsigned int> > budgets_;
+
+	boost::atomic<std::size_t> in_flight_;
+	boost::atomic<unsigned long long> admitted_;
+	boost::atomic<unsigned long long> rejected_in_flight_;
+	boost::atomic<unsigned long long> rejected_queue_time_;
+	/// rejected_queue_time_ when the last rejection was logged, and the
+	/// second it was.
+	boost::atomic<unsigned long long> warned_queue_time_;
+	boost::atomic<long> last_warning_second_;
+};
+
+} // namespace server
+} // namespace yucode
+
+#endif // YUCODE_SERVER_ADMISSION_CONTROL_H
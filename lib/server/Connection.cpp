@@ -12,21 +12,51 @@
  */
 #include "Connection.h"
 #include <vector>
+#include <string.h>
 #include <boost/bind.hpp>
+#include <boost/atomic.hpp>
 #include "RequestHandler.h"
+#include "WebSocketHub.h"
+#include "misc/Utilities.h"
 #include "Log.h"
 
 namespace yucode {
 namespace server {
 
 Connection::Connection(boost::asio::io_service& io_service,
-		RequestHandler& handler)
+		RequestHandler& handler, WorkerPool& worker_pool,
+		AdmissionControl& admission_control, std::size_t keep_alive_timeout)
 	: strand_(io_service),
 		socket_(io_service),
-		RequestHandler_(handler)
+		timer_(io_service),
+		keep_alive_timeout_(keep_alive_timeout),
+		RequestHandler_(handler),
+		WorkerPool_(worker_pool),
+		AdmissionControl_(admission_control),
+		write_started_(0),
+		buffer_(buffer_size),
+		buffer_begin_(0),
+		buffer_end_(0),
+		keep_alive_(false),
+		upgrading_(false),
+		websocket_(false),
+		ws_user_id_(0),
+		ws_in_message_(false),
+		ws_writing_(false),
+		ws_closing_(false),
+		ws_idle_(false),
+		started_(false)
 {
 }
 
+Connection::~Connection()
+{
+	if (started_)
+		Metrics::singleton().connectionClosed();
+	if (websocket_)
+		WebSocketHub::singleton().prune(ws_user_id_);
+}
+
 boost::asio::ip::tcp::socket& Connection::socket()
 {
 	return socket_;
@@ -34,11 +64,42 @@ boost::asio::ip::tcp::socket& Connection::socket()
 
 void Connection::start()
 {
-	static int req_sec_number = 0;
-	Request_.seq_number = ++req_sec_number;
+	started_ = true;
+	Metrics::singleton().connectionOpened();
 	Request_.remote_endpoint = socket_.remote_endpoint().address().to_string();
-	
-	socket_.async_read_some(boost::asio::buffer(buffer_),
+	reset_request();
+	start_read();
+}
+
+long long Connection::next_seq_number()
+{
+	static boost::atomic<long long> req_sec_number(0);
+	return ++req_sec_number;
+}
+
+void Connection::reset_request()
+{
+	Request_.reset();
+	Request_.seq_number = next_seq_number();
+	Reply_ = Reply();
+	RequestParser_.reset();
+	sample_.reset();
+}
+
+void Connection::arm_timer()
+{
+	timer_.expires_from_now(boost::posix_time::seconds(keep_alive_timeout_));
+	timer_.async_wait(
+			strand_.wrap(
+				boost::bind(&Connection::handle_timeout, shared_from_this(),
+					boost::asio::placeholders::error)));
+}
+
+void Connection::start_read()
+{
+	arm_timer();
+	socket_.async_read_some(boost::asio::buffer(buffer_.data() + buffer_end_,
+				buffer_.size() - buffer_end_),
 			strand_.wrap(
 				boost::bind(&Connection::handle_read, shared_from_this(),
 					boost::asio::placeholders::error,
@@ -48,60 +109,421 @@ void Connection::start()
 void Connection::handle_read(const boost::system::error_code& e,
 		std::size_t bytes_transferred)
 {
+	// Disarm the idle timer, handle_timeout ignores it from now on.
+	timer_.expires_at(boost::posix_time::pos_infin);
+
 	if (!e)
 	{
-		boost::tribool result;
-		boost::tie(result, boost::tuples::ignore) = RequestParser_.parse(
-				Request_, buffer_.data(), buffer_.data() + bytes_transferred);
+		buffer_end_ += bytes_transferred;
+		process_buffer();
+	}
 
-		if (result)
-		{
-			RequestHandler_.handleRequest(Request_, Reply_);
-			boost::asio::async_write(socket_, Reply_.to_buffers(),
-					strand_.wrap(
-						boost::bind(&Connection::handle_write, shared_from_this(),
-							boost::asio::placeholders::error)));
+	// If an error occurs then no new asynchronous operations are started. This
+	// means that all shared_ptr references to the Connection object will
+	// disappear and the object will be destroyed automatically after this
+	// handler returns. The Connection class's destructor closes the socket.
+}
+
+void Connection::process_buffer()
+{
+	boost::tribool result;
+	const char * parsed_end;
+	uint64_t parse_started = Metrics::now();
+	boost::tie(result, parsed_end) = RequestParser_.parse(
+			Request_, buffer_.data() + buffer_begin_, buffer_.data() + buffer_end_);
+	sample_.phases[PhaseParse] += Metrics::now() - parse_started;
+	sample_.bytes_in += parsed_end - (buffer_.data() + buffer_begin_);
+	buffer_begin_ = parsed_end - buffer_.data();
+
+	if (result)
+	{
+		// No read is pending while the Request is being handled, so the worker
+		// thread has exclusive access to Request_ and Reply_.
+		keep_alive_ = Request_.keep_alive;
+		if (!AdmissionControl_.admit()) {
+			// Overloaded: answer right away, without queueing
+			Reply_ = AdmissionControl_.overloaded();
+			write_reply();
+			return;
 		}
-		else if (!result)
-		{
+		queued_at_ = AdmissionControl::now();
+		WorkerPool_.post(boost::bind(&Connection::handle_request, shared_from_this()));
+	}
+	else if (!result)
+	{
+		keep_alive_ = false;
+		Reply_ = Reply::stock_Reply(RequestParser_.body_too_large()
+				? Reply::request_entity_too_large : Reply::bad_Request);
+		write_reply();
+	}
+	else
+	{
+		// The Request is incomplete. Move the pending bytes to the front and
+		// read the rest behind them, growing the buffer for a large body.
+		if (buffer_begin_ > 0) {
+			memmove(buffer_.data(), buffer_.data() + buffer_begin_, buffer_end_ - buffer_begin_);
+			buffer_end_ -= buffer_begin_;
+			buffer_begin_ = 0;
+		}
+		if (RequestParser_.expected_size() > buffer_.size())
+			buffer_.resize(RequestParser_.expected_size());
+		if (buffer_end_ == buffer_.size()) {
+			LOG_WARN("Connection::process_buffer: request head exceeds " << buffer_.size() << " bytes");
+			keep_alive_ = false;
 			Reply_ = Reply::stock_Reply(Reply::bad_Request);
-			boost::asio::async_write(socket_, Reply_.to_buffers(),
-					strand_.wrap(
-						boost::bind(&Connection::handle_write, shared_from_this(),
-							boost::asio::placeholders::error)));
+			write_reply();
+			return;
 		}
-		else
-		{
-			boost::asio::ip::tcp::socket::non_blocking_io non_blocking_io(true);
-			socket_.io_control(non_blocking_io);
-			socket_.async_read_some(boost::asio::buffer(buffer_),
+		if (RequestParser_.expects_continue()) {
+			static const char continue_line[] = "HTTP/1.1 100 Continue\r\n\r\n";
+			boost::asio::async_write(socket_, boost::asio::buffer(continue_line, sizeof(continue_line) - 1),
 					strand_.wrap(
-						boost::bind(&Connection::handle_read, shared_from_this(),
-							boost::asio::placeholders::error,
-							boost::asio::placeholders::bytes_transferred)));
+						boost::bind(&Connection::handle_continue, shared_from_this(),
+							boost::asio::placeholders::error)));
+			return;
 		}
+		start_read();
 	}
+}
 
-	// If an error occurs then no new asynchronous operations are started. This
-	// means that all shared_ptr references to the Connection object will
-	// disappear and the object will be destroyed automatically after this
-	// handler returns. The Connection class's destructor closes the socket.
+void Connection::handle_continue(const boost::system::error_code& e)
+{
+	if (!e)
+		start_read();
+}
+
+void Connection::handle_request()
+{
+	uint64_t started = Metrics::now();
+	sample_.phases[PhaseQueue] = started - Metrics::nanoseconds(queued_at_);
+	CurrentRequestSample = &sample_;
+	if (!AdmissionControl_.withinBudget(Request_, queued_at_))
+		Reply_ = AdmissionControl_.overloaded();
+	else if (websocket::is_upgrade(Request_))
+		upgrading_ = RequestHandler_.handleUpgrade(Request_, Reply_, ws_user_id_);
+	else
+		RequestHandler_.handleRequest(Request_, Reply_);
+	CurrentRequestSample = NULL;
+	sample_.phases[PhaseHandler] = Metrics::now() - started - sample_.phases[PhaseSerialize];
+	AdmissionControl_.release();
+	strand_.post(boost::bind(&Connection::write_reply, shared_from_this()));
+}
+
+void Connection::write_reply()
+{
+	Header connection;
+	connection.name = "Connection";
+	connection.value = upgrading_? "Upgrade" : keep_alive_? "keep-alive" : "close";
+	Reply_.headers.push_back(connection);
+
+	std::vector<boost::asio::const_buffer> buffers = Reply_.to_buffers();
+	sample_.status = Reply_.status;
+	sample_.bytes_out = boost::asio::buffer_size(buffers);
+	write_started_ = Metrics::now();
+	boost::asio::async_write(socket_, buffers,
+			strand_.wrap(
+				boost::bind(&Connection::handle_write, shared_from_this(),
+					boost::asio::placeholders::error)));
 }
 
 void Connection::handle_write(const boost::system::error_code& e)
 {
 	if (!e)
+		sample_.phases[PhaseWrite] = Metrics::now() - write_started_;
+	Metrics::singleton().record(sample_);
+
+	if (!e && upgrading_)
+	{
+		ws_start();
+	}
+	else if (!e && keep_alive_)
+	{
+		// Answer pipelined Requests already in buffer_ before reading again.
+		reset_request();
+		if (buffer_begin_ < buffer_end_) {
+			process_buffer();
+		} else {
+			buffer_begin_ = buffer_end_ = 0;
+			if (buffer_.size() > buffer_size)
+				std::vector<char>(buffer_size).swap(buffer_);
+			start_read();
+		}
+	}
+	else if (!e)
 	{
 		// Initiate graceful Connection closure.
 		boost::system::error_code ignored_ec;
 		socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
 	}
 
-	// No new asynchronous operations are started. This means that all shared_ptr
+	// When no new asynchronous operations are started, all shared_ptr
 	// references to the Connection object will disappear and the object will be
 	// destroyed automatically after this handler returns. The Connection class's
 	// destructor closes the socket.
 }
 
+void Connection::handle_timeout(const boost::system::error_code& e)
+{
+	// The timer may have been disarmed or re-armed after this wait was queued.
+	if (e == boost::asio::error::operation_aborted
+			|| timer_.expires_at() > boost::asio::deadline_timer::traits_type::now())
+		return;
+
+	// Idle WebSockets are pinged, and closed when the ping got no answer
+	if (websocket_ && !ws_idle_) {
+		ws_idle_ = true;
+		ws_send(websocket::ping, std::string());
+		arm_timer();
+		return;
+	}
+
+	LOG_VERBOSE("Connection::handle_timeout: closing idle connection");
+	boost::system::error_code ignored_ec;
+	socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+	socket_.close(ignored_ec);
+}
+
+void Connection::push(const std::string & text)
+{
+	strand_.post(boost::bind(&Connection::ws_send, shared_from_this(),
+				websocket::text, text));
+}
+
+void Connection::ws_start()
+{
+	upgrading_ = false;
+	websocket_ = true;
+	ws_path_.assign(Request_.uri.data(), Request_.uri.size());
+	ws_origin_ = Request_.origin;
+	WebSocketHub::singleton().add(ws_user_id_, shared_from_this());
+	reset_request();
+
+	if (buffer_begin_ < buffer_end_) {
+		ws_process_buffer();
+	} else {
+		buffer_begin_ = buffer_end_ = 0;
+		ws_read();
+	}
+}
+
+void Connection::ws_read()
+{
+	arm_timer();
+	if (buffer_end_ == 0 && buffer_.size() > buffer_size)
+		std::vector<char>(buffer_size).swap(buffer_);
+	socket_.async_read_some(boost::asio::buffer(buffer_.data() + buffer_end_,
+				buffer_.size() - buffer_end_),
+			strand_.wrap(
+				boost::bind(&Connection::ws_handle_read, shared_from_this(),
+					boost::asio::placeholders::error,
+					boost::asio::placeholders::bytes_transferred)));
+}
+
+void Connection::ws_handle_read(const boost::system::error_code& e,
+		std::size_t bytes_transferred)
+{
+	timer_.expires_at(boost::posix_time::pos_infin);
+
+	if (!e)
+	{
+		ws_idle_ = false;
+		buffer_end_ += bytes_transferred;
+		ws_process_buffer();
+	}
+}
+
+void Connection::ws_process_buffer()
+{
+	for (;;)
+	{
+		websocket::frame frame;
+		std::size_t consumed = 0;
+		boost::tribool result = websocket::decode_frame(
+				buffer_.data() + buffer_begin_, buffer_.data() + buffer_end_,
+				websocket_max_message, frame, consumed);
+
+		if (boost::logic::indeterminate(result))
+		{
+			// Wait for the rest of the frame behind the pending bytes, growing
+			// the buffer for a frame up to the largest message
+			if (buffer_begin_ > 0) {
+				memmove(buffer_.data(), buffer_.data() + buffer_begin_, buffer_end_ - buffer_begin_);
+				buffer_end_ -= buffer_begin_;
+				buffer_begin_ = 0;
+			}
+			if (buffer_end_ == buffer_.size())
+				buffer_.resize(websocket_max_message + websocket_max_frame_header);
+			ws_read();
+			return;
+		}
+		else if (!result)
+		{
+			if (frame.size > websocket_max_message) {
+				LOG_WARN("Connection::ws_process_buffer: frame too big, closing");
+				ws_close(1009);
+			} else {
+				LOG_WARN("Connection::ws_process_buffer: protocol error, closing");
+				ws_close(1002);
+			}
+			return;
+		}
+		buffer_begin_ += consumed;
+		if (buffer_begin_ == buffer_end_)
+			buffer_begin_ = buffer_end_ = 0;
+
+		switch (frame.op)
+		{
+		case websocket::text:
+		case websocket::binary:
+		case websocket::continuation:
+			// A data frame must start a message, a continuation extend one
+			if (ws_in_message_ == (frame.op != websocket::continuation)) {
+				ws_close(1002);
+				return;
+			}
+			if (ws_message_.size() + frame.size > websocket_max_message) {
+				ws_close(1009);
+				return;
+			}
+			ws_in_message_ = !frame.fin;
+			ws_message_.append(frame.payload, frame.size);
+			if (frame.fin) {
+				ws_dispatch(ws_message_);
+				ws_message_.clear();
+			}
+			break;
+		case websocket::ping:
+			ws_send(websocket::pong, std::string(frame.payload, frame.size));
+			break;
+		case websocket::pong:
+			break;
+		case websocket::close:
+			// Echo the status code and stop reading
+			ws_send(websocket::close, std::string(frame.payload, frame.size < 2 ? frame.size : 2));
+			ws_closing_ = true;
+			return;
+		default:
+			ws_close(1002);
+			return;
+		}
+	}
+}
+
+void Connection::ws_dispatch(const std::string & payload)
+{
+	boost::shared_ptr<WebSocketMessage> message(new WebSocketMessage());
+	message->payload = payload;
+
+	// Each message is a Request to the upgraded path with its own arguments
+	Request & req = message->request;
+	req.reset();
+	req.seq_number = next_seq_number();
+	req.remote_endpoint = Request_.remote_endpoint;
+	req.method = "GET";
+	req.uri = ws_path_;
+	req.origin = ws_origin_;
+	req.http_version_major = 1;
+	req.http_version_minor = 1;
+	req.socket_user_id = ws_user_id_;
+	if (!RequestParser_.parseQuery(req, message->payload)) {
+		ws_send(websocket::text, ws_failure(req, Reply::bad_Request));
+		return;
+	}
+
+	if (!AdmissionControl_.admit()) {
+		ws_send(websocket::text, ws_failure(req, Reply::service_unavailable));
+		return;
+	}
+	message->queued_at = AdmissionControl::now();
+	WorkerPool_.post(boost::bind(&Connection::ws_handle_message, shared_from_this(), message));
+}
+
+void Connection::ws_handle_message(boost::shared_ptr<WebSocketMessage> message)
+{
+	Reply & rep = message->reply;
+	RequestSample & sample = message->sample;
+	uint64_t started = Metrics::now();
+	sample.phases[PhaseQueue] = started - Metrics::nanoseconds(message->queued_at);
+	CurrentRequestSample = &sample;
+	if (!AdmissionControl_.withinBudget(message->request, message->queued_at))
+		rep = AdmissionControl_.overloaded();
+	else
+		RequestHandler_.handleRequest(message->request, rep);
+	CurrentRequestSample = NULL;
+	sample.phases[PhaseHandler] = Metrics::now() - started - sample.phases[PhaseSerialize];
+	AdmissionControl_.release();
+
+	std::string text;
+	if (rep.status != Reply::ok)
+		text = ws_failure(message->request, rep.status);
+	else if (rep.shared_content)
+		text = *rep.shared_content;
+	else
+		text.swap(rep.content);
+	sample.status = rep.status;
+	sample.bytes_in = message->payload.size();
+	sample.bytes_out = text.size();
+	Metrics::singleton().record(sample);
+	strand_.post(boost::bind(&Connection::ws_send, shared_from_this(),
+				websocket::text, text));
+}
+
+std::string Connection::ws_failure(const Request& req, int status)
+{
+	unsigned long long queryId = 0;
+	req.loadArgumentVerifyUnsignedLongLong(queryId, "query_id");
+	return MKSTRING("{\"header\":{},\"result\":{},\"query_id\":" << queryId
+			<< ",\"package_type\":\"service.fail\",\"status\":false"
+			<< ",\"messages\":[\"HTTP status " << status << "\"]}");
+}
+
+void Connection::ws_send(websocket::opcode op, const std::string & payload)
+{
+	if (ws_closing_ || !socket_.is_open())
+		return;
+	ws_outbox_.push_back(std::string());
+	websocket::encode_frame(op, payload, ws_outbox_.back());
+	if (!ws_writing_)
+		ws_write();
+}
+
+void Connection::ws_close(unsigned short status)
+{
+	std::string payload;
+	payload += static_cast<char>(status >> 8);
+	payload += static_cast<char>(status & 0xff);
+	ws_send(websocket::close, payload);
+	ws_closing_ = true;
+}
+
+void Connection::ws_write()
+{
+	ws_writing_ = true;
+	boost::asio::async_write(socket_, boost::asio::buffer(ws_outbox_.front()),
+			strand_.wrap(
+				boost::bind(&Connection::ws_handle_write, shared_from_this(),
+					boost::asio::placeholders::error)));
+}
+
+void Connection::ws_handle_write(const boost::system::error_code& e)
+{
+	ws_writing_ = false;
+	ws_outbox_.pop_front();
+	boost::system::error_code ignored_ec;
+	if (e)
+	{
+		socket_.close(ignored_ec);
+	}
+	else if (!ws_outbox_.empty())
+	{
+		ws_write();
+	}
+	else if (ws_closing_)
+	{
+		socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+		socket_.close(ignored_ec);
+	}
+}
+
 } // namespace server
 } // namespace yucode
\ No newline at end of file
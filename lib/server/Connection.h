@@ -14,15 +14,21 @@
 #ifndef YUCODE_SERVER_CONNECTION_H
 #define YUCODE_SERVER_CONNECTION_H
 
+#include <deque>
+#include <string>
+#include <vector>
 #include <boost/asio.hpp>
-#include <boost/array.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include "AdmissionControl.h"
+#include "Metrics.h"
 #include "Reply.h"
 #include "Request.h"
 #include "RequestHandler.h"
 #include "RequestParser.h"
+#include "WebSocket.h"
+#include "WorkerPool.h"
 
 namespace yucode {
 namespace server {
@@ -33,9 +39,11 @@ class Connection
 		private boost::noncopyable
 {
 public:
-	/// Construct a Connection with the given io_service.
+	/// Construct a Connection with the given io_service. Parsed Requests are
+	/// handled on worker_pool, socket operations stay on io_service.
 	explicit Connection(boost::asio::io_service& io_service,
-			RequestHandler& handler);
+			RequestHandler& handler, WorkerPool& worker_pool,
+			AdmissionControl& admission_control, std::size_t keep_alive_timeout);
 
 	/// Get the socket associated with the Connection.
 	boost::asio::ip::tcp::socket& socket();
@@ -43,7 +51,50 @@ public:
 	/// Start the first asynchronous operation for the Connection.
 	void start();
 
+	/// Send text as a message over the WebSocket. Safe from any thread.
+	void push(const std::string & text);
+
+	~Connection();
+
 private:
+	/// A WebSocket message being handled on the WorkerPool.
+	struct WebSocketMessage
+	{
+		std::string payload;
+		Request request;
+		Reply reply;
+		TimeStamp queued_at;
+		RequestSample sample;
+	};
+
+	/// Largest WebSocket frame header, for a masked 64 bits length.
+	static const std::size_t websocket_max_frame_header = 14;
+
+	/// Largest message reassembled from fragments.
+	static const std::size_t websocket_max_message = 64 * 1024;
+
+	/// Sequence number for the next Request on any Connection.
+	static long long next_seq_number();
+
+	/// Arm the idle timer.
+	void arm_timer();
+
+	/// Arm the idle timer and read more data from the socket.
+	void start_read();
+
+	/// Parse the pending bytes of buffer_, dispatching a Request when complete.
+	void process_buffer();
+
+	/// Run the RequestHandler on a worker thread, then post write_reply back
+	/// to the strand.
+	void handle_request();
+
+	/// Send Reply_ back to the client.
+	void write_reply();
+
+	/// Prepare Request_, Reply_ and the parser for the next Request.
+	void reset_request();
+
 	/// Handle completion of a read operation.
 	void handle_read(const boost::system::error_code& e,
 			std::size_t bytes_transferred);
@@ -51,17 +102,121 @@ private:
 	/// Handle completion of a write operation.
 	void handle_write(const boost::system::error_code& e);
 
+	/// Handle completion of the "100 Continue" write.
+	void handle_continue(const boost::system::error_code& e);
+
+	/// Handle expiration of the idle timer.
+	void handle_timeout(const boost::system::error_code& e);
+
+	/// Switch to WebSocket framing once the upgrade Reply is written.
+	void ws_start();
+
+	/// Arm the ping timer and read more frames.
+	void ws_read();
+
+	/// Handle completion of a WebSocket read operation.
+	void ws_handle_read(const boost::system::error_code& e,
+			std::size_t bytes_transferred);
+
+	/// Decode the pending frames of buffer_.
+	void ws_process_buffer();
+
+	/// Queue a complete message to the WorkerPool as a Request.
+	void ws_dispatch(const std::string & payload);
+
+	/// Run the RequestHandler for a message on a worker thread.
+	void ws_handle_message(boost::shared_ptr<WebSocketMessage> message);
+
+	/// Failure package answering req, for Replies that carry no package.
+	static std::string ws_failure(const Request& req, int status);
+
+	/// Queue a frame, writing it when no other write is in flight.
+	void ws_send(websocket::opcode op, const std::string & payload);
+
+	/// Send a close frame and stop reading.
+	void ws_close(unsigned short status);
+
+	/// Write the first queued frame.
+	void ws_write();
+
+	/// Handle completion of a WebSocket write operation.
+	void ws_handle_write(const boost::system::error_code& e);
+
 	/// Strand to ensure the Connection's handlers are not called concurrently.
 	boost::asio::io_service::strand strand_;
 
 	/// Socket for the Connection.
 	boost::asio::ip::tcp::socket socket_;
 
+	/// Closes the Connection when the client stays idle for too long.
+	boost::asio::deadline_timer timer_;
+
+	/// Seconds a Connection may stay idle waiting for (the rest of) a Request.
+	std::size_t keep_alive_timeout_;
+
 	/// The handler used to process the incoming Request.
 	RequestHandler& RequestHandler_;
 
-	/// Buffer for incoming data.
-	boost::array<char, 8192> buffer_;
+	/// The pool running the (blocking) RequestHandler.
+	WorkerPool& WorkerPool_;
+
+	/// Decides whether Requests are queued to WorkerPool_.
+	AdmissionControl& AdmissionControl_;
+
+	/// When the current Request was queued to WorkerPool_.
+	TimeStamp queued_at_;
+
+	/// Measures of the current Request, recorded once its Reply is written.
+	RequestSample sample_;
+
+	/// When the write of Reply_ started, CLOCK_MONOTONIC nanoseconds.
+	uint64_t write_started_;
+
+	/// Size of buffer_ between Requests. A Request head must fit in it.
+	static const std::size_t buffer_size = 8192;
+
+	/// Buffer for incoming data. Grown to hold a Request with a larger body
+	/// or a large WebSocket frame, the parsed Request keeps pointing into it
+	/// until its Reply is written.
+	std::vector<char> buffer_;
+
+	/// Range of buffer_ received but not yet consumed: an incomplete head or
+	/// pipelined Requests.
+	std::size_t buffer_begin_;
+	std::size_t buffer_end_;
+
+	/// Whether the Connection must be kept open after the current Reply.
+	bool keep_alive_;
+
+	/// Whether the current Reply accepts a WebSocket upgrade.
+	bool upgrading_;
+
+	/// Whether the Connection speaks WebSocket frames.
+	bool websocket_;
+
+	/// User authenticated by the upgrade, tagged on every message Request.
+	unsigned long long ws_user_id_;
+
+	/// Path and origin of the upgrade, reused by every message Request.
+	std::string ws_path_;
+	std::string ws_origin_;
+
+	/// Fragments of the incoming message.
+	std::string ws_message_;
+	bool ws_in_message_;
+
+	/// Encoded frames waiting to be written, the front one in flight.
+	std::deque<std::string> ws_outbox_;
+	bool ws_writing_;
+
+	/// Whether a close frame was sent or received.
+	bool ws_closing_;
+
+	/// Whether nothing arrived since the last ping.
+	bool ws_idle_;
+
+	/// Whether the Connection was accepted and counts as active.
+	bool started_;
 
 	/// The incoming Request.
 	Request Request_;
@@ -0,0 +1,196 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "ContentEncoding.h"
+
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include <boost/atomic.hpp>
+#include <boost/thread/tss.hpp>
+#include "Header.h"
+#include "Log.h"
+
+namespace yucode {
+namespace server {
+
+namespace {
+
+int level_ = Z_DEFAULT_COMPRESSION;
+std::size_t min_size_ = 1024;
+
+boost::atomic<unsigned long long> replies_(0);
+boost::atomic<unsigned long long> bytes_in_(0);
+boost::atomic<unsigned long long> bytes_out_(0);
+boost::atomic<unsigned long long> cpu_nanoseconds_(0);
+
+/// The zlib streams of a thread, initialised on first use.
+class Compressor
+{
+public:
+	Compressor() {
+		memset(&streams_, 0, sizeof(streams_));
+		initialised_[0] = initialised_[1] = false;
+	}
+
+	~Compressor() {
+		for (int i = 0; i < 2; ++i)
+			if (initialised_[i])
+				deflateEnd(&streams_[i]);
+	}
+
+	bool compress(ContentEncoding::Encoding encoding, const std::string & in, std::string & out) {
+		int i = encoding == ContentEncoding::gzip ? 0 : 1;
+		z_stream & stream = streams_[i];
+		if (!initialised_[i]) {
+			// 16 + MAX_WBITS writes a gzip wrapper, MAX_WBITS a zlib one,
+			// which is what HTTP calls deflate.
+			int window_bits = encoding == ContentEncoding::gzip ? 16 + MAX_WBITS : MAX_WBITS;
+			if (deflateInit2(&stream, level_, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+				return false;
+			initialised_[i] = true;
+		} else if (deflateReset(&stream) != Z_OK) {
+			return false;
+		}
+
+		out.resize(deflateBound(&stream, in.size()));
+		stream.next_in = (Bytef *)in.data();
+		stream.avail_in = in.size();
+		stream.next_out = (Bytef *)&out[0];
+		stream.avail_out = out.size();
+		if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+			return false;
+		out.resize(stream.total_out);
+		return true;
+	}
+
+private:
+	z_stream streams_[2];
+	bool initialised_[2];
+};
+
+boost::thread_specific_ptr<Compressor> compressor_;
+
+/// Whether an Accept-Encoding list accepts the coding named token, either by
+/// name or through "*". A q=0 parameter explicitly refuses it.
+bool accepts(boost::string_ref accept_encoding, boost::string_ref token)
+{
+	while (!accept_encoding.empty()) {
+		std::size_t comma = accept_encoding.find(',');
+		boost::string_ref coding = accept_encoding.substr(0, comma);
+		accept_encoding.remove_prefix(comma == boost::string_ref::npos ? accept_encoding.size() : comma + 1);
+
+		while (!coding.empty() && coding[0] == ' ')
+			coding.remove_prefix(1);
+		std::size_t semicolon = coding.find(';');
+		boost::string_ref name = coding.substr(0, semicolon);
+		while (!name.empty() && name[name.size() - 1] == ' ')
+			name.remove_suffix(1);
+		if (!EqualsIgnoreCase(name, token) && name != "*")
+			continue;
+
+		if (semicolon == boost::string_ref::npos)
+			return true;
+		boost::string_ref q = coding.substr(semicolon + 1);
+		while (!q.empty() && q[0] == ' ')
+			q.remove_prefix(1);
+		// q=0, q=0.0, q=0.00...
+		if (q.starts_with("q=0") && q.substr(3).find_first_not_of(".0") == boost::string_ref::npos)
+			return false;
+		return true;
+	}
+	return false;
+}
+
+unsigned long long thread_cpu_nanoseconds()
+{
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+} // namespace
+
+ContentEncoding::Encoding ContentEncoding::negotiate(boost::string_ref accept_encoding)
+{
+	if (accepts(accept_encoding, "gzip"))
+		return gzip;
+	if (accepts(accept_encoding, "deflate"))
+		return deflate;
+	return identity;
+}
+
+const char * ContentEncoding::name(Encoding encoding)
+{
+	switch (encoding)
+	{
+	case gzip:
+		return "gzip";
+	case deflate:
+		return "deflate";
+	default:
+		return "identity";
+	}
+}
+
+ContentEncoding::Encoding ContentEncoding::compress(Reply & rep, boost::string_ref accept_encoding)
+{
+	if (level_ == 0 || rep.content.size() < min_size_ || accept_encoding.empty())
+		return identity;
+	Encoding encoding = negotiate(accept_encoding);
+	if (encoding == identity)
+		return identity;
+
+	if (!compressor_.get())
+		compressor_.reset(new Compressor());
+
+	unsigned long long start = thread_cpu_nanoseconds();
+	std::string compressed;
+	if (!compressor_->compress(encoding, rep.content, compressed)) {
+		LOG_WARN("ContentEncoding::compress: " << name(encoding) << " failed, sending identity");
+		return identity;
+	}
+	unsigned long long cpu = thread_cpu_nanoseconds() - start;
+
+	replies_++;
+	bytes_in_ += rep.content.size();
+	bytes_out_ += compressed.size();
+	cpu_nanoseconds_ += cpu;
+	LOG_VERBOSE("ContentEncoding::compress: " << name(encoding) << " " << rep.content.size()
+			<< " -> " << compressed.size() << " bytes in " << cpu / 1000 << "us");
+
+	rep.content.swap(compressed);
+	return encoding;
+}
+
+void ContentEncoding::setLevel(int level)
+{
+	level_ = level;
+}
+
+void ContentEncoding::setMinSize(std::size_t min_size)
+{
+	min_size_ = min_size;
+}
+
+CompressionStats ContentEncoding::stats()
+{
+	CompressionStats stats;
+	stats.replies = replies_.load();
+	stats.bytes_in = bytes_in_.load();
+	stats.bytes_out = bytes_out_.load();
+	stats.cpu_nanoseconds = cpu_nanoseconds_.load();
+	return stats;
+}
+
+} // namespace server
+} // namespace yucode
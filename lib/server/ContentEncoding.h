@@ -0,0 +1,68 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef YUCODE_SERVER_CONTENT_ENCODING_H
+#define YUCODE_SERVER_CONTENT_ENCODING_H
+
+#include <string>
+#include <boost/utility/string_ref.hpp>
+#include "Reply.h"
+
+namespace yucode {
+namespace server {
+
+/// Totals of the compressed Replies since start up.
+struct CompressionStats
+{
+	unsigned long long replies;
+	unsigned long long bytes_in;
+	unsigned long long bytes_out;
+	unsigned long long cpu_nanoseconds;
+};
+
+/// Compression of Reply contents negotiated through Accept-Encoding. Every
+/// thread keeps its own zlib streams and resets them between Replies, so no
+/// compression context is allocated per Reply.
+class ContentEncoding
+{
+public:
+	enum Encoding
+	{
+		identity,
+		gzip,
+		deflate
+	};
+
+	/// Preferred encoding accepted by the client, gzip over deflate.
+	static Encoding negotiate(boost::string_ref accept_encoding);
+
+	/// Token of encoding as used in Content-Encoding.
+	static const char * name(Encoding encoding);
+
+	/// Compress rep.content with the encoding negotiated from accept_encoding
+	/// when it is at least the configured minimum size. Returns the encoding
+	/// applied, identity when content was left untouched.
+	static Encoding compress(Reply & rep, boost::string_ref accept_encoding);
+
+	/// Compression level, 0 disables compression. Set before serving.
+	static void setLevel(int level);
+
+	/// Contents smaller than min_size are sent uncompressed. Set before serving.
+	static void setMinSize(std::size_t min_size);
+
+	static CompressionStats stats();
+};
+
+} // namespace server
+} // namespace yucode
+
+#endif // YUCODE_SERVER_CONTENT_ENCODING_H
@@ -0,0 +1,207 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "FileCache.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/make_shared.hpp>
+#include "Log.h"
+#include "Trace.h"
+
+namespace yucode {
+namespace server {
+
+FileCache::FileCache(std::size_t max_file_size, int revalidate_seconds, std::size_t max_bytes)
+	: max_file_size_(max_file_size),
+		revalidate_seconds_(revalidate_seconds),
+		max_bytes_(max_bytes),
+		bytes_(0)
+{
+}
+
+FileCache::CachedFilePtr FileCache::get(const std::string & path)
+{
+	time_t now = time(NULL);
+	CachedFilePtr cached;
+	{
+		boost::mutex::scoped_lock lock(mutex_, boost::defer_lock);
+		TraceLock(lock, "FileCache");
+		Slots::iterator it = slots_.find(path);
+		if (it != slots_.end()) {
+			lru_.splice(lru_.begin(), lru_, it->second.used);
+			if (now - it->second.checked < revalidate_seconds_)
+				return it->second.file;
+			cached = it->second.file;
+		}
+	}
+
+	// Revalidate or load without holding the lock, other files keep being served
+	std::string file_path = path;
+	struct stat st;
+	if (!stat_file(file_path, st)) {
+		boost::mutex::scoped_lock lock(mutex_);
+		Slots::iterator it = slots_.find(path);
+		if (it != slots_.end())
+			erase(it);
+		return CachedFilePtr();
+	}
+
+	if (cached && cached->path == file_path && cached->mtime == st.st_mtime
+			&& cached->size == st.st_size) {
+		struct stat gzip_st;
+		time_t gzip_mtime = (::stat((file_path + ".gz").c_str(), &gzip_st) == 0) ? gzip_st.st_mtime : 0;
+		if (gzip_mtime == cached->gzip_mtime) {
+			// The slot may have been dropped meanwhile
+			boost::mutex::scoped_lock lock(mutex_);
+			Slots::iterator it = slots_.find(path);
+			if (it != slots_.end())
+				it->second.checked = now;
+			return cached;
+		}
+	}
+
+	CachedFilePtr file = load(file_path, st);
+	if (!file)
+		return file;
+	if ((std::size_t)st.st_size > max_file_size_) {
+		LOG_VERBOSE("FileCache::get: " << file_path << " too large to be cached");
+		return file;
+	}
+
+	LOG("FileCache::get: cached " << file_path << " (" << st.st_size << " bytes"
+			<< (file->gzip_content ? ", gzip variant" : "") << ")");
+	boost::mutex::scoped_lock lock(mutex_);
+	insert(path, file, now);
+	return file;
+}
+
+std::size_t FileCache::bytes(const CachedFile & file)
+{
+	return file.content->size() + (file.gzip_content ? file.gzip_content->size() : 0);
+}
+
+void FileCache::insert(const std::string & path, const CachedFilePtr & file, time_t now)
+{
+	Slots::iterator it = slots_.find(path);
+	if (it != slots_.end()) {
+		bytes_ -= bytes(*it->second.file);
+		lru_.splice(lru_.begin(), lru_, it->second.used);
+	} else {
+		it = slots_.insert(std::make_pair(path, Slot())).first;
+		lru_.push_front(it);
+		it->second.used = lru_.begin();
+	}
+	it->second.file = file;
+	it->second.checked = now;
+	bytes_ += bytes(*file);
+
+	// Replies keep the files they are sending, dropping only stops caching
+	while (bytes_ > max_bytes_ && lru_.size() > 1) {
+		LOG_VERBOSE("FileCache::insert: dropped " << lru_.back()->first);
+		erase(lru_.back());
+	}
+}
+
+void FileCache::erase(Slots::iterator slot)
+{
+	bytes_ -= bytes(*slot->second.file);
+	lru_.erase(slot->second.used);
+	slots_.erase(slot);
+}
+
+bool FileCache::stat_file(std::string & path, struct stat & st)
+{
+	if (::stat(path.c_str(), &st) != 0)
+		return false;
+	if (S_ISDIR(st.st_mode)) {
+		path += "/index.html";
+		if (::stat(path.c_str(), &st) != 0)
+			return false;
+	}
+	return S_ISREG(st.st_mode);
+}
+
+FileCache::CachedFilePtr FileCache::load(const std::string & path, const struct stat & st)
+{
+	boost::shared_ptr<CachedFile> file = boost::make_shared<CachedFile>();
+	file->path = path;
+	file->mtime = st.st_mtime;
+	file->size = st.st_size;
+	file->gzip_mtime = 0;
+
+	boost::shared_ptr<std::string> content = boost::make_shared<std::string>();
+	if (!read_file(path, *content))
+		return CachedFilePtr();
+	file->content = content;
+
+	// A .gz sibling older than the file is stale, ignore it
+	std::string gzip_path = path + ".gz";
+	struct stat gzip_st;
+	if (::stat(gzip_path.c_str(), &gzip_st) == 0) {
+		file->gzip_mtime = gzip_st.st_mtime;
+		boost::shared_ptr<std::string> gzip_content = boost::make_shared<std::string>();
+		if (S_ISREG(gzip_st.st_mode) && gzip_st.st_mtime >= st.st_mtime
+				&& read_file(gzip_path, *gzip_content))
+			file->gzip_content = gzip_content;
+	}
+
+	char etag[64];
+	snprintf(etag, sizeof(etag), "\"%lx-%lx\"", (unsigned long)st.st_mtime, (unsigned long)st.st_size);
+	file->etag = etag;
+	snprintf(etag, sizeof(etag), "\"%lx-%lx-gz\"", (unsigned long)st.st_mtime, (unsigned long)st.st_size);
+	file->gzip_etag = etag;
+
+	char date[64];
+	struct tm tm;
+	gmtime_r(&st.st_mtime, &tm);
+	strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	file->last_modified = date;
+
+	return file;
+}
+
+bool FileCache::read_file(const std::string & path, std::string & to)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (::fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+
+	to.resize(st.st_size);
+	std::size_t done = 0;
+	while (done < to.size()) {
+		ssize_t bytes = ::read(fd, &to[done], to.size() - done);
+		if (bytes < 0 && errno == EINTR)
+			continue;
+		if (bytes < 0) {
+			::close(fd);
+			return false;
+		}
+		if (bytes == 0)
+			break;
+		done += bytes;
+	}
+	to.resize(done);
+	::close(fd);
+	return true;
+}
+
+} // namespace server
+} // namespace yucode
@@ -0,0 +1,111 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef YUCODE_SERVER_FILE_CACHE_H
+#define YUCODE_SERVER_FILE_CACHE_H
+
+#include <string>
+#include <list>
+#include <map>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace yucode {
+namespace server {
+
+/// A file as held by the FileCache. Entries are immutable, a changed file
+/// gets a new Entry, so Replies may keep pointing at the content of an Entry
+/// while it is being written.
+struct CachedFile
+{
+	/// File actually read: path itself or its index.html for directories.
+	std::string path;
+	boost::shared_ptr<const std::string> content;
+	/// Precompressed path.gz sibling, if not older than path.
+	boost::shared_ptr<const std::string> gzip_content;
+	std::string etag;
+	std::string gzip_etag;
+	/// RFC 1123 date of mtime, as sent in Last-Modified.
+	std::string last_modified;
+	time_t mtime;
+	off_t size;
+	time_t gzip_mtime;
+};
+
+/// In memory cache of the static files served by ServiceFileDispatch. Files
+/// are read once and revalidated with a stat at most every
+/// revalidate_seconds, so edits on disk are picked up without a restart.
+/// Once the files held add up to more than max_bytes, the least recently
+/// served ones are dropped.
+class FileCache
+	: private boost::noncopyable
+{
+public:
+	typedef boost::shared_ptr<const CachedFile> CachedFilePtr;
+
+	/// Files larger than max_file_size are read for every Request instead.
+	explicit FileCache(std::size_t max_file_size = 16 * 1024 * 1024,
+			int revalidate_seconds = 1, std::size_t max_bytes = 128 * 1024 * 1024);
+
+	/// The file at path (index.html for a directory), loaded or reloaded when
+	/// it changed on disk. Null when it does not exist or can not be read.
+	CachedFilePtr get(const std::string & path);
+
+private:
+	/// Stat path, resolving directories to their index.html.
+	static bool stat_file(std::string & path, struct stat & st);
+
+	/// Read path and its .gz sibling into a new entry.
+	static CachedFilePtr load(const std::string & path, const struct stat & st);
+
+	static bool read_file(const std::string & path, std::string & to);
+
+	/// Bytes file takes, its gzip variant included.
+	static std::size_t bytes(const CachedFile & file);
+
+	struct Slot;
+	typedef std::map<std::string, Slot> Slots;
+
+	struct Slot
+	{
+		CachedFilePtr file;
+		time_t checked;
+		/// Position in lru_.
+		std::list<Slots::iterator>::iterator used;
+	};
+
+	/// Keep file for path, dropping the least recently used files over
+	/// max_bytes_. Called with mutex_ held, as erase.
+	void insert(const std::string & path, const CachedFilePtr & file, time_t now);
+
+	void erase(Slots::iterator slot);
+
+	std::size_t max_file_size_;
+	int revalidate_seconds_;
+	std::size_t max_bytes_;
+
+	boost::mutex mutex_;
+	Slots slots_;
+	/// Slots, most recently served first.
+	std::list<Slots::iterator> lru_;
+	/// Bytes of the files in slots_.
+	std::size_t bytes_;
+};
+
+} // namespace server
+} // namespace yucode
+
+#endif // YUCODE_SERVER_FILE_CACHE_H
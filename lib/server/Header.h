@@ -14,6 +14,7 @@
 #define YUCODE_SERVER_HEADER_H
 
 #include <string>
+#include <boost/utility/string_ref.hpp>
 
 namespace yucode {
 namespace server {
@@ -24,6 +25,37 @@ struct Header
 	std::string value;
 };
 
+/// A Request header as parsed, pointing into the Connection buffer.
+struct HeaderRef
+{
+	boost::string_ref name;
+	boost::string_ref value;
+};
+
+/// Whether a and b are equal ignoring ASCII case, as HTTP compares header
+/// names and tokens. boost::algorithm::iequals goes through a std::locale
+/// for every character, which costs more than splitting the whole head.
+inline bool EqualsIgnoreCase(boost::string_ref a, boost::string_ref b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (std::size_t i = 0; i < a.size(); ++i) {
+		unsigned char x = a[i], y = b[i];
+		if (x != y && ((x | 0x20) != (y | 0x20) || (x | 0x20) < 'a' || (x | 0x20) > 'z'))
+			return false;
+	}
+	return true;
+}
+
+/// Whether text contains token, ignoring ASCII case.
+inline bool ContainsIgnoreCase(boost::string_ref text, boost::string_ref token)
+{
+	for (std::size_t i = 0; i + token.size() <= text.size(); ++i)
+		if (EqualsIgnoreCase(text.substr(i, token.size()), token))
+			return true;
+	return false;
+}
+
 } // namespace server
 } // namespace yucode
 
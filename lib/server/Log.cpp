@@ -11,7 +11,15 @@
  *  modified is included with the above copyright notice.
  */
 #include "Log.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <vector>
+#include <algorithm>
+#include <streambuf>
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 
 namespace yucode {
@@ -19,8 +27,256 @@ namespace server {
 	
 __thread long long LogSeqNumber = 0;
 __thread unsigned long ThreadId = 0;
-const char * LogFile = NULL;
-boost::mutex global_stream_lock;
+boost::atomic<int> LogThreshold(LogTiming);
+
+namespace {
+
+/// Bytes of lines a thread may have queued before dropping more.
+const std::size_t ring_size = 128 * 1024;
+
+/// Longest line kept, longer ones are truncated.
+const std::size_t max_line = 8 * 1024;
+
+/// Lines queued by one thread, drained by the flusher. Single producer,
+/// single consumer: head and tail only ever grow, each is written by one
+/// side alone.
+struct LogRing
+{
+	LogRing() : head(0), tail(0), dropped(0), closed(false) {}
+	
+	/// Queue line, returns the bytes queued afterwards.
+	std::size_t push(const std::string & line) {
+		std::size_t size = line.size() < max_line ? line.size() : max_line;
+		std::size_t at = head.load(boost::memory_order_relaxed);
+		std::size_t used = at - tail.load(boost::memory_order_acquire);
+		if (size > ring_size - used) {
+			dropped.fetch_add(1, boost::memory_order_relaxed);
+			return used;
+		}
+		std::size_t offset = at % ring_size;
+		std::size_t first = std::min(size, ring_size - offset);
+		memcpy(data + offset, line.data(), first);
+		memcpy(data, line.data() + first, size - first);
+		if (size < line.size())
+			data[(at + size - 1) % ring_size] = '\n';
+		head.store(at + size, boost::memory_order_release);
+		return used + size;
+	}
+	
+	bool drain(FILE * out) {
+		std::size_t from = tail.load(boost::memory_order_relaxed);
+		std::size_t to = head.load(boost::memory_order_acquire);
+		if (from == to)
+			return false;
+		std::size_t offset = from % ring_size;
+		std::size_t first = std::min(to - from, ring_size - offset);
+		fwrite(data + offset, 1, first, out);
+		fwrite(data, 1, to - from - first, out);
+		tail.store(to, boost::memory_order_release);
+		return true;
+	}
+	
+	char data[ring_size];
+	boost::atomic<std::size_t> head;
+	boost::atomic<std::size_t> tail;
+	boost::atomic<unsigned long> dropped;
+	/// Set when the thread exits, the ring is released once drained.
+	boost::atomic<bool> closed;
+};
+
+/// Background thread writing the rings out to the log file.
+class LogFlusher
+{
+public:
+	static LogFlusher & singleton() {
+		// Never destroyed, threads may log while the process exits
+		static LogFlusher * instance = new LogFlusher();
+		return *instance;
+	}
+	
+	void add(const boost::shared_ptr<LogRing> & ring) {
+		boost::mutex::scoped_lock lock(mutex_);
+		rings_.push_back(ring);
+	}
+	
+	void setFile(const std::string & path) {
+		boost::mutex::scoped_lock lock(mutex_);
+		path_ = path;
+		reopen_ = true;
+	}
+	
+	/// Drain before the next period, signalling once per drain.
+	void wake() {
+		if (!woken_.exchange(true, boost::memory_order_relaxed))
+			wake_.notify_one();
+	}
+	
+	void flush() {
+		boost::mutex::scoped_lock lock(mutex_);
+		drain();
+	}
+	
+	void stop() {
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			stopping_ = true;
+		}
+		wake_.notify_one();
+		thread_.join();
+		flush();
+	}
+	
+private:
+	LogFlusher() : woken_(false), out_(stdout), inode_(0), checked_(0), reopen_(false), stopping_(false) {
+		thread_ = boost::thread(boost::bind(&LogFlusher::run, this));
+		atexit(&LogFlusher::stopAtExit);
+	}
+	
+	static void stopAtExit() {
+		singleton().stop();
+	}
+	
+	void run() {
+		boost::mutex::scoped_lock lock(mutex_);
+		while (!stopping_) {
+			wake_.timed_wait(lock, boost::posix_time::milliseconds(100));
+			drain();
+		}
+	}
+	
+	/// Write every ring out, with mutex_ held.
+	void drain() {
+		woken_.store(false, boost::memory_order_relaxed);
+		reopen();
+		bool written = false;
+		for (std::size_t i = 0; i < rings_.size(); ) {
+			LogRing & ring = *rings_[i];
+			bool closed = ring.closed.load(boost::memory_order_acquire);
+			written |= ring.drain(out_);
+			unsigned long dropped = ring.dropped.exchange(0, boost::memory_order_relaxed);
+			if (dropped) {
+				fprintf(out_, "%s WARN: %lu log lines dropped\n", currentDateTime().c_str(), dropped);
+				written = true;
+			}
+			if (closed) {
+				rings_[i] = rings_.back();
+				rings_.pop_back();
+			} else {
+				++i;
+			}
+		}
+		if (written)
+			fflush(out_);
+	}
+	
+	/// Open the log file when set, and again when rotated away, checked once
+	/// per second.
+	void reopen() {
+		time_t now = time(0);
+		if (!reopen_ && (path_.empty() || now == checked_))
+			return;
+		checked_ = now;
+		struct stat st;
+		if (!reopen_ && stat(path_.c_str(), &st) == 0 && st.st_ino == inode_)
+			return;
+		reopen_ = false;
+		
+		if (out_ != stdout)
+			fclose(out_);
+		out_ = stdout;
+		inode_ = 0;
+		if (path_.empty())
+			return;
+		FILE * file = fopen(path_.c_str(), "a");
+		if (!file) {
+			fprintf(stderr, "Log: can not open %s\n", path_.c_str());
+			return;
+		}
+		out_ = file;
+		if (fstat(fileno(file), &st) == 0)
+			inode_ = st.st_ino;
+	}
+	
+	boost::mutex mutex_;
+	boost::condition_variable wake_;
+	boost::atomic<bool> woken_;
+	std::vector<boost::shared_ptr<LogRing> > rings_;
+	FILE * out_;
+	std::string path_;
+	ino_t inode_;
+	time_t checked_;
+	bool reopen_;
+	bool stopping_;
+	boost::thread thread_;
+};
+
+/// Stream buffer appending to a string kept for the next line.
+class LineBuffer : public std::streambuf
+{
+public:
+	std::string line;
+	
+protected:
+	int_type overflow(int_type c) {
+		if (c != traits_type::eof())
+			line.push_back(traits_type::to_char_type(c));
+		return c;
+	}
+	std::streamsize xsputn(const char * s, std::streamsize n) {
+		line.append(s, n);
+		return n;
+	}
+};
+
+/// Logging state of a thread: its ring, its line buffer and the date of the
+/// current second, formatted once.
+struct LogThread
+{
+	LogThread() : ring(new LogRing()), stream(&buffer), second(-1), busy(false) {
+		date[0] = '\0';
+		buffer.line.reserve(256);
+		SetSelfThreadId();
+		LogFlusher::singleton().add(ring);
+	}
+	
+	~LogThread() {
+		ring->closed.store(true, boost::memory_order_release);
+	}
+	
+	const char * currentDate() {
+		timespec now;
+		clock_gettime(CLOCK_REALTIME_COARSE, &now);
+		if (now.tv_sec != second) {
+			second = now.tv_sec;
+			struct tm tstruct;
+			localtime_r(&second, &tstruct);
+			strftime(date, sizeof(date), "%Y-%m-%d.%X", &tstruct);
+		}
+		return date;
+	}
+	
+	boost::shared_ptr<LogRing> ring;
+	LineBuffer buffer;
+	std::ostream stream;
+	time_t second;
+	char date[32];
+	/// Whether a line is being formatted into buffer.
+	bool busy;
+};
+
+__thread LogThread * CurrentLogThread = NULL;
+
+LogThread & currentLogThread() {
+	if (!CurrentLogThread) {
+		// Deletes the state of each thread when it exits
+		static boost::thread_specific_ptr<LogThread> * threads = new boost::thread_specific_ptr<LogThread>();
+		threads->reset(new LogThread());
+		CurrentLogThread = threads->get();
+	}
+	return *CurrentLogThread;
+}
+
+} // namespace
 
 void SetRequestSeqNumber(long long seqNumber) { LogSeqNumber = seqNumber; }
 
@@ -33,7 +289,63 @@ void SetSelfThreadId() {
 	SetThreadId(threadNumber);
 }
 
-void SetLogFile(const char * logFile) { if (!logFile || strlen(logFile) == 0) LogFile = NULL; else LogFile = logFile; }
+void SetLogFile(const char * logFile) {
+	LogFlusher::singleton().setFile(logFile ? logFile : "");
+}
+
+void SetLogLevel(LogLevel level) {
+	LogThreshold.store(level, boost::memory_order_relaxed);
+}
+
+bool SetLogLevel(const std::string & level) {
+	static const char * names[] = { "verbose", "timing", "info", "warn", "error" };
+	for (int i = LogVerbose; i <= LogError; ++i) {
+		if (level == names[i]) {
+			SetLogLevel(static_cast<LogLevel>(i));
+			return true;
+		}
+	}
+	return false;
+}
+
+void FlushLog() {
+	LogFlusher::singleton().flush();
+}
+
+LogLine::LogLine(LogLevel level, const char * tag)
+	: level_(level), stream_(NULL), nested_(NULL)
+{
+	LogThread & thread = currentLogThread();
+	if (thread.busy) {
+		nested_ = new std::ostringstream();
+		stream_ = nested_;
+	} else {
+		thread.busy = true;
+		thread.buffer.line.clear();
+		thread.stream.flags(std::ios_base::dec | std::ios_base::skipws);
+		thread.stream.fill(' ');
+		thread.stream.precision(6);
+		stream_ = &thread.stream;
+	}
+	*stream_ << thread.currentDate() << ' ' << tag << " RQ" << LogSeqNumber << " at TH" << ThreadId << ": ";
+}
+
+LogLine::~LogLine()
+{
+	LogThread & thread = currentLogThread();
+	std::size_t queued;
+	if (nested_) {
+		queued = thread.ring->push(nested_->str() + '\n');
+		delete nested_;
+	} else {
+		thread.buffer.line += '\n';
+		queued = thread.ring->push(thread.buffer.line);
+		thread.busy = false;
+	}
+	// Errors are written right away, bursts before the ring fills up
+	if (level_ >= LogError || queued > ring_size / 2)
+		LogFlusher::singleton().wake();
+}
 
 TimeStamp TimespecDiff(TimeStamp start, TimeStamp end)
 {
@@ -65,7 +377,7 @@ const std::string currentDateTime() {
     time_t     now = time(0);
     struct tm  tstruct;
     char       buf[80];
-    tstruct = *localtime(&now);
+    localtime_r(&now, &tstruct);
     strftime(buf, sizeof(buf), "%Y-%m-%d.%X", &tstruct);
     return buf;
 }
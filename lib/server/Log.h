@@ -15,8 +15,11 @@
 
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <fstream>
+#include <string>
 #include <time.h>
+#include <boost/atomic.hpp>
 #include <boost/thread/mutex.hpp>
 
 
@@ -26,14 +29,60 @@ namespace server {
 // Private thread request identifier	
 extern __thread long long LogSeqNumber;
 extern __thread unsigned long ThreadId;
-extern const char * LogFile;
-extern boost::mutex global_stream_lock;
 
+/// Set the file lines are appended to, stdout when empty. The file is kept
+/// open, and reopened when it is rotated away.
 void SetLogFile(const char * logFile);
 void SetRequestSeqNumber(long long seqNumber);
 void SetThreadId(long long threadId);
 void SetSelfThreadId();
 
+// Levels, lines below the current one are skipped before being formatted
+enum LogLevel {
+	LogVerbose,
+	/// LOG_ELLAPSED lines, one or more per Request. Logged by default, a
+	/// threshold of info drops them.
+	LogTiming,
+	LogInfo,
+	LogWarn,
+	LogError
+};
+
+extern boost::atomic<int> LogThreshold;
+
+inline bool LogEnabled(LogLevel level) {
+	return level >= LogThreshold.load(boost::memory_order_relaxed);
+}
+
+void SetLogLevel(LogLevel level);
+
+/// Set the level by name: verbose, timing, info, warn or error.
+bool SetLogLevel(const std::string & level);
+
+/// Write out every line logged so far.
+void FlushLog();
+
+/// A line being logged. It is formatted into a buffer of the calling thread
+/// and queued on destruction to a ring of that thread, which a background
+/// thread drains into the log. The calling thread never waits for the
+/// file or for other threads, lines are dropped when its ring is full.
+class LogLine {
+public:
+	LogLine(LogLevel level, const char * tag);
+	~LogLine();
+	
+	inline std::ostream & stream() { return *stream_; }
+	
+private:
+	LogLine(const LogLine &);
+	LogLine & operator=(const LogLine &);
+	
+	LogLevel level_;
+	std::ostream * stream_;
+	/// Used by lines logged while formatting another one.
+	std::ostringstream * nested_;
+};
+
 // Timing
 typedef timespec TimeStamp;
 typedef struct {
@@ -63,83 +112,39 @@ TimeStamp TimespecAdd(TimeStamp oldTime, TimeStamp time);
 const std::string currentDateTime();
 
 // Logging
-#define LOG(...) \
-	{yucode::server::global_stream_lock.lock();\
-	yucode::server::SetSelfThreadId();\
-	std::ofstream outfile;\
-	if (yucode::server::LogFile)\
-		outfile.open(yucode::server::LogFile, std::fstream::app);\
-	std::ostream & out = yucode::server::LogFile? outfile : std::cout;\
-	out << yucode::server::currentDateTime() << " LOG RQ" << yucode::server::LogSeqNumber << " at TH" << yucode::server::ThreadId << ": " << __VA_ARGS__ << " [at " << __FILE__ << ":" << __LINE__ << "]" << std::endl;\
-	if (yucode::server::LogFile) outfile.close();\
-	yucode::server::global_stream_lock.unlock();}
+#define LOG_LINE(LEVEL, TAG, ...) \
+	{if (yucode::server::LogEnabled(LEVEL)) {\
+		yucode::server::LogLine __LOG_LINE(LEVEL, TAG);\
+		__LOG_LINE.stream() << __VA_ARGS__ << " [at " << __FILE__ << ":" << __LINE__ << "]";\
+	}}
+
+#define LOG(...) LOG_LINE(yucode::server::LogInfo, "LOG", __VA_ARGS__)
 
 #ifdef LOG_VERBOSE_ENABLED
-#define LOG_VERBOSE(...) LOG(__VA_ARGS__)
+#define LOG_VERBOSE(...) LOG_LINE(yucode::server::LogVerbose, "LOG", __VA_ARGS__)
 #else
 #define LOG_VERBOSE(...) {}
 #endif
 
-#define LOG_WARN(...) \
-	{yucode::server::global_stream_lock.lock();\
-	yucode::server::SetSelfThreadId();\
-	std::ofstream outfile;\
-	if (yucode::server::LogFile)\
-		outfile.open(yucode::server::LogFile, std::fstream::app);\
-	std::ostream & out = yucode::server::LogFile? outfile : std::cout;\
-	out << yucode::server::currentDateTime() << " WARN RQ" << yucode::server::LogSeqNumber << " at TH" << yucode::server::ThreadId << ": " << __VA_ARGS__ << " [at " << __FILE__ << ":" << __LINE__ << "]" << std::endl;\
-	if (yucode::server::LogFile) outfile.close();\
-	yucode::server::global_stream_lock.unlock();}
+#define LOG_WARN(...) LOG_LINE(yucode::server::LogWarn, "WARN", __VA_ARGS__)
 	
-#define LOG_ERROR(...) \
-	{yucode::server::global_stream_lock.lock();\
-	yucode::server::SetSelfThreadId();\
-	std::ofstream outfile;\
-	if (yucode::server::LogFile)\
-		outfile.open(yucode::server::LogFile, std::fstream::app);\
-	std::ostream & out = yucode::server::LogFile? outfile : std::cout;\
-	out << yucode::server::currentDateTime() << " ERROR RQ" << yucode::server::LogSeqNumber << " at TH" << yucode::server::ThreadId << ": " << __VA_ARGS__ << " [at " << __FILE__ << ":" << __LINE__ << "]" << std::endl;\
-	if (yucode::server::LogFile) outfile.close();\
-	yucode::server::global_stream_lock.unlock();}
-
-#define LOG_ERROR_SECURITY(...) \
-	{yucode::server::global_stream_lock.lock();\
-	yucode::server::SetSelfThreadId();\
-	std::ofstream outfile;\
-	if (yucode::server::LogFile)\
-		outfile.open(yucode::server::LogFile, std::fstream::app);\
-	std::ostream & out = yucode::server::LogFile? outfile : std::cout;\
-	out << yucode::server::currentDateTime() <<  " ERRORSEC RQ" << yucode::server::LogSeqNumber << " at TH" << yucode::server::ThreadId << ": " << __VA_ARGS__ << " [at " << __FILE__ << ":" << __LINE__ << "]" << std::endl;\
-	if (yucode::server::LogFile) outfile.close();\
-	yucode::server::global_stream_lock.unlock();}
+#define LOG_ERROR(...) LOG_LINE(yucode::server::LogError, "ERROR", __VA_ARGS__)
+
+#define LOG_ERROR_SECURITY(...) LOG_LINE(yucode::server::LogError, "ERRORSEC", __VA_ARGS__)
 	
-#define LOG_ERROR_CRITICAL(...) \
-	{yucode::server::global_stream_lock.lock();\
-	yucode::server::SetSelfThreadId();\
-	std::ofstream outfile;\
-	if (yucode::server::LogFile)\
-		outfile.open(yucode::server::LogFile, std::fstream::app);\
-	std::ostream & out = yucode::server::LogFile? outfile : std::cout;\
-	out << yucode::server::currentDateTime() <<  " ERRORCRT RQ" << yucode::server::LogSeqNumber << " at TH" << yucode::server::ThreadId << ": " << __VA_ARGS__ << " [at " << __FILE__ << ":" << __LINE__ << "]" << std::endl;\
-	if (yucode::server::LogFile) outfile.close();\
-	yucode::server::global_stream_lock.unlock();}
+#define LOG_ERROR_CRITICAL(...) LOG_LINE(yucode::server::LogError, "ERRORCRT", __VA_ARGS__)
 	
-#define LOG_ELLAPSED(T1, T2, ...) \
+#define LOG_ELLAPSED_LINE(LEVEL, TAG, T1, T2, ...) \
 	{\
 		yucode::server::TimeStamp diff = yucode::server::TimespecDiff(T1, T2);\
-		yucode::server::global_stream_lock.lock();\
-		yucode::server::SetSelfThreadId();\
-		std::ofstream outfile;\
-		if (yucode::server::LogFile)\
-			outfile.open(yucode::server::LogFile, std::fstream::app);\
-		std::ostream & out = yucode::server::LogFile? outfile : std::cout;\
-		out << yucode::server::currentDateTime() << " TIMESTAMP RQ" << yucode::server::LogSeqNumber << " at TH" << yucode::server::ThreadId << ": " << __VA_ARGS__ \
+		LOG_LINE(LEVEL, TAG, __VA_ARGS__ \
 			<< " (ellapsed " << diff.tv_sec << "." << std::setw(6) << std::setfill('0') \
-			<< diff.tv_nsec/1000 << ") [at " << __FILE__ << ":" << __LINE__ << "]" << std::endl;\
-		if (yucode::server::LogFile) outfile.close();\
-		yucode::server::global_stream_lock.unlock();\
+			<< diff.tv_nsec/1000 << ")")\
 	}
 
+#define LOG_ELLAPSED(T1, T2, ...) \
+	LOG_ELLAPSED_LINE(yucode::server::LogTiming, "TIMESTAMP", T1, T2, __VA_ARGS__)
+
 #define LOG_ELLAPSED_SINCE(T1, ...) \
 	{\
 		yucode::server::TimeStamp __TIMESTAMP;\
@@ -147,21 +152,19 @@ const std::string currentDateTime();
 		LOG_ELLAPSED(T1, __TIMESTAMP, __VA_ARGS__)\
 	}
 
-#define LOG_ELLAPSED_ACCUM(T1, ...) \
+/// Access log line of a Request, at info whatever the timing lines do.
+#define LOG_ACCESS_SINCE(T1, ...) \
 	{\
-		yucode::server::global_stream_lock.lock();\
-		yucode::server::SetSelfThreadId();\
-		std::ofstream outfile;\
-		if (yucode::server::LogFile)\
-			outfile.open(yucode::server::LogFile, std::fstream::app);\
-		std::ostream & out = yucode::server::LogFile? outfile : std::cout;\
-		out << yucode::server::currentDateTime() << " TIMESTAMP RQ" << yucode::server::LogSeqNumber << " at TH" << yucode::server::ThreadId << ": " << __VA_ARGS__ \
-			<< " (ellapsed " << T1.accum.tv_sec << "." << std::setw(6) << std::setfill('0') \
-			<< T1.accum.tv_nsec/1000 << ") [at " << __FILE__ << ":" << __LINE__ << "]" << std::endl;\
-		if (yucode::server::LogFile) outfile.close();\
-		yucode::server::global_stream_lock.unlock();\
+		yucode::server::TimeStamp __TIMESTAMP;\
+		SetTimeStamp(__TIMESTAMP);\
+		LOG_ELLAPSED_LINE(yucode::server::LogInfo, "ACCESS", T1, __TIMESTAMP, __VA_ARGS__)\
 	}
 
+#define LOG_ELLAPSED_ACCUM(T1, ...) \
+	LOG_LINE(yucode::server::LogTiming, "TIMESTAMP", __VA_ARGS__ \
+		<< " (ellapsed " << T1.accum.tv_sec << "." << std::setw(6) << std::setfill('0') \
+		<< T1.accum.tv_nsec/1000 << ")")
+
 }
 }
 
@@ -0,0 +1,267 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "Metrics.h"
+#include <stdlib.h>
+#include <vector>
+#include "Log.h"
+
+namespace yucode {
+namespace server {
+
+__thread RequestSample * CurrentRequestSample = NULL;
+
+namespace {
+
+/// Bucket bounds exported, in seconds. Each fine bucket is counted in the
+/// first bound not below its largest value, overstating by 25% at most.
+const double exported_bounds[] = {
+	0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+const std::size_t exported_buckets = sizeof(exported_bounds) / sizeof(exported_bounds[0]);
+
+const char * phase_names[RequestPhases] = {
+	"parse", "queue", "handler", "serialize", "write"
+};
+
+/// Label value with \, " and newlines escaped.
+std::string labelValue(const std::string & value) {
+	std::string escaped;
+	escaped.reserve(value.size());
+	for (std::size_t i = 0; i < value.size(); ++i) {
+		if (value[i] == '\\' || value[i] == '"')
+			escaped.push_back('\\');
+		if (value[i] == '\n')
+			escaped += "\\n";
+		else
+			escaped.push_back(value[i]);
+	}
+	return escaped;
+}
+
+} // namespace
+
+void Metrics::writeHistogram(std::ostream & os, const char * name, const std::string & labels, const LatencyHistogram & histogram)
+{
+	uint64_t exported[exported_buckets] = { 0 };
+	for (unsigned int i = 0; i < LatencyHistogram::buckets; ++i) {
+		uint64_t count = histogram.count(i);
+		if (!count)
+			continue;
+		double seconds = LatencyHistogram::bucketMax(i) / 1e6;
+		for (std::size_t b = 0; b < exported_buckets; ++b) {
+			if (seconds <= exported_bounds[b]) {
+				exported[b] += count;
+				break;
+			}
+		}
+	}
+	std::string separator = labels.empty()? "" : ",";
+	uint64_t cumulative = 0;
+	for (std::size_t b = 0; b < exported_buckets; ++b) {
+		cumulative += exported[b];
+		os << name << "_bucket{" << labels << separator << "le=\"" << exported_bounds[b] << "\"} " << cumulative << "\n";
+	}
+	os << name << "_bucket{" << labels << separator << "le=\"+Inf\"} " << histogram.total() << "\n";
+	std::string braced = labels.empty()? "" : "{" + labels + "}";
+	os << name << "_sum" << braced << " " << histogram.sumNanoseconds() / 1e9 << "\n";
+	os << name << "_count" << braced << " " << histogram.total() << "\n";
+}
+
+namespace {
+
+/// Counter of every method having served Requests, scaled by scale.
+void writeMethodCounter(std::ostream & os, const std::vector<MethodMetrics *> & methods, const char * name,
+		const char * help, boost::atomic<uint64_t> MethodMetrics::* counter, double scale = 1) {
+	os << "# HELP " << name << " " << help << "\n";
+	os << "# TYPE " << name << " counter\n";
+	for (std::size_t m = 0; m < methods.size(); ++m) {
+		if (!methods[m]->phases[PhaseHandler].total())
+			continue;
+		uint64_t value = (methods[m]->*counter).load(boost::memory_order_relaxed);
+		os << name << "{method=\"" << labelValue(methods[m]->name) << "\"} ";
+		if (scale == 1)
+			os << value << "\n";
+		else
+			os << value * scale << "\n";
+	}
+}
+
+} // namespace
+
+LatencyHistogram::LatencyHistogram()
+	: total_(0), sum_(0)
+{
+	for (unsigned int i = 0; i < buckets; ++i)
+		counts_[i].store(0, boost::memory_order_relaxed);
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds)
+{
+	counts_[bucket(nanoseconds / 1000)].fetch_add(1, boost::memory_order_relaxed);
+	total_.fetch_add(1, boost::memory_order_relaxed);
+	sum_.fetch_add(nanoseconds, boost::memory_order_relaxed);
+}
+
+unsigned int LatencyHistogram::bucket(uint64_t microseconds)
+{
+	if (microseconds < sub_buckets)
+		return microseconds;
+	// Power of two, then the 2 bits below the leading one
+	unsigned int exponent = 63 - __builtin_clzll(microseconds);
+	unsigned int index = sub_buckets * (exponent - 1) + ((microseconds >> (exponent - 2)) & (sub_buckets - 1));
+	return index < buckets ? index : buckets - 1;
+}
+
+uint64_t LatencyHistogram::bucketMax(unsigned int bucket)
+{
+	if (bucket < sub_buckets)
+		return bucket;
+	unsigned int exponent = bucket / sub_buckets + 1;
+	uint64_t mantissa = sub_buckets + bucket % sub_buckets;
+	return ((mantissa + 1) << (exponent - 2)) - 1;
+}
+
+Metrics::Metrics()
+	: other_("other"), default_query_budget_(0), bytes_in_(0), bytes_out_(0), queries_(0), connections_(0)
+{
+	for (int i = 0; i < max_status; ++i)
+		statuses_[i].store(0, boost::memory_order_relaxed);
+}
+
+MethodMetrics * Metrics::method(const std::string & name)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	std::unique_ptr<MethodMetrics> & metrics = methods_[name];
+	if (!metrics)
+		metrics.reset(new MethodMetrics(name));
+	return metrics.get();
+}
+
+void Metrics::record(const RequestSample & sample)
+{
+	MethodMetrics & method = sample.method ? *sample.method : other_;
+	for (int i = 0; i < RequestPhases; ++i)
+		if (sample.phases[i] || i == PhaseHandler)
+			method.phases[i].record(sample.phases[i]);
+	if (sample.queries) {
+		method.queries.fetch_add(sample.queries, boost::memory_order_relaxed);
+		method.db_rows.fetch_add(sample.db_rows, boost::memory_order_relaxed);
+		method.db_bytes.fetch_add(sample.db_bytes, boost::memory_order_relaxed);
+		method.db_nanoseconds.fetch_add(sample.db_nanoseconds, boost::memory_order_relaxed);
+		queries_.fetch_add(sample.queries, boost::memory_order_relaxed);
+	}
+	if (sample.status > 0 && sample.status < max_status)
+		statuses_[sample.status].fetch_add(1, boost::memory_order_relaxed);
+	bytes_in_.fetch_add(sample.bytes_in, boost::memory_order_relaxed);
+	bytes_out_.fetch_add(sample.bytes_out, boost::memory_order_relaxed);
+}
+
+void Metrics::setQueryBudget(const std::string & method, unsigned int queries)
+{
+	if (method == "default")
+		default_query_budget_ = queries;
+	else
+		this->method(method)->query_budget = queries;
+}
+
+bool Metrics::setQueryBudgets(const std::string & budgets)
+{
+	std::size_t pos = 0;
+	while (pos < budgets.size()) {
+		std::size_t comma = budgets.find(',', pos);
+		std::string budget = budgets.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+		pos = comma == std::string::npos ? budgets.size() : comma + 1;
+		if (budget.empty())
+			continue;
+
+		std::size_t equal = budget.find('=');
+		char * endptr = 0;
+		unsigned long queries = equal == std::string::npos ? 0 : strtoul(budget.c_str() + equal + 1, &endptr, 10);
+		if (equal == std::string::npos || equal == 0 || endptr == budget.c_str() + equal + 1 || *endptr != '\0') {
+			LOG_ERROR("Metrics::setQueryBudgets: wrong budget " << budget);
+			return false;
+		}
+		setQueryBudget(budget.substr(0, equal), queries);
+	}
+	return true;
+}
+
+void Metrics::checkQueryBudget(const RequestSample & sample)
+{
+	MethodMetrics & method = sample.method ? *sample.method : other_;
+	unsigned int budget = method.query_budget ? method.query_budget : default_query_budget_;
+	if (!budget || sample.queries <= budget)
+		return;
+	method.over_query_budget.fetch_add(1, boost::memory_order_relaxed);
+	LOG_WARN("Metrics::checkQueryBudget: " << method.name << " ran " << sample.queries
+			<< " queries, over its budget of " << budget);
+}
+
+void Metrics::writePrometheus(std::ostream & os)
+{
+	os.precision(12);
+	std::vector<MethodMetrics *> methods;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		for (std::map<std::string, std::unique_ptr<MethodMetrics> >::iterator it = methods_.begin(); it != methods_.end(); ++it)
+			methods.push_back(it->second.get());
+	}
+	methods.push_back(&other_);
+
+	os << "# HELP yucode_request_duration_seconds Time spent by Requests in each phase, per method.\n";
+	os << "# TYPE yucode_request_duration_seconds histogram\n";
+	for (std::size_t m = 0; m < methods.size(); ++m) {
+		std::string method = labelValue(methods[m]->name);
+		for (int i = 0; i < RequestPhases; ++i)
+			if (methods[m]->phases[i].total())
+				writeHistogram(os, "yucode_request_duration_seconds",
+						"method=\"" + method + "\",phase=\"" + phase_names[i] + "\"", methods[m]->phases[i]);
+	}
+
+	writeMethodCounter(os, methods, "yucode_method_db_queries_total",
+			"Data base queries run by Requests, per method.", &MethodMetrics::queries);
+	writeMethodCounter(os, methods, "yucode_method_db_rows_total",
+			"Rows fetched by Requests, per method.", &MethodMetrics::db_rows);
+	writeMethodCounter(os, methods, "yucode_method_db_bytes_total",
+			"Bytes of the values fetched by Requests, per method.", &MethodMetrics::db_bytes);
+	writeMethodCounter(os, methods, "yucode_method_db_seconds_total",
+			"Time Requests waited for the data base, per method.", &MethodMetrics::db_nanoseconds, 1e-9);
+	writeMethodCounter(os, methods, "yucode_method_over_query_budget_total",
+			"Requests running more queries than their budget, per method.", &MethodMetrics::over_query_budget);
+
+	os << "# HELP yucode_db_queries_total Data base queries run by Requests.\n";
+	os << "# TYPE yucode_db_queries_total counter\n";
+	os << "yucode_db_queries_total " << queries_.load(boost::memory_order_relaxed) << "\n";
+
+	os << "# HELP yucode_responses_total Replies sent, per status code.\n";
+	os << "# TYPE yucode_responses_total counter\n";
+	for (int i = 0; i < max_status; ++i) {
+		uint64_t count = statuses_[i].load(boost::memory_order_relaxed);
+		if (count)
+			os << "yucode_responses_total{code=\"" << i << "\"} " << count << "\n";
+	}
+
+	os << "# HELP yucode_received_bytes_total Bytes of the Requests parsed.\n";
+	os << "# TYPE yucode_received_bytes_total counter\n";
+	os << "yucode_received_bytes_total " << bytes_in_.load(boost::memory_order_relaxed) << "\n";
+	os << "# HELP yucode_sent_bytes_total Bytes of the Replies sent.\n";
+	os << "# TYPE yucode_sent_bytes_total counter\n";
+	os << "yucode_sent_bytes_total " << bytes_out_.load(boost::memory_order_relaxed) << "\n";
+
+	os << "# HELP yucode_active_connections Connections currently open.\n";
+	os << "# TYPE yucode_active_connections gauge\n";
+	os << "yucode_active_connections " << connections_.load(boost::memory_order_relaxed) << "\n";
+}
+
+} // namespace server
+} // namespace yucode
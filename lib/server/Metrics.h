@@ -0,0 +1,202 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef YUCODE_SERVER_METRICS_H
+#define YUCODE_SERVER_METRICS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace yucode {
+namespace server {
+
+/// Latency histogram with log-linear buckets, HdrHistogram style: 4 buckets
+/// per power of two of microseconds, so any value is within 25% of its
+/// bucket bounds, up to 2^26us (67s). Recording is a relaxed atomic
+/// increment, readers see counts that may lag by a few observations.
+class LatencyHistogram
+{
+public:
+	static const unsigned int sub_buckets = 4;
+	static const unsigned int buckets = sub_buckets + 24 * sub_buckets;
+
+	LatencyHistogram();
+
+	void record(uint64_t nanoseconds);
+
+	/// Bucket of microseconds.
+	static unsigned int bucket(uint64_t microseconds);
+
+	/// Largest microseconds falling in bucket.
+	static uint64_t bucketMax(unsigned int bucket);
+
+	inline uint64_t count(unsigned int bucket) const {
+		return counts_[bucket].load(boost::memory_order_relaxed);
+	}
+
+	inline uint64_t total() const { return total_.load(boost::memory_order_relaxed); }
+	inline uint64_t sumNanoseconds() const { return sum_.load(boost::memory_order_relaxed); }
+
+private:
+	boost::atomic<uint64_t> counts_[buckets];
+	boost::atomic<uint64_t> total_;
+	boost::atomic<uint64_t> sum_;
+};
+
+/// Phases a Request goes through, each timed separately.
+enum RequestPhase {
+	PhaseParse,		///< Inside the RequestParser
+	PhaseQueue,		///< Waiting for a worker
+	PhaseHandler,		///< In the service handler, but serialization
+	PhaseSerialize,		///< Writing and compressing the response package
+	PhaseWrite,		///< Sending the Reply
+	RequestPhases
+};
+
+/// Measures of the Requests of one method.
+struct MethodMetrics
+{
+	explicit MethodMetrics(const std::string & _name)
+		: name(_name), query_budget(0), queries(0), db_rows(0), db_bytes(0),
+		  db_nanoseconds(0), over_query_budget(0) {}
+
+	const std::string name;
+	/// Queries a Request may run before a warning, 0 for the default one.
+	unsigned int query_budget;
+	LatencyHistogram phases[RequestPhases];
+	boost::atomic<uint64_t> queries;
+	boost::atomic<uint64_t> db_rows;
+	boost::atomic<uint64_t> db_bytes;
+	boost::atomic<uint64_t> db_nanoseconds;
+	boost::atomic<uint64_t> over_query_budget;
+};
+
+/// Measures of the Request a Connection is serving. Filled by the
+/// Connection and, through CurrentRequestSample, by the code handling it.
+struct RequestSample
+{
+	RequestSample() { reset(); }
+
+	void reset() {
+		method = NULL;
+		for (int i = 0; i < RequestPhases; ++i)
+			phases[i] = 0;
+		status = 0;
+		bytes_in = bytes_out = 0;
+		queries = 0;
+		db_rows = db_bytes = db_nanoseconds = 0;
+	}
+
+	/// Add the phases and data base cost of other, measured on another
+	/// thread on behalf of this Request.
+	void merge(const RequestSample & other) {
+		for (int i = 0; i < RequestPhases; ++i)
+			phases[i] += other.phases[i];
+		queries += other.queries;
+		db_rows += other.db_rows;
+		db_bytes += other.db_bytes;
+		db_nanoseconds += other.db_nanoseconds;
+	}
+
+	/// NULL for Requests not handled by a known method.
+	MethodMetrics * method;
+	uint64_t phases[RequestPhases];
+	int status;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	/// Data base cost: queries run, rows fetched, bytes of their values and
+	/// time spent waiting for the server.
+	unsigned int queries;
+	uint64_t db_rows;
+	uint64_t db_bytes;
+	uint64_t db_nanoseconds;
+};
+
+/// Sample of the Request the calling thread is handling, NULL outside one.
+extern __thread RequestSample * CurrentRequestSample;
+
+/// Process wide counters and per method histograms, exported in the
+/// Prometheus text format.
+class Metrics
+{
+public:
+	inline static Metrics & singleton() {
+		static Metrics instance;
+		return instance;
+	}
+
+	/// Metrics of method, created the first time. The pointer stays valid,
+	/// callers keep it rather than looking it up per Request.
+	MethodMetrics * method(const std::string & name);
+
+	/// Account a served Request.
+	void record(const RequestSample & sample);
+
+	/// Queries a Request of method may run before a warning, 0 unlimited.
+	/// "default" names the budget of methods without one. Set before serving.
+	void setQueryBudget(const std::string & method, unsigned int queries);
+
+	/// Parse "method=queries,method=queries" budgets.
+	bool setQueryBudgets(const std::string & budgets);
+
+	/// Warn when the Request of sample ran more queries than the budget of
+	/// its method. Call from the thread handling it.
+	void checkQueryBudget(const RequestSample & sample);
+
+	inline void connectionOpened() { connections_.fetch_add(1, boost::memory_order_relaxed); }
+	inline void connectionClosed() { connections_.fetch_sub(1, boost::memory_order_relaxed); }
+
+	/// Write every metric in the Prometheus text exposition format.
+	void writePrometheus(std::ostream & os);
+
+	/// Write histogram as the Prometheus histogram name, with labels.
+	static void writeHistogram(std::ostream & os, const char * name, const std::string & labels,
+			const LatencyHistogram & histogram);
+
+	/// Current CLOCK_MONOTONIC time, in nanoseconds.
+	static inline uint64_t now() {
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return nanoseconds(now);
+	}
+	
+	static inline uint64_t nanoseconds(const timespec & time) {
+		return static_cast<uint64_t>(time.tv_sec) * 1000000000ULL + time.tv_nsec;
+	}
+
+private:
+	Metrics();
+
+	/// Largest status code counted.
+	static const int max_status = 600;
+
+	boost::mutex mutex_;
+	std::map<std::string, std::unique_ptr<MethodMetrics> > methods_;
+	MethodMetrics other_;
+	unsigned int default_query_budget_;
+	boost::atomic<uint64_t> statuses_[max_status];
+	boost::atomic<uint64_t> bytes_in_;
+	boost::atomic<uint64_t> bytes_out_;
+	boost::atomic<uint64_t> queries_;
+	boost::atomic<long long> connections_;
+};
+
+} // namespace server
+} // namespace yucode
+
+#endif // YUCODE_SERVER_METRICS_H
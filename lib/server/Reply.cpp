@@ -20,38 +20,42 @@ namespace server {
 
 namespace status_strings {
 
+const std::string switching_protocols =
+	"HTTP/1.1 101 Switching Protocols\r\n";
 const std::string ok =
-	"HTTP/1.0 200 OK\r\n";
+	"HTTP/1.1 200 OK\r\n";
 const std::string created =
-	"HTTP/1.0 201 Created\r\n";
+	"HTTP/1.1 201 Created\r\n";
 const std::string accepted =
-	"HTTP/1.0 202 Accepted\r\n";
+	"HTTP/1.1 202 Accepted\r\n";
 const std::string no_content =
-	"HTTP/1.0 204 No Content\r\n";
+	"HTTP/1.1 204 No Content\r\n";
 const std::string multiple_choices =
-	"HTTP/1.0 300 Multiple Choices\r\n";
+	"HTTP/1.1 300 Multiple Choices\r\n";
 const std::string moved_permanently =
-	"HTTP/1.0 301 Moved Permanently\r\n";
+	"HTTP/1.1 301 Moved Permanently\r\n";
 const std::string moved_temporarily =
-	"HTTP/1.0 302 Moved Temporarily\r\n";
+	"HTTP/1.1 302 Moved Temporarily\r\n";
 const std::string not_modified =
-	"HTTP/1.0 304 Not Modified\r\n";
+	"HTTP/1.1 304 Not Modified\r\n";
 const std::string bad_Request =
-	"HTTP/1.0 400 Bad Request\r\n";
+	"HTTP/1.1 400 Bad Request\r\n";
 const std::string unauthorized =
-	"HTTP/1.0 401 Unauthorized\r\n";
+	"HTTP/1.1 401 Unauthorized\r\n";
 const std::string forbidden =
-	"HTTP/1.0 403 Forbidden\r\n";
+	"HTTP/1.1 403 Forbidden\r\n";
 const std::string not_found =
-	"HTTP/1.0 404 Not Found\r\n";
+	"HTTP/1.1 404 Not Found\r\n";
+const std::string request_entity_too_large =
+	"HTTP/1.1 413 Request Entity Too Large\r\n";
 const std::string internal_Server_error =
-	"HTTP/1.0 500 Internal Server Error\r\n";
+	"HTTP/1.1 500 Internal Server Error\r\n";
 const std::string not_implemented =
-	"HTTP/1.0 501 Not Implemented\r\n";
+	"HTTP/1.1 501 Not Implemented\r\n";
 const std::string bad_gateway =
-	"HTTP/1.0 502 Bad Gateway\r\n";
+	"HTTP/1.1 502 Bad Gateway\r\n";
 const std::string service_unavailable =
-	"HTTP/1.0 503 Service Unavailable\r\n";
+	"HTTP/1.1 503 Service Unavailable\r\n";
 
 boost::asio::const_buffer to_buffer(Reply::status_type status)
 {
@@ -71,6 +75,8 @@ boost::asio::const_buffer to_buffer(Reply::status_type status)
 		return boost::asio::buffer(moved_permanently);
 	case Reply::moved_temporarily:
 		return boost::asio::buffer(moved_temporarily);
+	case Reply::switching_protocols:
+		return boost::asio::buffer(switching_protocols);
 	case Reply::not_modified:
 		return boost::asio::buffer(not_modified);
 	case Reply::bad_Request:
@@ -81,6 +87,8 @@ boost::asio::const_buffer to_buffer(Reply::status_type status)
 		return boost::asio::buffer(forbidden);
 	case Reply::not_found:
 		return boost::asio::buffer(not_found);
+	case Reply::request_entity_too_large:
+		return boost::asio::buffer(request_entity_too_large);
 	case Reply::internal_Server_error:
 		return boost::asio::buffer(internal_Server_error);
 	case Reply::not_implemented:
@@ -116,7 +124,7 @@ std::vector<boost::asio::const_buffer> Reply::to_buffers()
 		buffers.push_back(boost::asio::buffer(misc_strings::crlf));
 	}
 	buffers.push_back(boost::asio::buffer(misc_strings::crlf));
-	buffers.push_back(boost::asio::buffer(content));
+	buffers.push_back(boost::asio::buffer(shared_content ? *shared_content : content));
 	return buffers;
 }
 
@@ -178,6 +186,11 @@ const char not_found[] =
 	"<head><title>Not Found</title></head>"
 	"<body><h1>404 Not Found</h1></body>"
 	"</html>";
+const char request_entity_too_large[] =
+	"<html>"
+	"<head><title>Request Entity Too Large</title></head>"
+	"<body><h1>413 Request Entity Too Large</h1></body>"
+	"</html>";
 const char internal_Server_error[] =
 	"<html>"
 	"<head><title>Internal Server Error</title></head>"
@@ -227,6 +240,8 @@ std::string to_string(Reply::status_type status)
 		return forbidden;
 	case Reply::not_found:
 		return not_found;
+	case Reply::request_entity_too_large:
+		return request_entity_too_large;
 	case Reply::internal_Server_error:
 		return internal_Server_error;
 	case Reply::not_implemented:
@@ -246,6 +261,11 @@ Reply Reply::stock_Reply(Reply::status_type status)
 {
 	Reply rep;
 	rep.status = status;
+	// These must not carry a body, a persistent Connection would read it
+	// as the start of the next Reply.
+	if (status == Reply::switching_protocols || status == Reply::no_content
+			|| status == Reply::not_modified)
+		return rep;
 	rep.content = stock_replies::to_string(status);
 	rep.headers.resize(2);
 	rep.headers[0].name = "Content-Length";
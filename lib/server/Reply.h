@@ -17,6 +17,7 @@
 #include <string>
 #include <vector>
 #include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
 #include "Header.h"
 
 namespace yucode {
@@ -28,6 +29,7 @@ struct Reply
 	/// The status of the Reply.
 	enum status_type
 	{
+		switching_protocols = 101,
 		ok = 200,
 		created = 201,
 		accepted = 202,
@@ -40,6 +42,7 @@ struct Reply
 		unauthorized = 401,
 		forbidden = 403,
 		not_found = 404,
+		request_entity_too_large = 413,
 		internal_Server_error = 500,
 		not_implemented = 501,
 		bad_gateway = 502,
@@ -52,6 +55,10 @@ struct Reply
 	/// The content to be sent in the Reply.
 	std::string content;
 
+	/// Content shared with a cache, sent instead of content when set so it is
+	/// not copied into every Reply.
+	boost::shared_ptr<const std::string> shared_content;
+
 	/// Convert the Reply into a vector of buffers. The buffers do not own the
 	/// underlying memory blocks, therefore the Reply object must remain valid and
 	/// not be changed until the write operation has completed.
@@ -16,8 +16,12 @@
 
 #include <string>
 #include <vector>
-#include <map>
 #include <cstdlib>
+#include <string.h>
+#include <limits>
+#include <boost/utility/string_ref.hpp>
+#include <boost/container/small_vector.hpp>
+#include <boost/type_traits/make_unsigned.hpp>
 #include "Header.h"
 #include "Log.h"
 #include "misc/Utilities.h"
@@ -26,50 +30,106 @@
 namespace yucode {
 namespace server {
 
+/// A query string argument or a cookie of a Request.
+struct RequestArgument
+{
+	boost::string_ref name;
+	boost::string_ref value;
+};
+
+/// Arguments in arrival order. Typical Requests carry a handful of them, which
+/// fit inline without any allocation.
+typedef boost::container::small_vector<RequestArgument, 16> RequestArguments;
+
 /// A Request received from a client.
 struct Request
 {
 	long long seq_number;
 	TimeStamp timestamp;
 	std::string remote_endpoint;
-	std::string method;
-	std::string uri;
+	/// method, uri and headers point into the Connection buffer, which is left
+	/// untouched until the Reply has been written. Copy them to keep them.
+	boost::string_ref method;
+	boost::string_ref uri;
 	std::string referer;
 	std::string origin;
 	int http_version_major;
 	int http_version_minor;
-	std::vector<Header> headers;
+	bool keep_alive;
+	/// User authenticated when the WebSocket carrying this Request was
+	/// opened, 0 for plain HTTP Requests.
+	unsigned long long socket_user_id;
+	std::vector<HeaderRef> headers;
 	std::string extension;
 	std::string root_folder;
 	std::string decoded_uri;
-	std::map<std::string, std::string> arguments;
-	std::map<std::string, std::string> cookies;
+	/// Arguments point into the uri when they needed no decoding, into
+	/// decoded_arguments otherwise. Cookies point into their header.
+	RequestArguments arguments;
+	RequestArguments cookies;
+	/// Url decoded argument names and values. Reserved to the size of the
+	/// encoded query string before decoding, so it never reallocates under
+	/// the views of arguments.
+	std::string decoded_arguments;
+	
+	/// Clear the parsed fields for the next Request of a Connection, keeping
+	/// the already allocated storage.
+	void reset() {
+		method.clear();
+		uri.clear();
+		referer.clear();
+		origin.clear();
+		http_version_major = 0;
+		http_version_minor = 0;
+		keep_alive = false;
+		socket_user_id = 0;
+		headers.clear();
+		extension.clear();
+		root_folder.clear();
+		decoded_uri.clear();
+		arguments.clear();
+		cookies.clear();
+		decoded_arguments.clear();
+	}
 	
-	inline bool loadArgument(std::string & to, std::string argName, bool paranoiacSQLInjection = true) const {
-		std::map<std::string, std::string>::const_iterator argIt = arguments.find(argName);
-		if (argIt == arguments.end()) 
+	/// Value of the first header named name (case insensitive), empty if none.
+	boost::string_ref header(boost::string_ref name) const {
+		for (std::vector<HeaderRef>::const_iterator it = headers.begin(); it != headers.end(); ++it)
+			if (EqualsIgnoreCase(it->name, name))
+				return it->value;
+		return boost::string_ref();
+	}
+	
+	/// Look up an argument without copying it. The last occurrence wins.
+	inline bool loadArgumentView(boost::string_ref & to, boost::string_ref argName) const {
+		return find(arguments, to, argName);
+	}
+	
+	inline bool loadArgument(std::string & to, boost::string_ref argName, bool paranoiacSQLInjection = true) const {
+		boost::string_ref value;
+		if (!loadArgumentView(value, argName))
 			return false;
-		to = argIt->second;
+		to.assign(value.data(), value.size());
 		return true;
 	}
 		
-	bool loadArgumentVerifyString(std::string & to, std::string argName) const {
-		std::string tmp;
-		if (!loadArgument(tmp, argName))
+	bool loadArgumentVerifyString(std::string & to, boost::string_ref argName) const {
+		boost::string_ref tmp;
+		if (!loadArgumentView(tmp, argName))
 			return false;
 		
-		if (tmp.find(';')!=std::string::npos 
-			|| tmp.find('\'')!=std::string::npos 
-			|| tmp.find('\\')!=std::string::npos) {
+		if (tmp.find(';')!=boost::string_ref::npos 
+			|| tmp.find('\'')!=boost::string_ref::npos 
+			|| tmp.find('\\')!=boost::string_ref::npos) {
 			LOG_ERROR_SECURITY("SQL Injection alert at argument " << argName << ": " << tmp);
 			return false;
 		}
 		
-		to = tmp;
+		to.assign(tmp.data(), tmp.size());
 		return true;
 	}
 	
-	bool loadArgumentVerifyStringText(std::string & to, std::string argName) const {
+	bool loadArgumentVerifyStringText(std::string & to, boost::string_ref argName) const {
 		std::string tmp;
 		if (!loadArgumentVerifyString(tmp, argName))
 			return false;
@@ -77,176 +137,170 @@ struct Request
 		return true;
 	}
 	
-	bool loadArgumentVerifyDouble(double & to, std::string argName) const {
-		std::string tmp;
-		if (!loadArgument(tmp, argName))
+	bool loadArgumentVerifyDouble(double & to, boost::string_ref argName) const {
+		boost::string_ref tmp;
+		if (!loadArgumentView(tmp, argName))
 			return false;
 		
-		char *endptr = 0;
-		to = strtod(tmp.c_str(), &endptr);
-		if (endptr == tmp.c_str()) {
+		// strtod needs a terminated string, numbers are short
+		char number[64];
+		char *endptr = number;
+		if (tmp.size() < sizeof(number)) {
+			memcpy(number, tmp.data(), tmp.size());
+			number[tmp.size()] = '\0';
+			to = strtod(number, &endptr);
+		}
+		if (endptr == number || *endptr != '\0') {
 			LOG_ERROR_SECURITY("invalid input argument " << argName << " " << tmp);
 			return false;
 		}
 		return true;
 	}
 	
-	bool loadArgumentVerifyLong(long int & to, std::string argName) const {
-		std::string tmp;
-		if (!loadArgument(tmp, argName))
-			return false;
-		
-		char *endptr = 0;
-		to = strtol(tmp.c_str(), &endptr, 10);
-		if (endptr == tmp.c_str()) {
-			LOG_ERROR_SECURITY("invalid input argument " << argName << " " << tmp);
-			return false;
-		}
-		return true;
+	bool loadArgumentVerifyLong(long int & to, boost::string_ref argName) const {
+		return loadArgumentVerifyInteger(to, argName);
 	}
 	
-	bool loadArgumentVerifyUnsignedInt(unsigned int & to, std::string argName) const {
-		std::string tmp;
-		if (!loadArgument(tmp, argName))
-			return false;
-		
-		char *endptr = 0;
-		unsigned long realval = strtoul(tmp.c_str(), &endptr, 10);
-		if (endptr == tmp.c_str()) {
-			LOG_ERROR_SECURITY("invalid input argument " << argName << " " << tmp);
-			return false;
-		}
-		to = (unsigned int)realval;
-		return true;
+	bool loadArgumentVerifyUnsignedInt(unsigned int & to, boost::string_ref argName) const {
+		return loadArgumentVerifyInteger(to, argName);
 	}
 		
-	bool loadArgumentVerifyTimeT(time_t & to, std::string argName) const {
-		std::string tmp;
-		if (!loadArgument(tmp, argName))
+	bool loadArgumentVerifyTimeT(time_t & to, boost::string_ref argName) const {
+		unsigned long realval;
+		if (!loadArgumentVerifyInteger(realval, argName))
 			return false;
-		
-		char *endptr = 0;
-		unsigned long realval = strtoul(tmp.c_str(), &endptr, 10);
-		if (endptr == tmp.c_str()) {
-			LOG_ERROR_SECURITY("invalid input argument " << argName << " " << tmp);
-			return false;
-		}
 		to = (time_t)realval;
 		return true;
 	}
 	
-	bool loadArgumentVerifyUnsignedLong(unsigned long int & to, std::string argName) const {
-		std::string tmp;
-		if (!loadArgument(tmp, argName))
+	bool loadArgumentVerifyUnsignedLong(unsigned long int & to, boost::string_ref argName) const {
+		return loadArgumentVerifyInteger(to, argName);
+	}
+	
+	bool loadArgumentVerifyLongLong(long long & to, boost::string_ref argName) const {
+		return loadArgumentVerifyInteger(to, argName);
+	}
+	
+	bool loadArgumentVerifyUnsignedLongLong(unsigned long long & to, boost::string_ref argName) const {
+		return loadArgumentVerifyInteger(to, argName);
+	}
+	
+	bool loadArgumentVerifyCsvLongLong(std::vector<long long> & to, boost::string_ref argName) const {
+		return loadArgumentVerifyCsvInteger(to, argName);
+	}
+	
+	bool loadArgumentVerifyCsvUnsignedLongLong(std::vector<unsigned long long> & to, boost::string_ref argName) const {
+		return loadArgumentVerifyCsvInteger(to, argName);
+	}
+	
+	bool loadArgumentVerifyCsvStringText(std::vector<std::string> & to, boost::string_ref argName) const {
+		boost::string_ref tmp;
+		if (!loadArgumentView(tmp, argName))
 			return false;
 		
-		char *endptr = 0;
-		to = strtoul(tmp.c_str(), &endptr, 10);
-		if (endptr == tmp.c_str()) {
-			LOG_ERROR_SECURITY("invalid input argument " << argName << " " << tmp);
-			return false;
+		to.clear();
+		std::string token_string;
+		for (boost::string_ref token; nextCsvToken(tmp, token); ) {
+			token_string.assign(token.data(), token.size());
+			to.push_back(DataBase::singleton().escapeString(token_string));
 		}
 		return true;
 	}
 	
-	bool loadArgumentVerifyLongLong(long long & to, std::string argName) const {
-		std::string tmp;
-		if (!loadArgument(tmp, argName))
+	inline bool loadCookie(std::string & to, boost::string_ref argName) const {
+		boost::string_ref value;
+		if (!find(cookies, value, argName))
 			return false;
-		
-		char *endptr = 0;
-		to = strtoll(tmp.c_str(), &endptr, 10);
-		if (endptr == tmp.c_str()) {
-			LOG_ERROR_SECURITY("invalid input argument " << argName << " " << tmp);
-			return false;
-		}
+		to.assign(value.data(), value.size());
 		return true;
 	}
 	
-	bool loadArgumentVerifyUnsignedLongLong(unsigned long long & to, std::string argName) const {
-		std::string tmp;
-		if (!loadArgument(tmp, argName))
+	bool loadCookieVerifyLongLong(long long & to, boost::string_ref argName) const {
+		boost::string_ref tmp;
+		if (!find(cookies, tmp, argName))
 			return false;
 		
-		char *endptr = 0;
-		to = strtoull(tmp.c_str(), &endptr, 10);
-		if (endptr == tmp.c_str()) {
-			LOG_ERROR_SECURITY("invalid input argument " << argName << " " << tmp);
+		if (!parseInteger(tmp, to)) {
+			LOG_ERROR_SECURITY("invalid input cookie " << argName << " " << tmp);
 			return false;
 		}
 		return true;
 	}
 	
-	bool loadArgumentVerifyCsvLongLong(std::vector<long long> & to, std::string argName) const {
-		std::string tmp;
-		if (!loadArgument(tmp, argName))
+	/// Parse a whole decimal number: optional sign for signed types, no
+	/// blanks, no trailing characters and no overflow.
+	template <typename T>
+	static bool parseInteger(boost::string_ref in, T & to) {
+		typedef typename boost::make_unsigned<T>::type Unsigned;
+		bool negative = false;
+		if (std::numeric_limits<T>::is_signed && !in.empty() && (in[0] == '-' || in[0] == '+')) {
+			negative = in[0] == '-';
+			in.remove_prefix(1);
+		}
+		if (in.empty())
 			return false;
 		
-		std::vector<std::string> tokens;
-		&misc::Utilities::split(tmp, ',', tokens);
-		for (std::vector<std::string>::iterator it = tokens.begin(); it != tokens.end(); ++it) {
-			char *endptr = 0;
-			long long val = strtoll(it->c_str(), &endptr, 10);
-			if (endptr == tmp.c_str()) {
-				LOG_ERROR_SECURITY("invalid input argument " << argName << " " << tmp);
+		Unsigned limit = (Unsigned)std::numeric_limits<T>::max() + (negative ? 1 : 0);
+		Unsigned value = 0;
+		for (boost::string_ref::const_iterator it = in.begin(); it != in.end(); ++it) {
+			unsigned int digit = (unsigned char)*it - '0';
+			if (digit > 9 || value > (limit - digit) / 10)
 				return false;
-			}
-			to.push_back(val);
+			value = value * 10 + digit;
 		}
-
+		to = negative ? (T)(0 - value) : (T)value;
 		return true;
 	}
 	
-	bool loadArgumentVerifyCsvUnsignedLongLong(std::vector<unsigned long long> & to, std::string argName) const {
-		std::string tmp;
-		if (!loadArgument(tmp, argName))
-			return false;
-	
-		std::vector<std::string> tokens;
-		&misc::Utilities::split(tmp, ',', tokens);
-		for (std::vector<std::string>::iterator it = tokens.begin(); it != tokens.end(); ++it) {
-			char *endptr = 0;
-			unsigned long long val = strtoull(it->c_str(), &endptr, 10);
-			if (endptr == tmp.c_str()) {
-				LOG_ERROR_SECURITY("invalid input argument " << argName << " " << tmp);
-				return false;
+private:
+	static bool find(const RequestArguments & in, boost::string_ref & to, boost::string_ref name) {
+		for (RequestArguments::const_reverse_iterator it = in.rbegin(); it != in.rend(); ++it) {
+			if (it->name == name) {
+				to = it->value;
+				return true;
 			}
-			to.push_back(val);
 		}
-
-		return true;
+		return false;
 	}
-	bool loadArgumentVerifyCsvStringText(std::vector<std::string> & to, std::string argName) const {
-		std::string tmp;
-		if (!loadArgument(tmp, argName))
-			return false;
-		
-		std::vector<std::string> tokens;
-		&misc::Utilities::split(tmp, ',', tokens);
-		for (std::vector<std::string>::iterator it = tokens.begin(); it != tokens.end(); ++it)
-			*it = DataBase::singleton().escapeString(*it);
-		to = tokens;
-		return true;
+	
+	/// Split the next non empty token of a comma separated list off csv.
+	static bool nextCsvToken(boost::string_ref & csv, boost::string_ref & token) {
+		while (!csv.empty()) {
+			std::size_t comma = csv.find(',');
+			token = csv.substr(0, comma);
+			csv.remove_prefix(comma == boost::string_ref::npos ? csv.size() : comma + 1);
+			if (!token.empty())
+				return true;
+		}
+		return false;
 	}
 	
-	inline bool loadCookie(std::string & to, std::string argName) const {
-		std::map<std::string, std::string>::const_iterator argIt = cookies.find(argName);
-		if (argIt == cookies.end()) 
+	template <typename T>
+	bool loadArgumentVerifyInteger(T & to, boost::string_ref argName) const {
+		boost::string_ref tmp;
+		if (!loadArgumentView(tmp, argName))
 			return false;
-		to = argIt->second;
+		
+		if (!parseInteger(tmp, to)) {
+			LOG_ERROR_SECURITY("invalid input argument " << argName << " " << tmp);
+			return false;
+		}
 		return true;
 	}
 	
-	bool loadCookieVerifyLongLong(long long & to, std::string argName) const {
-		std::string tmp;
-		if (!loadCookie(tmp, argName))
+	template <typename T>
+	bool loadArgumentVerifyCsvInteger(std::vector<T> & to, boost::string_ref argName) const {
+		boost::string_ref tmp;
+		if (!loadArgumentView(tmp, argName))
 			return false;
 		
-		char *endptr = 0;
-		to = strtoll(tmp.c_str(), &endptr, 10);
-		if (endptr == tmp.c_str()) {
-			LOG_ERROR_SECURITY("invalid input cookie " << argName << " " << tmp);
-			return false;
+		for (boost::string_ref token, csv = tmp; nextCsvToken(csv, token); ) {
+			T val;
+			if (!parseInteger(token, val)) {
+				LOG_ERROR_SECURITY("invalid input argument " << argName << " " << tmp);
+				return false;
+			}
+			to.push_back(val);
 		}
 		return true;
 	}
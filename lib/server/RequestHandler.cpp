@@ -17,7 +17,10 @@
 #include "Reply.h"
 #include "Request.h"
 #include "ServiceFileDispatch.h"
+#include "WebSocket.h"
 #include "Log.h"
+#include "Metrics.h"
+#include "Trace.h"
 #include <iostream>
 #include <stdexcept>
 #include <regex>
@@ -31,6 +34,7 @@ namespace server {
 void RequestHandler::handleRequest(Request& req, Reply& rep)
 {
 	bool dispatched = false;
+	SetRequestSeqNumber(req.seq_number);
 #ifdef ACCESS_CONTROL_ENABLED	
 	if (req.origin != "yucode.com" && req.origin != "es.yucode.com" && req.origin != "en.yucode.com") {
 		LOG_ERROR_SECURITY("Access denied to origin: " << req.origin);
@@ -38,9 +42,19 @@ void RequestHandler::handleRequest(Request& req, Reply& rep)
 		return;
 	}
 #endif
-	SetTimeStamp(req.timestamp);	
+	SetTimeStamp(req.timestamp);
+	boost::string_ref path = req.uri.substr(0, req.uri.find('?'));
+	TraceSpan trace(TraceRequestBegin, TraceLabel(path.data(), path.size()));
+	// The data base connection checked out goes back to the pool at return
+	ConnectionScope connectionScope;
 	try {
-		vector<shared_ptr<ServiceInterface> > & services = server_->getServices();
+		ServiceInterface * routed = server_->findRoute(req.uri);
+		if (routed) {
+			routed->handleRequest(req, rep, serverContext_);
+			dispatched = true;
+		}
+		
+		vector<shared_ptr<ServiceInterface> > & services = server_->getUnroutedServices();
 		for (vector<shared_ptr<ServiceInterface> >::iterator it = services.begin(); 
 		     it != services.end() && !dispatched; ++it) {
 			shared_ptr<ServiceInterface> service = *it;
@@ -51,9 +65,11 @@ void RequestHandler::handleRequest(Request& req, Reply& rep)
 		}
 		
 		if (!dispatched) {
-			ServiceFileDispatch serviceFile;
-			if (serviceFile.matchRequest(req)) {
-				serviceFile.handleRequest(req, rep, serverContext_);
+			if (fileDispatch_.matchRequest(req)) {
+				static MethodMetrics * files = Metrics::singleton().method("file");
+				if (CurrentRequestSample)
+					CurrentRequestSample->method = files;
+				fileDispatch_.handleRequest(req, rep, serverContext_);
 				dispatched = true;
 			}
 		}
@@ -73,9 +89,65 @@ void RequestHandler::handleRequest(Request& req, Reply& rep)
 		LOG_WARN("Request not found");
 	}
 	
-	LOG_ELLAPSED_SINCE(req.timestamp, "service dispatched");
+	trace.setArgument(rep.status);
+	if (CurrentRequestSample) {
+		const RequestSample & sample = *CurrentRequestSample;
+		LOG_ACCESS_SINCE(req.timestamp, "service dispatched " << (sample.method? sample.method->name : "other")
+				<< ", status " << rep.status << ", db " << sample.queries << " queries, " << sample.db_rows
+				<< " rows, " << sample.db_bytes << " bytes, " << sample.db_nanoseconds / 1000 << "us");
+		Metrics::singleton().checkQueryBudget(sample);
+	} else {
+		LOG_ELLAPSED_SINCE(req.timestamp, "service dispatched");
+	}
 }
 
+bool RequestHandler::handleUpgrade(Request& req, Reply& rep, unsigned long long & userId)
+{
+	SetRequestSeqNumber(req.seq_number);
+	if (req.header("Sec-WebSocket-Version") != "13") {
+		LOG_WARN("WebSocket version not supported: " << req.header("Sec-WebSocket-Version"));
+		rep = Reply::stock_Reply(Reply::bad_Request);
+		rep.headers.push_back(Header());
+		rep.headers.back().name = "Sec-WebSocket-Version";
+		rep.headers.back().value = "13";
+		return false;
+	}
+	
+	ConnectionScope connectionScope;
+	try {
+		ServiceInterface * service = server_->findRoute(req.uri);
+		if (!service) {
+			rep = Reply::stock_Reply(Reply::not_found);
+			return false;
+		}
+		if (!service->acceptWebSocket(req, userId)) {
+			LOG_WARN("WebSocket refused at " << req.uri);
+			rep = Reply::stock_Reply(Reply::forbidden);
+			return false;
+		}
+	} catch (const char * e) {
+		LOG_ERROR("Exception catched: " << e);
+		rep = Reply::stock_Reply(Reply::internal_Server_error);
+		return false;
+	} catch (std::exception & e) {
+		LOG_ERROR("Exception catched: " << e.what());
+		rep = Reply::stock_Reply(Reply::internal_Server_error);
+		return false;
+	} catch (...) {
+		LOG_ERROR("Exception catched: <unknown>");
+		rep = Reply::stock_Reply(Reply::internal_Server_error);
+		return false;
+	}
+	
+	rep = Reply::stock_Reply(Reply::switching_protocols);
+	rep.headers.resize(2);
+	rep.headers[0].name = "Upgrade";
+	rep.headers[0].value = "websocket";
+	rep.headers[1].name = "Sec-WebSocket-Accept";
+	rep.headers[1].value = websocket::accept_key(req.header("Sec-WebSocket-Key"));
+	LOG("WebSocket opened at " << req.uri << " for user " << userId);
+	return true;
+}
 
 } // namespace server
 } // namespace yucode
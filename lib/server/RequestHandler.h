@@ -17,6 +17,7 @@
 #include <string>
 #include <boost/noncopyable.hpp>
 #include "ServerContext.h"
+#include "ServiceFileDispatch.h"
 
 namespace yucode {
 namespace server {
@@ -36,10 +37,18 @@ public:
 
 	void handleRequest(Request& req, Reply& rep);
 
+	/// Answer a WebSocket upgrade Request. Returns true, with the 101 Reply in
+	/// rep and the socket user in userId, when the service routed at req.uri
+	/// accepts it.
+	bool handleUpgrade(Request& req, Reply& rep, unsigned long long & userId);
+
 private:
 	const ServerContext &serverContext_;
 	Server * server_;
 	
+	/// Fallback for Requests no service matched, kept for its file cache.
+	ServiceFileDispatch fileDispatch_;
+	
 	static bool url_decode(const std::string& in, std::string& out);
 	
 };
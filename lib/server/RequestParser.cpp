@@ -12,20 +12,169 @@
  */
 #include "RequestParser.h"
 
-#include <sstream>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "external/rapidjson/reader.h"
 #include "Request.h"
 
 namespace yucode {
 namespace server {
 
+namespace {
+
+std::size_t max_body_size_ = 1024 * 1024;
+
+/// Stream over a JSON body for the rapidjson reader, decoding strings in
+/// place. The end of the body reads as the NUL the reader stops at. Copies
+/// share the position, so the handler knows where the reader is.
+struct JsonBodyStream
+{
+	typedef char Ch;
+	
+	struct Position
+	{
+		char * begin;
+		char * end;
+		char * src;
+		char * dst;
+	};
+	
+	explicit JsonBodyStream(Position & position) : position_(&position) {}
+	
+	char Peek() { return position_->src != position_->end ? *position_->src : '\0'; }
+	char Take() { return position_->src != position_->end ? *position_->src++ : '\0'; }
+	std::size_t Tell() { return position_->src - position_->begin; }
+	
+	char * PutBegin() { return position_->dst = position_->src; }
+	void Put(char c) { *position_->dst++ = c; }
+	std::size_t PutEnd(char * begin) { return position_->dst - begin; }
+	
+	Position * position_;
+};
+
+/// Maps the members of a JSON object to Request arguments: strings as
+/// decoded, numbers as written, booleans as 1/0 and arrays of those as the
+/// CSV lists the query strings carry. Arrays are rewritten in place over
+/// their own text, which is never shorter. Nested objects are refused, null
+/// members are left out.
+struct JsonArgumentsHandler
+{
+	JsonArgumentsHandler(Request & req, JsonBodyStream::Position & position)
+		: req_(req), position_(position), depth_(0), expects_name_(true), failed_(false),
+		  list_begin_(NULL), list_end_(NULL) {}
+	
+	void Null() {
+		if (depth_ == 1)
+			expects_name_ = true;
+	}
+	void Bool(bool b) { value(b ? "1" : "0"); }
+	void Int(int) { number(); }
+	void Uint(unsigned) { number(); }
+	void Int64(int64_t) { number(); }
+	void Uint64(uint64_t) { number(); }
+	void Double(double) { number(); }
+	void String(const char * str, rapidjson::SizeType length, bool) {
+		if (depth_ == 1 && expects_name_) {
+			argument_.name = boost::string_ref(str, length);
+			expects_name_ = false;
+		} else {
+			value(boost::string_ref(str, length));
+		}
+	}
+	void StartObject() {
+		if (++depth_ != 1)
+			failed_ = true;
+	}
+	void EndObject(rapidjson::SizeType) {
+		--depth_;
+	}
+	void StartArray() {
+		if (++depth_ != 2)
+			failed_ = true;
+		// The list overwrites the array from its '['
+		list_begin_ = list_end_ = position_.src - 1;
+	}
+	void EndArray(rapidjson::SizeType) {
+		--depth_;
+		value(boost::string_ref(list_begin_, list_end_ - list_begin_));
+	}
+	
+	/// Numbers are kept as written, which ends where the reader stands.
+	void number() {
+		char * end = position_.src;
+		char * begin = end;
+		while (begin != position_.begin && begin[-1] && strchr("0123456789+-.eE", begin[-1]))
+			--begin;
+		value(boost::string_ref(begin, end - begin));
+	}
+	
+	void value(boost::string_ref text) {
+		if (depth_ == 1) {
+			argument_.value = text;
+			req_.arguments.push_back(argument_);
+			expects_name_ = true;
+		} else if (depth_ == 2) {
+			if (list_end_ != list_begin_)
+				*list_end_++ = ',';
+			memmove(list_end_, text.data(), text.size());
+			list_end_ += text.size();
+		} else {
+			failed_ = true;
+		}
+	}
+	
+	Request & req_;
+	JsonBodyStream::Position & position_;
+	int depth_;
+	bool expects_name_;
+	bool failed_;
+	RequestArgument argument_;
+	char * list_begin_;
+	char * list_end_;
+};
+
+} // namespace
+
 RequestParser::RequestParser()
-	: state_(method_start)
+	: scanned_(0),
+		head_length_(0),
+		content_length_(0),
+		body_too_large_(false),
+		expects_continue_(false)
 {
 }
 
 void RequestParser::reset()
 {
-	state_ = method_start;
+	scanned_ = 0;
+	head_length_ = 0;
+	content_length_ = 0;
+	body_too_large_ = false;
+	expects_continue_ = false;
+}
+
+std::size_t RequestParser::expected_size() const
+{
+	return head_length_ ? head_length_ + content_length_ : 0;
+}
+
+bool RequestParser::body_too_large() const
+{
+	return body_too_large_;
+}
+
+bool RequestParser::expects_continue()
+{
+	bool expects = expects_continue_;
+	expects_continue_ = false;
+	return expects;
+}
+
+void RequestParser::setMaxBodySize(std::size_t max_body_size)
+{
+	max_body_size_ = max_body_size;
 }
 
 
@@ -37,304 +186,253 @@ void RequestParser::parseGetString(Request& req, const std::string & get_request
 	enhace_Request(req);
 }
 
-std::string RequestParser::ParseUrlDomain(const std::string & url_s) {
-	std::string domain_;
-	
-	const std::string prot_end("://");
-	std::string::const_iterator prot_i = search(url_s.begin(), url_s.end(),
-						prot_end.begin(), prot_end.end());
-	prot_i += 3;
-	if (prot_i == url_s.end())
+std::string RequestParser::ParseUrlDomain(boost::string_ref url_s) {
+	std::size_t prot_i = url_s.find("://");
+	if (prot_i == boost::string_ref::npos || prot_i + 3 >= url_s.size())
 		return std::string();
-	std::string::const_iterator path_i = find(prot_i, url_s.end(), '/');
-	domain_.assign(prot_i, path_i);
-	return domain_;
+	boost::string_ref domain = url_s.substr(prot_i + 3);
+	return std::string(domain.begin(), std::find(domain.begin(), domain.end(), '/'));
 }
 
-
-boost::tribool RequestParser::consume(Request& req, char input)
+boost::tuple<boost::tribool, const char *> RequestParser::parse(Request& req,
+		char * begin, char * end)
 {
-	switch (state_)
-	{
-	case method_start:
-		if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-		{
-			return false;
-		}
-		else
-		{
-			state_ = method;
-			req.method.push_back(input);
-			return boost::indeterminate;
-		}
-	case method:
-		if (input == ' ')
-		{
-			state_ = uri;
-			return boost::indeterminate;
-		}
-		else if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-		{
-			return false;
-		}
-		else
-		{
-			req.method.push_back(input);
-			return boost::indeterminate;
-		}
-	case uri:
-		if (input == ' ')
-		{
-			state_ = http_version_h;
-			return boost::indeterminate;
-		}
-		else if (is_ctl(input))
-		{
-			return false;
-		}
-		else
-		{
-			req.uri.push_back(input);
-			return boost::indeterminate;
-		}
-	case http_version_h:
-		if (input == 'H')
-		{
-			state_ = http_version_t_1;
-			return boost::indeterminate;
-		}
-		else
-		{
-			return false;
-		}
-	case http_version_t_1:
-		if (input == 'T')
-		{
-			state_ = http_version_t_2;
-			return boost::indeterminate;
-		}
-		else
-		{
-			return false;
-		}
-	case http_version_t_2:
-		if (input == 'T')
-		{
-			state_ = http_version_p;
-			return boost::indeterminate;
-		}
-		else
-		{
-			return false;
-		}
-	case http_version_p:
-		if (input == 'P')
-		{
-			state_ = http_version_slash;
-			return boost::indeterminate;
-		}
-		else
-		{
-			return false;
-		}
-	case http_version_slash:
-		if (input == '/')
-		{
-			req.http_version_major = 0;
-			req.http_version_minor = 0;
-			state_ = http_version_major_start;
-			return boost::indeterminate;
-		}
-		else
-		{
-			return false;
-		}
-	case http_version_major_start:
-		if (is_digit(input))
-		{
-			req.http_version_major = req.http_version_major * 10 + input - '0';
-			state_ = http_version_major;
-			return boost::indeterminate;
-		}
-		else
-		{
-			return false;
-		}
-	case http_version_major:
-		if (input == '.')
-		{
-			state_ = http_version_minor_start;
-			return boost::indeterminate;
-		}
-		else if (is_digit(input))
-		{
-			req.http_version_major = req.http_version_major * 10 + input - '0';
-			return boost::indeterminate;
-		}
-		else
-		{
-			return false;
-		}
-	case http_version_minor_start:
-		if (is_digit(input))
-		{
-			req.http_version_minor = req.http_version_minor * 10 + input - '0';
-			state_ = http_version_minor;
-			return boost::indeterminate;
-		}
-		else
-		{
-			return false;
-		}
-	case http_version_minor:
-		if (input == '\r')
-		{
-			state_ = expecting_newline_1;
-			return boost::indeterminate;
-		}
-		else if (is_digit(input))
-		{
-			req.http_version_minor = req.http_version_minor * 10 + input - '0';
-			return boost::indeterminate;
-		}
-		else
-		{
-			return false;
-		}
-	case expecting_newline_1:
-		if (input == '\n')
-		{
-			state_ = header_line_start;
-			return boost::indeterminate;
-		}
-		else
-		{
-			return false;
-		}
-	case header_line_start:
-		if (input == '\r')
-		{
-			state_ = expecting_newline_3;
-			return boost::indeterminate;
-		}
-		else if (!req.headers.empty() && (input == ' ' || input == '\t'))
-		{
-			state_ = header_lws;
-			return boost::indeterminate;
-		}
-		else if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-		{
-			return false;
-		}
-		else
-		{
-			req.headers.push_back(Header());
-			req.headers.back().name.push_back(input);
-			state_ = header_name;
-			return boost::indeterminate;
-		}
-	case header_lws:
-		if (input == '\r')
-		{
-			state_ = expecting_newline_2;
-			return boost::indeterminate;
-		}
-		else if (input == ' ' || input == '\t')
-		{
-			return boost::indeterminate;
-		}
-		else if (is_ctl(input))
-		{
-			return false;
-		}
-		else
-		{
-			state_ = header_value;
-			req.headers.back().value.push_back(input);
-			return boost::indeterminate;
-		}
-	case header_name:
-		if (input == ':')
-		{
-			state_ = space_before_header_value;
-			return boost::indeterminate;
-		}
-		else if (!is_char(input) || is_ctl(input) || is_tspecial(input))
-		{
-			return false;
-		}
-		else
-		{
-			req.headers.back().name.push_back(input);
-			return boost::indeterminate;
-		}
-	case space_before_header_value:
-		if (input == ' ')
-		{
-			state_ = header_value;
-			return boost::indeterminate;
+	SetRequestSeqNumber(req.seq_number);
+	boost::tribool result = boost::indeterminate;
+	
+	if (!head_length_) {
+		// The last 3 scanned bytes may start the terminator
+		const char * from = begin + (scanned_ > 3 ? scanned_ - 3 : 0);
+		const char * head_end = find_head_end(from < end ? from : end, end);
+		if (!head_end) {
+			scanned_ = end - begin;
+			return boost::make_tuple(result, begin);
+		}
+		head_length_ = head_end + 4 - begin;
+		
+		// Content-Length tells how much body follows the head
+		if (!parse_head(req, begin, head_end) || !parse_content_length(req)) {
+			result = false;
+			return boost::make_tuple(result, begin);
 		}
-		else
-		{
-			return false;
+		if (static_cast<std::size_t>(end - begin) < head_length_ + content_length_) {
+			expects_continue_ = EqualsIgnoreCase(req.header("Expect"), "100-continue");
+			return boost::make_tuple(result, begin);
 		}
-	case header_value:
-		if (input == '\r')
-		{
-			state_ = expecting_newline_2;
-			return boost::indeterminate;
+	} else {
+		if (static_cast<std::size_t>(end - begin) < head_length_ + content_length_)
+			return boost::make_tuple(result, begin);
+		
+		// The bytes may have moved since the head was split, split it again
+		req.headers.clear();
+		if (!parse_head(req, begin, begin + head_length_ - 4)) {
+			result = false;
+			return boost::make_tuple(result, begin);
 		}
-		else if (is_ctl(input))
-		{
+	}
+	
+	// Arguments decoded from the uri and a form body are both shorter than
+	// the Request, reserving for it keeps them from moving
+	char * body = begin + head_length_;
+	req.decoded_arguments.reserve(head_length_ + content_length_);
+	result = enhace_Request(req) && parse_body(req, body, body + content_length_);
+	return boost::make_tuple(result, body + content_length_);
+}
+
+bool RequestParser::parse_content_length(Request & req)
+{
+	content_length_ = 0;
+	// Only identity, the body as is, can be read without decoding
+	boost::string_ref encoding = req.header("Transfer-Encoding");
+	if (!encoding.empty() && !EqualsIgnoreCase(encoding, "identity")) {
+		LOG_WARN("RequestParser::parse_content_length: transfer encoding " << encoding << " not supported");
+		return false;
+	}
+	boost::string_ref length = req.header("Content-Length");
+	for (boost::string_ref::const_iterator it = length.begin(); it != length.end(); ++it) {
+		if (!is_digit(*it))
 			return false;
-		}
-		else
-		{
-			req.headers.back().value.push_back(input);
-			return boost::indeterminate;
-		}
-	case expecting_newline_2:
-		if (input == '\n')
-		{
-			state_ = header_line_start;
-			return boost::indeterminate;
-		}
-		else
-		{
+		content_length_ = content_length_ * 10 + (*it - '0');
+		if (content_length_ > max_body_size_) {
+			LOG_WARN("RequestParser::parse_content_length: body exceeds " << max_body_size_ << " bytes");
+			body_too_large_ = true;
 			return false;
 		}
-	case expecting_newline_3:
-		return (input == '\n');
-	default:
-		return false;
 	}
+	return true;
+}
+
+bool RequestParser::parse_body(Request & req, char * begin, char * end)
+{
+	if (begin == end)
+		return true;
+	
+	boost::string_ref type = req.header("Content-Type");
+	type = type.substr(0, type.find(';'));
+	while (!type.empty() && type.back() == ' ')
+		type.remove_suffix(1);
+	
+	if (EqualsIgnoreCase(type, "application/x-www-form-urlencoded"))
+		return parseQuery(req, boost::string_ref(begin, end - begin));
+	if (EqualsIgnoreCase(type, "application/json"))
+		return parse_json_body(req, begin, end);
+	return true;
 }
 
-bool RequestParser::is_char(int c)
+bool RequestParser::parse_json_body(Request & req, char * begin, char * end)
 {
-	return c >= 0 && c <= 127;
+	// The reader takes a NUL byte for the end of the text
+	if (memchr(begin, '\0', end - begin))
+		return false;
+	
+	JsonBodyStream::Position position = { begin, end, begin, NULL };
+	JsonBodyStream stream(position);
+	JsonArgumentsHandler handler(req, position);
+	rapidjson::Reader reader;
+	if (!reader.Parse<rapidjson::kParseInsituFlag>(stream, handler)) {
+		LOG_WARN("RequestParser::parse_json_body: " << reader.GetParseError() << " at " << reader.GetErrorOffset());
+		return false;
+	}
+	return !handler.failed_;
 }
 
-bool RequestParser::is_ctl(int c)
+const char * RequestParser::find_head_end(const char * begin, const char * end)
 {
-	return (c >= 0 && c <= 31) || (c == 127);
+	const char * it = begin;
+#ifdef __SSE2__
+	// Compare 16 bytes at once against '\r', then check the candidates
+	const __m128i cr = _mm_set1_epi8('\r');
+	for (; it + 16 <= end; it += 16) {
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, cr));
+		while (mask) {
+			const char * candidate = it + __builtin_ctz(mask);
+			if (candidate + 4 > end)
+				return NULL;
+			if (candidate[1] == '\n' && candidate[2] == '\r' && candidate[3] == '\n')
+				return candidate;
+			mask &= mask - 1;
+		}
+	}
+#endif
+	for (; it + 4 <= end; ++it) {
+		it = static_cast<const char *>(memchr(it, '\r', end - it));
+		if (!it || it + 4 > end)
+			return NULL;
+		if (it[1] == '\n' && it[2] == '\r' && it[3] == '\n')
+			return it;
+	}
+	return NULL;
 }
 
-bool RequestParser::is_tspecial(int c)
+bool RequestParser::parse_head(Request& req, const char * begin, const char * end)
 {
-	switch (c)
-	{
-	case '(': case ')': case '<': case '>': case '@':
-	case ',': case ';': case ':': case '\\': case '"':
-	case '/': case '[': case ']': case '?': case '=':
-	case '{': case '}': case ' ': case '\t':
-		return true;
-	default:
+	const char * it = begin;
+	
+	// Method
+	const char * token = it;
+	while (it != end && is_token(*it))
+		++it;
+	if (it == token || it == end || *it != ' ')
 		return false;
+	req.method = boost::string_ref(token, it - token);
+	
+	// Uri
+	token = ++it;
+	while (it != end && *it != ' ') {
+		if (is_ctl(*it))
+			return false;
+		++it;
 	}
+	if (it == token || it == end)
+		return false;
+	req.uri = boost::string_ref(token, it - token);
+	
+	// HTTP version, the line ends at the first '\r'
+	++it;
+	if (end - it < 8 || memcmp(it, "HTTP/", 5) != 0)
+		return false;
+	it += 5;
+	req.http_version_major = 0;
+	req.http_version_minor = 0;
+	if (it == end || !is_digit(*it))
+		return false;
+	while (it != end && is_digit(*it))
+		req.http_version_major = req.http_version_major * 10 + *it++ - '0';
+	if (it == end || *it != '.')
+		return false;
+	++it;
+	if (it == end || !is_digit(*it))
+		return false;
+	while (it != end && is_digit(*it))
+		req.http_version_minor = req.http_version_minor * 10 + *it++ - '0';
+	
+	// Headers, each "name: value\r\n". The head end points at the last
+	// "\r\n\r\n", so every line, including the request line, ends in '\r'.
+	while (it != end) {
+		if (end - it < 2 || it[0] != '\r' || it[1] != '\n')
+			return false;
+		it += 2;
+		if (it == end)
+			break;
+		
+		// Folded (obsolete) header lines can not be kept as views, reject them
+		token = it;
+		while (it != end && is_token(*it))
+			++it;
+		if (it == token || it == end || *it != ':')
+			return false;
+		HeaderRef header;
+		header.name = boost::string_ref(token, it - token);
+		
+		++it;
+		while (it != end && (*it == ' ' || *it == '\t'))
+			++it;
+		token = it;
+		const char * line_end = static_cast<const char *>(memchr(it, '\r', end - it));
+		if (!line_end)
+			line_end = end;
+		for (; it != line_end; ++it)
+			if (is_ctl(*it) && *it != '\t')
+				return false;
+		const char * value_end = line_end;
+		while (value_end != token && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+			--value_end;
+		header.value = boost::string_ref(token, value_end - token);
+		req.headers.push_back(header);
+	}
+	return true;
+}
+
+bool RequestParser::is_token(unsigned char c)
+{
+	// Characters but controls and tspecials: ()<>@,;:\"/[]?={} SP HT
+	static const bool table[256] = {
+		// 0x00 - 0x1f: controls
+		0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+		// SP ! " # $ % & ' ( ) * + , - . /
+		0,1,0,1,1,1,1,1,0,0,1,1,0,1,1,0,
+		// 0-9 : ; < = > ?
+		1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,0,
+		// @ A-O
+		0,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+		// P-Z [ \ ] ^ _
+		1,1,1,1,1,1,1,1,1,1,1,0,0,0,1,1,
+		// ` a-o
+		1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+		// p-z { | } ~ DEL
+		1,1,1,1,1,1,1,1,1,1,1,0,1,0,1,0
+		// 0x80 - 0xff: not characters, zero initialised
+	};
+	return table[c];
+}
+
+bool RequestParser::is_ctl(unsigned char c)
+{
+	return c <= 31 || c == 127;
 }
 
-bool RequestParser::is_digit(int c)
+bool RequestParser::is_digit(unsigned char c)
 {
 	return c >= '0' && c <= '9';
 }
@@ -342,19 +440,16 @@ bool RequestParser::is_digit(int c)
 bool RequestParser::enhace_Request(Request & req)
 {
 	// Split get arguments
-	std::string uri_path, uri_arguments;
+	boost::string_ref uri_arguments;
 	
-	LOG("incomming connection from " << req.remote_endpoint);
-	LOG("request uri: " << req.uri);
+	LOG_VERBOSE("incomming connection from " << req.remote_endpoint);
+	LOG_VERBOSE("request uri: " << req.uri);
 	
-	std::size_t arguments_start = req.uri.find_first_of("?");
-	if (arguments_start != std::string::npos) {
-		uri_path = req.uri.substr(0, arguments_start);
+	std::size_t arguments_start = req.uri.find('?');
+	if (arguments_start != boost::string_ref::npos) {
 		uri_arguments = req.uri.substr(arguments_start + 1);
-	} else {
-		uri_path = req.uri;
+		req.uri = req.uri.substr(0, arguments_start);
 	}
-	req.uri = uri_path;
 	
 	// Translate uri.
 	if (!url_decode(req.uri, req.decoded_uri))
@@ -377,124 +472,145 @@ bool RequestParser::enhace_Request(Request & req)
 		req.root_folder = req.decoded_uri.substr(1, req.decoded_uri.length() - 1);
 	}
 	
+	// HTTP/1.1 connections are persistent unless the client asks otherwise
+	req.keep_alive = req.http_version_major > 1
+		|| (req.http_version_major == 1 && req.http_version_minor >= 1);
+	
 	// Extract interesting headers
-	for (std::vector<Header>::const_iterator headerIt = req.headers.begin(); headerIt != req.headers.end(); ++headerIt) {
-		if (headerIt->name == "Cookie") {
+	for (std::vector<HeaderRef>::const_iterator headerIt = req.headers.begin(); headerIt != req.headers.end(); ++headerIt) {
+		if (EqualsIgnoreCase(headerIt->name, "Connection")) {
+			if (ContainsIgnoreCase(headerIt->value, "close"))
+				req.keep_alive = false;
+			else if (ContainsIgnoreCase(headerIt->value, "keep-alive"))
+				req.keep_alive = true;
+		} else if (headerIt->name == "Cookie") {
 			parse_cookies(req, headerIt->value);
 		} else if (headerIt->name == "Referer") {
 			req.referer = ParseUrlDomain(headerIt->value);
-			LOG("header " << headerIt->name << ": " << headerIt->value << " as domain " << req.referer);
+			LOG_VERBOSE("header " << headerIt->name << ": " << headerIt->value << " as domain " << req.referer);
 		} else if (headerIt->name == "Origin") {
 			req.origin = ParseUrlDomain(headerIt->value);
-			LOG("header " << headerIt->name << ": " << headerIt->value<< " as domain " << req.origin);
+			LOG_VERBOSE("header " << headerIt->name << ": " << headerIt->value<< " as domain " << req.origin);
 		}
 	}
 		
 	
 	// Extract arguments
-	if (!uri_arguments.empty()) {
-		std::string arg, deco_arg, value, deco_value;
+	return parseQuery(req, uri_arguments);
+}
+
+bool RequestParser::parseQuery(Request& req, boost::string_ref query)
+{
+	if (query.empty())
+		return true;
+	
+	// Decoding never grows the text, so the views stay valid
+	req.decoded_arguments.reserve(req.decoded_arguments.size() + query.size());
+	
+	boost::string_ref remaining = query;
+	while (!remaining.empty()) {
+		std::size_t next_and = remaining.find('&');
+		boost::string_ref pair = remaining.substr(0, next_and);
+		remaining.remove_prefix(next_and == boost::string_ref::npos ? remaining.size() : next_and + 1);
+		if (pair.empty())
+			continue;
 		
-		std::size_t cur_pointer = 0;
+		// Check syntax
+		std::size_t next_equal = pair.find('=');
+		if (next_equal == boost::string_ref::npos || next_equal == 0)
+			return false;
 		
-		while (cur_pointer != std::string::npos && cur_pointer + 1 < uri_arguments.length()) {
-			std::size_t next_and = uri_arguments.find("&", cur_pointer+1);
-			std::size_t next_equal = uri_arguments.find("=", cur_pointer+1);
-			
-			// Check syntax
-			if (next_equal == std::string::npos
-				|| ((int)cur_pointer > (int)next_equal - 1)
-				|| (next_and != std::string::npos && (int)next_equal > (int)next_and - 1))
-				return false;
-			
-			// Extract argument-value
-			arg = uri_arguments.substr(cur_pointer, next_equal - cur_pointer);
-			if (next_and != std::string::npos && (int)next_equal == (int)next_and - 1)
-				value = std::string();
-			else {
-				if (next_and != std::string::npos)
-					value = uri_arguments.substr(next_equal + 1, next_and - next_equal - 1);
-				else
-					value = uri_arguments.substr(next_equal + 1);
-			}
-
-			// Decode and insert argument
-			if (!url_decode(arg, deco_arg) || !url_decode(value, deco_value))
-				return false;
-			req.arguments[deco_arg] = deco_value;
-			
-			cur_pointer = (next_and != std::string::npos? next_and + 1 : next_and);
-		}
+		// Decode and insert argument
+		RequestArgument argument;
+		if (!decode_argument(req, pair.substr(0, next_equal), argument.name)
+				|| !decode_argument(req, pair.substr(next_equal + 1), argument.value))
+			return false;
+		req.arguments.push_back(argument);
 	}
-	
 	return true;
 }
 
-bool RequestParser::url_decode(const std::string& in, std::string& out)
+/// Value of each hexadecimal digit, -1 for any other byte.
+struct HexDigits
+{
+	HexDigits() {
+		memset(value, -1, sizeof(value));
+		for (int c = 0; c < 10; ++c)
+			value['0' + c] = c;
+		for (int c = 0; c < 6; ++c)
+			value['a' + c] = value['A' + c] = 10 + c;
+	}
+	signed char value[256];
+};
+static const HexDigits hex_digits;
+
+bool RequestParser::url_decode(boost::string_ref in, std::string& out)
 {
 	out.clear();
 	out.reserve(in.size());
-	for (std::size_t i = 0; i < in.size(); ++i)
-	{
-		if (in[i] == '%')
-		{
-			if (i + 3 <= in.size())
-			{
-				int value = 0;
-				std::istringstream is(in.substr(i + 1, 2));
-				if (is >> std::hex >> value)
-				{
-					out += static_cast<char>(value);
-					i += 2;
-				}
-				else
-				{
-					return false;
-				}
-			}
-			else
-			{
-				return false;
-			}
-		}
-		else if (in[i] == '+')
-		{
+	return url_decode_append(in, out);
+}
+
+bool RequestParser::url_decode_append(boost::string_ref in, std::string& out)
+{
+	const char * it = in.begin();
+	const char * end = in.end();
+	while (it != end) {
+		// Copy the plain run at once
+		const char * run = it;
+		while (it != end && *it != '%' && *it != '+')
+			++it;
+		out.append(run, it);
+		if (it == end)
+			break;
+		
+		if (*it == '+') {
 			out += ' ';
+			++it;
+			continue;
 		}
-		else
-		{
-			out += in[i];
-		}
+		if (end - it < 3)
+			return false;
+		int high = hex_digits.value[(unsigned char)it[1]];
+		int low = hex_digits.value[(unsigned char)it[2]];
+		if (high < 0 || low < 0)
+			return false;
+		out += static_cast<char>(high * 16 + low);
+		it += 3;
 	}
 	return true;
 }
 
-bool RequestParser::parse_cookies(Request & req, const std::string& cookies) {
-	size_t pos = 0;
-	while (pos != std::string::npos && pos < cookies.size()) {
-		size_t it = cookies.find_first_of('=', pos);
-		if (it != std::string::npos) {
-			std::string name = cookies.substr(pos, it-pos);
-			if (it + 1 < cookies.size()) {
-				pos = it + 1;
-				it = cookies.find_first_of(';', pos);
-				if (it != std::string::npos) {
-					std::string value = cookies.substr(pos, it-pos);
-					req.cookies[name] = value;
-					pos = it + 1;
-					while (pos < cookies.size() && cookies[pos] == ' ')
-						++pos;
-				} else {
-					if (pos < cookies.size()) {
-						std::string value = cookies.substr(pos, cookies.size()-pos);
-						req.cookies[name] = value;
-						pos = std::string::npos;
-					}
-					pos = it;
-				}
-			} else pos = it;
-		} else pos = it;
+bool RequestParser::decode_argument(Request & req, boost::string_ref in, boost::string_ref & out)
+{
+	if (in.find('%') == boost::string_ref::npos && in.find('+') == boost::string_ref::npos) {
+		out = in;
+		return true;
 	}
+	std::size_t start = req.decoded_arguments.size();
+	if (!url_decode_append(in, req.decoded_arguments))
+		return false;
+	out = boost::string_ref(req.decoded_arguments.data() + start, req.decoded_arguments.size() - start);
+	return true;
+}
+
+bool RequestParser::parse_cookies(Request & req, boost::string_ref cookies) {
+	while (!cookies.empty()) {
+		std::size_t next_semicolon = cookies.find(';');
+		boost::string_ref pair = cookies.substr(0, next_semicolon);
+		cookies.remove_prefix(next_semicolon == boost::string_ref::npos ? cookies.size() : next_semicolon + 1);
+		while (!cookies.empty() && cookies[0] == ' ')
+			cookies.remove_prefix(1);
+		
+		std::size_t next_equal = pair.find('=');
+		if (next_equal == boost::string_ref::npos)
+			continue;
+		RequestArgument cookie;
+		cookie.name = pair.substr(0, next_equal);
+		cookie.value = pair.substr(next_equal + 1);
+		req.cookies.push_back(cookie);
+	}
+	return true;
 }
 
 } // namespace server
@@ -16,6 +16,7 @@
 
 #include <boost/logic/tribool.hpp>
 #include <boost/tuple/tuple.hpp>
+#include <boost/utility/string_ref.hpp>
 #include <string>
 
 #include "Request.h"
@@ -25,7 +26,11 @@ namespace server {
 
 struct Request;
 
-/// Parser for incoming Requests.
+/// Parser for incoming Requests. The Request head is only parsed once it has
+/// been fully received; method, uri and headers are left pointing into the
+/// parsed bytes, so nothing is copied and no string is built per header.
+/// A body announced by Content-Length is awaited too, and its arguments are
+/// added to the ones of the uri when it is form url encoded or a JSON object.
 class RequestParser
 {
 public:
@@ -37,81 +42,92 @@ public:
 
 	/// Parse some data. The tribool return value is true when a complete Request
 	/// has been parsed, false if the data is invalid, indeterminate when more
-	/// data is required. The InputIterator return value indicates how much of the
-	/// input has been consumed.
-	template <typename InputIterator>
-	boost::tuple<boost::tribool, InputIterator> parse(Request& req,
-			InputIterator begin, InputIterator end)
-	{    
-		SetRequestSeqNumber(req.seq_number);
-		
-		while (begin != end)
-		{
-			boost::tribool result = consume(req, *begin++);
-			if (result || !result) {
-				if (result)
-					result = enhace_Request(req);
-				return boost::make_tuple(result, begin);
-			}
-		}
-		boost::tribool result = boost::indeterminate;
-		return boost::make_tuple(result, begin);
-	}
-	
-	static std::string ParseUrlDomain(const std::string & url_s);
+	/// data is required. The returned pointer indicates how much of the input
+	/// has been consumed: nothing until the head and body are complete, so the
+	/// caller must keep [begin, end) and call again with the same begin and
+	/// more data appended (the bytes may be moved in between). JSON bodies are
+	/// decoded in place.
+	boost::tuple<boost::tribool, const char *> parse(Request& req,
+			char * begin, char * end);
+	
+	/// Bytes the current Request takes, head and body, once its head has been
+	/// received. 0 while the head is incomplete.
+	std::size_t expected_size() const;
+	
+	/// Whether parse failed because the body exceeds the size limit.
+	bool body_too_large() const;
+	
+	/// Whether the client waits for "100 Continue" before sending the body.
+	/// True once per Request.
+	bool expects_continue();
+	
+	/// Largest body accepted, in bytes.
+	static void setMaxBodySize(std::size_t max_body_size);
+	
+	static std::string ParseUrlDomain(boost::string_ref url_s);
+	
+	/// Decode the arguments of a query string into req.arguments. They keep
+	/// pointing into query, which must outlive req. Parsing several queries
+	/// into one Request needs req.decoded_arguments reserved for all of them
+	/// upfront.
+	bool parseQuery(Request& req, boost::string_ref query);
 	
 	// fake parser for debug only
 	void parseGetString(Request& req, const std::string & get_request);
 
 private:
+	/// Split a complete Request head, ending at the empty line, into req.
+	bool parse_head(Request& req, const char * begin, const char * end);
+	
 	/// Decode uri and extract meaningfull fields.
 	bool enhace_Request(Request & req);
 	
+	/// Read Content-Length into content_length_.
+	bool parse_content_length(Request & req);
+	
+	/// Add the arguments of a body to req, by its Content-Type.
+	bool parse_body(Request & req, char * begin, char * end);
+	
+	/// Add the members of a JSON object body to req, decoded in place.
+	bool parse_json_body(Request & req, char * begin, char * end);
+	
 	/// Decode and map cookies
-	bool parse_cookies(Request & req, const std::string& cookies);
+	bool parse_cookies(Request & req, boost::string_ref cookies);
 	
-	/// Decode uri and extract meaningfull fields.
-	bool url_decode(const std::string& in, std::string& out);
+	/// Decode an url encoded string into out.
+	bool url_decode(boost::string_ref in, std::string& out);
+	
+	/// Decode an url encoded string at the end of out.
+	static bool url_decode_append(boost::string_ref in, std::string& out);
+	
+	/// Point out at in, or at its decoded copy in req.decoded_arguments when
+	/// in has escapes.
+	static bool decode_argument(Request & req, boost::string_ref in, boost::string_ref & out);
 	
-	/// Handle the next character of input.
-	boost::tribool consume(Request& req, char input);
+	/// Find the CRLFCRLF ending a Request head, 16 bytes at a time.
+	static const char * find_head_end(const char * begin, const char * end);
 
-	/// Check if a byte is an HTTP character.
-	static bool is_char(int c);
+	/// Check if a byte is allowed in an HTTP token (method, header name).
+	static bool is_token(unsigned char c);
 
 	/// Check if a byte is an HTTP control character.
-	static bool is_ctl(int c);
-
-	/// Check if a byte is defined as an HTTP tspecial character.
-	static bool is_tspecial(int c);
+	static bool is_ctl(unsigned char c);
 
 	/// Check if a byte is a digit.
-	static bool is_digit(int c);
+	static bool is_digit(unsigned char c);
 
-	/// The current state of the parser.
-	enum state
-	{
-		method_start,
-		method,
-		uri,
-		http_version_h,
-		http_version_t_1,
-		http_version_t_2,
-		http_version_p,
-		http_version_slash,
-		http_version_major_start,
-		http_version_major,
-		http_version_minor_start,
-		http_version_minor,
-		expecting_newline_1,
-		header_line_start,
-		header_lws,
-		header_name,
-		space_before_header_value,
-		header_value,
-		expecting_newline_2,
-		expecting_newline_3
-	} state_;
+	/// Bytes already searched for the end of the head, not rescanned when
+	/// more data arrives.
+	std::size_t scanned_;
+	
+	/// Length of the head including its final CRLFCRLF, 0 until received.
+	std::size_t head_length_;
+	
+	/// Length of the body announced by the head.
+	std::size_t content_length_;
+	
+	bool body_too_large_;
+	bool expects_continue_;
 };
 
 } // namespace server
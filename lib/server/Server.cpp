@@ -14,12 +14,16 @@
 #include "Log.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <boost/thread/thread.hpp>
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/exception/diagnostic_information.hpp> 
 #include <vector>
+#include <algorithm>
 #include <iostream>
+#include <pthread.h>
+#include <sched.h>
 
 #define DUMP_STACK_FILE "/server/core/yucode-server"
 
@@ -27,12 +31,15 @@ namespace yucode {
 namespace server {
 
 Server::Server(const std::string& address, const std::string& port,
-		const std::string& doc_root, std::size_t thread_pool_size)
+		const std::string& doc_root, std::size_t thread_pool_size,
+		std::size_t worker_pool_size, std::size_t keep_alive_timeout,
+		bool sharded, bool pin_cpus)
 	: thread_pool_size_(thread_pool_size),
+		keep_alive_timeout_(keep_alive_timeout),
+		sharded_(sharded), pin_cpus_(pin_cpus),
+		worker_pool_(worker_pool_size),
 		signals_(io_service_), crash_signals_(io_service_), abort_signals_(io_service_),
-		acceptor_(io_service_),
-		new_Connection_(),
-		ServerContext_(doc_root),
+		ServerContext_(doc_root, &worker_pool_, &admission_control_),
 		RequestHandler_(ServerContext_, this),
 		address_(address), port_(port)
 {
@@ -55,66 +62,161 @@ Server::Server(const std::string& address, const std::string& port,
 	abort_signals_.add(SIGABRT);
 	abort_signals_.async_wait(boost::bind(&Server::handle_abort, this));
 	
-	setup_acceptor();
-	start_accept();
+	if (sharded_) {
+		// A single thread runs each shard: hint asio so it skips the locking
+		if (thread_pool_size_ == 0)
+			thread_pool_size_ = 1;
+		for (std::size_t i = 0; i < thread_pool_size_; ++i) {
+			boost::shared_ptr<boost::asio::io_service> service(
+					new boost::asio::io_service(1));
+			shard_services_.push_back(service);
+			listeners_.push_back(boost::shared_ptr<Listener>(new Listener(*service)));
+		}
+	} else {
+		listeners_.push_back(boost::shared_ptr<Listener>(new Listener(io_service_)));
+	}
+
+	for (std::size_t i = 0; i < listeners_.size(); ++i) {
+		setup_acceptor(*listeners_[i]);
+		start_accept(*listeners_[i]);
+	}
+}
+
+/// Orders routes by path, also against a bare path.
+struct RouteLess {
+	typedef std::pair<std::string, ServiceInterface *> Route;
+	bool operator()(const Route & a, const Route & b) const {
+		return a.first < b.first;
+	}
+	bool operator()(const Route & a, boost::string_ref b) const {
+		return boost::string_ref(a.first) < b;
+	}
+};
+
+void Server::addService(std::shared_ptr<ServiceInterface> service)
+{
+	services_.push_back(service);
+	service->bootStrap();
+	
+	std::string path = service->routePath();
+	if (path.empty()) {
+		unrouted_services_.push_back(service);
+		return;
+	}
+	std::vector<Route>::iterator it = std::lower_bound(routes_.begin(), routes_.end(),
+			boost::string_ref(path), RouteLess());
+	if (it != routes_.end() && it->first == path) {
+		LOG_WARN("Server::addService: path " << path << " already routed, replacing it");
+		it->second = service.get();
+	} else {
+		routes_.insert(it, Route(path, service.get()));
+	}
+}
+
+ServiceInterface * Server::findRoute(boost::string_ref path) const
+{
+	std::vector<Route>::const_iterator it = std::lower_bound(routes_.begin(), routes_.end(),
+			path, RouteLess());
+	if (it != routes_.end() && it->first == path)
+		return it->second;
+	return NULL;
 }
 
 void Server::run()
 {
+	worker_pool_.start();
+
 	// Create a pool of threads to run all of the io_services.
 	std::vector<boost::shared_ptr<boost::thread> > threads;
-	for (std::size_t i = 0; i < thread_pool_size_; ++i)
-	{
+	if (sharded_) {
+		for (std::size_t i = 0; i < shard_services_.size(); ++i)
+		{
+			boost::shared_ptr<boost::thread> thread(new boost::thread(
+						boost::bind(&Server::run_shard, this, i)));
+			threads.push_back(thread);
+		}
+		// Signals are still delivered through the shared io_service
 		boost::shared_ptr<boost::thread> thread(new boost::thread(
 					boost::bind(&boost::asio::io_service::run, &io_service_)));
 		threads.push_back(thread);
+	} else {
+		for (std::size_t i = 0; i < thread_pool_size_; ++i)
+		{
+			boost::shared_ptr<boost::thread> thread(new boost::thread(
+						boost::bind(&boost::asio::io_service::run, &io_service_)));
+			threads.push_back(thread);
+		}
 	}
 
 	// Wait for all threads in the pool to exit.
 	for (std::size_t i = 0; i < threads.size(); ++i)
 		threads[i]->join();
+
+	worker_pool_.stop();
 }
 
-void Server::setup_acceptor()
+void Server::run_shard(std::size_t index)
 {
+	if (pin_cpus_) {
+		unsigned int cpus = boost::thread::hardware_concurrency();
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(cpus ? index % cpus : 0, &cpuset);
+		int error = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+		if (error)
+			LOG_WARN("Server::run_shard: could not pin shard " << index << ": " << strerror(error));
+	}
+	shard_services_[index]->run();
+}
+
+void Server::setup_acceptor(Listener& listener)
+{
+	boost::asio::ip::tcp::acceptor& acceptor = listener.acceptor;
+
 	// Release any previous data
 	boost::system::error_code ignore_error;
-	acceptor_.cancel(ignore_error);	
-	if (acceptor_.is_open()) {
+	acceptor.cancel(ignore_error);	
+	if (acceptor.is_open()) {
 		LOG("Server::setup_acceptor: release previous acceptor");
-		acceptor_.close(ignore_error);
+		acceptor.close(ignore_error);
 	}
 
 	// Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
 	LOG("Server::setup_acceptor: bind acceptor at " << address_ << ":" << port_);
-	boost::asio::ip::tcp::resolver resolver(io_service_);
+	boost::asio::ip::tcp::resolver resolver(listener.io_service);
 	boost::asio::ip::tcp::resolver::query query(address_, port_);
 	boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
-	acceptor_.open(endpoint.protocol());
-	acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-	acceptor_.bind(endpoint);
-	acceptor_.listen();
+	acceptor.open(endpoint.protocol());
+	acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+	if (sharded_) {
+		// Every shard binds the same port, the kernel spreads the Connections
+		typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+		acceptor.set_option(reuse_port(true));
+	}
+	acceptor.bind(endpoint);
+	acceptor.listen();
 }
 
-void Server::start_accept()
+void Server::start_accept(Listener& listener)
 {
-	new_Connection_.reset(new Connection(io_service_, RequestHandler_));
-	acceptor_.async_accept(new_Connection_->socket(),
-			boost::bind(&Server::handle_accept, this,
+	listener.new_Connection.reset(new Connection(listener.io_service,
+				RequestHandler_, worker_pool_, admission_control_, keep_alive_timeout_));
+	listener.acceptor.async_accept(listener.new_Connection->socket(),
+			boost::bind(&Server::handle_accept, this, boost::ref(listener),
 				boost::asio::placeholders::error));
 }
 
-void Server::handle_accept(const boost::system::error_code& e)
+void Server::handle_accept(Listener& listener, const boost::system::error_code& e)
 {
 	try {
 		if (!e){
-			new_Connection_->start();
-			start_accept();
+			listener.new_Connection->start();
+			start_accept(listener);
 		}
 	} catch(...) {
 		LOG_ERROR_CRITICAL("Server::handle_accept: Exception catched: " << boost::current_exception_diagnostic_information());
-		setup_acceptor();
-		start_accept();
+		setup_acceptor(listener);
+		start_accept(listener);
 		//io_service_.stop();
 	}
 }
@@ -122,6 +224,8 @@ void Server::handle_accept(const boost::system::error_code& e)
 void Server::handle_stop()
 {
 	LOG("Server shutdown");
+	for (std::size_t i = 0; i < shard_services_.size(); ++i)
+		shard_services_[i]->stop();
 	io_service_.stop();
 }
 
@@ -20,10 +20,13 @@
 #include <memory>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/utility/string_ref.hpp>
+#include "AdmissionControl.h"
 #include "Connection.h"
 #include "RequestHandler.h"
 #include "ServerContext.h"
 #include "ServiceInterface.h"
+#include "WorkerPool.h"
 
 namespace yucode {
 namespace server {
@@ -33,29 +36,68 @@ class Server
 {
 public:
 	/// Construct the Server to listen on the specified TCP address and port, and
-	/// serve up files from the given directory.
+	/// serve up files from the given directory. thread_pool_size threads run
+	/// the socket I/O while worker_pool_size threads run the service handlers.
+	/// Idle persistent Connections are closed after keep_alive_timeout seconds.
+	/// When sharded, every I/O thread owns its io_service and a SO_REUSEPORT
+	/// acceptor, so the kernel balances Connections across them; pin_cpus
+	/// additionally binds each of those threads to its own CPU.
 	explicit Server(const std::string& address, const std::string& port,
-			const std::string& doc_root, std::size_t thread_pool_size);
+			const std::string& doc_root, std::size_t thread_pool_size,
+			std::size_t worker_pool_size, std::size_t keep_alive_timeout = 15,
+			bool sharded = false, bool pin_cpus = false);
 
 	/// Run the Server's io_service loop.
 	void run();
 
-	inline void addService(std::shared_ptr<ServiceInterface> service) { 
-		services_.push_back(service);
-		service->bootStrap();
-	}
+	/// Register and boot strap a service. Services are added before run().
+	void addService(std::shared_ptr<ServiceInterface> service);
+	
+	/// Limits applied to Requests before they are queued to the workers.
+	inline AdmissionControl & admissionControl() { return admission_control_; }
+	
+	/// The shared io_service, run in both modes; asynchronous clients such as
+	/// AsyncDataBase are driven by it.
+	inline boost::asio::io_service & ioService() { return io_service_; }
 	
 	inline std::vector<std::shared_ptr<ServiceInterface> > & getServices() { return services_; }
 	
+	/// Services without a routePath, to be asked through matchRequest.
+	inline std::vector<std::shared_ptr<ServiceInterface> > & getUnroutedServices() { return unrouted_services_; }
+	
+	/// Service bound to path by its routePath, NULL if none.
+	ServiceInterface * findRoute(boost::string_ref path) const;
+	
 private:
+	/// An acceptor together with the io_service its Connections run on.
+	/// The shared mode has a single Listener on io_service_; the sharded mode
+	/// has one per I/O thread, each on a private single threaded io_service.
+	struct Listener
+		: private boost::noncopyable
+	{
+		explicit Listener(boost::asio::io_service& io_service)
+			: io_service(io_service), acceptor(io_service), new_Connection() {}
+
+		boost::asio::io_service& io_service;
+
+		/// Acceptor used to listen for incoming Connections.
+		boost::asio::ip::tcp::acceptor acceptor;
+
+		/// The next Connection to be accepted.
+		Connection_ptr new_Connection;
+	};
+
 	/// Configure and bind socket
-	void setup_acceptor();
+	void setup_acceptor(Listener& listener);
 
 	/// Initiate an asynchronous accept operation.
-	void start_accept();
+	void start_accept(Listener& listener);
 
 	/// Handle completion of an asynchronous accept operation.
-	void handle_accept(const boost::system::error_code& e);
+	void handle_accept(Listener& listener, const boost::system::error_code& e);
+
+	/// Body of the I/O thread owning the index-th sharded io_service.
+	void run_shard(std::size_t index);
 
 	/// Handle a Request to stop the Server.
 	void handle_stop();
@@ -67,21 +109,42 @@ private:
 
 private:
 	std::vector<std::shared_ptr<ServiceInterface> > services_;
+	std::vector<std::shared_ptr<ServiceInterface> > unrouted_services_;
+	
+	/// Route paths, sorted for lookup by findRoute.
+	typedef std::pair<std::string, ServiceInterface *> Route;
+	std::vector<Route> routes_;
 	
 	/// The number of threads that will call io_service::run().
 	std::size_t thread_pool_size_;
 
-	/// The io_service used to perform asynchronous operations.
+	/// Seconds an idle Connection is kept open.
+	std::size_t keep_alive_timeout_;
+
+	/// One io_service and acceptor per I/O thread instead of a shared one.
+	bool sharded_;
+
+	/// Pin every sharded I/O thread to a CPU.
+	bool pin_cpus_;
+
+	/// The io_service used to perform asynchronous operations. Only signals
+	/// are handled here when the Server is sharded.
 	boost::asio::io_service io_service_;
 
+	/// Private io_services of the sharded I/O threads.
+	std::vector<boost::shared_ptr<boost::asio::io_service> > shard_services_;
+
+	/// Threads running the RequestHandler, off the io_service threads.
+	WorkerPool worker_pool_;
+
+	/// Decides which Requests are queued to worker_pool_.
+	AdmissionControl admission_control_;
+
 	/// The signal_set is used to register for process termination notifications.
 	boost::asio::signal_set signals_, crash_signals_, abort_signals_;
 
-	/// Acceptor used to listen for incoming Connections.
-	boost::asio::ip::tcp::acceptor acceptor_;
-
-	/// The next Connection to be accepted.
-	Connection_ptr new_Connection_;
+	/// Listening sockets, one per shard or a single shared one.
+	std::vector<boost::shared_ptr<Listener> > listeners_;
 
 	ServerContext ServerContext_;
 	RequestHandler RequestHandler_;
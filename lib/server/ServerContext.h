@@ -18,12 +18,21 @@
 namespace yucode {
 namespace server {
 
+class AdmissionControl;
+class WorkerPool;
+
 struct ServerContext
 {
-	ServerContext(const std::string &doc_root)
-		: doc_root_(doc_root) {}
+	ServerContext(const std::string &doc_root, WorkerPool * worker_pool = NULL,
+			const AdmissionControl * admission_control = NULL)
+		: doc_root_(doc_root), worker_pool_(worker_pool), admission_control_(admission_control) {}
 		
 	std::string doc_root_;
+	/// Pool running the service handlers, for handlers splitting their work.
+	/// NULL when handlers are not run by a Server.
+	WorkerPool * worker_pool_;
+	/// Admission decisions of the Server, for reporting. NULL outside a Server.
+	const AdmissionControl * admission_control_;
 };
 
 } // namespace server
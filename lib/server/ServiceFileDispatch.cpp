@@ -13,10 +13,9 @@
 #include "ServiceFileDispatch.h"
 
 #include <string>
-#include <fstream>
+#include <string.h>
+#include <time.h>
 #include <boost/lexical_cast.hpp>
-#include <boost/filesystem/operations.hpp>
-#include <boost/filesystem/path.hpp>
 #include "mime_types.h"
 
 namespace yucode {
@@ -50,28 +49,59 @@ namespace server {
 			extension = "html";
 		
 		
-		// Open the file to send back.
-		std::string full_path = con.doc_root_ + Request_path;
-		if (boost::filesystem::is_directory(boost::filesystem::path(full_path))) {
-			full_path += "/index.html";
-		}
-		std::ifstream is(full_path.c_str(), std::ios::in | std::ios::binary);
-		if (!is)
+		// Get the file to send back, directories resolve to their index.html.
+		FileCache::CachedFilePtr file = cache_.get(con.doc_root_ + Request_path);
+		if (!file)
 		{
 					rep = Reply::stock_Reply(Reply::not_found);
 					return;
 		}
-
-		// Fill out the Reply to be sent to the client.
-		rep.status = Reply::ok;
-		char buf[512];
-		while (is.read(buf, sizeof(buf)).gcount() > 0)
-			rep.content.append(buf, is.gcount());
-		rep.headers.resize(2);
-		rep.headers[0].name = "Content-Length";
-		rep.headers[0].value = boost::lexical_cast<std::string>(rep.content.size());
-		rep.headers[1].name = "Content-Type";
-		rep.headers[1].value = mime_types::extension_to_type(extension);
+		
+		// Serve the precompressed variant to clients accepting it
+		bool gzip = file->gzip_content
+			&& ContainsIgnoreCase(req.header("Accept-Encoding"), "gzip");
+		const std::string & etag = gzip ? file->gzip_etag : file->etag;
+		
+		if (notModified(req, *file, etag)) {
+			rep = Reply::stock_Reply(Reply::not_modified);
+		} else {
+			// Fill out the Reply to be sent to the client.
+			rep.status = Reply::ok;
+			rep.shared_content = gzip ? file->gzip_content : file->content;
+			addHeader(rep, "Content-Length", boost::lexical_cast<std::string>(rep.shared_content->size()));
+			addHeader(rep, "Content-Type", mime_types::extension_to_type(extension));
+			if (gzip)
+				addHeader(rep, "Content-Encoding", "gzip");
+		}
+		addHeader(rep, "ETag", etag);
+		addHeader(rep, "Last-Modified", file->last_modified);
+		if (file->gzip_content)
+			addHeader(rep, "Vary", "Accept-Encoding");
+	}
+	
+	bool ServiceFileDispatch::notModified(const Request& req, const CachedFile & file, const std::string & etag) {
+		// If-None-Match wins over If-Modified-Since when both are present
+		boost::string_ref if_none_match = req.header("If-None-Match");
+		if (!if_none_match.empty())
+			return if_none_match == "*" || if_none_match.find(etag) != boost::string_ref::npos;
+		
+		boost::string_ref if_modified_since = req.header("If-Modified-Since");
+		if (if_modified_since.empty())
+			return false;
+		if (if_modified_since == file.last_modified)
+			return true;
+		struct tm tm;
+		memset(&tm, 0, sizeof(tm));
+		std::string date = if_modified_since.to_string();
+		if (!strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm))
+			return false;
+		return timegm(&tm) >= file.mtime;
+	}
+	
+	void ServiceFileDispatch::addHeader(Reply& rep, const std::string & name, const std::string & value) {
+		rep.headers.push_back(Header());
+		rep.headers.back().name = name;
+		rep.headers.back().value = value;
 	}
 		
 }
@@ -13,7 +13,9 @@
 #ifndef YUCODE_SERVER_SERVICE_FILE_DISPATCH_H
 #define YUCODE_SERVER_SERVICE_FILE_DISPATCH_H
 
+#include <string>
 #include "ServiceInterface.h"
+#include "FileCache.h"
 
 namespace yucode {
 namespace server {
@@ -25,6 +27,15 @@ namespace server {
 		
 		/// Handle a Request and produce a Reply.
 		void handleRequest(const Request& req, Reply& rep, const ServerContext & con);
+		
+	private:
+		/// Whether the client copy of file, as described by the conditional
+		/// headers of req, is still valid.
+		static bool notModified(const Request& req, const CachedFile & file, const std::string & etag);
+		
+		static void addHeader(Reply& rep, const std::string & name, const std::string & value);
+		
+		FileCache cache_;
 	};
 	
 }
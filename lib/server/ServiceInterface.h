@@ -26,9 +26,22 @@ namespace server {
 		/// Returns whether this service applies to req.
 		virtual bool matchRequest(const Request& req) const = 0;
 		
+		/// Path served by this service. The Server routes Requests for it
+		/// without calling matchRequest; empty to be matched by matchRequest.
+		virtual std::string routePath() const {
+			return std::string();
+		}
+		
 		/// Handle a Request and produce a Reply.
 		virtual void handleRequest(const Request& req, Reply& rep, const ServerContext & con) = 0;
 		
+		/// Whether a WebSocket may be opened on routePath for the upgrade
+		/// Request req. userId receives the user the socket acts for and whose
+		/// pushes it receives.
+		virtual bool acceptWebSocket(const Request& req, unsigned long long & userId) {
+			return false;
+		}
+		
 		virtual void bootStrap() {
 		}
 	};
@@ -0,0 +1,114 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "ServiceMetrics.h"
+#include <sstream>
+#include <boost/lexical_cast.hpp>
+#include "AdmissionControl.h"
+#include "ContentEncoding.h"
+#include "Metrics.h"
+#include "database/DataBase.h"
+#ifdef YUCODE_MYSQL_NONBLOCK
+#include "database/AsyncDataBase.h"
+#endif
+
+namespace yucode {
+namespace server {
+
+	void ServiceMetrics::handleRequest(const Request& req, Reply& rep, const ServerContext & con) {
+		std::ostringstream os;
+		Metrics::singleton().writePrometheus(os);
+		
+		CompressionStats compression = ContentEncoding::stats();
+		os << "# HELP yucode_compressed_replies_total Replies compressed.\n";
+		os << "# TYPE yucode_compressed_replies_total counter\n";
+		os << "yucode_compressed_replies_total " << compression.replies << "\n";
+		os << "# HELP yucode_compression_bytes_total Bytes before and after compression.\n";
+		os << "# TYPE yucode_compression_bytes_total counter\n";
+		os << "yucode_compression_bytes_total{side=\"in\"} " << compression.bytes_in << "\n";
+		os << "yucode_compression_bytes_total{side=\"out\"} " << compression.bytes_out << "\n";
+		os << "# HELP yucode_compression_cpu_seconds_total Thread CPU time spent compressing.\n";
+		os << "# TYPE yucode_compression_cpu_seconds_total counter\n";
+		os << "yucode_compression_cpu_seconds_total " << compression.cpu_nanoseconds / 1e9 << "\n";
+		
+		if (con.admission_control_) {
+			AdmissionStats admission = con.admission_control_->stats();
+			os << "# HELP yucode_admitted_total Requests admitted to the workers.\n";
+			os << "# TYPE yucode_admitted_total counter\n";
+			os << "yucode_admitted_total " << admission.admitted << "\n";
+			os << "# HELP yucode_rejected_total Requests answered 503, per reason.\n";
+			os << "# TYPE yucode_rejected_total counter\n";
+			os << "yucode_rejected_total{reason=\"in_flight\"} " << admission.rejected_in_flight << "\n";
+			os << "yucode_rejected_total{reason=\"queue_time\"} " << admission.rejected_queue_time << "\n";
+			os << "# HELP yucode_in_flight Requests queued or running.\n";
+			os << "# TYPE yucode_in_flight gauge\n";
+			os << "yucode_in_flight " << admission.in_flight << "\n";
+		}
+		
+		ConnectionPool & pool = DataBase::singleton().pool();
+		ConnectionPoolStats connections = pool.stats();
+		os << "# HELP yucode_db_pool_connections Data base connections open, per state.\n";
+		os << "# TYPE yucode_db_pool_connections gauge\n";
+		os << "yucode_db_pool_connections{state=\"idle\"} " << connections.idle << "\n";
+		os << "yucode_db_pool_connections{state=\"in_use\"} " << connections.in_use << "\n";
+		os << "# HELP yucode_db_pool_waiting Threads waiting for a data base connection.\n";
+		os << "# TYPE yucode_db_pool_waiting gauge\n";
+		os << "yucode_db_pool_waiting " << connections.waiting << "\n";
+		os << "# HELP yucode_db_pool_checkouts_total Data base connections checked out, per outcome.\n";
+		os << "# TYPE yucode_db_pool_checkouts_total counter\n";
+		os << "yucode_db_pool_checkouts_total{outcome=\"immediate\"} " << connections.checkouts - connections.waits << "\n";
+		os << "yucode_db_pool_checkouts_total{outcome=\"waited\"} " << connections.waits - connections.timeouts << "\n";
+		os << "yucode_db_pool_checkouts_total{outcome=\"timeout\"} " << connections.timeouts << "\n";
+		os << "# HELP yucode_db_pool_connects_total Data base connections opened, per outcome.\n";
+		os << "# TYPE yucode_db_pool_connects_total counter\n";
+		os << "yucode_db_pool_connects_total{outcome=\"success\"} " << connections.connects << "\n";
+		os << "yucode_db_pool_connects_total{outcome=\"failure\"} " << connections.connect_failures << "\n";
+		os << "# HELP yucode_db_pool_ping_failures_total Idle data base connections found lost.\n";
+		os << "# TYPE yucode_db_pool_ping_failures_total counter\n";
+		os << "yucode_db_pool_ping_failures_total " << connections.ping_failures << "\n";
+		os << "# HELP yucode_db_pool_wait_seconds Time spent checking out data base connections.\n";
+		os << "# TYPE yucode_db_pool_wait_seconds histogram\n";
+		Metrics::writeHistogram(os, "yucode_db_pool_wait_seconds", "", pool.waitTime());
+		
+#ifdef YUCODE_MYSQL_NONBLOCK
+		AsyncDataBase & async = AsyncDataBase::singleton();
+		if (async.started()) {
+			AsyncDataBaseStats asyncStats = async.stats();
+			os << "# HELP yucode_db_async_connections Non blocking data base connections open, per state.\n";
+			os << "# TYPE yucode_db_async_connections gauge\n";
+			os << "yucode_db_async_connections{state=\"connecting\"} " << asyncStats.connecting << "\n";
+			os << "yucode_db_async_connections{state=\"idle\"} " << asyncStats.idle << "\n";
+			os << "yucode_db_async_connections{state=\"busy\"} " << asyncStats.busy << "\n";
+			os << "# HELP yucode_db_async_queued Queries waiting for a non blocking data base connection.\n";
+			os << "# TYPE yucode_db_async_queued gauge\n";
+			os << "yucode_db_async_queued " << asyncStats.queued << "\n";
+			os << "# HELP yucode_db_async_queries_total Non blocking queries run, per outcome.\n";
+			os << "# TYPE yucode_db_async_queries_total counter\n";
+			os << "yucode_db_async_queries_total{outcome=\"success\"} " << asyncStats.queries - asyncStats.failures << "\n";
+			os << "yucode_db_async_queries_total{outcome=\"failure\"} " << asyncStats.failures << "\n";
+			os << "# HELP yucode_db_async_query_seconds Time from queueing a non blocking query to its result.\n";
+			os << "# TYPE yucode_db_async_query_seconds histogram\n";
+			Metrics::writeHistogram(os, "yucode_db_async_query_seconds", "", async.queryTime());
+		}
+#endif
+		
+		rep.status = Reply::ok;
+		rep.content = os.str();
+		rep.headers.resize(2);
+		rep.headers[0].name = "Content-Length";
+		rep.headers[0].value = boost::lexical_cast<std::string>(rep.content.size());
+		rep.headers[1].name = "Content-Type";
+		rep.headers[1].value = "text/plain; version=0.0.4";
+	}
+	
+}
+}
@@ -0,0 +1,64 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "ServiceQueryProfile.h"
+#include <sstream>
+#include <boost/lexical_cast.hpp>
+#include <boost/asio/ip/address.hpp>
+#include "Log.h"
+#include "database/QueryProfiler.h"
+
+namespace yucode {
+namespace server {
+
+	/// Whether endpoint is a loopback address, IPv4 mapped ones included as
+	/// dual stack listeners report IPv4 peers that way.
+	static bool isLoopback(const std::string & endpoint) {
+		boost::system::error_code error;
+		boost::asio::ip::address address = boost::asio::ip::address::from_string(endpoint, error);
+		if (error)
+			return false;
+		if (address.is_v6() && address.to_v6().is_v4_mapped())
+			return address.to_v6().to_v4().is_loopback();
+		return address.is_loopback();
+	}
+
+	void ServiceQueryProfile::handleRequest(const Request& req, Reply& rep, const ServerContext & con) {
+		if (!isLoopback(req.remote_endpoint)) {
+			LOG_ERROR_SECURITY("ServiceQueryProfile: denied to " << req.remote_endpoint);
+			rep = Reply::stock_Reply(Reply::forbidden);
+			return;
+		}
+		
+		std::string order = "total";
+		req.loadArgumentVerifyString(order, "order");
+		unsigned int limit = 0;
+		req.loadArgumentVerifyUnsignedInt(limit, "limit");
+		unsigned int reset = 0;
+		req.loadArgumentVerifyUnsignedInt(reset, "reset");
+		
+		std::ostringstream os;
+		QueryProfiler::singleton().write(os, order, limit);
+		if (reset)
+			QueryProfiler::singleton().reset();
+		
+		rep.status = Reply::ok;
+		rep.content = os.str();
+		rep.headers.resize(2);
+		rep.headers[0].name = "Content-Length";
+		rep.headers[0].value = boost::lexical_cast<std::string>(rep.content.size());
+		rep.headers[1].name = "Content-Type";
+		rep.headers[1].value = "text/plain";
+	}
+	
+}
+}
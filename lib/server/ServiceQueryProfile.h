@@ -0,0 +1,41 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef YUCODE_SERVER_SERVICE_QUERY_PROFILE_H
+#define YUCODE_SERVER_SERVICE_QUERY_PROFILE_H
+
+#include <string>
+#include "ServiceInterface.h"
+
+namespace yucode {
+namespace server {
+
+	/// Dumps the QueryProfiler statistics as a text table at /admin/queries,
+	/// to clients on the loopback interface only. Arguments: order (total,
+	/// count, max or rows), limit, and reset=1 to start over afterwards.
+	class ServiceQueryProfile : public ServiceInterface {
+	public:
+		bool matchRequest(const Request& req) const {
+			return false;
+		}
+		
+		std::string routePath() const {
+			return "/admin/queries";
+		}
+		
+		void handleRequest(const Request& req, Reply& rep, const ServerContext & con);
+	};
+	
+}
+}
+
+#endif
@@ -0,0 +1,307 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "Trace.h"
+#include "Log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <unordered_set>
+#include <boost/lexical_cast.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/thread.hpp>
+
+namespace yucode {
+namespace server {
+
+boost::atomic<bool> TraceOn(false);
+
+namespace {
+
+BOOST_STATIC_ASSERT(sizeof(TraceRecord) == 32);
+
+/// Records of a segment file, 4MB.
+const std::size_t segment_records = 128 * 1024;
+
+/// Longest text named, longer ones are truncated.
+const std::size_t max_name = 1024;
+
+const std::size_t name_chunk = 16;
+
+boost::mutex TraceMutex;
+std::string TraceDirectory;
+unsigned TraceSegments = 8;
+/// Bumped on each SetTraceDirectory, threads reopen their segments.
+boost::atomic<unsigned> TraceGeneration(0);
+boost::atomic<uint32_t> TraceThreads(0);
+
+inline uint64_t nanoseconds(clockid_t clock) {
+	timespec now;
+	clock_gettime(clock, &now);
+	return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+inline uint64_t fnv1a(const char * data, std::size_t size) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (std::size_t i = 0; i < size; ++i) {
+		hash ^= static_cast<unsigned char>(data[i]);
+		hash *= 0x100000001b3ULL;
+	}
+	// 0 stands for tracing off
+	return hash ? hash : 1;
+}
+
+inline bool endsWith(const std::string & text, const char * suffix) {
+	std::size_t size = strlen(suffix);
+	return text.size() >= size && text.compare(text.size() - size, size, suffix) == 0;
+}
+
+inline bool isWord(char c) {
+	return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$';
+}
+
+/// Segment files of a thread, mapped one at a time.
+struct TraceThread
+{
+	TraceThread() : index(++TraceThreads), segment(0), fd(-1), records(NULL), next(0),
+		generation(TraceGeneration.load() - 1)
+	{
+		scratch.reserve(256);
+	}
+	
+	~TraceThread() {
+		close();
+	}
+	
+	/// Whether count records fit in the current segment, moving to the next
+	/// one when needed. False when tracing is off or the segment could not
+	/// be opened.
+	bool ready(std::size_t count) {
+		unsigned current = TraceGeneration.load(boost::memory_order_acquire);
+		if (generation != current) {
+			close();
+			generation = current;
+			open();
+		} else if (records && next + count > segment_records) {
+			open();
+		}
+		return records != NULL;
+	}
+	
+	TraceRecord * reserve(std::size_t count) {
+		if (!ready(count))
+			return NULL;
+		TraceRecord * record = records + next;
+		next += count;
+		return record;
+	}
+	
+	/// Name fingerprint in the current segment unless already done. Names
+	/// are repeated in each segment, so that each one decodes alone.
+	void name(uint64_t fingerprint, const char * text, std::size_t size) {
+		if (size > max_name)
+			size = max_name;
+		std::size_t chunks = (size + name_chunk - 1) / name_chunk;
+		if (!ready(chunks + 1) || !named.insert(fingerprint).second)
+			return;
+		TraceRecord * record = reserve(chunks);
+		for (std::size_t at = 0; at < size; at += name_chunk, ++record) {
+			std::size_t length = std::min(name_chunk, size - at);
+			memset(record, 0, sizeof(TraceRecord));
+			memcpy(&record->timestamp, text + at, length);
+			record->argument = fingerprint;
+			record->thread = index;
+			record->length = static_cast<uint16_t>(length);
+			record->event = TraceName;
+		}
+	}
+	
+	void open() {
+		close();
+		std::string directory;
+		unsigned segments;
+		{
+			boost::mutex::scoped_lock lock(TraceMutex);
+			directory = TraceDirectory;
+			segments = TraceSegments;
+		}
+		if (directory.empty())
+			return;
+		if (segment >= segments)
+			unlink(path(directory, segment - segments).c_str());
+		std::string file = path(directory, segment++);
+		std::size_t size = segment_records * sizeof(TraceRecord);
+		fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || ftruncate(fd, size)) {
+			LOG_ERROR("Trace segment " << file << " could not be created: " << strerror(errno));
+			close();
+			return;
+		}
+		void * map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			LOG_ERROR("Trace segment " << file << " could not be mapped: " << strerror(errno));
+			close();
+			return;
+		}
+		records = static_cast<TraceRecord *>(map);
+		next = 1;
+		named.clear();
+		
+		TraceRecord & header = records[0];
+		header.timestamp = nanoseconds(CLOCK_MONOTONIC);
+		header.seq_number = nanoseconds(CLOCK_REALTIME);
+		header.argument = TraceMagic;
+		header.thread = index;
+		header.length = TraceVersion;
+		header.event = TraceHeader;
+	}
+	
+	/// Unmap the segment, cutting the file to the records written.
+	void close() {
+		if (records) {
+			munmap(records, segment_records * sizeof(TraceRecord));
+			if (ftruncate(fd, next * sizeof(TraceRecord))) {}
+			records = NULL;
+		}
+		if (fd >= 0)
+			::close(fd);
+		fd = -1;
+		next = 0;
+	}
+	
+	std::string path(const std::string & directory, unsigned number) const {
+		return directory + "/trace-" + boost::lexical_cast<std::string>(getpid()) + "-"
+			+ boost::lexical_cast<std::string>(index) + "-"
+			+ boost::lexical_cast<std::string>(number) + ".bin";
+	}
+	
+	uint32_t index;
+	unsigned segment;
+	int fd;
+	TraceRecord * records;
+	std::size_t next;
+	unsigned generation;
+	/// Fingerprints named in the current segment.
+	std::unordered_set<uint64_t> named;
+	std::string scratch;
+};
+
+__thread TraceThread * CurrentTraceThread = NULL;
+
+TraceThread & currentTraceThread() {
+	if (!CurrentTraceThread) {
+		// Unmaps the segment of each thread when it exits
+		static boost::thread_specific_ptr<TraceThread> * threads = new boost::thread_specific_ptr<TraceThread>();
+		threads->reset(new TraceThread());
+		CurrentTraceThread = threads->get();
+	}
+	return *CurrentTraceThread;
+}
+
+} // namespace
+
+void SetTraceDirectory(const std::string & directory, unsigned segments)
+{
+	{
+		boost::mutex::scoped_lock lock(TraceMutex);
+		TraceDirectory = directory;
+		TraceSegments = segments ? segments : 1;
+	}
+	TraceGeneration.fetch_add(1, boost::memory_order_release);
+	TraceOn.store(!directory.empty(), boost::memory_order_relaxed);
+}
+
+void TraceWrite(TraceEvent event, uint64_t argument)
+{
+	TraceThread & thread = currentTraceThread();
+	TraceRecord * record = thread.reserve(1);
+	if (!record)
+		return;
+	record->timestamp = nanoseconds(CLOCK_MONOTONIC);
+	record->seq_number = LogSeqNumber;
+	record->argument = argument;
+	record->thread = thread.index;
+	record->length = 0;
+	record->event = event;
+}
+
+uint64_t TraceFingerprint(const char * statement, std::string & normalized)
+{
+	normalized.clear();
+	for (const char * c = statement; *c; ) {
+		if (*c == '\'' || *c == '"') {
+			// String literal, quotes escaped by a backslash or doubled
+			char quote = *c++;
+			while (*c) {
+				if (*c == '\\' && c[1])
+					c += 2;
+				else if (*c == quote && c[1] == quote)
+					c += 2;
+				else if (*c++ == quote)
+					break;
+			}
+		} else if (isdigit(static_cast<unsigned char>(*c))
+		           && (normalized.empty() || !isWord(normalized[normalized.size() - 1]))) {
+			while (isalnum(static_cast<unsigned char>(*c)) || *c == '.')
+				++c;
+		} else if (isspace(static_cast<unsigned char>(*c))) {
+			while (isspace(static_cast<unsigned char>(*c)))
+				++c;
+			if (!normalized.empty() && *c)
+				normalized.push_back(' ');
+			continue;
+		} else {
+			normalized.push_back(*c++);
+			// Rows of a multiple row insert: (?),(?) is (?)
+			if (normalized[normalized.size() - 1] == ')') {
+				if (endsWith(normalized, "(?),(?)"))
+					normalized.resize(normalized.size() - 4);
+				else if (endsWith(normalized, "(?), (?)"))
+					normalized.resize(normalized.size() - 5);
+			}
+			continue;
+		}
+		// Lists of literals: ?,? is ?
+		if (endsWith(normalized, "?,"))
+			normalized.resize(normalized.size() - 1);
+		else if (endsWith(normalized, "?, "))
+			normalized.resize(normalized.size() - 2);
+		else
+			normalized.push_back('?');
+	}
+	return fnv1a(normalized.data(), normalized.size());
+}
+
+uint64_t TraceStatement(const char * statement)
+{
+	if (!TraceEnabled())
+		return 0;
+	TraceThread & thread = currentTraceThread();
+	uint64_t fingerprint = TraceFingerprint(statement, thread.scratch);
+	thread.name(fingerprint, thread.scratch.data(), thread.scratch.size());
+	return fingerprint;
+}
+
+uint64_t TraceLabel(const char * label, std::size_t size)
+{
+	if (!TraceEnabled())
+		return 0;
+	uint64_t fingerprint = fnv1a(label, size);
+	currentTraceThread().name(fingerprint, label, size);
+	return fingerprint;
+}
+
+} // namespace server
+} // namespace yucode
@@ -0,0 +1,139 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef YUCODE_SERVER_TRACE_H
+#define YUCODE_SERVER_TRACE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <boost/atomic.hpp>
+
+namespace yucode {
+namespace server {
+
+/// Binary trace events. The values are part of the file format read by
+/// yucode-trace-decoder, append new ones at the end.
+enum TraceEvent {
+	TraceEmpty = 0,		///< Unwritten record, the rest of the segment is empty
+	TraceHeader,		///< First record of a segment
+	TraceName,		///< Chunk of the text a fingerprint stands for
+	TraceRequestBegin,	///< argument: fingerprint of the method or path
+	TraceRequestEnd,	///< argument: reply status
+	TraceQueryBegin,	///< argument: statement fingerprint
+	TraceQueryEnd,		///< argument: statement fingerprint
+	TraceLockWaitBegin,	///< argument: fingerprint of the lock name
+	TraceLockWaitEnd	///< argument: fingerprint of the lock name
+};
+
+/// Format version, in the length of TraceHeader records.
+const uint16_t TraceVersion = 1;
+
+/// "YUCTRACE", in the argument of TraceHeader records.
+const uint64_t TraceMagic = 0x4543415254435559ULL;
+
+/// A trace record, 32 bytes in host byte order.
+///
+/// TraceHeader records carry CLOCK_MONOTONIC in timestamp and the matching
+/// CLOCK_REALTIME in seq_number, both in nanoseconds. TraceName records carry
+/// up to 16 bytes of text in place of timestamp and seq_number, length
+/// says how many, and the fingerprint named in argument. Longer texts take
+/// several consecutive records.
+struct TraceRecord {
+	uint64_t timestamp;	///< CLOCK_MONOTONIC, in nanoseconds
+	uint64_t seq_number;	///< Request being handled, 0 outside requests
+	uint64_t argument;
+	uint32_t thread;	///< Index of the tracing thread, from 1
+	uint16_t event;		///< TraceEvent
+	uint16_t length;
+};
+
+extern boost::atomic<bool> TraceOn;
+
+inline bool TraceEnabled() {
+	return TraceOn.load(boost::memory_order_relaxed);
+}
+
+/// Trace into per thread segment files of directory, named
+/// trace-<pid>-<thread>-<segment>.bin. Each thread keeps its last segments
+/// only, removing older ones. An empty directory turns tracing off.
+void SetTraceDirectory(const std::string & directory, unsigned segments);
+
+/// Append a record to the segment of the calling thread.
+void TraceWrite(TraceEvent event, uint64_t argument);
+
+/// Fingerprint of a statement: a hash of its text with literals replaced
+/// by '?', lists of them collapsed and spaces folded. Statements differing
+/// only in their values share it. normalized receives that text, its
+/// buffer is reused from call to call.
+uint64_t TraceFingerprint(const char * statement, std::string & normalized);
+
+/// Fingerprint of statement, naming it in the trace the first time the
+/// calling thread sees it. 0 when tracing is off.
+uint64_t TraceStatement(const char * statement);
+
+/// Fingerprint of a name used verbatim, such as a method or a lock, naming
+/// it in the trace the first time the calling thread sees it. 0 when
+/// tracing is off.
+uint64_t TraceLabel(const char * label, std::size_t size);
+
+inline uint64_t TraceLabel(const char * label) {
+	return TraceEnabled() ? TraceLabel(label, strlen(label)) : 0;
+}
+
+/// Records a begin event when built and its end event when left, also when
+/// leaving by an exception.
+class TraceSpan {
+public:
+	TraceSpan(TraceEvent begin, uint64_t argument)
+		: end_(TraceEmpty), argument_(argument)
+	{
+		if (TraceEnabled()) {
+			TraceWrite(begin, argument);
+			end_ = static_cast<TraceEvent>(begin + 1);
+		}
+	}
+	
+	~TraceSpan() {
+		if (end_ != TraceEmpty)
+			TraceWrite(end_, argument_);
+	}
+	
+	inline void setArgument(uint64_t argument) { argument_ = argument; }
+	
+private:
+	TraceSpan(const TraceSpan &);
+	TraceSpan & operator=(const TraceSpan &);
+	
+	TraceEvent end_;
+	uint64_t argument_;
+};
+
+/// Lock lock, an unlocked boost::unique_lock, recording the wait when
+/// it is held by another thread.
+template <typename Lock>
+inline void TraceLock(Lock & lock, const char * name)
+{
+	if (lock.try_lock())
+		return;
+	if (!TraceEnabled()) {
+		lock.lock();
+		return;
+	}
+	TraceSpan wait(TraceLockWaitBegin, TraceLabel(name));
+	lock.lock();
+}
+
+} // namespace server
+} // namespace yucode
+
+#endif
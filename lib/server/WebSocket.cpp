@@ -0,0 +1,122 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "WebSocket.h"
+
+#include <openssl/sha.h>
+#include <openssl/evp.h>
+
+namespace yucode {
+namespace server {
+namespace websocket {
+
+namespace {
+
+/// Fixed GUID appended to the key before hashing (RFC 6455 1.3).
+const char handshake_guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+} // namespace
+
+bool is_upgrade(const Request& req)
+{
+	return req.method == "GET"
+		&& EqualsIgnoreCase(req.header("Upgrade"), "websocket")
+		&& ContainsIgnoreCase(req.header("Connection"), "upgrade")
+		&& !req.header("Sec-WebSocket-Key").empty();
+}
+
+std::string accept_key(boost::string_ref key)
+{
+	std::string input(key.data(), key.size());
+	input += handshake_guid;
+
+	unsigned char digest[SHA_DIGEST_LENGTH];
+	SHA1(reinterpret_cast<const unsigned char *>(input.data()), input.size(), digest);
+
+	// 4 * ceil(20 / 3) characters plus the terminating null
+	unsigned char encoded[32];
+	int length = EVP_EncodeBlock(encoded, digest, SHA_DIGEST_LENGTH);
+	return std::string(reinterpret_cast<char *>(encoded), length);
+}
+
+boost::tribool decode_frame(char * begin, char * end, std::size_t max_payload,
+		frame& f, std::size_t& consumed)
+{
+	const unsigned char * it = reinterpret_cast<unsigned char *>(begin);
+	std::size_t available = end - begin;
+	f.size = 0;
+	if (available < 2)
+		return boost::indeterminate;
+
+	// Reserved bits are not negotiated, client frames must be masked
+	if ((it[0] & 0x70) || !(it[1] & 0x80))
+		return false;
+	f.fin = (it[0] & 0x80) != 0;
+	f.op = static_cast<opcode>(it[0] & 0x0f);
+
+	std::size_t header = 2;
+	unsigned long long size = it[1] & 0x7f;
+	if (size == 126) {
+		header += 2;
+		if (available < header)
+			return boost::indeterminate;
+		size = (it[2] << 8) | it[3];
+	} else if (size == 127) {
+		header += 8;
+		if (available < header)
+			return boost::indeterminate;
+		size = 0;
+		for (int i = 2; i < 10; ++i)
+			size = (size << 8) | it[i];
+	}
+	// Control frames can not be fragmented nor carry over 125 bytes (5.5)
+	if ((f.op & 0x8) && (!f.fin || size > 125))
+		return false;
+	if (size > max_payload) {
+		f.size = max_payload + 1;
+		return false;
+	}
+
+	const unsigned char * mask = it + header;
+	header += 4;
+	if (available < header + size)
+		return boost::indeterminate;
+
+	f.payload = begin + header;
+	f.size = size;
+	for (std::size_t i = 0; i < size; ++i)
+		f.payload[i] ^= mask[i & 3];
+	consumed = header + size;
+	return true;
+}
+
+void encode_frame(opcode op, boost::string_ref payload, std::string& out)
+{
+	out += static_cast<char>(0x80 | op);
+	std::size_t size = payload.size();
+	if (size < 126) {
+		out += static_cast<char>(size);
+	} else if (size <= 0xffff) {
+		out += static_cast<char>(126);
+		out += static_cast<char>(size >> 8);
+		out += static_cast<char>(size & 0xff);
+	} else {
+		out += static_cast<char>(127);
+		for (int shift = 56; shift >= 0; shift -= 8)
+			out += static_cast<char>((static_cast<unsigned long long>(size) >> shift) & 0xff);
+	}
+	out.append(payload.data(), payload.size());
+}
+
+} // namespace websocket
+} // namespace server
+} // namespace yucode
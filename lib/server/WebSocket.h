@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef YUCODE_SERVER_WEBSOCKET_H
+#define YUCODE_SERVER_WEBSOCKET_H
+
+#include <string>
+#include <boost/logic/tribool.hpp>
+#include <boost/utility/string_ref.hpp>
+#include "Request.h"
+
+namespace yucode {
+namespace server {
+namespace websocket {
+
+/// Frame opcodes (RFC 6455 5.2).
+enum opcode
+{
+	continuation = 0x0,
+	text = 0x1,
+	binary = 0x2,
+	close = 0x8,
+	ping = 0x9,
+	pong = 0xa
+};
+
+/// A frame received from a client, its payload already unmasked.
+struct frame
+{
+	bool fin;
+	opcode op;
+	char * payload;
+	std::size_t size;
+};
+
+/// Check whether req asks to switch the Connection to the WebSocket protocol.
+bool is_upgrade(const Request& req);
+
+/// Compute the Sec-WebSocket-Accept value answering a Sec-WebSocket-Key.
+std::string accept_key(boost::string_ref key);
+
+/// Decode the client frame starting at begin, unmasking its payload in place.
+/// The tribool is true when a whole frame was decoded, false for protocol
+/// errors (fragmented or over 125 bytes control frames among them) or
+/// payloads over max_payload, indeterminate when more data is required.
+/// consumed is set to the size of the decoded frame. A payload over
+/// max_payload leaves f.size above it, telling it from other errors.
+boost::tribool decode_frame(char * begin, char * end, std::size_t max_payload,
+		frame& f, std::size_t& consumed);
+
+/// Append a final, unmasked server frame carrying payload to out.
+void encode_frame(opcode op, boost::string_ref payload, std::string& out);
+
+} // namespace websocket
+} // namespace server
+} // namespace yucode
+
+#endif // YUCODE_SERVER_WEBSOCKET_H
@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "WebSocketHub.h"
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include "Connection.h"
+#include "Trace.h"
+
+namespace yucode {
+namespace server {
+
+void WebSocketHub::add(unsigned long long userId, boost::weak_ptr<Connection> connection)
+{
+	boost::mutex::scoped_lock lock(mutex_, boost::defer_lock);
+	TraceLock(lock, "WebSocketHub");
+	sockets_.insert(std::make_pair(userId, connection));
+}
+
+void WebSocketHub::prune(unsigned long long userId)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	std::pair<Sockets::iterator, Sockets::iterator> range = sockets_.equal_range(userId);
+	for (Sockets::iterator it = range.first; it != range.second; ) {
+		if (it->second.expired())
+			sockets_.erase(it++);
+		else
+			++it;
+	}
+}
+
+bool WebSocketHub::empty()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	return sockets_.empty();
+}
+
+std::size_t WebSocketHub::publish(unsigned long long userId, const std::string & text)
+{
+	// Push outside the lock, Connections queue the message on their strand
+	std::vector<boost::shared_ptr<Connection> > connections;
+	{
+		boost::mutex::scoped_lock lock(mutex_, boost::defer_lock);
+		TraceLock(lock, "WebSocketHub");
+		std::pair<Sockets::iterator, Sockets::iterator> range = sockets_.equal_range(userId);
+		for (Sockets::iterator it = range.first; it != range.second; ++it)
+			if (boost::shared_ptr<Connection> connection = it->second.lock())
+				connections.push_back(connection);
+	}
+
+	for (std::size_t i = 0; i < connections.size(); ++i)
+		connections[i]->push(text);
+	return connections.size();
+}
+
+} // namespace server
+} // namespace yucode
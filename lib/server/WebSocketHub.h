@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef YUCODE_SERVER_WEBSOCKET_HUB_H
+#define YUCODE_SERVER_WEBSOCKET_HUB_H
+
+#include <map>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace yucode {
+namespace server {
+
+class Connection;
+
+/// Open WebSockets of this process by user, to push messages to them.
+class WebSocketHub
+	: private boost::noncopyable
+{
+public:
+	inline static WebSocketHub& singleton() {
+		static WebSocketHub instance;
+		return instance;
+	}
+
+	/// Register connection as a WebSocket of userId.
+	void add(unsigned long long userId, boost::weak_ptr<Connection> connection);
+
+	/// Forget the closed WebSockets of userId.
+	void prune(unsigned long long userId);
+
+	/// Whether any WebSocket is open, so pushes are worth preparing.
+	bool empty();
+
+	/// Send text to every WebSocket of userId. Returns how many got it.
+	std::size_t publish(unsigned long long userId, const std::string & text);
+
+private:
+	WebSocketHub() {}
+
+	typedef std::multimap<unsigned long long, boost::weak_ptr<Connection> > Sockets;
+
+	boost::mutex mutex_;
+	Sockets sockets_;
+};
+
+} // namespace server
+} // namespace yucode
+
+#endif // YUCODE_SERVER_WEBSOCKET_HUB_H
@@ -0,0 +1,77 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "WorkerPool.h"
+#include <boost/bind.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+#include "Log.h"
+
+namespace yucode {
+namespace server {
+
+WorkerPool::WorkerPool(std::size_t pool_size)
+	: pool_size_(pool_size > 0? pool_size : 1),
+		io_service_(),
+		work_(),
+		threads_()
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+	stop();
+}
+
+void WorkerPool::start()
+{
+	if (!threads_.empty())
+		return;
+
+	LOG("WorkerPool::start: starting " << pool_size_ << " worker threads");
+	work_.reset(new boost::asio::io_service::work(io_service_));
+	for (std::size_t i = 0; i < pool_size_; ++i)
+	{
+		boost::shared_ptr<boost::thread> thread(new boost::thread(
+					boost::bind(&WorkerPool::run, this)));
+		threads_.push_back(thread);
+	}
+}
+
+void WorkerPool::run()
+{
+	// A handler throwing unwinds io_service::run(), enter it again so the
+	// pool does not lose the thread
+	for (;;) {
+		try {
+			io_service_.run();
+			return;
+		} catch(...) {
+			LOG_ERROR_CRITICAL("WorkerPool::run: Exception catched: " << boost::current_exception_diagnostic_information());
+		}
+	}
+}
+
+void WorkerPool::stop()
+{
+	if (threads_.empty())
+		return;
+
+	// Pending handlers are dropped, the threads leave io_service::run().
+	work_.reset();
+	io_service_.stop();
+	for (std::size_t i = 0; i < threads_.size(); ++i)
+		threads_[i]->join();
+	threads_.clear();
+}
+
+} // namespace server
+} // namespace yucode
@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef YUCODE_SERVER_WORKER_POOL_H
+#define YUCODE_SERVER_WORKER_POOL_H
+
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace yucode {
+namespace server {
+
+/// Fixed size pool of threads running blocking work (service handlers, data
+/// base queries) away from the threads running the Server's io_service.
+class WorkerPool
+	: private boost::noncopyable
+{
+public:
+	explicit WorkerPool(std::size_t pool_size);
+	~WorkerPool();
+
+	/// Start the worker threads.
+	void start();
+
+	/// Stop accepting work and wait for the worker threads to exit.
+	void stop();
+
+	/// Queue a handler to be run by one of the worker threads.
+	template <typename Handler>
+	void post(Handler handler) {
+		io_service_.post(handler);
+	}
+
+	inline std::size_t size() const { return pool_size_; }
+
+private:
+	/// Body of the worker threads: run handlers until stop().
+	void run();
+
+	std::size_t pool_size_;
+
+	/// The io_service used as the work queue.
+	boost::asio::io_service io_service_;
+
+	/// Keeps the worker threads running while the queue is empty.
+	boost::scoped_ptr<boost::asio::io_service::work> work_;
+
+	std::vector<boost::shared_ptr<boost::thread> > threads_;
+};
+
+} // namespace server
+} // namespace yucode
+
+#endif // YUCODE_SERVER_WORKER_POOL_H
@@ -14,9 +14,17 @@
 #include <sstream>
 #include <boost/lexical_cast.hpp>
 #include <cmath>
+#include <algorithm>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include "JsonServiceInterface.h"
 #include "server/Log.h"
+#include "server/ContentEncoding.h"
+#include "server/RequestParser.h"
+#include "server/WorkerPool.h"
 #include "database/TableTraverser.h"
 
 using namespace std;
@@ -26,24 +34,78 @@ using namespace yucode::server;
 namespace yucode {
 namespace jsonservice {
 	
+	/// Orders the handler table by method, also against a bare method name.
+	struct JsonServiceEntryLess {
+		bool operator()(const JsonServiceEntry & a, const JsonServiceEntry & b) const {
+			return a.method < b.method;
+		}
+		bool operator()(const JsonServiceEntry & a, boost::string_ref b) const {
+			return boost::string_ref(a.method) < b;
+		}
+	};
+	
+	/// Calls of a batch, claimed one at a time by the threads running them.
+	struct JsonServiceInterface::JsonBatch {
+		JsonBatch(const ServerContext & _con, const RequestContext * _requestContext)
+			: con(_con), requestContext(_requestContext), sample(CurrentRequestSample), next(0), done(0) {}
+		
+		const ServerContext & con;
+		const RequestContext * requestContext;
+		/// Sample of the batch Request, charged with the cost of every call.
+		/// Only written under mutex.
+		RequestSample * sample;
+		std::vector<JsonBatchCall> calls;
+		boost::atomic<std::size_t> next;
+		std::size_t done;
+		boost::mutex mutex;
+		boost::condition_variable finished;
+	};
+	
+	/// Results of the calls of a batch, in order.
+	class BatchPackage : public Package {
+	public:
+		BatchPackage(const std::string & packageType, const std::vector<JsonBatchCall> & calls)
+			: Package(packageType), calls_(calls) {
+		}
+	protected:
+		void writeContentJson(std::ostream& os, bool minified) {
+			os << "[";
+			for (std::size_t i = 0; i < calls_.size(); ++i)
+				os << (i? "," : "") << calls_[i].result;
+			os << "]";
+		}
+	private:
+		const std::vector<JsonBatchCall> & calls_;
+	};
+	
 // Service Interface
 	void JsonServiceInterface::handleRequest(const Request& req, Reply& rep, const ServerContext & con) {
 		RequestContext * requestContext = makeRequestContext(req);
-		
+		dispatch(req, rep, con, requestContext);
+		if (requestContext)
+			delete requestContext;
+	}
+	
+	void JsonServiceInterface::dispatch(const Request& req, Reply& rep, const ServerContext & con, RequestContext * requestContext) {
 		// Get general arguments for Json services
 		if (!addRequestContext(req, rep, requestContext)) {
 			responseErrorPackage(req, rep, requestContext, "service.fail", "Wrong syntax, required: 'method', expected: 'minified','query_id'");
+		} else if (requestContext->batch && requestContext->method == requestContext->batch->method) {
+			responseErrorPackage(req, rep, requestContext, "service.fail", "Batches can not be nested");
 		} else {
 			// Try to dispatch service to its registered handler
-			map<string, JsonServiceHandler>::iterator serviceHandlersIt = jsonServiceHandlers_.find(requestContext->method);
-			if (serviceHandlersIt != jsonServiceHandlers_.end()) {
+			const JsonServiceEntry * entry = findJsonServiceEntry(requestContext->method);
+			if (entry) {
+				requestContext->serviceData = entry->data.get();
+				if (!requestContext->batch && CurrentRequestSample)
+					CurrentRequestSample->method = entry->metrics;
+				
 				// Let subclasses complete teh request
 				if (addJsonRequestContext(req, rep, requestContext)) {
 				
 					// Dispatch service handler
-					JsonServiceHandler serviceHandler = serviceHandlersIt->second;
 					try {
-						serviceHandler(req, rep, con, requestContext);
+						entry->handler(req, rep, con, requestContext);
 					} catch(...) {
 						responseErrorPackage(req, rep, requestContext, requestContext->method, "Unexpected error");
 					}
@@ -52,8 +114,102 @@ namespace jsonservice {
 				responseErrorPackage(req, rep, requestContext, "service.fail", MKSTRING("Method '" << requestContext->method << "' not implemented"));
 			}
 		}
-		if (requestContext)
+	}
+	
+	void JsonServiceInterface::handleBatch(const Request& req, Reply& rep, const ServerContext & con, RequestContext * requestContext) {
+		std::vector<boost::string_ref> queries;
+		boost::string_ref query;
+		while (req.loadArgumentView(query, MKSTRING("call." << queries.size())))
+			queries.push_back(query);
+		if (queries.empty() || queries.size() > maxBatchCalls) {
+			responseErrorPackage(req, rep, requestContext, requestContext->method, MKSTRING("Wrong argument, required: 'call.0' to 'call." << maxBatchCalls - 1 << "'"));
+			return;
+		}
+		
+		// Calls are Requests like the batch one with their own arguments
+		std::shared_ptr<JsonBatch> batch(new JsonBatch(con, requestContext));
+		batch->calls.resize(queries.size());
+		RequestParser parser;
+		for (std::size_t i = 0; i < queries.size(); ++i) {
+			JsonBatchCall & call = batch->calls[i];
+			call.query.assign(queries[i].data(), queries[i].size());
+			call.request = req;
+			call.request.arguments.clear();
+			call.request.decoded_arguments.clear();
+			if (!parser.parseQuery(call.request, call.query))
+				call.request.arguments.clear();
+		}
+		
+		// This thread runs calls too, so the batch completes even when every
+		// worker is busy
+		std::size_t helpers = con.worker_pool_? std::min(con.worker_pool_->size(), queries.size()) : 0;
+		for (std::size_t i = 1; i < helpers; ++i)
+			con.worker_pool_->post(boost::bind(&JsonServiceInterface::runBatchCalls, this, batch));
+		runBatchCalls(batch);
+		{
+			boost::mutex::scoped_lock lock(batch->mutex);
+			while (batch->done < batch->calls.size())
+				batch->finished.wait(lock);
+		}
+		SetRequestSeqNumber(req.seq_number);
+		
+		BatchPackage package(requestContext->method, batch->calls);
+		for (std::vector<JsonBatchCall>::const_iterator it = batch->calls.begin(); it != batch->calls.end(); ++it)
+			package.getHeader().merge(it->header);
+		responsePackage(rep, req, requestContext, package);
+	}
+	
+	void JsonServiceInterface::runBatchCalls(std::shared_ptr<JsonBatch> batch) {
+		// Helpers run out of any Request: the scope returns their connection
+		// to the pool, and the calls are measured here then charged to the
+		// batch, whose sample other threads may be updating
+		ConnectionScope connectionScope;
+		RequestSample * requestSample = CurrentRequestSample;
+		RequestSample sample;
+		CurrentRequestSample = &sample;
+		for (std::size_t i = batch->next++; i < batch->calls.size(); i = batch->next++) {
+			JsonBatchCall & call = batch->calls[i];
+			SetRequestSeqNumber(call.request.seq_number);
+			RequestContext * requestContext = makeRequestContext(call.request);
+			requestContext->batch = batch->requestContext;
+			requestContext->batchCall = &call;
+			try {
+				dispatch(call.request, call.reply, batch->con, requestContext);
+			} catch (...) {
+				responseErrorPackage(call.request, call.reply, requestContext, "service.fail", "Unexpected error");
+			}
+			if (call.result.empty())
+				responseErrorPackage(call.request, call.reply, requestContext, "service.fail", "No response");
 			delete requestContext;
+			
+			boost::mutex::scoped_lock lock(batch->mutex);
+			if (batch->sample)
+				batch->sample->merge(sample);
+			sample.reset();
+			if (++batch->done == batch->calls.size())
+				batch->finished.notify_all();
+		}
+		CurrentRequestSample = requestSample;
+		SetRequestSeqNumber(0);
+	}
+
+	void JsonServiceInterface::bootStrap() {
+		std::sort(jsonServiceEntries_.begin(), jsonServiceEntries_.end(), JsonServiceEntryLess());
+		jsonServicesFrozen_ = true;
+	}
+	
+	const JsonServiceEntry * JsonServiceInterface::findJsonServiceEntry(boost::string_ref method) const {
+		if (!jsonServicesFrozen_) {
+			for (vector<JsonServiceEntry>::const_iterator it = jsonServiceEntries_.begin(); it != jsonServiceEntries_.end(); ++it)
+				if (it->method == method)
+					return &*it;
+			return NULL;
+		}
+		vector<JsonServiceEntry>::const_iterator it = std::lower_bound(
+				jsonServiceEntries_.begin(), jsonServiceEntries_.end(), method, JsonServiceEntryLess());
+		if (it != jsonServiceEntries_.end() && it->method == method)
+			return &*it;
+		return NULL;
 	}
 
 // Preparing context from request
@@ -84,6 +240,19 @@ namespace jsonservice {
 
 // Handling answer
 	void JsonServiceInterface::responsePackage(Reply& rep, const Request& req, RequestContext * requestContext, yucode::jsonservice::Package & package) {
+		uint64_t started = Metrics::now();
+		
+		// Calls of a batch answer into the package of the batch
+		if (requestContext && requestContext->batchCall) {
+			requestContext->batchCall->header = package.getHeader();
+			stringstream ss;
+			package.writeResultJson(ss, requestContext);
+			requestContext->batchCall->result = ss.str();
+			if (CurrentRequestSample)
+				CurrentRequestSample->phases[PhaseSerialize] += Metrics::now() - started;
+			return;
+		}
+		
 		stringstream ss;
 		package.writeJson(ss, requestContext);
 		string result = ss.str();
@@ -94,18 +263,30 @@ namespace jsonservice {
 			resultSummary += "...";
 		}
 		LOG("JsonServiceInterface::responsePackage: " << resultSummary);
-		rep.headers.resize(req.origin.empty()? 2 : 4);
+		
+		ContentEncoding::Encoding encoding = ContentEncoding::compress(rep, req.header("Accept-Encoding"));
+		
+		rep.headers.resize(req.origin.empty()? 3 : 5);
 		rep.headers[0].name = "Content-Length";
 		rep.headers[0].value = boost::lexical_cast<string>(rep.content.size());
 		rep.headers[1].name = "Content-Type";
 		rep.headers[1].value = "application/json";
+		rep.headers[2].name = "Vary";
+		rep.headers[2].value = "Accept-Encoding";
 		if (!req.origin.empty()) {
-			rep.headers[2].name = "Access-Control-Allow-Origin";
-			rep.headers[2].value = string("http://") + req.origin;
-			rep.headers[3].name = "Access-Control-Allow-Credentials";
-			rep.headers[3].value = "true";
+			rep.headers[3].name = "Access-Control-Allow-Origin";
+			rep.headers[3].value = string("http://") + req.origin;
+			rep.headers[4].name = "Access-Control-Allow-Credentials";
+			rep.headers[4].value = "true";
+		}
+		if (encoding != ContentEncoding::identity) {
+			rep.headers.push_back(server::Header());
+			rep.headers.back().name = "Content-Encoding";
+			rep.headers.back().value = ContentEncoding::name(encoding);
 		}
 		rep.status = Reply::ok;
+		if (CurrentRequestSample)
+			CurrentRequestSample->phases[PhaseSerialize] += Metrics::now() - started;
 	}
 }
 }
@@ -14,10 +14,13 @@
 #define YUCODE_SERVER_JSONSERVICEINTERFACE_H
 
 #include <string>
+#include <vector>
 #include <memory>
 #include <boost/function.hpp>
+#include <boost/utility/string_ref.hpp>
 #include "server/ServiceInterface.h"
 #include "server/Log.h"
+#include "server/Metrics.h"
 #include "services/json/RequestContext.h"
 #include "services/json/transportdata/package/Package.h"
 
@@ -32,10 +35,36 @@ namespace jsonservice {
 		virtual ~JsonServiceData() {} //NOTE: Only to ensure v-table exists
 	};
 	
+	/// A call of a batch: the Request parsed from its query string and the
+	/// package it answered, split into header and result.
+	struct JsonBatchCall {
+		std::string query;
+		server::Request request;
+		server::Reply reply;
+		Header header;
+		std::string result;
+	};
+	
+	/// A registered method: its handler, the metadata it was registered with
+	/// and the metrics its Requests are recorded in.
+	struct JsonServiceEntry {
+		std::string method;
+		JsonServiceHandler handler;
+		std::shared_ptr<JsonServiceData> data;
+		server::MethodMetrics * metrics;
+	};
+	
 	class JsonServiceInterface : public server::ServiceInterface {
+	public:
+		JsonServiceInterface() : jsonServicesFrozen_(false) {}
+		
 	// Service Interface
 	public:
 		void handleRequest(const server::Request& req, server::Reply& rep, const server::ServerContext & con);
+		
+		/// Freeze the handler table, sorted by method for lookups. Subclasses
+		/// overriding bootStrap must call up.
+		void bootStrap();
 	
 	// Preparing context from request
 	protected:
@@ -50,22 +79,51 @@ namespace jsonservice {
 	// Service handlers
 	protected:
 		inline bool handlerExists(RequestContext * requestContext) {
-			return requestContext && jsonServiceHandlers_.find(requestContext->method) != jsonServiceHandlers_.end();
+			return requestContext && findJsonServiceEntry(requestContext->method);
 		}
 		
+		/// Register before bootStrap, the table is read only afterwards.
 		template<class T>
 		void registerJsonServiceHandler(const std::string & method, const JsonServiceHandler &handler, const T &serviceData) {
-			jsonServiceHandlers_[method] = handler;
-			jsonServiceData_[method] = std::shared_ptr<T>(new T(serviceData));
+			if (jsonServicesFrozen_)
+				throw "JsonServiceInterface::registerJsonServiceHandler: handler table already frozen";
+			JsonServiceEntry entry;
+			entry.method = method;
+			entry.handler = handler;
+			entry.data = std::shared_ptr<T>(new T(serviceData));
+			entry.metrics = server::Metrics::singleton().method(method);
+			for (std::vector<JsonServiceEntry>::iterator it = jsonServiceEntries_.begin(); it != jsonServiceEntries_.end(); ++it) {
+				if (it->method == method) {
+					*it = entry;
+					return;
+				}
+			}
+			jsonServiceEntries_.push_back(entry);
 		}
 		
-		std::shared_ptr<JsonServiceData> getServiceData(const std::string & method) {
-			return jsonServiceData_[method];
-		}
+		/// Entry registered for method, NULL if none.
+		const JsonServiceEntry * findJsonServiceEntry(boost::string_ref method) const;
+		
+		/// Most calls accepted in a batch.
+		static const std::size_t maxBatchCalls = 16;
+		
+		/// Handler for a batch method: runs the calls given as query strings in
+		/// the arguments call.0, call.1... concurrently on the WorkerPool, as
+		/// if requested one by one within the session of the batch. Answers one
+		/// package with their results in order and their headers merged.
+		void handleBatch(const server::Request& req, server::Reply& rep, const server::ServerContext & con, RequestContext * requestContext);
 		
 	private:
-		std::map<std::string, JsonServiceHandler> jsonServiceHandlers_;
-		std::map<std::string, std::shared_ptr<JsonServiceData> > jsonServiceData_;
+		struct JsonBatch;
+		
+		/// Run the handler registered for the method of req.
+		void dispatch(const server::Request& req, server::Reply& rep, const server::ServerContext & con, RequestContext * requestContext);
+		
+		/// Run the calls of batch not yet claimed by another thread.
+		void runBatchCalls(std::shared_ptr<JsonBatch> batch);
+		
+		std::vector<JsonServiceEntry> jsonServiceEntries_;
+		bool jsonServicesFrozen_;
 
 	// Handling answer
 	protected:
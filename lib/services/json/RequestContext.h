@@ -18,15 +18,26 @@
 namespace yucode {
 namespace jsonservice {
 
+class JsonServiceData;
+struct JsonBatchCall;
+
 struct RequestContext
 {
 	RequestContext()
-		: queryId(0), minified(true), method(), userId(0) {}
+		: queryId(0), minified(true), method(), userId(0), serviceData(NULL),
+		  batch(NULL), batchCall(NULL) {}
 		
 	unsigned long long queryId;
 	bool minified;
 	std::string method;
 	unsigned long long userId;
+	/// Metadata registered with the handler of method, owned by the service.
+	const JsonServiceData * serviceData;
+	/// Context of the batch running this call, whose session was already
+	/// checked. NULL outside a batch.
+	const RequestContext * batch;
+	/// Slot collecting the package of this call for its batch.
+	JsonBatchCall * batchCall;
 };
 
 } // namespace server
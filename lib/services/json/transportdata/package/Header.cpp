@@ -46,5 +46,17 @@ void Header::writeJson(std::ostream &os, bool minified) const {
 	os << "}";
 }
 
+void Header::merge(const Header & other) {
+	for (ModelObjectListCollection::const_iterator it = other.modelObjectListCollection_.begin(); it != other.modelObjectListCollection_.end(); ++it) {
+		ModelObjectList & objects = modelObjectListCollection_[it->first];
+		set<long long> keys;
+		for (ModelObjectList::const_iterator itObj = objects.begin(); itObj != objects.end(); ++itObj)
+			keys.insert((*itObj)->getKey());
+		for (ModelObjectList::const_iterator itObj = it->second.begin(); itObj != it->second.end(); ++itObj)
+			if (keys.insert((*itObj)->getKey()).second)
+				objects.push_back(*itObj);
+	}
+}
+
 }
 }
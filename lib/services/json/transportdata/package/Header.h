@@ -31,6 +31,10 @@ class Header {
 public:
 	void writeJson(std::ostream&, bool minified) const;
 	
+	/// Add the objects of other, skipping those whose key is already in the
+	/// same collection.
+	void merge(const Header & other);
+	
 	template <typename ModelType>
 	void addModelObject(const std::string &collection, const ModelType & modelObject) {
 		ModelObjectListCollection::iterator modelObjectListCollectionIt = modelObjectListCollection_.find(collection);
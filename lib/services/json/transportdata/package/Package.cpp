@@ -20,13 +20,26 @@ void Package::writeJson(std::ostream &os, const RequestContext * requestContext)
 	bool minified = requestContext? requestContext->minified : false;
 	os << "{\"header\":";
 	header_.writeJson(os, minified);
-	os << ",\"result\":";
+	os << ",";
+	writeFieldsJson(os, requestContext);
+	os << "}";
+}
+
+void Package::writeResultJson(std::ostream &os, const RequestContext * requestContext) {
+	os << "{";
+	writeFieldsJson(os, requestContext);
+	os << "}";
+}
+
+void Package::writeFieldsJson(std::ostream &os, const RequestContext * requestContext) {
+	bool minified = requestContext? requestContext->minified : false;
+	os << "\"result\":";
 	writeContentJson(os, minified);
 	if (requestContext)
 		os << ",\"query_id\":" << requestContext->queryId;
 	os  << ",\"package_type\":\"" << packageType_ << "\""
 	   << ",\"status\":" << (hasError()? "false" : "true")
-	   << ",\"messages\":[\"" << errorMessage()<<"\"]}";
+	   << ",\"messages\":[\"" << errorMessage()<<"\"]";
 }
 
 }
@@ -39,6 +39,10 @@ public:
 	
 	void writeJson(std::ostream &os, const RequestContext * requestContext);
 	
+	/// Same as writeJson without the header, for a call whose header is
+	/// merged into the one of a batch.
+	void writeResultJson(std::ostream &os, const RequestContext * requestContext);
+	
 	inline std::string toString(const RequestContext * requestContext = NULL) {
 		std::ostringstream stm ;
 		writeJson(stm, requestContext);
@@ -50,6 +54,9 @@ protected:
 		os << "1";
 	};
 
+private:
+	void writeFieldsJson(std::ostream &os, const RequestContext * requestContext);
+
 protected:
 	Header header_;
 	std::string packageType_;
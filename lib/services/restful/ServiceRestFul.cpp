@@ -45,19 +45,24 @@ namespace restful {
 				    boost::bind(&ServiceRestFul::serviceSessionLookUpUserName, this, _1, _2, _3, _4), false);
 		registerRestFulServiceHandler("session.register.token.ios", /* token:String*/
 				    boost::bind(&ServiceRestFul::serviceSessionRegisterTokenIos, this, _1, _2, _3, _4), true);
+		registerRestFulServiceHandler("batch", /* call.0:String,call.1:String... each a query string of another method */
+				    boost::bind(&ServiceRestFul::handleBatch, this, _1, _2, _3, _4), true);
 	}
 	
 // Service Interfce
 	void ServiceRestFul::bootStrap() {
 		RestFulController::bootStrap();
+		
+		// super call
+		JsonServiceInterface::bootStrap();
 	}
 
 // Extend services with session
 	bool ServiceRestFul::addJsonRequestContext(const Request& req, Reply& rep, RequestContext * requestContext) {
 		
-		// session key check
-		shared_ptr<RestFulServiceData> serviceData 
-			= dynamic_pointer_cast<RestFulServiceData> (getServiceData(requestContext->method));
+		// session key check, every handler here is registered with RestFulServiceData
+		const RestFulServiceData * serviceData
+			= static_cast<const RestFulServiceData *>(requestContext->serviceData);
 		bool requiredSessionApi = true;
 		if (serviceData) {
 			requiredSessionApi = serviceData->requiredSessionApi;
@@ -65,7 +70,13 @@ namespace restful {
 			LOG_ERROR("JsonServiceInterface::addRequestContext: Unexpected missing RestFulServiceData for " << requestContext->method);
 		}
 		
-		if (requiredSessionApi) {
+		// Calls of a batch run in its session, messages of a WebSocket carry
+		// the user authenticated when it opened
+		if (requiredSessionApi && requestContext->batch) {
+			requestContext->userId = requestContext->batch->userId;
+		} else if (requiredSessionApi && req.socket_user_id) {
+			requestContext->userId = req.socket_user_id;
+		} else if (requiredSessionApi) {
 			std::string sessionKey;
 			if (!req.loadArgumentVerifyStringText(sessionKey, "session_key")) {
 				LOG_WARN("ServiceRestFul::addRequestContext: Missing session_key argument for method " << requestContext->method);
@@ -83,6 +94,20 @@ namespace restful {
 		return true;
 	}
 	
+	bool ServiceRestFul::acceptWebSocket(const Request& req, unsigned long long & userId) {
+		std::string sessionKey;
+		if (!req.loadArgumentVerifyStringText(sessionKey, "session_key")) {
+			LOG_WARN("ServiceRestFul::acceptWebSocket: Missing session_key argument");
+			return false;
+		}
+		
+		boost::optional<unsigned long long> authenticated = RestFulController::getAuthenticatedUser(sessionKey, req);
+		if (!authenticated)
+			return false;
+		userId = *authenticated;
+		return true;
+	}
+	
 // Session Services
 	void ServiceRestFul::serviceSessionSignUp(const Request& req, Reply& rep, const ServerContext & serverContext, jsonservice::RequestContext * requestContext) {
 		// Fetch and verify arguments
@@ -42,6 +42,9 @@ namespace restful {
 		void bootStrap();
 		
 		bool addJsonRequestContext(const server::Request& req, server::Reply& rep, jsonservice::RequestContext * requestContext);
+		
+		/// WebSockets open for the user owning the 'session_key' argument.
+		bool acceptWebSocket(const server::Request& req, unsigned long long & userId);
 	
 	// Custom service registering
 	protected:
@@ -49,6 +52,10 @@ namespace restful {
 			registerJsonServiceHandler<RestFulServiceData>(method, handler, RestFulServiceData(requiredSessionApi));
 		}
 		
+	private:
+		/// Handlers must carry RestFulServiceData, register them as above.
+		using jsonservice::JsonServiceInterface::registerJsonServiceHandler;
+		
 	// Overload to extend
 	protected:
 		virtual void userDidSignUp(const server::Request& req, server::Reply& rep, const server::ServerContext & serverContext, jsonservice::RequestContext * requestContext) {
@@ -16,6 +16,7 @@
 #include <sstream>
 
 #include "misc/Utilities.h"
+#include "database/StatementTraverser.h"
 #include "database/TableTraverser.h"
 #include "SecurityController.h"
 
@@ -171,10 +172,12 @@ boost::optional<string> RestFulController::sessionSignIn(const string & userName
 
 boost::optional<unsigned long long> RestFulController::getAuthenticatedUser(const string & sessionKey, const server::Request& req) {
 	// Retrieve session data
-	TableTraverser sessionsTraverser(
+	static const StatementId selectSession = PreparedStatements::singleton().declare(
 		MKSTRING("SELECT user_id,ip,UNIX_TIMESTAMP(creation_date) FROM " << TableRestFulSession << " "
-			"WHERE session_key_md5='" << sessionKey << "' "));
-	TableTraverser::iterator sessionIt = sessionsTraverser.begin();
+			"WHERE session_key_md5=?"));
+	StatementTraverser sessionsTraverser(selectSession);
+	sessionsTraverser.bind(sessionKey);
+	StatementTraverser::iterator sessionIt = sessionsTraverser.begin();
 	if (sessionIt == sessionsTraverser.end())
 		return boost::none;
 	
@@ -54,6 +54,10 @@ namespace restfulgame {
 		return req.uri == "/games/greedycats/api";
 	}
 	
+	std::string ServiceRestFulGame::routePath() const {
+		return "/games/greedycats/api";
+	}
+	
 	void ServiceRestFulGame::bootStrap() {
 		GameController::bootStrap();
 		
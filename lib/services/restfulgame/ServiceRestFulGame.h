@@ -27,6 +27,7 @@ namespace restfulgame {
 	// Service Interfce
 	public:
 		bool matchRequest(const server::Request& req) const;
+		std::string routePath() const;
 		void bootStrap();
 	
 	// Service Restful
@@ -13,9 +13,12 @@
 #include "GameAlgorithm.h"
 
 #include "GameController.h"
+#include "GameBoard.h"
 #include "misc/Utilities.h"
+#include "database/StatementTraverser.h"
 #include "database/TableTraverser.h"
 #include <climits>
+#include <unordered_map>
 #include <unordered_set>
 
 using namespace std;
@@ -44,20 +47,25 @@ inline bool CanMoveToCell(int I, int J, int width, int height, vector<GameAlgori
 	return canMove;
 }
 
-vector<GameAlgorithm::CellData> GameAlgorithm::getCells(unsigned long long gameId, unsigned int width, unsigned int height) {
+vector<GameAlgorithm::CellData> GameAlgorithm::getCells(unsigned long long gameId, unsigned int width, unsigned int height, const boost::optional<string> & board) {
 	// Load cells layout
 	vector<GameAlgorithm::CellData> cells;
+	if (board) {
+		if (!GameBoard::unpack(board->data(), board->size(), width, height, cells))
+			LOG_ERROR("GameAlgorithm::getCells : malformed board for game " << gameId);
+		return cells;
+	}
 	cells.reserve(width*height);
 	
 	// Load cell info
-	TableTraverser cellTraverser(
+	static const StatementId selectCells = PreparedStatements::singleton().declare(
 		MKSTRING("SELECT position,player_id,resources,state "
 			"FROM " << GameController::TableGameCells << " "
-			"WHERE game_id=" << gameId << " ORDER BY position ASC"));
-	for (TableTraverser::iterator cellIt = cellTraverser.begin(); cellIt != cellTraverser.end(); ++cellIt) {
+			"WHERE game_id=? ORDER BY position ASC"));
+	StatementTraverser cellTraverser(selectCells);
+	cellTraverser.bind(gameId);
+	for (StatementTraverser::iterator cellIt = cellTraverser.begin(); cellIt != cellTraverser.end(); ++cellIt) {
 		unsigned int position = cellIt.rowAsUnsignedInt(0);
-		size_t i = position - position/width;
-		size_t j = position/width;
 		cells.push_back(GameAlgorithm::CellData(
 			position, cellIt.isNull(1)? -1 : cellIt.rowAsUnsignedLongLong(1),
 			cellIt.rowAsUnsignedInt(2), cellIt.rowAsUnsignedInt(3)));
@@ -66,22 +74,31 @@ vector<GameAlgorithm::CellData> GameAlgorithm::getCells(unsigned long long gameI
 	return cells;
 }
 
-vector<GameAlgorithm::PlayerData> GameAlgorithm::getPlayers(unsigned long long gameId) {
-	// Load cells layout
+vector<GameAlgorithm::PlayerData> GameAlgorithm::getPlayers(unsigned long long gameId, const vector<GameAlgorithm::CellData> & cells) {
+	// Player positions, players out of the board are left out
+	unordered_map<int, unsigned int> positions;
+	for (vector<GameAlgorithm::CellData>::const_iterator it = cells.begin(); it != cells.end(); ++it)
+		if (it->playerId >= 0)
+			positions[it->playerId] = it->position;
+	
 	vector<GameAlgorithm::PlayerData> players;
 	
-	// Load cell info
-	TableTraverser playerTraverser(
-		MKSTRING("SELECT p.player_id,c.position,p.can_move,p.score,p.user_id,p.virtual_user_id "
-			"FROM " << GameController::TableGamePlayers << " p "
-			"INNER JOIN " << GameController::TableGameCells << " c ON c.game_id=p.game_id AND c.player_id=p.player_id "
-			"WHERE p.game_id=" << gameId << " ORDER BY p.player_id ASC"));
-	for (TableTraverser::iterator playerIt = playerTraverser.begin(); playerIt != playerTraverser.end(); ++playerIt) {
+	// Load player info
+	static const StatementId selectPlayers = PreparedStatements::singleton().declare(
+		MKSTRING("SELECT player_id,can_move,score,user_id,virtual_user_id "
+			"FROM " << GameController::TableGamePlayers << " "
+			"WHERE game_id=? ORDER BY player_id ASC"));
+	StatementTraverser playerTraverser(selectPlayers);
+	playerTraverser.bind(gameId);
+	for (StatementTraverser::iterator playerIt = playerTraverser.begin(); playerIt != playerTraverser.end(); ++playerIt) {
+		unordered_map<int, unsigned int>::const_iterator position = positions.find(playerIt.rowAsInt(0));
+		if (position == positions.end())
+			continue;
 		players.push_back(GameAlgorithm::PlayerData(
-			playerIt.rowAsUnsignedInt(0), playerIt.rowAsUnsignedLongLong(1),
-			playerIt.rowAsUnsignedInt(2) > 0? true : false, playerIt.rowAsInt(3),
-			playerIt.isNull(4)? boost::none : boost::optional<unsigned long long>(playerIt.rowAsUnsignedLongLong(4)),
-			playerIt.isNull(5)? boost::none : boost::optional<unsigned long long>(playerIt.rowAsUnsignedLongLong(5))));
+			playerIt.rowAsUnsignedInt(0), position->second,
+			playerIt.rowAsUnsignedInt(1) > 0? true : false, playerIt.rowAsInt(2),
+			playerIt.isNull(3)? boost::none : boost::optional<unsigned long long>(playerIt.rowAsUnsignedLongLong(3)),
+			playerIt.isNull(4)? boost::none : boost::optional<unsigned long long>(playerIt.rowAsUnsignedLongLong(4))));
 	}
 	
 	return players;
@@ -423,10 +440,27 @@ vector<unsigned long long> GameAlgorithm::getBlockedPlayers(vector<GameAlgorithm
 	return blockedPlayers;
 }
 
-unsigned int GameAlgorithm::minMaxGame(unsigned long long gameId, unsigned int width, unsigned int height, unsigned int playerId) {
+unsigned int GameAlgorithm::minMaxGame(unsigned long long gameId, unsigned int width, unsigned int height,
+		const boost::optional<string> & board, unsigned int playerId) {
 	// Load cells layout
-	vector<CellData> cells = getCells(gameId, width, height);
-	vector<PlayerData> players = getPlayers(gameId);
+	vector<CellData> cells = getCells(gameId, width, height, board);
+	if (cells.size() != width*height) {
+		LOG_ERROR("GameAlgorithm::minMaxGame : " << cells.size() << " cells instead of " << width << "x" << height << " at game " << gameId);
+		return width*height;
+	}
+	
+	// The search indexes players by id, every one must be on the board
+	vector<PlayerData> players = getPlayers(gameId, cells);
+	for (unsigned int i = 0; i < players.size(); ++i) {
+		if (players[i].playerId != static_cast<int>(i)) {
+			LOG_ERROR("GameAlgorithm::minMaxGame : player " << i << " missing from the board at game " << gameId);
+			return width*height;
+		}
+	}
+	if (playerId >= players.size()) {
+		LOG_ERROR("GameAlgorithm::minMaxGame : player " << playerId << " missing from the board at game " << gameId);
+		return width*height;
+	}
 	unsigned int selfPosition = players[playerId].position;
 	
 	LOG("Run MinMax for " << playerId << " at (" << PosI(selfPosition, width) << ", " << PosJ(selfPosition, width) << ")");
@@ -64,8 +64,11 @@ public:
 		bool modified;
 	};
 	
-	static std::vector<CellData> getCells(unsigned long long gameId, unsigned int width, unsigned int height);
-	static std::vector<PlayerData> getPlayers(unsigned long long gameId);
+	/// Cells of a game, from its packed board when it has one (see
+	/// GameBoard) or else from its cell rows.
+	static std::vector<CellData> getCells(unsigned long long gameId, unsigned int width, unsigned int height, const boost::optional<std::string> & board);
+	/// Players of a game placed on some of its cells.
+	static std::vector<PlayerData> getPlayers(unsigned long long gameId, const std::vector<CellData> & cells);
 	
 // Game Logic
 public:
@@ -80,7 +83,11 @@ protected:
 
 // AI contrincants
 public:
-	static unsigned int minMaxGame(unsigned long long gameId, unsigned int width, unsigned int height, unsigned int playerId);
+	/// Best position for playerId to move to, width*height or beyond when
+	/// the board is malformed or the player can not move. board is the
+	/// packed board of the game, as for getCells.
+	static unsigned int minMaxGame(unsigned long long gameId, unsigned int width, unsigned int height,
+		const boost::optional<std::string> & board, unsigned int playerId);
 };
 
 }
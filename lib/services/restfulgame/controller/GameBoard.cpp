@@ -0,0 +1,199 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "GameBoard.h"
+
+#include "GameController.h"
+#include "misc/Utilities.h"
+#include "database/DataBase.h"
+#include "database/StatementTraverser.h"
+#include "database/TableTraverser.h"
+#include "server/Log.h"
+
+using namespace std;
+
+namespace yucode {
+namespace restfulgame {
+
+const string GameBoard::TableBoardPositions = "bom_board_positions";
+const string GameBoard::ViewGameCells = "bom_game_cells_view";
+
+bool GameBoard::packed_ = false;
+
+void GameBoard::bootStrap() {
+	// Games created before packed boards
+	if (!DataBase::singleton().existsResultsForQuery(MKSTRING(
+			"SELECT 1 FROM information_schema.COLUMNS "
+			"WHERE TABLE_SCHEMA=DATABASE() "
+				"AND TABLE_NAME='" << GameController::TableGame << "' "
+				"AND COLUMN_NAME='board'")))
+		DataBase::singleton().executeQuery(MKSTRING(
+			"ALTER TABLE " << GameController::TableGame << " "
+			"ADD COLUMN board BLOB DEFAULT NULL"));
+	
+	// Positions a packed board may have, to expand boards in SQL
+	DataBase::singleton().createTableIfNotExists(TableBoardPositions,
+		"position SMALLINT UNSIGNED NOT NULL PRIMARY KEY");
+	stringstream ssPositions;
+	for (unsigned int position = 0; position < MaxPackedCells; ++position)
+		ssPositions << (position? "," : "") << "(" << position << ")";
+	DataBase::singleton().executeInsertIgnore(TableBoardPositions, "position", ssPositions.str());
+	
+	// Cells of every game as TableGameCells rows, for reports and tools
+	string cell = MKSTRING("ORD(SUBSTRING(g.board," << PackedHeaderSize + 1 << "+n.position,1))");
+	DataBase::singleton().executeQuery(MKSTRING(
+		"CREATE OR REPLACE VIEW " << ViewGameCells << " (game_id,position,player_id,resources,state) AS "
+		"SELECT game_id,position,player_id,resources,state "
+			"FROM " << GameController::TableGameCells << " "
+		"UNION ALL "
+		"SELECT g.id,n.position,"
+				"IF(" << cell << ">>4=0,NULL,(" << cell << ">>4)-1),"
+				"(" << cell << ">>2)&3,"
+				<< cell << "&3 "
+			"FROM " << GameController::TableGame << " g "
+			"INNER JOIN " << TableBoardPositions << " n "
+				"ON n.position<g.width*g.height "
+			"WHERE g.board IS NOT NULL AND ORD(g.board)=" << PackedVersion));
+}
+
+bool GameBoard::pack(const vector<GameAlgorithm::CellData> & cells, unsigned int width, unsigned int height, string & board) {
+	if (width > 255 || height > 255 || width * height > MaxPackedCells || cells.size() != width * height)
+		return false;
+	
+	board.resize(PackedHeaderSize + cells.size());
+	board[0] = PackedVersion;
+	board[1] = width;
+	board[2] = height;
+	for (size_t position = 0; position < cells.size(); ++position) {
+		const GameAlgorithm::CellData & cell = cells[position];
+		if (cell.position != position
+			|| cell.state > MaxPackedState
+			|| cell.resources > MaxPackedResources
+			|| cell.playerId >= MaxPackedPlayers)
+			return false;
+		unsigned int occupant = cell.playerId < 0? 0 : cell.playerId + 1;
+		board[PackedHeaderSize + position] = cell.state | (cell.resources << 2) | (occupant << 4);
+	}
+	return true;
+}
+
+bool GameBoard::unpack(const char * board, size_t length, unsigned int width, unsigned int height, vector<GameAlgorithm::CellData> & cells) {
+	const unsigned char * bytes = reinterpret_cast<const unsigned char *>(board);
+	if (length < PackedHeaderSize || bytes[0] != PackedVersion
+		|| bytes[1] != width || bytes[2] != height
+		|| length != PackedHeaderSize + width * height)
+		return false;
+	
+	cells.clear();
+	cells.reserve(width * height);
+	for (unsigned int position = 0; position < width * height; ++position) {
+		unsigned char cell = bytes[PackedHeaderSize + position];
+		cells.push_back(GameAlgorithm::CellData(position, 
+			(cell >> 4) ? (cell >> 4) - 1 : -1, (cell >> 2) & 3, cell & 3));
+	}
+	return true;
+}
+
+unsigned long long GameBoard::migrate(bool toPacked, unsigned long long limit) {
+	TableTraverser gamesTraverser(MKSTRING(
+		"SELECT id,width,height FROM " << GameController::TableGame << " "
+		"WHERE board IS " << (toPacked? "NULL" : "NOT NULL")));
+	gamesTraverser.setKeyset("id", 0);
+	gamesTraverser.setChunkSize(100);
+	
+	unsigned long long moved = 0, failed = 0;
+	for (TableTraverser::iterator it = gamesTraverser.begin(); it != gamesTraverser.end() && (!limit || moved < limit); ++it) {
+		unsigned long long gameId = it.rowAsUnsignedLongLong(0);
+		unsigned int width = it.rowAsUnsignedInt(1);
+		unsigned int height = it.rowAsUnsignedInt(2);
+		if (toPacked? packGame(gameId, width, height) : unpackGame(gameId, width, height)) {
+			if (!(++moved % 1000))
+				LOG("GameBoard::migrate : " << moved << " games moved");
+		} else
+			++failed;
+	}
+	
+	LOG("GameBoard::migrate : " << moved << " games moved to " << (toPacked? "packed boards" : "cell rows")
+		<< ", " << failed << " left as they were");
+	return moved;
+}
+
+bool GameBoard::packGame(unsigned long long gameId, unsigned int width, unsigned int height) {
+	Transaction transaction;
+	
+	// Moves on the game wait for the migration
+	static const StatementId lockGame = PreparedStatements::singleton().declare(
+		MKSTRING("SELECT board IS NULL FROM " << GameController::TableGame << " "
+			"WHERE id=? FOR UPDATE"));
+	StatementTraverser lockTraverser(lockGame);
+	lockTraverser.bind(gameId);
+	StatementTraverser::iterator lockIt = lockTraverser.begin();
+	if (lockIt == lockTraverser.end() || !lockIt.rowAsInt(0))
+		return false;
+	
+	vector<GameAlgorithm::CellData> cells = GameAlgorithm::getCells(gameId, width, height, boost::none);
+	string board;
+	if (!pack(cells, width, height, board)) {
+		LOG_WARN("GameBoard::packGame : game " << gameId << " cells do not fit a packed board");
+		return false;
+	}
+	
+	static const StatementId updateBoard = PreparedStatements::singleton().declare(
+		MKSTRING("UPDATE " << GameController::TableGame << " "
+			"SET board=? WHERE id=?"));
+	StatementTraverser(updateBoard).bind(board).bind(gameId).execute();
+	DataBase::singleton().executeDelete(GameController::TableGameCells.c_str(), MKSTRING("game_id=" << gameId).c_str());
+	
+	transaction.commit();
+	return true;
+}
+
+bool GameBoard::unpackGame(unsigned long long gameId, unsigned int width, unsigned int height) {
+	Transaction transaction;
+	
+	static const StatementId lockBoard = PreparedStatements::singleton().declare(
+		MKSTRING("SELECT board FROM " << GameController::TableGame << " "
+			"WHERE id=? FOR UPDATE"));
+	StatementTraverser lockTraverser(lockBoard);
+	lockTraverser.bind(gameId);
+	StatementTraverser::iterator lockIt = lockTraverser.begin();
+	if (lockIt == lockTraverser.end() || lockIt.isNull(0))
+		return false;
+	
+	vector<GameAlgorithm::CellData> cells;
+	if (!unpack(lockIt.rowAsString(0), lockIt.rowLength(0), width, height, cells)) {
+		LOG_WARN("GameBoard::unpackGame : game " << gameId << " has a malformed board");
+		return false;
+	}
+	
+	stringstream ssCells;
+	for (vector<GameAlgorithm::CellData>::const_iterator it = cells.begin(); it != cells.end(); ++it) {
+		ssCells << (it == cells.begin()? "" : ",") << "(" << gameId << "," << it->position << ",";
+		if (it->playerId < 0)
+			ssCells << "NULL";
+		else
+			ssCells << it->playerId;
+		ssCells << "," << it->resources << "," << it->state << ")";
+	}
+	DataBase::singleton().executeInsert(GameController::TableGameCells, 
+		"game_id,position,player_id,resources,state",
+		ssCells.str());
+	DataBase::singleton().executeQuery(MKSTRING(
+		"UPDATE " << GameController::TableGame << " "
+		"SET board=NULL WHERE id=" << gameId));
+	
+	transaction.commit();
+	return true;
+}
+
+}
+}
@@ -0,0 +1,81 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef YUCODE_RESTFUL_GAMEBOARD_H
+#define YUCODE_RESTFUL_GAMEBOARD_H
+
+#include <vector>
+#include <string>
+#include <boost/optional.hpp>
+#include "GameAlgorithm.h"
+
+namespace yucode {
+namespace restfulgame {
+
+/// Packed board storage: the cells of a game kept as one BLOB in the board
+/// column of its row, instead of one row per cell in TableGameCells.
+/// Games whose board is NULL keep their rows, so both storages coexist.
+///
+/// BLOB layout (version 1): version, width and height bytes, followed by
+/// one byte per cell in position order, holding its state in bits 0-1,
+/// its resources in bits 2-3 and its occupant player plus one in bits
+/// 4-7 (0 when empty).
+class GameBoard {
+public:
+// Constants
+	enum PackedLayout {
+		PackedVersion = 1,
+		PackedHeaderSize = 3,
+		MaxPackedState = 3,
+		MaxPackedResources = 3,
+		MaxPackedPlayers = 15,
+		MaxPackedCells = 1024
+	};
+	static const std::string TableBoardPositions;
+	static const std::string ViewGameCells;
+	
+public:
+	/// Adds the board column to games created before it, and the view
+	/// listing the cells of every game whatever its storage.
+	static void bootStrap();
+	
+	/// Whether new games get a packed board.
+	static void setPackedStorage(bool packed) { packed_ = packed; }
+	static bool packedStorage() { return packed_; }
+	
+// Encoding
+public:
+	/// Packs cells of a width x height board, false if some value does not
+	/// fit in the layout.
+	static bool pack(const std::vector<GameAlgorithm::CellData> & cells, unsigned int width, unsigned int height, std::string & board);
+	
+	/// Unpacks a board of width x height cells, false if it is malformed.
+	static bool unpack(const char * board, size_t length, unsigned int width, unsigned int height, std::vector<GameAlgorithm::CellData> & cells);
+	
+// Migration
+public:
+	/// Moves up to limit games (0 for all) from cell rows to packed boards,
+	/// or back when toPacked is false, one transaction per game. Returns
+	/// the games moved.
+	static unsigned long long migrate(bool toPacked, unsigned long long limit);
+
+protected:
+	static bool packGame(unsigned long long gameId, unsigned int width, unsigned int height);
+	static bool unpackGame(unsigned long long gameId, unsigned int width, unsigned int height);
+	
+	static bool packed_;
+};
+
+}
+}
+
+#endif
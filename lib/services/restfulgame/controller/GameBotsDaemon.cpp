@@ -73,6 +73,7 @@ void GameBotsDaemon::createBot(const string & userName, const string & name) {
 void GameBotsDaemon::bootStrapLoadBots() {
 	TableTraverser botTraverser(
 		MKSTRING("SELECT user_id FROM " << TableDaemons));
+	botTraverser.setStreaming();
 	for (TableTraverser::iterator botIt = botTraverser.begin(); botIt != botTraverser.end(); ++ botIt)
 		bots_.push_back(botIt.rowAsUnsignedLongLong(0));
 }
@@ -83,7 +84,10 @@ void GameBotsDaemon::runRandomGamesJoiner() {
 	boost::posix_time::seconds sleepTime(20);
 	
 	while (1) {
-		joinRandomGames();
+		{
+			ConnectionScope connectionScope;
+			joinRandomGames();
+		}
 		boost::this_thread::sleep(sleepTime);
 	}
 }
@@ -93,11 +97,14 @@ void GameBotsDaemon::runBotTurnPlayer() {
 	
 	LOG("GameBotsDaemon::runBotTurnPlayer: Started turn player bot");
 	while (1) {
-		vector<unsigned long long> gameIds = getBotTurnGames();
-		if (gameIds.size() > 0) {
-			LOG("GameBotsDaemon::runBotTurnPlayer: " << gameIds.size() << " bot turn games");
-			for (vector<unsigned long long>::const_iterator it = gameIds.begin(); it != gameIds.end(); ++it)
-				playBotTurn(*it);
+		{
+			ConnectionScope connectionScope;
+			vector<unsigned long long> gameIds = getBotTurnGames();
+			if (gameIds.size() > 0) {
+				LOG("GameBotsDaemon::runBotTurnPlayer: " << gameIds.size() << " bot turn games");
+				for (vector<unsigned long long>::const_iterator it = gameIds.begin(); it != gameIds.end(); ++it)
+					playBotTurn(*it);
+			}
 		}
 		
 		boost::this_thread::sleep(sleepTime);
@@ -143,25 +150,7 @@ void GameBotsDaemon::joinRandomGames() {
 
 					joinedGameIds.push_back(gameId);
 	
-					string cellConstraint = MKSTRING(
-						"(position-floor(position/"<< GameController::DefaultGameWidth <<")*"<< GameController::DefaultGameWidth <<")>2 "
-						"AND floor(position/"<< GameController::DefaultGameWidth <<")>2 "
-						"AND (position-floor(position/"<< GameController::DefaultGameWidth <<")*"<< GameController::DefaultGameWidth <<")<("<< GameController::DefaultGameWidth <<"-2) "
-						"AND floor(position/"<< GameController::DefaultGameWidth <<")<("<< GameController::DefaultGameWidth <<"-2)");
-					DataBase::singleton().executeQuery(MKSTRING(
-						"UPDATE " << GameController::TableGameCells << " "
-						"SET player_id=" << playerId << " "
-						"WHERE game_id= " << gameId << " AND player_id IS NULL and state>0 "
-						" AND (" << cellConstraint << ")"
-						"ORDER BY RAND() "
-						"LIMIT 1"));
-					
-					DataBase::singleton().executeQuery(MKSTRING(
-						"UPDATE " << GameController::TableGamePlayers << " p "
-						"INNER JOIN " << GameController::TableGameCells << " c "
-						"SET p.score=p.score+c.resources "
-						"WHERE p.id= " << playerAbsId << " AND c.player_id=" << playerId <<
-						" AND c.game_id=" << gameId));
+					GameController::placeJoinedPlayer(gameId, playerId, playerAbsId);
 
 					DataBase::singleton().executeQuery(MKSTRING(
 						"UPDATE " << GameController::TableGame << " "
@@ -214,11 +203,15 @@ vector<unsigned long long> GameBotsDaemon::getBotTurnGames() {
 			"WHERE g.turn_player_id=p.player_id AND g.finished=0 "
 				"AND g.time_stamp < DATE_SUB(NOW(),INTERVAL 5 SECOND)"
 		));
-	int limit = 0;
-	for (TableTraverser::iterator it = gameTraverser.begin(); it != gameTraverser.end() && limit < 100; ++it, ++limit)
+	// One chunk, lowest ids first, is read per round: 100 games to play
+	// and one more telling whether others are left behind
+	gameTraverser.setKeyset("g.id", 0);
+	gameTraverser.setChunkSize(101);
+	TableTraverser::iterator it = gameTraverser.begin();
+	for (; it != gameTraverser.end() && gameIds.size() < 100; ++it)
 		gameIds.push_back(it.rowAsUnsignedLongLong(0));
 	
-	if (limit >= 100) {
+	if (it != gameTraverser.end()) {
 		LOG_WARN("GameBotsDaemon::getBotTurnGames : Possible load excess, more than 100 queued games");
 	}
 	
@@ -228,15 +221,13 @@ vector<unsigned long long> GameBotsDaemon::getBotTurnGames() {
 void GameBotsDaemon::playBotTurn(unsigned long long gameId) {
 	// Fetch game info
 	TableTraverser gameTraverser(
-		MKSTRING("SELECT g.width,g.height,g.turn_player_id,c.position,p.user_id FROM " << GameController::TableGame << " g "
-			"INNER JOIN " << GameController::TableGameCells << " c "
-				"ON c.game_id=g.id AND c.player_id=g.turn_player_id "
+		MKSTRING("SELECT g.width,g.height,g.turn_player_id,p.user_id,g.board FROM " << GameController::TableGame << " g "
 			"INNER JOIN " << GameController::TableGamePlayers << " p "
 				"ON p.game_id=g.id AND p.player_id=g.turn_player_id "
 			"WHERE g.id=" << gameId
 		));
 	TableTraverser::iterator gameIt = gameTraverser.begin();
-	if (gameIt == gameTraverser.end() || gameIt.isNull(5)) {
+	if (gameIt == gameTraverser.end() || gameIt.isNull(3)) {
 		LOG_ERROR("GameBotsDaemon::playBotTurn : failed to fetch waiting for bot game " << gameId);
 		return;
 	}
@@ -244,16 +235,19 @@ void GameBotsDaemon::playBotTurn(unsigned long long gameId) {
 	unsigned int width = gameIt.rowAsUnsignedInt(0);
 	unsigned int height = gameIt.rowAsUnsignedInt(1);
 	unsigned int playerId = gameIt.rowAsUnsignedInt(2);
-	unsigned int position = gameIt.rowAsUnsignedInt(3);
-	unsigned int userId = gameIt.rowAsUnsignedLongLong(4);
+	unsigned int userId = gameIt.rowAsUnsignedLongLong(3);
+	boost::optional<string> board;
+	if (!gameIt.isNull(4))
+		board = string(gameIt.rowAsString(4), gameIt.rowLength(4));
 	
 	// Run AI
 	server::TimeStamp ts;
 	SetTimeStamp(ts);
-	unsigned int nextPosition = GameAlgorithm::minMaxGame(gameId, width, height, playerId);
+	unsigned int nextPosition = GameAlgorithm::minMaxGame(gameId, width, height, board, playerId);
 	LOG_ELLAPSED_SINCE(ts, "GameBotsDaemon::playBotTurn : optimal position computed");
-	if (position == nextPosition) {
-		LOG_ERROR("GameBotsDaemon::playBotTurn : AI failed to move player " << playerId << " (at position " << position << ") to a valid position at game " << gameId);
+	// The player position comes with the board, which the AI loads
+	if (nextPosition >= width * height) {
+		LOG_ERROR("GameBotsDaemon::playBotTurn : AI failed to move player " << playerId << " to a valid position at game " << gameId);
 		return;
 	}
 	
@@ -261,7 +255,7 @@ void GameBotsDaemon::playBotTurn(unsigned long long gameId) {
 	jsonservice::DefaultPackage package("game.move");
 	boost::optional<Game> game  = GameController::gameMove(gameId, nextPosition, userId, package.getHeader());
 	if (!game) {
-		LOG_ERROR("GameBotsDaemon::playBotTurn : unable to move player " << playerId << " (at position " << position << ") to a valid position at game " << gameId);
+		LOG_ERROR("GameBotsDaemon::playBotTurn : unable to move player " << playerId << " to position " << nextPosition << " at game " << gameId);
 		return;
 	}
 	
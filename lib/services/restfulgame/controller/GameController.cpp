@@ -14,13 +14,17 @@
 
 #include <string>
 #include <sstream>
+#include <cstring>
 
 #include "services/restful/controller/RestFulController.h"
 #include "misc/Utilities.h"
+#include "database/RowTraverser.h"
+#include "database/StatementTraverser.h"
 #include "database/TableTraverser.h"
 #include "transportdata/model/User.h"
 #include "transportdata/model/Cell.h"
 #include "GameAlgorithm.h"
+#include "GameBoard.h"
 #include "notifications/NotificationController.h"
 
 using namespace std;
@@ -83,36 +87,75 @@ void GameController::bootStrap() {
 		"random_game TINYINT DEFAULT 0, "
 		"finished TINYINT DEFAULT 0, "
 		"time_stamp TIMESTAMP DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP, "
+		"board BLOB DEFAULT NULL, "
 		"KEY owner_user_id (owner_user_id),"
 		"KEY turn_player_id (turn_player_id)"
 	);
 	
+	// Players and cells are clustered by game, so a game reads as one
+	// range of its primary key
 	DataBase::singleton().createTableIfNotExists(TableGamePlayers,
-		"id BIGINT UNSIGNED NOT NULL AUTO_INCREMENT PRIMARY KEY, "
+		"id BIGINT UNSIGNED NOT NULL AUTO_INCREMENT, "
 		"player_id BIGINT UNSIGNED NOT NULL, "
 		"game_id BIGINT UNSIGNED NOT NULL, "
 		"user_id BIGINT UNSIGNED DEFAULT NULL, "
 		"virtual_user_id BIGINT UNSIGNED DEFAULT NULL, "
 		"can_move TINYINT NOT NULL DEFAULT 1, "
 		"score INT UNSIGNED NOT NULL DEFAULT 0, "
-		"KEY game_id (game_id),"
-		"KEY player_id (player_id),"
+		"PRIMARY KEY (game_id,player_id),"
+		"UNIQUE KEY id (id),"
 		"KEY user_id (user_id),"
 		"KEY virtual_user_id (virtual_user_id)"
 	);
 	
 	DataBase::singleton().createTableIfNotExists(TableGameCells,
-		"id BIGINT UNSIGNED NOT NULL AUTO_INCREMENT PRIMARY KEY, "
 		"game_id BIGINT UNSIGNED NOT NULL, "
 		"position SMALLINT UNSIGNED NOT NULL, "
 		"player_id BIGINT UNSIGNED DEFAULT NULL, "
 		"resources SMALLINT UNSIGNED NOT NULL DEFAULT 5, "
 		"state SMALLINT UNSIGNED NOT NULL DEFAULT 1, "
-		"KEY game_id (game_id),"
-		"KEY player_id (player_id),"
-		"KEY position (position),"
-		"KEY (game_id,player_id)"
+		"PRIMARY KEY (game_id,position),"
+		"KEY game_id_2 (game_id,player_id)"
 	);
+	
+	migrateTables();
+	
+	GameBoard::bootStrap();
+}
+
+void GameController::migrateTables() {
+	DataBase & dataBase = DataBase::singleton();
+	string engine = MKSTRING("ENGINE=" << dataBase.getEngine());
+	
+	// Tables created while keyed by a surrogate id
+	string cellsAlterations, playersAlterations;
+	if (dataBase.existsResultsForQuery(MKSTRING(
+			"SELECT 1 FROM information_schema.COLUMNS "
+			"WHERE TABLE_SCHEMA=DATABASE() "
+				"AND TABLE_NAME='" << TableGameCells << "' "
+				"AND COLUMN_NAME='id'")))
+		cellsAlterations = "DROP COLUMN id,DROP KEY game_id,DROP KEY player_id,DROP KEY position,"
+			"ADD PRIMARY KEY (game_id,position),";
+	if (dataBase.existsResultsForQuery(MKSTRING(
+			"SELECT 1 FROM information_schema.STATISTICS "
+			"WHERE TABLE_SCHEMA=DATABASE() "
+				"AND TABLE_NAME='" << TableGamePlayers << "' "
+				"AND INDEX_NAME='PRIMARY' AND COLUMN_NAME='id'")))
+		playersAlterations = "DROP PRIMARY KEY,DROP KEY game_id,DROP KEY player_id,"
+			"ADD PRIMARY KEY (game_id,player_id),ADD UNIQUE KEY id (id),";
+	
+	const string * tables[] = { &TableUser, &TableVirtualUser, &TableGame, &TableGamePlayers, &TableGameCells };
+	for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); ++i) {
+		const string & table = *tables[i];
+		string alterations = table == TableGameCells? cellsAlterations
+			: (table == TableGamePlayers? playersAlterations : string());
+		if (alterations.empty() && strcasecmp(dataBase.getTableEngine(table).c_str(), dataBase.getEngine().c_str()) == 0)
+			continue;
+		
+		LOG_WARN("GameController::migrateTables : rebuilding " << table << " with " << alterations << engine);
+		if (!dataBase.alterTable(table, alterations + engine))
+			LOG_ERROR("GameController::migrateTables : " << table << " left as it was");
+	}
 }
 
 //
@@ -131,26 +174,31 @@ bool GameController::userHasReadRightsOverGame(unsigned long long gameId, unsign
 }
 
 boost::optional<Game> GameController::getGame(unsigned long long clientUserId, unsigned long long gameId, jsonservice::Header & header) {
-	boost::optional<Game> game = getGameBase(gameId, header);
+	boost::optional<string> board;
+	boost::optional<Game> game = getGameBase(gameId, board, header);
 	if (!game)
 		return boost::none;
 	
 	addGamePlayers(clientUserId, *game, header);
 	
-	addGameCells(*game, header);
+	addGameCells(*game, board, header);
 	
 	return game;
 }
 
-boost::optional<Game> GameController::getGameBase(unsigned long long gameId, jsonservice::Header & header) {
+boost::optional<Game> GameController::getGameBase(unsigned long long gameId, boost::optional<string> & board, jsonservice::Header & header) {
 	// Fetch game data
-	string queryGame = MKSTRING("SELECT id,sequence_num,width,height,owner_user_id,turn_player_id,random_game,finished,UNIX_TIMESTAMP(time_stamp) "
-		"FROM " << TableGame << " WHERE id=" << gameId);
-	TableTraverser gameTraverser(queryGame);
-	TableTraverser::iterator gameIt = gameTraverser.begin();
+	static const StatementId selectGame = PreparedStatements::singleton().declare(
+		MKSTRING("SELECT id,sequence_num,width,height,owner_user_id,turn_player_id,random_game,finished,UNIX_TIMESTAMP(time_stamp),board "
+			"FROM " << TableGame << " WHERE id=?"));
+	StatementTraverser gameTraverser(selectGame);
+	gameTraverser.bind(gameId);
+	StatementTraverser::iterator gameIt = gameTraverser.begin();
 	if (gameIt == gameTraverser.end())
 		return boost::none;
 	
+	if (!gameIt.isNull(9))
+		board = string(gameIt.rowAsString(9), gameIt.rowLength(9));
 	return Game(gameIt.rowAsUnsignedLongLong(0), gameIt.rowAsUnsignedLongLong(1), 
 			gameIt.rowAsUnsignedInt(2), gameIt.rowAsUnsignedInt(3),
 			gameIt.rowAsUnsignedLongLong(4), gameIt.rowAsUnsignedInt(5), 
@@ -201,20 +249,45 @@ void GameController::addGamePlayers(unsigned long long clientUserId, Game & game
 	game.setPlayers(players);
 }
 
-void GameController::addGameCells(Game & game, jsonservice::Header & header) {
+namespace {
+
+struct CellRow {
+	boost::optional<unsigned long long> playerId;
+	unsigned int resources;
+	unsigned int state;
+};
+
+typedef RowTraverser<CellRow,
+	Column<CellRow, boost::optional<unsigned long long>, &CellRow::playerId>,
+	Column<CellRow, unsigned int, &CellRow::resources>,
+	Column<CellRow, unsigned int, &CellRow::state> > CellTraverser;
+
+}
+
+void GameController::addGameCells(Game & game, const boost::optional<string> & board, jsonservice::Header & header) {
+	if (board) {
+		vector<GameAlgorithm::CellData> cellsData = GameAlgorithm::getCells(game.getId(), game.getWidth(), game.getHeight(), board);
+		vector<Cell> cells;
+		cells.reserve(cellsData.size());
+		for (vector<GameAlgorithm::CellData>::const_iterator it = cellsData.begin(); it != cellsData.end(); ++it)
+			cells.push_back(Cell(it->playerId < 0? boost::none : boost::optional<unsigned long long>(it->playerId),
+				it->resources, it->state));
+		game.setCells(cells);
+		return;
+	}
+	
 	// Fetch cells
-	vector<Cell> cells;
-	string queryCells = MKSTRING("SELECT player_id,resources,state "
+	CellTraverser cellsTraverser(MKSTRING("SELECT player_id,resources,state "
 		"FROM " << TableGameCells << " "
 		"WHERE game_id=" << game.getId() << " "
-		"ORDER BY position ASC");
-	TableTraverser cellsTraverser(queryCells);
-	for (TableTraverser::iterator cellIt = cellsTraverser.begin(); cellIt != cellsTraverser.end(); ++cellIt) {
-		cells.push_back(
-			Cell(cellIt.isNull(0)? boost::none : boost::optional<unsigned long long>(cellIt.rowAsUnsignedLongLong(0)),
-			     cellIt.rowAsUnsignedInt(1),
-			     cellIt.rowAsUnsignedInt(2)));
-	}
+		"ORDER BY position ASC"));
+	vector<CellRow> rows;
+	cellsTraverser.fetchAll(rows);
+	
+	vector<Cell> cells;
+	cells.reserve(rows.size());
+	for (vector<CellRow>::const_iterator it = rows.begin(); it != rows.end(); ++it)
+		cells.push_back(Cell(it->playerId, it->resources, it->state));
 	game.setCells(cells);
 }
 
@@ -239,12 +312,6 @@ boost::optional<Game> GameController::createGame(const vector<unsigned long long
 	// Network ones last
 	fullUserIds.insert (fullUserIds.end(), userIds.begin(), userIds.end());
 	
-	// Store game object
-	unsigned long long gameId = DataBase::singleton().executeInsert(TableGame, 
-		"sequence_num,width,height,owner_user_id,turn_player_id,random_game",
-		MKSTRING("(0," << DefaultGameWidth << "," 
-			<< DefaultGameHeight << "," << clientUserId << "," << 0 << "," << (random? 1 : 0) << ")"));
-	
 	// Select random user positions
 	map<unsigned int, unsigned long long> userPositions;
 	vector<unsigned long long> initialScore;
@@ -263,6 +330,44 @@ boost::optional<Game> GameController::createGame(const vector<unsigned long long
 		initialScore.push_back(rand() % MaxResourcesPerCell + 1);
 	}
 	
+	// Lay out cells
+	vector<GameAlgorithm::CellData> cells;
+	cells.reserve(DefaultGameWidth * DefaultGameHeight);
+	for (int cellPos = 0; cellPos < DefaultGameWidth * DefaultGameHeight; ++cellPos) {
+		unsigned int tI = PosI(cellPos, DefaultGameWidth);
+		unsigned int tJ = PosJ(cellPos, DefaultGameWidth);
+		bool border1 = (tI <= 0 || tI >= DefaultGameWidth - 1) 
+			|| (tJ <= 0 || tJ >= DefaultGameHeight - 1);
+		bool border2 = !border1 && ((tI <= 1 || tI >= DefaultGameWidth - 2) 
+			|| (tJ <= 1 || tJ >= DefaultGameHeight - 2));
+		int state = (!border1 && !border2) ? 1
+			: (border1? (rand() % 8 > 5 ? 1 : 0) : (rand() % 8 > 2 ? 1 : 0));
+		// Double state cells
+		if (state == 1) {
+			state += (rand() % 4 > 2 ? 1 : 0);
+		}
+		map<unsigned int, unsigned long long>::const_iterator user = userPositions.find(cellPos);
+		cells.push_back(GameAlgorithm::CellData(cellPos, user != userPositions.end()? int(user->second) : -1,
+			user != userPositions.end()? initialScore[user->second] : (rand() % MaxResourcesPerCell + 1), state));
+	}
+	
+	// Store game object, holding the cells when packed
+	string board;
+	bool packed = GameBoard::packedStorage() && GameBoard::pack(cells, DefaultGameWidth, DefaultGameHeight, board);
+	static const StatementId insertGame = PreparedStatements::singleton().declare(
+		MKSTRING("INSERT INTO " << TableGame << " "
+			"(sequence_num,width,height,owner_user_id,turn_player_id,random_game,board) "
+			"VALUES (0,?,?,?,0,?,?)"));
+	StatementTraverser gameInsert(insertGame);
+	gameInsert.bind(static_cast<unsigned int>(DefaultGameWidth)).bind(static_cast<unsigned int>(DefaultGameHeight))
+		.bind(clientUserId).bind(random? 1 : 0);
+	if (packed)
+		gameInsert.bind(board);
+	else
+		gameInsert.bindNull();
+	gameInsert.execute();
+	unsigned long long gameId = gameInsert.getLastInsertedId();
+	
 	// Store players
 	stringstream ssPlayers;
 	string separator = "";
@@ -281,43 +386,41 @@ boost::optional<Game> GameController::createGame(const vector<unsigned long long
 		"player_id,game_id,user_id,virtual_user_id,score",
 		ssPlayers.str());
 	
-	// Store cells
-	stringstream ssCells;
-	separator = "";
-	for (int cellPos = 0; cellPos < DefaultGameWidth * DefaultGameHeight; ++cellPos) {
-		unsigned int tI = PosI(cellPos, DefaultGameWidth);
-		unsigned int tJ = PosJ(cellPos, DefaultGameWidth);
-		bool border1 = (tI <= 0 || tI >= DefaultGameWidth - 1) 
-			|| (tJ <= 0 || tJ >= DefaultGameHeight - 1);
-		bool border2 = !border1 && ((tI <= 1 || tI >= DefaultGameWidth - 2) 
-			|| (tJ <= 1 || tJ >= DefaultGameHeight - 2));
-		int state = (!border1 && !border2) ? 1
-			: (border1? (rand() % 8 > 5 ? 1 : 0) : (rand() % 8 > 2 ? 1 : 0));
-		// Double state cells
-		if (state == 1) {
-			state += (rand() % 4 > 2 ? 1 : 0);
+	// Store cells as rows otherwise
+	if (!packed) {
+		stringstream ssCells;
+		separator = "";
+		for (vector<GameAlgorithm::CellData>::const_iterator it = cells.begin(); it != cells.end(); ++it) {
+			ssCells << separator << "(" << gameId << "," << it->position << ",";
+			if (it->playerId < 0)
+				ssCells << "NULL";
+			else
+				ssCells << it->playerId;
+			ssCells << "," << it->resources << "," << it->state << ")";
+			separator = ",";
 		}
-		ssCells << separator << "(" << gameId << "," << cellPos << ","
-			<< (userPositions.find(cellPos) != userPositions.end()? MKSTRING(userPositions[cellPos]) : string("NULL")) << ","
-			<< MKSTRING((userPositions.find(cellPos) != userPositions.end()? 
-				initialScore[userPositions[cellPos]] :(rand() % MaxResourcesPerCell + 1)))
-			<< "," << state << ")";
-		separator = ",";
+		DataBase::singleton().executeInsert(TableGameCells, 
+			"game_id,position,player_id,resources,state",
+			ssCells.str());
 	}
-	DataBase::singleton().executeInsert(TableGameCells, 
-		"game_id,position,player_id,resources,state",
-		ssCells.str());
 	
 	return getGame(clientUserId, gameId, header);
 }
 
 boost::optional<Game> GameController::gameMove(unsigned long long gameId, unsigned int position, unsigned long long clientUserId, jsonservice::Header & header) {
+	// Reads lock the game row, so concurrent moves on it serialize, and
+	// every write below lands at once
+	Transaction transaction;
+	
 	// Fetch general game data
-	TableTraverser gameTraverser(
-		MKSTRING("SELECT turn_player_id,owner_user_id,width,height "
+	static const StatementId selectGameTurn = PreparedStatements::singleton().declare(
+		MKSTRING("SELECT turn_player_id,owner_user_id,width,height,board "
 			"FROM " << TableGame << " "
-			"WHERE id=" << gameId));
-	TableTraverser::iterator gameIt = gameTraverser.begin();
+			"WHERE id=? "
+			"FOR UPDATE"));
+	StatementTraverser gameTraverser(selectGameTurn);
+	gameTraverser.bind(gameId);
+	StatementTraverser::iterator gameIt = gameTraverser.begin();
 	if (gameIt == gameTraverser.end())
 		return boost::none;
 	
@@ -325,9 +428,15 @@ boost::optional<Game> GameController::gameMove(unsigned long long gameId, unsign
 	unsigned long long ownerUserId = gameIt.rowAsUnsignedLongLong(1);
 	unsigned int width = gameIt.rowAsUnsignedInt(2);
 	unsigned int height = gameIt.rowAsUnsignedInt(3);
+	boost::optional<string> board;
+	if (!gameIt.isNull(4))
+		board = string(gameIt.rowAsString(4), gameIt.rowLength(4));
+	
+	// Fetch cells
+	vector<GameAlgorithm::CellData> cells = GameAlgorithm::getCells(gameId, width, height, board);
 	
 	// Fetch players
-	vector<GameAlgorithm::PlayerData> players = GameAlgorithm::getPlayers(gameId);
+	vector<GameAlgorithm::PlayerData> players = GameAlgorithm::getPlayers(gameId, cells);
 	
 	// Detect not in turn
 	if (turnPlayerId >= players.size()
@@ -335,9 +444,6 @@ boost::optional<Game> GameController::gameMove(unsigned long long gameId, unsign
 		|| (players[turnPlayerId].userId == boost::none && ownerUserId != clientUserId))
 		return boost::none;
 	
-	// Fetch cells
-	vector<GameAlgorithm::CellData> cells = GameAlgorithm::getCells(gameId, width, height);
-	
 	// Validate move
 	if (!GameAlgorithm::canMove(turnPlayerId, position, players, cells, width, height)) {
 		LOG("GameController::gameMove : can move failed");
@@ -348,27 +454,58 @@ boost::optional<Game> GameController::gameMove(unsigned long long gameId, unsign
 	bool endOfGame = false;
 	GameAlgorithm::move(turnPlayerId, players, position, cells, width, height, endOfGame);
 	
-	// Update game
-	DataBase::singleton().executeQuery(MKSTRING(
-		"UPDATE " << TableGame << " "
-		"SET finished=" << (endOfGame? 1 : 0) << ",sequence_num=sequence_num+1,turn_player_id=" << turnPlayerId << " "
-		"WHERE id=" << gameId));
-			
-	// Update players
-	for (vector<GameAlgorithm::PlayerData>::const_iterator it = players.begin(); it != players.end(); ++it)
-		if (it->modified)
-			DataBase::singleton().executeQuery(MKSTRING(
-				"UPDATE " << TableGamePlayers << " "
-				"SET score=" << it->score << ",can_move=" << (it->canMove? 1 : 0) << " "
-				"WHERE player_id=" << it->playerId << " AND game_id=" << gameId));
-	
-	// Update cells
-	for (vector<GameAlgorithm::CellData>::const_iterator it = cells.begin(); it != cells.end(); ++it)
-		if (it->modified)
-			DataBase::singleton().executeQuery(MKSTRING(
-				"UPDATE " << TableGameCells << " "
-				"SET state=" << it->state << ",player_id=" << (it->playerId < 0? string("NULL") : MKSTRING(it->playerId)) << " "
-				"WHERE position=" << it->position << " AND game_id=" << gameId));
+	// Update game, along its board when packed
+	if (board && !GameBoard::pack(cells, width, height, *board)) {
+		LOG_ERROR("GameController::gameMove : game " << gameId << " board no longer packs");
+		return boost::none;
+	}
+	static const StatementId updateGame = PreparedStatements::singleton().declare(
+		MKSTRING("UPDATE " << TableGame << " "
+			"SET finished=?,sequence_num=sequence_num+1,turn_player_id=?,board=? "
+			"WHERE id=?"));
+	StatementTraverser gameUpdate(updateGame);
+	gameUpdate.bind(endOfGame? 1 : 0).bind(turnPlayerId);
+	if (board)
+		gameUpdate.bind(*board);
+	else
+		gameUpdate.bindNull();
+	gameUpdate.bind(gameId).execute();
+	
+	// Update modified players, all in one statement
+	stringstream ssScore, ssCanMove, ssPlayerIds;
+	for (vector<GameAlgorithm::PlayerData>::const_iterator it = players.begin(); it != players.end(); ++it) {
+		if (!it->modified)
+			continue;
+		ssScore << " WHEN " << it->playerId << " THEN " << it->score;
+		ssCanMove << " WHEN " << it->playerId << " THEN " << (it->canMove? 1 : 0);
+		ssPlayerIds << (ssPlayerIds.tellp() > 0? "," : "") << it->playerId;
+	}
+	if (ssPlayerIds.tellp() > 0)
+		DataBase::singleton().executeQuery(MKSTRING(
+			"UPDATE " << TableGamePlayers << " "
+			"SET score=CASE player_id" << ssScore.str() << " END,"
+				"can_move=CASE player_id" << ssCanMove.str() << " END "
+			"WHERE game_id=" << gameId << " AND player_id IN (" << ssPlayerIds.str() << ")"));
+	
+	// Update modified cells, all in one statement, unless packed
+	stringstream ssState, ssCellPlayer, ssPositions;
+	for (vector<GameAlgorithm::CellData>::const_iterator it = cells.begin(); it != cells.end() && !board; ++it) {
+		if (!it->modified)
+			continue;
+		ssState << " WHEN " << it->position << " THEN " << it->state;
+		ssCellPlayer << " WHEN " << it->position << " THEN ";
+		if (it->playerId < 0)
+			ssCellPlayer << "NULL";
+		else
+			ssCellPlayer << it->playerId;
+		ssPositions << (ssPositions.tellp() > 0? "," : "") << it->position;
+	}
+	if (ssPositions.tellp() > 0)
+		DataBase::singleton().executeQuery(MKSTRING(
+			"UPDATE " << TableGameCells << " "
+			"SET state=CASE position" << ssState.str() << " END,"
+				"player_id=CASE position" << ssCellPlayer.str() << " END "
+			"WHERE game_id=" << gameId << " AND position IN (" << ssPositions.str() << ")"));
 	
 	// On End of Game, update total score of each user (real or virtual)
 	if (endOfGame) {
@@ -386,6 +523,7 @@ boost::optional<Game> GameController::gameMove(unsigned long long gameId, unsign
 					"AND p.virtual_user_id=u.id "
 			"SET u.score=u.score+p.score"));
 	}
+	transaction.commit();
 	
 	return getGame(clientUserId, gameId, header);
 }
@@ -421,25 +559,7 @@ boost::optional<Game> GameController::createOrJoinRandomGame(unsigned long long
 			unsigned long long timeStamp = gameIt.rowAsUnsignedLongLong(1);
 			unsigned long long playerId = gameIt.rowAsUnsignedLongLong(2);
 
-			string cellConstraint = MKSTRING(
-						"(position-floor(position/"<< GameController::DefaultGameWidth <<")*"<< GameController::DefaultGameWidth <<")>2 "
-						"AND floor(position/"<< GameController::DefaultGameWidth <<")>2 "
-						"AND (position-floor(position/"<< GameController::DefaultGameWidth <<")*"<< GameController::DefaultGameWidth <<")<("<< GameController::DefaultGameWidth <<"-2) "
-						"ABD floor(position/"<< GameController::DefaultGameWidth <<")<("<< GameController::DefaultGameWidth <<"-2)");
-			DataBase::singleton().executeQuery(MKSTRING(
-														"UPDATE " << GameController::TableGameCells << " "
-														"SET player_id=" << playerId << " "
-														"WHERE game_id= " << gameId << " AND player_id IS NULL AND state>0 "
-														"AND (" << cellConstraint << ")"
-														"ORDER BY RAND() "
-														"LIMIT 1"));
-			
-			DataBase::singleton().executeQuery(MKSTRING(
-														"UPDATE " << GameController::TableGamePlayers << " p "
-														"INNER JOIN " << GameController::TableGameCells << " c "
-														"SET p.score=p.score+c.resources "
-														"WHERE p.id= " << playerAbsId << " AND c.player_id=" << playerId <<
-														" AND c.game_id=" << gameId));
+			placeJoinedPlayer(gameId, playerId, playerAbsId);
 			
 			DataBase::singleton().executeQuery(MKSTRING(
 														"UPDATE " << GameController::TableGame << " "
@@ -470,6 +590,80 @@ boost::optional<Game> GameController::createOrJoinRandomGame(unsigned long long
 	return createGame(vector<unsigned long long>(), clientUserId, vector<string>(), true, header);
 }
 
+void GameController::placeJoinedPlayer(unsigned long long gameId, unsigned long long playerId, unsigned long long playerAbsId) {
+	Transaction transaction;
+	
+	static const StatementId selectBoard = PreparedStatements::singleton().declare(
+		MKSTRING("SELECT width,height,board "
+			"FROM " << TableGame << " "
+			"WHERE id=? "
+			"FOR UPDATE"));
+	StatementTraverser boardTraverser(selectBoard);
+	boardTraverser.bind(gameId);
+	StatementTraverser::iterator boardIt = boardTraverser.begin();
+	if (boardIt == boardTraverser.end())
+		return;
+	
+	if (boardIt.isNull(2)) {
+		string cellConstraint = MKSTRING(
+			"(position-floor(position/"<< DefaultGameWidth <<")*"<< DefaultGameWidth <<")>2 "
+			"AND floor(position/"<< DefaultGameWidth <<")>2 "
+			"AND (position-floor(position/"<< DefaultGameWidth <<")*"<< DefaultGameWidth <<")<("<< DefaultGameWidth <<"-2) "
+			"AND floor(position/"<< DefaultGameWidth <<")<("<< DefaultGameWidth <<"-2)");
+		DataBase::singleton().executeQuery(MKSTRING(
+			"UPDATE " << TableGameCells << " "
+			"SET player_id=" << playerId << " "
+			"WHERE game_id= " << gameId << " AND player_id IS NULL AND state>0 "
+			"AND (" << cellConstraint << ")"
+			"ORDER BY RAND() "
+			"LIMIT 1"));
+		
+		DataBase::singleton().executeQuery(MKSTRING(
+			"UPDATE " << TableGamePlayers << " p "
+			"INNER JOIN " << TableGameCells << " c "
+			"SET p.score=p.score+c.resources "
+			"WHERE p.id= " << playerAbsId << " AND c.player_id=" << playerId <<
+			" AND c.game_id=" << gameId));
+	} else {
+		unsigned int width = boardIt.rowAsUnsignedInt(0);
+		unsigned int height = boardIt.rowAsUnsignedInt(1);
+		vector<GameAlgorithm::CellData> cells;
+		if (!GameBoard::unpack(boardIt.rowAsString(2), boardIt.rowLength(2), width, height, cells)) {
+			LOG_ERROR("GameController::placeJoinedPlayer : malformed board for game " << gameId);
+			return;
+		}
+		
+		vector<unsigned int> freeCells;
+		for (vector<GameAlgorithm::CellData>::const_iterator it = cells.begin(); it != cells.end(); ++it) {
+			unsigned int i = PosI(it->position, width);
+			unsigned int j = PosJ(it->position, width);
+			if (i > 2 && j > 2 && i + 2 < width && j + 2 < height && it->playerId < 0 && it->state > 0)
+				freeCells.push_back(it->position);
+		}
+		if (freeCells.empty())
+			return;
+		
+		GameAlgorithm::CellData & cell = cells[freeCells[rand() % freeCells.size()]];
+		cell.playerId = playerId;
+		string board;
+		if (!GameBoard::pack(cells, width, height, board)) {
+			LOG_ERROR("GameController::placeJoinedPlayer : player " << playerId << " does not fit game " << gameId << " board");
+			return;
+		}
+		
+		static const StatementId updateBoard = PreparedStatements::singleton().declare(
+			MKSTRING("UPDATE " << TableGame << " "
+				"SET board=? WHERE id=?"));
+		StatementTraverser(updateBoard).bind(board).bind(gameId).execute();
+		DataBase::singleton().executeQuery(MKSTRING(
+			"UPDATE " << TableGamePlayers << " "
+			"SET score=score+" << cell.resources << " "
+			"WHERE id=" << playerAbsId));
+	}
+	
+	transaction.commit();
+}
+
 //
 // User Package
 //
@@ -42,6 +42,11 @@ public:
 public:
 	static void bootStrap();
 	
+protected:
+	/// Moves game tables created by older versions to the configured
+	/// engine and to primary keys clustered by game.
+	static void migrateTables();
+	
 // Game Object
 public:
 	static bool userHasReadRightsOverGame(unsigned long long gameId, unsigned long long clientUserId);
@@ -55,10 +60,14 @@ public:
 		static std::vector<unsigned long long> getFinishedGames(unsigned long long clientUserId, jsonservice::Header & header);
 	static std::vector<unsigned long long> getUpdatesSinceTimeStamp(unsigned long long clientUserId, const std::map<unsigned long long, unsigned long long> & gameTimeStamps, jsonservice::Header & header);
 	
+	/// Places a player who just joined a random game on a free cell away
+	/// from the borders, adding the cell resources to its score.
+	static void placeJoinedPlayer(unsigned long long gameId, unsigned long long playerId, unsigned long long playerAbsId);
+	
 protected:
-	static boost::optional<Game> getGameBase(unsigned long long gameId, jsonservice::Header & header);
+	static boost::optional<Game> getGameBase(unsigned long long gameId, boost::optional<std::string> & board, jsonservice::Header & header);
 	static void addGamePlayers(unsigned long long clientUserId, Game & game, jsonservice::Header & header);
-	static void addGameCells(Game & game, jsonservice::Header & header);
+	static void addGameCells(Game & game, const boost::optional<std::string> & board, jsonservice::Header & header);
 
 // User Object
 public:
@@ -0,0 +1,37 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#ifndef YUCODE_BENCH_BENCH_H
+#define YUCODE_BENCH_BENCH_H
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace yucode {
+namespace bench {
+
+/// Time the Request parser against the per byte one it replaced, both
+/// decoding uri, arguments and cookies of canned Requests.
+void benchParser(unsigned long iterations);
+
+/// Time DataBase::rowToScalar against the stream decoding it replaced,
+/// over canned column values of each type.
+void benchRows(unsigned long iterations);
+
+/// Print ns per run and MB/s of a case run iterations times over bytes
+/// each, in ellapsed ns.
+void report(const char * name, unsigned long iterations, std::size_t bytes, uint64_t ellapsed);
+
+} // namespace bench
+} // namespace yucode
+
+#endif // YUCODE_BENCH_BENCH_H
@@ -0,0 +1,459 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "Bench.h"
+
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/logic/tribool.hpp>
+#include "server/Header.h"
+#include "server/Metrics.h"
+#include "server/Request.h"
+#include "server/RequestParser.h"
+
+namespace yucode {
+namespace bench {
+
+namespace {
+
+/// Request as the per byte parser filled it, every field a copy.
+struct BaselineRequest
+{
+	std::string method;
+	std::string uri;
+	std::string referer;
+	std::string origin;
+	int http_version_major;
+	int http_version_minor;
+	std::vector<server::Header> headers;
+	std::string extension;
+	std::string root_folder;
+	std::string decoded_uri;
+	std::map<std::string, std::string> arguments;
+	std::map<std::string, std::string> cookies;
+};
+
+/// The Request parser before the head was split at once: a state machine
+/// fed a byte at a time, followed by the same uri, argument and cookie
+/// decoding, minus its logging.
+class BaselineParser
+{
+public:
+	BaselineParser() : state_(method_start) {}
+	
+	void reset() { state_ = method_start; }
+	
+	bool parse(BaselineRequest & req, const char * begin, const char * end) {
+		boost::tribool result = boost::indeterminate;
+		while (begin != end && boost::indeterminate(result))
+			result = consume(req, *begin++);
+		return result ? enhace_Request(req) : false;
+	}
+	
+private:
+	boost::tribool consume(BaselineRequest & req, char input);
+	bool enhace_Request(BaselineRequest & req);
+	static bool url_decode(const std::string & in, std::string & out);
+	static bool parse_cookies(BaselineRequest & req, const std::string & cookies);
+	static std::string ParseUrlDomain(const std::string & url_s);
+	
+	static bool is_char(int c) { return c >= 0 && c <= 127; }
+	static bool is_ctl(int c) { return (c >= 0 && c <= 31) || (c == 127); }
+	static bool is_digit(int c) { return c >= '0' && c <= '9'; }
+	static bool is_tspecial(int c) {
+		switch (c)
+		{
+		case '(': case ')': case '<': case '>': case '@':
+		case ',': case ';': case ':': case '\\': case '"':
+		case '/': case '[': case ']': case '?': case '=':
+		case '{': case '}': case ' ': case '\t':
+			return true;
+		default:
+			return false;
+		}
+	}
+	
+	enum state
+	{
+		method_start,
+		method,
+		uri,
+		http_version_h,
+		http_version_t_1,
+		http_version_t_2,
+		http_version_p,
+		http_version_slash,
+		http_version_major_start,
+		http_version_major,
+		http_version_minor_start,
+		http_version_minor,
+		expecting_newline_1,
+		header_line_start,
+		header_lws,
+		header_name,
+		space_before_header_value,
+		header_value,
+		expecting_newline_2,
+		expecting_newline_3
+	} state_;
+};
+
+boost::tribool BaselineParser::consume(BaselineRequest & req, char input)
+{
+	switch (state_)
+	{
+	case method_start:
+		if (!is_char(input) || is_ctl(input) || is_tspecial(input))
+			return false;
+		state_ = method;
+		req.method.push_back(input);
+		return boost::indeterminate;
+	case method:
+		if (input == ' ') {
+			state_ = uri;
+			return boost::indeterminate;
+		}
+		if (!is_char(input) || is_ctl(input) || is_tspecial(input))
+			return false;
+		req.method.push_back(input);
+		return boost::indeterminate;
+	case uri:
+		if (input == ' ') {
+			state_ = http_version_h;
+			return boost::indeterminate;
+		}
+		if (is_ctl(input))
+			return false;
+		req.uri.push_back(input);
+		return boost::indeterminate;
+	case http_version_h:
+		if (input != 'H')
+			return false;
+		state_ = http_version_t_1;
+		return boost::indeterminate;
+	case http_version_t_1:
+		if (input != 'T')
+			return false;
+		state_ = http_version_t_2;
+		return boost::indeterminate;
+	case http_version_t_2:
+		if (input != 'T')
+			return false;
+		state_ = http_version_p;
+		return boost::indeterminate;
+	case http_version_p:
+		if (input != 'P')
+			return false;
+		state_ = http_version_slash;
+		return boost::indeterminate;
+	case http_version_slash:
+		if (input != '/')
+			return false;
+		req.http_version_major = 0;
+		req.http_version_minor = 0;
+		state_ = http_version_major_start;
+		return boost::indeterminate;
+	case http_version_major_start:
+		if (!is_digit(input))
+			return false;
+		req.http_version_major = req.http_version_major * 10 + input - '0';
+		state_ = http_version_major;
+		return boost::indeterminate;
+	case http_version_major:
+		if (input == '.') {
+			state_ = http_version_minor_start;
+			return boost::indeterminate;
+		}
+		if (!is_digit(input))
+			return false;
+		req.http_version_major = req.http_version_major * 10 + input - '0';
+		return boost::indeterminate;
+	case http_version_minor_start:
+		if (!is_digit(input))
+			return false;
+		req.http_version_minor = req.http_version_minor * 10 + input - '0';
+		state_ = http_version_minor;
+		return boost::indeterminate;
+	case http_version_minor:
+		if (input == '\r') {
+			state_ = expecting_newline_1;
+			return boost::indeterminate;
+		}
+		if (!is_digit(input))
+			return false;
+		req.http_version_minor = req.http_version_minor * 10 + input - '0';
+		return boost::indeterminate;
+	case expecting_newline_1:
+		if (input != '\n')
+			return false;
+		state_ = header_line_start;
+		return boost::indeterminate;
+	case header_line_start:
+		if (input == '\r') {
+			state_ = expecting_newline_3;
+			return boost::indeterminate;
+		}
+		if (!req.headers.empty() && (input == ' ' || input == '\t')) {
+			state_ = header_lws;
+			return boost::indeterminate;
+		}
+		if (!is_char(input) || is_ctl(input) || is_tspecial(input))
+			return false;
+		req.headers.push_back(server::Header());
+		req.headers.back().name.push_back(input);
+		state_ = header_name;
+		return boost::indeterminate;
+	case header_lws:
+		if (input == '\r') {
+			state_ = expecting_newline_2;
+			return boost::indeterminate;
+		}
+		if (input == ' ' || input == '\t')
+			return boost::indeterminate;
+		if (is_ctl(input))
+			return false;
+		state_ = header_value;
+		req.headers.back().value.push_back(input);
+		return boost::indeterminate;
+	case header_name:
+		if (input == ':') {
+			state_ = space_before_header_value;
+			return boost::indeterminate;
+		}
+		if (!is_char(input) || is_ctl(input) || is_tspecial(input))
+			return false;
+		req.headers.back().name.push_back(input);
+		return boost::indeterminate;
+	case space_before_header_value:
+		if (input != ' ')
+			return false;
+		state_ = header_value;
+		return boost::indeterminate;
+	case header_value:
+		if (input == '\r') {
+			state_ = expecting_newline_2;
+			return boost::indeterminate;
+		}
+		if (is_ctl(input))
+			return false;
+		req.headers.back().value.push_back(input);
+		return boost::indeterminate;
+	case expecting_newline_2:
+		if (input != '\n')
+			return false;
+		state_ = header_line_start;
+		return boost::indeterminate;
+	case expecting_newline_3:
+		return (input == '\n');
+	default:
+		return false;
+	}
+}
+
+bool BaselineParser::enhace_Request(BaselineRequest & req)
+{
+	std::string uri_path, uri_arguments;
+	
+	std::size_t arguments_start = req.uri.find_first_of("?");
+	if (arguments_start != std::string::npos) {
+		uri_path = req.uri.substr(0, arguments_start);
+		uri_arguments = req.uri.substr(arguments_start + 1);
+	} else {
+		uri_path = req.uri;
+	}
+	req.uri = uri_path;
+	
+	if (!url_decode(req.uri, req.decoded_uri))
+		return false;
+	
+	std::size_t last_slash_pos = req.decoded_uri.find_last_of("/");
+	std::size_t last_dot_pos = req.decoded_uri.find_last_of(".");
+	if (last_dot_pos != std::string::npos && last_dot_pos > last_slash_pos)
+		req.extension = req.decoded_uri.substr(last_dot_pos + 1);
+	
+	std::size_t first_slash_pos = req.decoded_uri.find("/", 1);
+	if (first_slash_pos != std::string::npos)
+		req.root_folder = req.decoded_uri.substr(1, first_slash_pos - 1);
+	else
+		req.root_folder = req.decoded_uri.substr(1, req.decoded_uri.length() - 1);
+	
+	for (std::vector<server::Header>::const_iterator headerIt = req.headers.begin(); headerIt != req.headers.end(); ++headerIt) {
+		if (headerIt->name == "Cookie")
+			parse_cookies(req, headerIt->value);
+		else if (headerIt->name == "Referer")
+			req.referer = ParseUrlDomain(headerIt->value);
+		else if (headerIt->name == "Origin")
+			req.origin = ParseUrlDomain(headerIt->value);
+	}
+	
+	if (!uri_arguments.empty()) {
+		std::string arg, deco_arg, value, deco_value;
+		std::size_t cur_pointer = 0;
+		
+		while (cur_pointer != std::string::npos && cur_pointer + 1 < uri_arguments.length()) {
+			std::size_t next_and = uri_arguments.find("&", cur_pointer+1);
+			std::size_t next_equal = uri_arguments.find("=", cur_pointer+1);
+			
+			if (next_equal == std::string::npos
+				|| ((int)cur_pointer > (int)next_equal - 1)
+				|| (next_and != std::string::npos && (int)next_equal > (int)next_and - 1))
+				return false;
+			
+			arg = uri_arguments.substr(cur_pointer, next_equal - cur_pointer);
+			if (next_and != std::string::npos && (int)next_equal == (int)next_and - 1)
+				value = std::string();
+			else if (next_and != std::string::npos)
+				value = uri_arguments.substr(next_equal + 1, next_and - next_equal - 1);
+			else
+				value = uri_arguments.substr(next_equal + 1);
+			
+			if (!url_decode(arg, deco_arg) || !url_decode(value, deco_value))
+				return false;
+			req.arguments[deco_arg] = deco_value;
+			
+			cur_pointer = (next_and != std::string::npos? next_and + 1 : next_and);
+		}
+	}
+	return true;
+}
+
+bool BaselineParser::url_decode(const std::string & in, std::string & out)
+{
+	out.clear();
+	out.reserve(in.size());
+	for (std::size_t i = 0; i < in.size(); ++i) {
+		if (in[i] == '%') {
+			if (i + 3 > in.size())
+				return false;
+			int value = 0;
+			std::istringstream is(in.substr(i + 1, 2));
+			if (!(is >> std::hex >> value))
+				return false;
+			out += static_cast<char>(value);
+			i += 2;
+		} else if (in[i] == '+') {
+			out += ' ';
+		} else {
+			out += in[i];
+		}
+	}
+	return true;
+}
+
+bool BaselineParser::parse_cookies(BaselineRequest & req, const std::string & cookies)
+{
+	std::size_t pos = 0;
+	while (pos != std::string::npos && pos < cookies.size()) {
+		std::size_t it = cookies.find_first_of('=', pos);
+		if (it == std::string::npos || it + 1 >= cookies.size())
+			break;
+		std::string name = cookies.substr(pos, it - pos);
+		pos = it + 1;
+		it = cookies.find_first_of(';', pos);
+		if (it == std::string::npos) {
+			req.cookies[name] = cookies.substr(pos);
+			break;
+		}
+		req.cookies[name] = cookies.substr(pos, it - pos);
+		pos = it + 1;
+		while (pos < cookies.size() && cookies[pos] == ' ')
+			++pos;
+	}
+	return true;
+}
+
+std::string BaselineParser::ParseUrlDomain(const std::string & url_s)
+{
+	const std::string prot_end("://");
+	std::string::const_iterator prot_i = std::search(url_s.begin(), url_s.end(),
+			prot_end.begin(), prot_end.end());
+	if (prot_i == url_s.end() || prot_i + 3 == url_s.end())
+		return std::string();
+	prot_i += 3;
+	return std::string(prot_i, std::find(prot_i, url_s.end(), '/'));
+}
+
+struct Case {
+	const char * name;
+	const char * head;
+};
+
+const Case cases[] = {
+	{ "small GET",
+		"GET /restfulgame/getGame?gameId=1289&userId=77&sessionToken=a41f09c2 HTTP/1.1\r\n"
+		"Host: api.greedycats.com\r\n"
+		"User-Agent: GreedyCats/2.3 (iPhone; iOS 9.2)\r\n"
+		"Accept: application/json\r\n"
+		"Accept-Encoding: gzip, deflate\r\n"
+		"Connection: keep-alive\r\n"
+		"\r\n" },
+	{ "GET with cookies and escapes",
+		"GET /restfulgame/sendMessage?gameId=1289&userId=77&text=hola%20que%20tal%3F&sessionToken=a41f09c2 HTTP/1.1\r\n"
+		"Host: api.greedycats.com\r\n"
+		"User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_11_2) AppleWebKit/601.3.9 (KHTML, like Gecko) Version/9.0.2 Safari/601.3.9\r\n"
+		"Accept: application/json, text/javascript, */*; q=0.01\r\n"
+		"Accept-Language: es-es\r\n"
+		"Accept-Encoding: gzip, deflate\r\n"
+		"Referer: https://www.greedycats.com/play/game.html\r\n"
+		"Origin: https://www.greedycats.com\r\n"
+		"Cookie: userId=77; sessionToken=a41f09c2; lang=es; _ga=GA1.2.1729381442.1450612871; _gat=1\r\n"
+		"X-Requested-With: XMLHttpRequest\r\n"
+		"Connection: keep-alive\r\n"
+		"\r\n" }
+};
+
+} // namespace
+
+void benchParser(unsigned long iterations)
+{
+	for (std::size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+		std::vector<char> buffer(cases[c].head, cases[c].head + strlen(cases[c].head));
+		char * begin = &buffer[0];
+		char * end = begin + buffer.size();
+		std::cout << cases[c].name << ", " << buffer.size() << " bytes" << std::endl;
+		
+		BaselineParser baseline;
+		uint64_t start = server::Metrics::now();
+		for (unsigned long i = 0; i < iterations; ++i) {
+			BaselineRequest req;
+			baseline.reset();
+			if (!baseline.parse(req, begin, end)) {
+				std::cerr << "baseline parser rejected " << cases[c].name << std::endl;
+				return;
+			}
+		}
+		report("  per byte (baseline)", iterations, buffer.size(), server::Metrics::now() - start);
+		
+		// As a Connection does, the Request is reused and only reset
+		server::RequestParser parser;
+		server::Request req;
+		req.seq_number = 0;
+		start = server::Metrics::now();
+		for (unsigned long i = 0; i < iterations; ++i) {
+			req.reset();
+			parser.reset();
+			if (!boost::get<0>(parser.parse(req, begin, end))) {
+				std::cerr << "parser rejected " << cases[c].name << std::endl;
+				return;
+			}
+		}
+		report("  whole head", iterations, buffer.size(), server::Metrics::now() - start);
+	}
+}
+
+} // namespace bench
+} // namespace yucode
@@ -0,0 +1,90 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "Bench.h"
+
+#include <string.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "database/DataBase.h"
+#include "server/Metrics.h"
+
+namespace yucode {
+namespace bench {
+
+namespace {
+
+/// DataBase::rowToScalar before ScalarDecoder: a string and a stream per
+/// value.
+template <typename T>
+T baselineRowToScalar(const char * ptr, int len)
+{
+	if (!ptr) return T(0);
+	T t;
+	std::istringstream stringStream(std::string(ptr, len));
+	if ((stringStream >> t).fail())
+		return T(0);
+	return t;
+}
+
+/// Column values as a MYSQL_ROW holds them, NUL terminated.
+const char * const ints[] = { "1289", "77", "-3", "0", "1450612871", "42", "65535", "9" };
+const char * const unsigned_long_longs[] = { "18446744073709551615", "1289", "77", "1450612871000",
+	"0", "4294967296", "31337", "12" };
+const char * const doubles[] = { "3.14159265", "-0.5", "1289", "2.5e10", "0", "0.001", "77.77", "1e-3" };
+
+const std::size_t values = sizeof(ints) / sizeof(ints[0]);
+
+template <typename T>
+void benchColumn(const char * name, const char * const * column, unsigned long iterations)
+{
+	unsigned long lengths[values];
+	std::size_t bytes = 0;
+	for (std::size_t v = 0; v < values; ++v) {
+		lengths[v] = strlen(column[v]);
+		bytes += lengths[v];
+		if (baselineRowToScalar<T>(column[v], lengths[v]) != DataBase::rowToScalar<T>(column[v], lengths[v]))
+			std::cerr << name << ": " << column[v] << " decodes differently" << std::endl;
+	}
+	std::cout << name << ", " << values << " values" << std::endl;
+	
+	// Summed so the decoding is not optimized away
+	T sum = T();
+	uint64_t start = server::Metrics::now();
+	for (unsigned long i = 0; i < iterations; ++i)
+		for (std::size_t v = 0; v < values; ++v)
+			sum += baselineRowToScalar<T>(column[v], lengths[v]);
+	report("  stream (baseline)", iterations * values, bytes / values, server::Metrics::now() - start);
+	
+	T fast_sum = T();
+	start = server::Metrics::now();
+	for (unsigned long i = 0; i < iterations; ++i)
+		for (std::size_t v = 0; v < values; ++v)
+			fast_sum += DataBase::rowToScalar<T>(column[v], lengths[v]);
+	report("  in place", iterations * values, bytes / values, server::Metrics::now() - start);
+	
+	if (sum != fast_sum)
+		std::cerr << name << ": sums differ" << std::endl;
+}
+
+} // namespace
+
+void benchRows(unsigned long iterations)
+{
+	benchColumn<int>("int", ints, iterations);
+	benchColumn<unsigned long long>("unsigned long long", unsigned_long_longs, iterations);
+	benchColumn<double>("double", doubles, iterations);
+}
+
+} // namespace bench
+} // namespace yucode
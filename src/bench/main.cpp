@@ -0,0 +1,86 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "Bench.h"
+
+#include <string.h>
+#include <iomanip>
+#include <iostream>
+#include <boost/lexical_cast.hpp>
+#include "server/Log.h"
+
+using namespace std;
+using namespace yucode;
+
+struct Config {
+#define OPTION(ARG_SHORT, ARG_LARGE, FIELD, DESC, DEFAULT) \
+	const char *FIELD;
+#include "options.def"
+#undef OPTION
+} config;
+
+bool loadConfig(Config & config, int argc, char* argv[]) {
+#define OPTION(ARG_SHORT, ARG_LARGE, FIELD, DESC, DEFAULT) \
+	config.FIELD = DEFAULT;
+#include "options.def"
+#undef OPTION
+	if (!(argc % 2))
+		return false;
+	
+	int i = 1;
+	while (i + 1 < argc) {
+		char * arg = argv[i];
+		char * value = argv[i+1];
+		
+#define OPTION(ARG_SHORT, ARG_LARGE, FIELD, DESC, DEFAULT) \
+		if (strcmp(arg, ARG_SHORT) == 0 || strcmp(arg, ARG_LARGE) == 0) config.FIELD = value; else
+#include "options.def"
+		// Final 'else' fallback
+		return false;
+		i += 2;
+#undef OPTION
+	}
+	return true;
+}
+
+void bench::report(const char * name, unsigned long iterations, size_t bytes, uint64_t ellapsed) {
+	double ns = static_cast<double>(ellapsed) / iterations;
+	double mbs = ellapsed ? static_cast<double>(bytes) * iterations * 1000.0 / ellapsed : 0;
+	cout << left << setw(32) << name << right << fixed << setprecision(1)
+		<< setw(10) << ns << " ns" << setw(10) << mbs << " MB/s" << endl;
+}
+
+int main (int argc, char ** argv) {
+	if (!loadConfig(config, argc, argv))
+	{
+		cerr << "Usage: " << argv[0] << " <options>\n";
+#define OPTION(ARG_SHORT, ARG_LARGE, FIELD, DESC, DEFAULT) \
+		cerr << "\t" ARG_LARGE "|" ARG_SHORT "\t - " DESC "(def " DEFAULT ")" << endl;
+#include "options.def"
+#undef OPTION
+		return 1;
+	}
+	
+	// Logging per run would be what gets measured
+	server::SetLogLevel(server::LogError);
+	
+	unsigned long iterations = boost::lexical_cast<unsigned long>(config.iterations);
+	if (strcmp(config.bench, "parser") == 0) {
+		bench::benchParser(iterations);
+	} else if (strcmp(config.bench, "rows") == 0) {
+		bench::benchRows(iterations);
+	} else {
+		cerr << "Unknown benchmark: " << config.bench << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -15,6 +15,7 @@
 #include "server/Request.h"
 #include "server/RequestParser.h"
 #include "server/RequestHandler.h"
+#include "external/curl/Downloader.h"
 
 #include <stdlib.h>
 #include <iostream>
@@ -167,6 +168,29 @@ public:
 	}
 };
 
+class QueryStatsAction : public ConsoleAction {
+public:
+	QueryStatsAction() : ConsoleAction("query_stats", "qs",
+		"query_stats [order [limit [reset]]] dumps the server query profile;\n"
+		"\torder is total, count, max or rows, reset clears it after dumping.\n"
+		"\tExample: query_stats max 20") {}
+
+	bool doAction(const vector<string> &args) {
+		curl::Query query(string("http://") + config.server + "/admin/queries");
+		query.addAttribute("order", args.size() > 1 ? args[1] : string("total"));
+		if (args.size() > 2)
+			query.addAttribute("limit", args[2]);
+		if (args.size() > 3 && args[3] == "reset")
+			query.addAttribute("reset", 1);
+		
+		string output;
+		if (!curl::Downloader::Download(query, &output))
+			return false;
+		cout << output;
+		return true;
+	}
+};
+
 /*
  * Main program
  */
@@ -198,6 +222,7 @@ bool loadConfig(Config & config, int argc, char* argv[]) {
 int main (int argc, char ** argv) {
 	Console console;
 	console.addAction(new MyAction());
+	console.addAction(new QueryStatsAction());
 
 	// Check command line arguments
 	if (!loadConfig(config, argc, argv))
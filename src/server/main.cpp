@@ -17,9 +17,20 @@
 #include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include "server/Server.h"
+#include "server/ContentEncoding.h"
+#include "server/Metrics.h"
+#include "server/RequestParser.h"
+#include "server/ServiceMetrics.h"
+#include "server/ServiceQueryProfile.h"
 #include "services/restfulgame/ServiceRestFulGame.h"
+#include "services/restfulgame/controller/GameBoard.h"
 #include "server/Log.h"
+#include "server/Trace.h"
 #include "database/DataBase.h"
+#ifdef YUCODE_MYSQL_NONBLOCK
+#include "database/AsyncDataBase.h"
+#endif
+#include "database/QueryProfiler.h"
 
 using namespace std;
 using namespace yucode;
@@ -69,18 +80,71 @@ int main (int argc, char ** argv) {
 		
 	if (config.log_file && strlen(config.log_file) > 0)
 		server::SetLogFile(config.log_file);
+	if (!server::SetLogLevel(std::string(config.log_level))) {
+		cerr << "Unknown log level: " << config.log_level << endl;
+		return 1;
+	}
+	if (strcmp(config.board_storage, "rows") != 0 && strcmp(config.board_storage, "packed") != 0) {
+		cerr << "Unknown board storage: " << config.board_storage << endl;
+		return 1;
+	}
 	
 	try {
+		// Each worker holds a connection while it handles a Request, so a
+		// smaller pool has them fail once they are all busy
+		size_t num_workers = boost::lexical_cast<size_t>(config.workers);
+		size_t db_pool_max = boost::lexical_cast<size_t>(config.db_pool_max);
+		if (!db_pool_max) {
+			db_pool_max = num_workers;
+		} else if (db_pool_max < num_workers) {
+			cerr << "db_pool_max " << db_pool_max << " is below the " << num_workers << " workers" << endl;
+			return 1;
+		}
+		
 		DataBase::singleton().setAccess(config.db_database, config.db_user, config.db_password);
-		DataBase::singleton().openConnection();
+		DataBase::singleton().setEngine(config.db_engine);
+		DataBase::singleton().pool().setLimits(boost::lexical_cast<size_t>(config.db_pool_min), db_pool_max);
+		DataBase::singleton().pool().setWaitTimeout(boost::lexical_cast<unsigned int>(config.db_pool_wait));
+		{
+			ConnectionScope connectionScope;
+			DataBase::singleton().openConnection();
+		}
+		DataBase::singleton().pool().fill();
 		
 		// Initialise the Server.
 		size_t num_threads = boost::lexical_cast<size_t>(config.threads);
-		server::Server server(config.address, config.port, config.doc_root, num_threads);
+		size_t keep_alive_timeout = boost::lexical_cast<size_t>(config.keep_alive);
+		bool sharded = boost::lexical_cast<int>(config.sharded) != 0;
+		bool pin_cpus = boost::lexical_cast<int>(config.pin_cpus) != 0;
+		server::ContentEncoding::setLevel(boost::lexical_cast<int>(config.gzip_level));
+		server::ContentEncoding::setMinSize(boost::lexical_cast<size_t>(config.gzip_min_size));
+		server::RequestParser::setMaxBodySize(boost::lexical_cast<size_t>(config.max_body_size));
+		server::SetTraceDirectory(config.trace_dir, boost::lexical_cast<unsigned>(config.trace_segments));
+		server::Server server(config.address, config.port, config.doc_root, num_threads, num_workers, keep_alive_timeout,
+				sharded, pin_cpus);
+		server.admissionControl().setMaxInFlight(boost::lexical_cast<size_t>(config.max_in_flight));
+		server.admissionControl().setRetryAfter(boost::lexical_cast<unsigned int>(config.retry_after));
+		if (!server.admissionControl().setQueueBudgets(config.queue_budget))
+			return 1;
+		if (!server::Metrics::singleton().setQueryBudgets(config.query_budget))
+			return 1;
+		QueryProfiler::singleton().setSlowThreshold(boost::lexical_cast<unsigned int>(config.slow_query_ms));
+		restfulgame::GameBoard::setPackedStorage(strcmp(config.board_storage, "packed") == 0);
 		server.addService(shared_ptr<server::ServiceInterface>(new restfulgame::ServiceRestFulGame()));
+		server.addService(shared_ptr<server::ServiceInterface>(new server::ServiceMetrics()));
+		server.addService(shared_ptr<server::ServiceInterface>(new server::ServiceQueryProfile()));
+		
+#ifdef YUCODE_MYSQL_NONBLOCK
+		size_t async_connections = boost::lexical_cast<size_t>(config.db_async_connections);
+		if (async_connections > 0)
+			AsyncDataBase::singleton().start(server.ioService(), async_connections);
+#endif
 		
 		// Run the Server until stopped.
 		server.run();
+#ifdef YUCODE_MYSQL_NONBLOCK
+		AsyncDataBase::singleton().stop();
+#endif
 	} catch (exception& e) {
 		cerr << "exception: " << e.what() << "\n";
 	}
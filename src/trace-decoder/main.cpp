@@ -0,0 +1,319 @@
+/*
+ *  Copyright (c) 2015 David Yuste Romero
+ *
+ *  THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ *  OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ *  Permission is hereby granted to use or copy this program
+ *  for any purpose,  provided the above notices are retained on all copies.
+ *  Permission to modify the code and to distribute modified code is granted,
+ *  provided the above notices are retained, and a notice that the code was
+ *  modified is included with the above copyright notice.
+ */
+#include "server/Trace.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace yucode::server;
+
+struct Config {
+#define OPTION(ARG_SHORT, ARG_LARGE, FIELD, DESC, DEFAULT) \
+	const char *FIELD;
+#include "options.def"
+#undef OPTION
+} config;
+
+bool loadConfig(Config & config, int argc, char* argv[]) {
+#define OPTION(ARG_SHORT, ARG_LARGE, FIELD, DESC, DEFAULT) \
+	config.FIELD = DEFAULT;
+#include "options.def"
+#undef OPTION
+	if (!(argc % 2))
+		return false;
+	
+	int i = 1;
+	while (i + 1 < argc) {
+		char * arg = argv[i];
+		char * value = argv[i+1];
+		
+#define OPTION(ARG_SHORT, ARG_LARGE, FIELD, DESC, DEFAULT) \
+		if (strcmp(arg, ARG_SHORT) == 0 || strcmp(arg, ARG_LARGE) == 0) config.FIELD = value; else
+#include "options.def"
+		// Final 'else' fallback
+		return false;
+		i += 2;
+#undef OPTION
+	}
+	return true;
+}
+
+/// A decoded event, with its timestamp converted to CLOCK_REALTIME.
+struct Event {
+	unsigned long long time;
+	unsigned long long seq_number;
+	unsigned long long argument;
+	unsigned long long name;
+	unsigned long long duration;
+	unsigned long pid;
+	unsigned int thread;
+	unsigned int event;
+	
+	bool operator<(const Event & other) const {
+		return time < other.time;
+	}
+};
+
+/// Segment file: trace-<pid>-<thread>-<segment>.bin
+struct Segment {
+	string path;
+	unsigned long pid;
+	unsigned int thread;
+	unsigned int number;
+	
+	bool operator<(const Segment & other) const {
+		if (pid != other.pid) return pid < other.pid;
+		if (thread != other.thread) return thread < other.thread;
+		return number < other.number;
+	}
+};
+
+map<unsigned long long, string> names;
+vector<Event> events;
+/// Spans begun and not ended yet by each thread, as indexes in events.
+map<pair<unsigned long, unsigned int>, vector<size_t> > openSpans;
+
+vector<Segment> listSegments(const string & directory, const string & pid) {
+	vector<Segment> segments;
+	DIR * dir = opendir(directory.c_str());
+	if (!dir)
+		return segments;
+	while (struct dirent * entry = readdir(dir)) {
+		Segment segment;
+		char suffix[8];
+		if (sscanf(entry->d_name, "trace-%lu-%u-%u%7s", &segment.pid, &segment.thread, &segment.number, suffix) != 4
+				|| strcmp(suffix, ".bin") != 0)
+			continue;
+		if (!pid.empty() && pid != to_string(segment.pid))
+			continue;
+		segment.path = directory + "/" + entry->d_name;
+		segments.push_back(segment);
+	}
+	closedir(dir);
+	sort(segments.begin(), segments.end());
+	return segments;
+}
+
+bool loadSegment(const Segment & segment) {
+	ifstream in(segment.path.c_str(), ios::binary);
+	vector<TraceRecord> records;
+	TraceRecord record;
+	while (in.read(reinterpret_cast<char *>(&record), sizeof(record)) && record.event != TraceEmpty)
+		records.push_back(record);
+	if (records.empty() || records[0].event != TraceHeader || records[0].argument != TraceMagic) {
+		cerr << segment.path << ": not a trace segment" << endl;
+		return false;
+	}
+	if (records[0].length != TraceVersion) {
+		cerr << segment.path << ": unknown trace version " << records[0].length << endl;
+		return false;
+	}
+	
+	long long offset = records[0].seq_number - records[0].timestamp;
+	// Names are repeated in each segment of a thread
+	map<unsigned long long, string> segmentNames;
+	vector<size_t> & open = openSpans[make_pair(segment.pid, segment.thread)];
+	for (size_t i = 1; i < records.size(); ++i) {
+		const TraceRecord & r = records[i];
+		if (r.event == TraceName) {
+			segmentNames[r.argument].append(reinterpret_cast<const char *>(&r.timestamp), min<size_t>(r.length, 16));
+			continue;
+		}
+		
+		Event event;
+		event.time = r.timestamp + offset;
+		event.seq_number = r.seq_number;
+		event.argument = r.argument;
+		event.name = r.argument;
+		event.duration = 0;
+		event.pid = segment.pid;
+		event.thread = r.thread;
+		event.event = r.event;
+		
+		switch (r.event) {
+		case TraceRequestBegin:
+		case TraceQueryBegin:
+		case TraceLockWaitBegin:
+			open.push_back(events.size());
+			break;
+		case TraceRequestEnd:
+		case TraceQueryEnd:
+		case TraceLockWaitEnd:
+			// Spans nest. Skip those whose end never came, when the process
+			// died, and ends whose begin was in a removed segment.
+			while (!open.empty() && events[open.back()].event + 1 != r.event)
+				open.pop_back();
+			if (!open.empty()) {
+				Event & begin = events[open.back()];
+				begin.duration = event.time - begin.time;
+				event.name = begin.name;
+				open.pop_back();
+			}
+			break;
+		default:
+			break;
+		}
+		events.push_back(event);
+	}
+	names.insert(segmentNames.begin(), segmentNames.end());
+	return true;
+}
+
+const char * eventName(unsigned int event) {
+	switch (event) {
+	case TraceRequestBegin: return "request";
+	case TraceRequestEnd: return "request end";
+	case TraceQueryBegin: return "query";
+	case TraceQueryEnd: return "query end";
+	case TraceLockWaitBegin: return "lock wait";
+	case TraceLockWaitEnd: return "lock wait end";
+	default: return "unknown";
+	}
+}
+
+const char * eventCategory(unsigned int event) {
+	switch (event) {
+	case TraceRequestBegin: case TraceRequestEnd: return "request";
+	case TraceQueryBegin: case TraceQueryEnd: return "query";
+	case TraceLockWaitBegin: case TraceLockWaitEnd: return "lock";
+	default: return "unknown";
+	}
+}
+
+string nameOf(const Event & event) {
+	map<unsigned long long, string>::const_iterator it = names.find(event.name);
+	if (it != names.end())
+		return it->second;
+	char fingerprint[24];
+	snprintf(fingerprint, sizeof(fingerprint), "%016llx", event.name);
+	return fingerprint;
+}
+
+void writeText(ostream & out) {
+	for (size_t i = 0; i < events.size(); ++i) {
+		const Event & event = events[i];
+		time_t seconds = event.time / 1000000000ULL;
+		struct tm tstruct;
+		localtime_r(&seconds, &tstruct);
+		char date[32];
+		strftime(date, sizeof(date), "%Y-%m-%d.%X", &tstruct);
+		char nanoseconds[16];
+		snprintf(nanoseconds, sizeof(nanoseconds), ".%09llu", event.time % 1000000000ULL);
+		
+		out << date << nanoseconds << " P" << event.pid << " TH" << event.thread << " RQ" << event.seq_number
+			<< " " << eventName(event.event);
+		switch (event.event) {
+		case TraceRequestBegin:
+		case TraceQueryBegin:
+		case TraceLockWaitBegin:
+			out << " " << nameOf(event);
+			if (event.duration)
+				out << " (" << event.duration / 1000 << " us)";
+			break;
+		case TraceRequestEnd:
+			out << " status " << event.argument;
+			break;
+		default:
+			break;
+		}
+		out << "\n";
+	}
+}
+
+void writeJsonString(ostream & out, const string & text) {
+	out << '"';
+	for (size_t i = 0; i < text.size(); ++i) {
+		unsigned char c = text[i];
+		if (c == '"' || c == '\\')
+			out << '\\' << c;
+		else if (c < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			out << escaped;
+		} else
+			out << c;
+	}
+	out << '"';
+}
+
+/// Chrome trace event format, as loaded by chrome://tracing or Perfetto.
+/// Timestamps are microseconds.
+void writeChrome(ostream & out) {
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	for (size_t i = 0; i < events.size(); ++i) {
+		const Event & event = events[i];
+		bool begin = event.event == TraceRequestBegin || event.event == TraceQueryBegin
+			|| event.event == TraceLockWaitBegin;
+		if (!first)
+			out << ",";
+		first = false;
+		char ts[32];
+		snprintf(ts, sizeof(ts), "%llu.%03llu", event.time / 1000, event.time % 1000);
+		out << "\n{\"name\":";
+		writeJsonString(out, nameOf(event));
+		out << ",\"cat\":\"" << eventCategory(event.event) << "\",\"ph\":\"" << (begin ? "B" : "E")
+			<< "\",\"ts\":" << ts << ",\"pid\":" << event.pid << ",\"tid\":" << event.thread
+			<< ",\"args\":{\"seq_number\":" << event.seq_number;
+		if (event.event == TraceRequestEnd)
+			out << ",\"status\":" << event.argument;
+		out << "}}";
+	}
+	out << "\n]}\n";
+}
+
+int main (int argc, char ** argv) {
+	if (!loadConfig(config, argc, argv)
+			|| (strcmp(config.format, "text") != 0 && strcmp(config.format, "chrome") != 0))
+	{
+		cerr << "Usage: " << argv[0] << " <options>\n";
+#define OPTION(ARG_SHORT, ARG_LARGE, FIELD, DESC, DEFAULT) \
+		cerr << "\t" ARG_LARGE "|" ARG_SHORT "\t - " DESC "(def " DEFAULT ")" << endl;
+#include "options.def"
+#undef OPTION
+		return 1;
+	}
+	
+	vector<Segment> segments = listSegments(config.trace_dir, config.pid);
+	if (segments.empty()) {
+		cerr << "No trace segments found in " << config.trace_dir << endl;
+		return 1;
+	}
+	for (size_t i = 0; i < segments.size(); ++i)
+		loadSegment(segments[i]);
+	stable_sort(events.begin(), events.end());
+	
+	ofstream file;
+	if (strlen(config.output) > 0) {
+		file.open(config.output);
+		if (!file) {
+			cerr << "Cannot write " << config.output << endl;
+			return 1;
+		}
+	}
+	ostream & out = strlen(config.output) > 0 ? file : cout;
+	if (strcmp(config.format, "chrome") == 0)
+		writeChrome(out);
+	else
+		writeText(out);
+	return 0;
+}